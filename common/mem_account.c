@@ -0,0 +1,217 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/mem_account.c
+ * @brief   Optional accounting of large memory allocations
+ *
+ * Blocks from mem_account_malloc() are preceded by a small header which
+ * records the tag and the size charged. The size is zero if the block
+ * was allocated before accounting was enabled, so it is never
+ * credited back.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arch.h"
+#include "mem_account.h"
+#include "thread_calls.h"
+
+/* Header preceding each block. The union keeps the user data aligned */
+union block_header
+{
+    struct
+    {
+        size_t charged;
+        enum mem_account_tag tag;
+    } h;
+    long double align1;
+    void *align2;
+};
+
+static const char *g_tag_names[MEM_TAG_COUNT] =
+{
+    "other", "trans", "encoder", "mppc", "cache"
+};
+
+static int g_enabled = 0;
+static tbus g_mutex = 0;
+/* The extra entry is the total for all tags */
+static struct mem_account_usage g_usage[MEM_TAG_COUNT + 1];
+
+/*****************************************************************************/
+void
+mem_account_enable(void)
+{
+    if (!g_enabled)
+    {
+        g_mutex = tc_mutex_create();
+        g_enabled = 1;
+    }
+}
+
+/*****************************************************************************/
+int
+mem_account_is_enabled(void)
+{
+    return g_enabled;
+}
+
+/*****************************************************************************/
+static void
+update_usage(struct mem_account_usage *usage, size_t add, size_t sub)
+{
+    usage->current += add;
+    usage->current -= (sub > usage->current) ? usage->current : sub;
+    if (usage->current > usage->peak)
+    {
+        usage->peak = usage->current;
+    }
+}
+
+/*****************************************************************************/
+static void
+charge(enum mem_account_tag tag, size_t add, size_t sub)
+{
+    if ((unsigned int)tag >= MEM_TAG_COUNT)
+    {
+        tag = MEM_TAG_OTHER;
+    }
+
+    tc_mutex_lock(g_mutex);
+    update_usage(&g_usage[tag], add, sub);
+    update_usage(&g_usage[MEM_TAG_COUNT], add, sub);
+    tc_mutex_unlock(g_mutex);
+}
+
+/*****************************************************************************/
+void *
+mem_account_malloc(enum mem_account_tag tag, size_t size, int zero)
+{
+    union block_header *hdr;
+
+    if (size > (size_t) -1 - sizeof(*hdr))
+    {
+        return NULL;
+    }
+
+    hdr = (union block_header *)(zero ? calloc(1, sizeof(*hdr) + size)
+                                 : malloc(sizeof(*hdr) + size));
+    if (hdr == NULL)
+    {
+        return NULL;
+    }
+
+    hdr->h.tag = tag;
+    hdr->h.charged = 0;
+    if (g_enabled)
+    {
+        hdr->h.charged = size;
+        charge(tag, size, 0);
+    }
+
+    return hdr + 1;
+}
+
+/*****************************************************************************/
+void
+mem_account_free(void *ptr)
+{
+    union block_header *hdr;
+
+    if (ptr != NULL)
+    {
+        hdr = (union block_header *)ptr - 1;
+        if (hdr->h.charged > 0)
+        {
+            charge(hdr->h.tag, 0, hdr->h.charged);
+        }
+        free(hdr);
+    }
+}
+
+/*****************************************************************************/
+void
+mem_account_add(enum mem_account_tag tag, size_t bytes)
+{
+    if (g_enabled && bytes > 0)
+    {
+        charge(tag, bytes, 0);
+    }
+}
+
+/*****************************************************************************/
+void
+mem_account_sub(enum mem_account_tag tag, size_t bytes)
+{
+    if (g_enabled && bytes > 0)
+    {
+        charge(tag, 0, bytes);
+    }
+}
+
+/*****************************************************************************/
+void
+mem_account_get_usage(enum mem_account_tag tag,
+                      struct mem_account_usage *usage)
+{
+    if ((unsigned int)tag > MEM_TAG_COUNT || !g_enabled)
+    {
+        memset(usage, 0, sizeof(*usage));
+        return;
+    }
+
+    tc_mutex_lock(g_mutex);
+    *usage = g_usage[tag];
+    tc_mutex_unlock(g_mutex);
+}
+
+/*****************************************************************************/
+void
+mem_account_log_usage(enum logLevels log_level, const char *title)
+{
+    struct mem_account_usage usage;
+    int tag;
+
+    if (!g_enabled)
+    {
+        return;
+    }
+
+    mem_account_get_usage(MEM_TAG_COUNT, &usage);
+    LOG(log_level, "%s: total current %lu KiB peak %lu KiB", title,
+        (unsigned long)(usage.current / 1024),
+        (unsigned long)(usage.peak / 1024));
+
+    for (tag = 0; tag < MEM_TAG_COUNT; ++tag)
+    {
+        mem_account_get_usage((enum mem_account_tag)tag, &usage);
+        if (usage.peak > 0)
+        {
+            LOG(log_level, "%s:   %-8s current %lu KiB peak %lu KiB", title,
+                g_tag_names[tag],
+                (unsigned long)(usage.current / 1024),
+                (unsigned long)(usage.peak / 1024));
+        }
+    }
+}
@@ -0,0 +1,139 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/mem_account.h
+ * @brief   Optional accounting of large memory allocations
+ *
+ * Allocations made with mem_account_malloc() are charged to a subsystem
+ * tag. Memory managed in some other way (e.g. stream buffers) can be
+ * charged with mem_account_add() and mem_account_sub().
+ *
+ * The counters are process-wide. As xrdp normally forks a process for
+ * each connection, this gives a per-session figure.
+ *
+ * Accounting is off until mem_account_enable() is called. While it is
+ * off the functions here cost very little.
+ */
+
+#ifndef _MEM_ACCOUNT_H
+#define _MEM_ACCOUNT_H
+
+#include <stddef.h>
+
+#include "log.h"
+
+/**
+ * Subsystems memory can be charged to
+ */
+enum mem_account_tag
+{
+    MEM_TAG_OTHER = 0,
+    MEM_TAG_TRANS, /* Transport input and output streams */
+    MEM_TAG_ENCODER, /* Encoder work buffers */
+    MEM_TAG_MPPC, /* Bulk compressor history and hash tables */
+    MEM_TAG_CACHE, /* Bitmap, glyph and pointer caches */
+    MEM_TAG_COUNT /* Must be last. Used for the total of all tags */
+};
+
+/**
+ * Memory charged to a tag
+ */
+struct mem_account_usage
+{
+    size_t current; /* Bytes currently allocated */
+    size_t peak; /* Highest value of current */
+};
+
+/**
+ * Turns memory accounting on
+ *
+ * Call this before any threads which allocate accounted memory are
+ * started. Accounting can't be turned off again.
+ */
+void
+mem_account_enable(void);
+
+/**
+ * Returns non-zero if memory accounting is on
+ */
+int
+mem_account_is_enabled(void);
+
+/**
+ * Allocates a block of memory and charges it to a tag
+ *
+ * The block must be freed with mem_account_free(). This is the case
+ * even if accounting is not enabled.
+ *
+ * @param tag Tag to charge the memory to
+ * @param size Size of block
+ * @param zero If non-zero, the block is zeroed
+ * @return block, or NULL if no memory
+ */
+void *
+mem_account_malloc(enum mem_account_tag tag, size_t size, int zero);
+
+/**
+ * Frees a block allocated with mem_account_malloc()
+ *
+ * @param ptr Block to free (may be NULL)
+ */
+void
+mem_account_free(void *ptr);
+
+/**
+ * Charges memory allocated elsewhere to a tag
+ *
+ * @param tag Tag to charge
+ * @param bytes Bytes to add to the tag
+ */
+void
+mem_account_add(enum mem_account_tag tag, size_t bytes);
+
+/**
+ * Removes a charge made with mem_account_add()
+ *
+ * @param tag Tag to credit
+ * @param bytes Bytes to remove from the tag
+ */
+void
+mem_account_sub(enum mem_account_tag tag, size_t bytes);
+
+/**
+ * Gets the memory charged to a tag
+ *
+ * @param tag Tag to query, or MEM_TAG_COUNT for the total for all tags
+ * @param[out] usage Usage for the tag
+ */
+void
+mem_account_get_usage(enum mem_account_tag tag,
+                      struct mem_account_usage *usage);
+
+/**
+ * Logs the memory usage for all tags
+ *
+ * Nothing is logged if accounting is not enabled.
+ *
+ * @param log_level Log level to use
+ * @param title Title for the log message
+ */
+void
+mem_account_log_usage(enum logLevels log_level, const char *title);
+
+#endif
@@ -1231,7 +1231,9 @@ g_tcp_bind_address(int sck, const char *port, const char *address)
 int
 g_sck_listen(int sck)
 {
-    return listen(sck, 2);
+    /* A short backlog makes connections fail outright, rather than wait,
+       when a lot of clients connect at once */
+    return listen(sck, SOMAXCONN);
 }
 
 /*****************************************************************************/
@@ -2384,6 +2386,22 @@ g_file_map(int fd, int aread, int awrite, size_t length, void **addr)
     return 0;
 }
 
+/*****************************************************************************/
+int
+g_anon_map(size_t length, void **addr)
+{
+    void *laddr;
+
+    laddr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (laddr == MAP_FAILED)
+    {
+        return 1;
+    }
+    *addr = laddr;
+    return 0;
+}
+
 /*****************************************************************************/
 int
 g_munmap(void *addr, size_t length)
@@ -233,6 +233,14 @@ int      g_file_seek(int fd, int offset);
 int      g_file_lock(int fd, int start, int len);
 int
 g_file_map(int fd, int aread, int awrite, size_t length, void **addr);
+/**
+ * Maps zero-filled anonymous memory, to be released with g_munmap()
+ * @param length Bytes to map
+ * @param[out] addr Address of mapping
+ * @return 0 for success
+ */
+int
+g_anon_map(size_t length, void **addr);
 int
 g_munmap(void *addr, size_t length);
 int      g_file_duplicate_on(int fd, int target_fd);
@@ -22,9 +22,12 @@
 #include <config_ac.h>
 #endif
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "arch.h"
+#include "defines.h"
 #include "parse.h"
 #include "log.h"
 #include "string_calls.h"
@@ -120,6 +123,23 @@ out_utf8_as_utf16_le_proc(struct stream *s, const char *v,
 
     while (vn > 0)
     {
+        if ((unsigned char)*v < 0x80)
+        {
+            /* Widen a run of ASCII without decoding it */
+            unsigned int ascii_len = utf8_ascii_prefix_len(v, vn);
+            unsigned char *p = (unsigned char *)s->p;
+            unsigned int i;
+            for (i = 0 ; i < ascii_len ; ++i)
+            {
+                p[i * 2] = (unsigned char)v[i];
+                p[i * 2 + 1] = 0;
+            }
+            s->p += ascii_len * 2;
+            v += ascii_len;
+            vn -= ascii_len;
+            continue;
+        }
+
         char32_t c32 = utf8_get_next_char(&v, &vn);
         char16_t low;
         if (c32 < 0x10000)
@@ -137,6 +157,91 @@ out_utf8_as_utf16_le_proc(struct stream *s, const char *v,
     }
 }
 
+/******************************************************************************/
+/**
+ * Returns the length of the run of ASCII UTF-16LE words on a stream
+ * @param s Stream. The run ends at s->end
+ * @param stop_at_nul If set, a zero word also ends the run
+ * @return Number of words
+ *
+ * Four words are checked at a time. The stream isn't moved on.
+ */
+static unsigned int
+utf16_le_ascii_prefix_len(const struct stream *s, int stop_at_nul)
+{
+    /* Set in the high byte of each little-endian word */
+#if defined(B_ENDIAN)
+    const uint64_t high_bytes = 0x00ff00ff00ff00ffULL;
+#else
+    const uint64_t high_bytes = 0xff00ff00ff00ff00ULL;
+#endif
+    const unsigned char *start = (const unsigned char *)s->p;
+    const unsigned char *p = start;
+    const unsigned char *end = (const unsigned char *)s->end;
+    uint64_t w;
+    uint64_t t;
+
+    while (end - p >= (int)sizeof(w))
+    {
+        memcpy(&w, p, sizeof(w));
+        /* High bytes must be zero, and low bytes below 0x80 */
+        if ((w & (high_bytes | 0x8080808080808080ULL)) != 0)
+        {
+            break;
+        }
+        if (stop_at_nul)
+        {
+            /* Look for a zero byte, with the high bytes filled in */
+            t = w | high_bytes;
+            if (((t - 0x0101010101010101ULL) & ~t &
+                    0x8080808080808080ULL) != 0)
+            {
+                break;
+            }
+        }
+        p += sizeof(w);
+    }
+    while (end - p >= 2 && p[1] == 0 && p[0] < 0x80 &&
+            (p[0] != 0 || !stop_at_nul))
+    {
+        p += 2;
+    }
+
+    return (unsigned int)(p - start) / 2;
+}
+
+/******************************************************************************/
+/**
+ * Copies a run of ASCII UTF-16LE words from a stream as UTF-8
+ *
+ * The output is truncated in the same way as the single character
+ * loops of the callers truncate it. The stream is moved on past the run.
+ *
+ * @return Number of UTF-8 bytes needed for the run
+ */
+static unsigned int
+in_utf16_le_ascii_as_utf8(struct stream *s, unsigned int count,
+                          char **v, unsigned int *vn)
+{
+    /* One byte must be kept for the terminator */
+    unsigned int copy = (*vn > 0) ? MIN(count, *vn - 1) : 0;
+    const char *p = s->p;
+    unsigned int i;
+
+    if (copy > 0)
+    {
+        for (i = 0 ; i < copy ; ++i)
+        {
+            (*v)[i] = p[i * 2];
+        }
+        *v += copy;
+        *vn -= copy;
+    }
+    s->p += count * 2;
+
+    return count;
+}
+
 /******************************************************************************/
 /**
  * Gets the next Unicode character from a code stream
@@ -202,6 +307,7 @@ in_utf16_le_fixed_as_utf8_proc(struct stream *s, unsigned int n,
     char32_t c32;
     char u8str[MAXLEN_UTF8_CHAR];
     unsigned int u8len;
+    unsigned int ascii_len;
     char *saved_s_end = s->end;
 
     // Expansion of S_CHECK_REM(s, n*2) using passed-in file and line
@@ -217,6 +323,16 @@ in_utf16_le_fixed_as_utf8_proc(struct stream *s, unsigned int n,
 
     while (s_check_rem(s, 2))
     {
+        if (s->p[1] == 0 && (unsigned char)s->p[0] < 0x80)
+        {
+            ascii_len = utf16_le_ascii_prefix_len(s, 0);
+            if (ascii_len > 0)
+            {
+                rv += in_utf16_le_ascii_as_utf8(s, ascii_len, &v, &vn);
+                continue;
+            }
+        }
+
         c32 = get_c32_from_stream(s);
 
         u8len = utf_char32_to_utf8(c32, u8str);
@@ -273,8 +389,19 @@ in_utf16_le_terminated_as_utf8(struct stream *s,
     char32_t c32;
     char u8str[MAXLEN_UTF8_CHAR];
     unsigned int u8len;
+    unsigned int ascii_len;
     while (s_check_rem(s, 2))
     {
+        if (s->p[1] == 0 && (unsigned char)s->p[0] < 0x80)
+        {
+            ascii_len = utf16_le_ascii_prefix_len(s, 1);
+            if (ascii_len > 0)
+            {
+                rv += in_utf16_le_ascii_as_utf8(s, ascii_len, &v, &vn);
+                continue;
+            }
+        }
+
         c32 = get_c32_from_stream(s);
         if (c32 == 0)
         {
@@ -0,0 +1,296 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/proto_record.c
+ * @brief   Recording of the protocol traffic of a connection, for replay
+ *
+ * A copy is kept of each shared buffer which is likely to be passed
+ * again, so that later records need only hold the pages which have
+ * changed. Buffers are identified by device and inode, as the fd number
+ * is different each time a buffer is passed.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "log.h"
+#include "os_calls.h"
+#include "proto_record.h"
+
+/* Most buffers we keep a copy of */
+#define MAX_BUFFERS 16
+
+struct recorded_buffer
+{
+    int id; /* 0 if the slot is unused */
+    dev_t dev;
+    ino_t ino;
+    int bytes;
+    char *copy; /* contents when last recorded */
+    unsigned int last_used;
+};
+
+static FILE *g_file = NULL;
+static int g_start_time = 0;
+static int g_next_id = 1;
+static unsigned int g_use_count = 0;
+static struct recorded_buffer g_buffers[MAX_BUFFERS];
+static const char g_zero_page[PROTO_RECORD_PAGE_SIZE] = { 0 };
+
+/*****************************************************************************/
+static void
+write_uint32(unsigned int value)
+{
+    unsigned char b[4];
+
+    b[0] = (unsigned char)value;
+    b[1] = (unsigned char)(value >> 8);
+    b[2] = (unsigned char)(value >> 16);
+    b[3] = (unsigned char)(value >> 24);
+    fwrite(b, 1, 4, g_file);
+}
+
+/*****************************************************************************/
+static void
+write_header(int type, int length)
+{
+    unsigned char pad[4] = { 0 };
+
+    write_uint32((unsigned int)(g_time3() - g_start_time));
+    pad[0] = (unsigned char)type;
+    fwrite(pad, 1, 4, g_file);
+    write_uint32(length);
+}
+
+/*****************************************************************************/
+int
+proto_record_open(const char *filename)
+{
+    int fd;
+
+    if (g_file != NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "Already recording a connection in this "
+            "process, not recording to %s", filename);
+        return 1;
+    }
+    /* the recording holds the password, so nobody else may read it */
+    fd = open(filename, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+              S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't create recording %s [%s]", filename,
+            g_get_strerror());
+        return 1;
+    }
+    g_file = fdopen(fd, "wb");
+    if (g_file == NULL)
+    {
+        close(fd);
+        return 1;
+    }
+    setvbuf(g_file, NULL, _IOFBF, 256 * 1024);
+    g_start_time = g_time3();
+    fwrite(PROTO_RECORD_MAGIC, 1, 8, g_file);
+    write_uint32(PROTO_RECORD_VERSION);
+    LOG(LOG_LEVEL_WARNING, "Recording this connection to %s. The recording "
+        "includes the password", filename);
+    return 0;
+}
+
+/*****************************************************************************/
+void
+proto_record_close(void)
+{
+    int index;
+
+    if (g_file != NULL)
+    {
+        fclose(g_file);
+        g_file = NULL;
+    }
+    for (index = 0; index < MAX_BUFFERS; index++)
+    {
+        g_free(g_buffers[index].copy);
+        g_memset(g_buffers + index, 0, sizeof(g_buffers[index]));
+    }
+}
+
+/*****************************************************************************/
+int
+proto_record_is_open(void)
+{
+    return g_file != NULL;
+}
+
+/*****************************************************************************/
+void
+proto_record_data(int type, const void *data, int bytes)
+{
+    if (g_file != NULL && bytes > 0)
+    {
+        write_header(type, bytes);
+        fwrite(data, 1, bytes, g_file);
+    }
+}
+
+/*****************************************************************************/
+/* writes the pages of a buffer which differ from copy, and updates copy.
+   If copy is NULL, the pages which are not all zero are written */
+static void
+write_buffer(int id, int flags, const char *ptr, int bytes, char *copy)
+{
+    int pages = (bytes + PROTO_RECORD_PAGE_SIZE - 1) / PROTO_RECORD_PAGE_SIZE;
+    int page;
+    int offset;
+    int len;
+    int length;
+    char *changed;
+
+    changed = (char *)g_malloc(pages > 0 ? pages : 1, 0);
+    if (changed == NULL)
+    {
+        return;
+    }
+    length = 12;
+    for (page = 0; page < pages; page++)
+    {
+        offset = page * PROTO_RECORD_PAGE_SIZE;
+        len = MIN(bytes - offset, PROTO_RECORD_PAGE_SIZE);
+        changed[page] = g_memcmp(ptr + offset,
+                                 copy != NULL ? copy + offset : g_zero_page,
+                                 len) != 0;
+        if (changed[page])
+        {
+            length += 4 + len;
+        }
+    }
+
+    write_header(PROTO_RECORD_BUFFER, length);
+    write_uint32(id);
+    write_uint32(bytes);
+    write_uint32(flags);
+    for (page = 0; page < pages; page++)
+    {
+        if (changed[page])
+        {
+            offset = page * PROTO_RECORD_PAGE_SIZE;
+            len = MIN(bytes - offset, PROTO_RECORD_PAGE_SIZE);
+            write_uint32(page);
+            fwrite(ptr + offset, 1, len, g_file);
+            if (copy != NULL)
+            {
+                g_memcpy(copy + offset, ptr + offset, len);
+            }
+        }
+    }
+    g_free(changed);
+}
+
+/*****************************************************************************/
+int
+proto_record_buffer_fd(int fd, const void *ptr, int bytes, int keep)
+{
+    struct recorded_buffer *rb;
+    struct stat st;
+    int flags;
+    int index;
+
+    if (g_file == NULL || bytes < 0)
+    {
+        return -1;
+    }
+    flags = PROTO_RECORD_BUFFER_PASSED | PROTO_RECORD_BUFFER_NEW;
+    if (!keep || fstat(fd, &st) != 0)
+    {
+        write_buffer(0, flags, (const char *)ptr, bytes, NULL);
+        return 0;
+    }
+
+    /* the buffer we've seen before, or else the least recently used */
+    rb = g_buffers;
+    for (index = 0; index < MAX_BUFFERS; index++)
+    {
+        if (g_buffers[index].id != 0 && g_buffers[index].dev == st.st_dev &&
+                g_buffers[index].ino == st.st_ino)
+        {
+            rb = g_buffers + index;
+            break;
+        }
+        if (g_buffers[index].last_used < rb->last_used)
+        {
+            rb = g_buffers + index;
+        }
+    }
+    if (index == MAX_BUFFERS || rb->bytes != bytes)
+    {
+        g_free(rb->copy);
+        rb->copy = (char *)g_malloc(bytes, 1);
+        if (rb->copy == NULL)
+        {
+            g_memset(rb, 0, sizeof(*rb));
+            write_buffer(0, flags, (const char *)ptr, bytes, NULL);
+            return 0;
+        }
+        if (index == MAX_BUFFERS)
+        {
+            rb->id = g_next_id++;
+            rb->dev = st.st_dev;
+            rb->ino = st.st_ino;
+        }
+        rb->bytes = bytes;
+    }
+    else
+    {
+        flags = PROTO_RECORD_BUFFER_PASSED;
+    }
+    rb->last_used = ++g_use_count;
+    write_buffer(rb->id, flags, (const char *)ptr, bytes, rb->copy);
+    return rb->id;
+}
+
+/*****************************************************************************/
+void
+proto_record_buffer(int id, const void *ptr, int bytes)
+{
+    int index;
+
+    if (g_file == NULL || id < 1)
+    {
+        return;
+    }
+    for (index = 0; index < MAX_BUFFERS; index++)
+    {
+        if (g_buffers[index].id == id && g_buffers[index].bytes == bytes)
+        {
+            g_buffers[index].last_used = ++g_use_count;
+            write_buffer(id, 0, (const char *)ptr, bytes,
+                         g_buffers[index].copy);
+            return;
+        }
+    }
+}
@@ -0,0 +1,141 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    common/proto_record.h
+ * @brief   Recording of the protocol traffic of a connection, for replay
+ *
+ * A recording holds what an xrdp connection process received: the
+ * decrypted PDUs from the client, the messages from the X server, and
+ * the contents of the shared memory buffers the X server passed with
+ * them. tools/devel/replay plays a recording back against xrdp.
+ *
+ * A recording contains the client's password, and everything it typed.
+ * Recording is only for test systems, so the recorder is only built
+ * with --enable-devel-record, which defines USE_DEVEL_RECORD.
+ *
+ * The recorder is process-wide. As xrdp normally forks a process for
+ * each connection, each connection gets its own recording.
+ *
+ * File format, all values little-endian:-
+ *
+ *     char magic[8]    PROTO_RECORD_MAGIC
+ *     uint32 version   PROTO_RECORD_VERSION
+ *     records...
+ *
+ * Each record is:-
+ *
+ *     uint32 time      milliseconds since the recording was opened
+ *     uint8 type       PROTO_RECORD_*
+ *     uint8 pad[3]
+ *     uint32 length    length of data
+ *     data
+ *
+ * The data of a PROTO_RECORD_BUFFER record is:-
+ *
+ *     uint32 id        buffer id. 0 is used for buffers used only once
+ *     uint32 bytes     buffer size
+ *     uint32 flags     PROTO_RECORD_BUFFER_*
+ *     pages...         uint32 page number, then the page contents
+ *
+ * Pages are PROTO_RECORD_PAGE_SIZE bytes, except that the last page of
+ * a buffer may be shorter. Only the pages which have changed since the
+ * buffer was last recorded are included. A new buffer starts zeroed.
+ */
+
+#ifndef _PROTO_RECORD_H
+#define _PROTO_RECORD_H
+
+#define PROTO_RECORD_MAGIC "XRDPREC\0"
+#define PROTO_RECORD_VERSION 1
+#define PROTO_RECORD_HEADER_SIZE 12
+#define PROTO_RECORD_PAGE_SIZE 4096
+
+/* Record types */
+#define PROTO_RECORD_CLIENT_IN 1 /* Decrypted data from the client */
+#define PROTO_RECORD_MODULE_IN 2 /* Data from the X server (xup) */
+#define PROTO_RECORD_BUFFER 3 /* Shared buffer contents (xup) */
+
+/* PROTO_RECORD_BUFFER flags */
+/* The buffer fd was passed with the last module message */
+#define PROTO_RECORD_BUFFER_PASSED 1
+/* This is a new buffer, which replaces any earlier one with its id */
+#define PROTO_RECORD_BUFFER_NEW 2
+
+/**
+ * Starts recording to a new file
+ *
+ * Only one recording can be in progress in a process.
+ *
+ * @param filename File to create. It must not exist already
+ * @return 0 for success
+ */
+int
+proto_record_open(const char *filename);
+
+/**
+ * Stops recording, if it was started
+ */
+void
+proto_record_close(void);
+
+/**
+ * Returns non-zero if a recording is in progress
+ */
+int
+proto_record_is_open(void);
+
+/**
+ * Adds a record of data received
+ *
+ * Nothing is done if a recording is not in progress.
+ *
+ * @param type PROTO_RECORD_CLIENT_IN or PROTO_RECORD_MODULE_IN
+ * @param data Data received
+ * @param bytes Length of data
+ */
+void
+proto_record_data(int type, const void *data, int bytes);
+
+/**
+ * Records a shared buffer passed as an fd with the last module message
+ *
+ * If the fd refers to a buffer recorded before, only the changes are
+ * recorded.
+ *
+ * @param fd File descriptor received
+ * @param ptr Mapping of the buffer
+ * @param bytes Size of the mapping
+ * @param keep Non-zero if the buffer is likely to be passed again. If
+ *             zero, the buffer is recorded in full, and not remembered
+ * @return id the buffer was recorded with, or -1 if not recording
+ */
+int
+proto_record_buffer_fd(int fd, const void *ptr, int bytes, int keep);
+
+/**
+ * Records the changes to a buffer passed before
+ *
+ * @param id Value returned by proto_record_buffer_fd()
+ * @param ptr Mapping of the buffer
+ * @param bytes Size of the mapping
+ */
+void
+proto_record_buffer(int id, const void *ptr, int bytes);
+
+#endif
@@ -22,6 +22,7 @@
 #include "config_ac.h"
 #endif
 #include <signal.h>
+#include <stdint.h>
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
@@ -1390,17 +1391,55 @@ utf8_char_count(const char *utf8str)
     return rv;
 }
 
+/*****************************************************************************/
+unsigned int
+utf8_ascii_prefix_len(const char *utf8str, unsigned int len)
+{
+    unsigned int rv = 0;
+    uint64_t w;
+
+    // Eight bytes at a time. None of them may have the top bit set.
+    while (len - rv >= sizeof(w))
+    {
+        memcpy(&w, utf8str + rv, sizeof(w));
+        if ((w & 0x8080808080808080ULL) != 0)
+        {
+            break;
+        }
+        rv += sizeof(w);
+    }
+    while (rv < len && (unsigned char)utf8str[rv] < 0x80)
+    {
+        ++rv;
+    }
+
+    return rv;
+}
+
 /*****************************************************************************/
 unsigned int
 utf8_as_utf16_word_count(const char *utf8str, unsigned int len)
 {
     unsigned int rv = 0;
+    unsigned int ascii_len;
+
     while (len > 0)
     {
-        char32_t c = utf8_get_next_char(&utf8str, &len);
-        // Characters not in the BMP (i.e. over 0xffff) need a high/low
-        // surrogate pair
-        rv += (c >= 0x10000) ? 2 : 1;
+        if ((unsigned char)*utf8str < 0x80)
+        {
+            // Each ASCII character is a single word
+            ascii_len = utf8_ascii_prefix_len(utf8str, len);
+            rv += ascii_len;
+            utf8str += ascii_len;
+            len -= ascii_len;
+        }
+        else
+        {
+            char32_t c = utf8_get_next_char(&utf8str, &len);
+            // Characters not in the BMP (i.e. over 0xffff) need a high/low
+            // surrogate pair
+            rv += (c >= 0x10000) ? 2 : 1;
+        }
     }
 
     return rv;
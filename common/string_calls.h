@@ -369,6 +369,18 @@ utf_char32_to_utf8(char32_t c32, char *u8str);
 unsigned int
 utf8_char_count(const char *utf8str);
 
+/**
+ * Returns the length of the ASCII run at the start of a UTF-8 string
+ * @param utf8str UTF-8 string
+ * @param len Length of UTF-8 string
+ * @result Number of leading bytes in utf8str which are below 0x80
+ *
+ * The string is checked a word at a time, so this is a cheap way for
+ * converters to skip over plain text before decoding characters singly.
+ */
+unsigned int
+utf8_ascii_prefix_len(const char *utf8str, unsigned int len);
+
 /**
  * Returns the number of UTF-16 words required to store a UTF-8 string
  * @param utf8str UTF-8 string
@@ -29,6 +29,10 @@
 #include "parse.h"
 #include "ssl_calls.h"
 #include "log.h"
+#include "mem_account.h"
+#if defined(USE_DEVEL_RECORD)
+#include "proto_record.h"
+#endif
 
 #define MAX_SBYTES 0
 
@@ -36,6 +40,10 @@
 #define CONNECT_TERM_POLL_MS 3000
 /** Time we wait before another connect() attempt if one fails immediately */
 #define CONNECT_DELAY_ON_FAIL_MS 2000
+/** Most connections a listener accepts in one trans_check_wait_objs() call,
+ *  unless the listener sets its own limit. This is one, as a trans_conn_in
+ *  callback may delete its own listener */
+#define DEFAULT_ACCEPT_LIMIT 1
 
 /*****************************************************************************/
 static int
@@ -91,6 +99,33 @@ trans_tcp_can_recv(struct trans *self, int sck, int millis)
     return g_sck_can_recv(sck, millis);
 }
 
+/*****************************************************************************/
+/**
+ * Charges the current size of the stream buffers to MEM_TAG_TRANS
+ *
+ * The buffers can be resized by the users of the transport, so this
+ * is called from time to time to keep the figure up-to-date.
+ */
+static void
+trans_update_mem_account(struct trans *self)
+{
+    size_t bytes;
+
+    if (mem_account_is_enabled())
+    {
+        bytes = self->in_s->size + self->out_s->size;
+        if (bytes > self->mem_account_bytes)
+        {
+            mem_account_add(MEM_TAG_TRANS, bytes - self->mem_account_bytes);
+        }
+        else
+        {
+            mem_account_sub(MEM_TAG_TRANS, self->mem_account_bytes - bytes);
+        }
+        self->mem_account_bytes = bytes;
+    }
+}
+
 /*****************************************************************************/
 struct trans *
 trans_create(int mode, int in_size, int out_size)
@@ -112,6 +147,7 @@ trans_create(int mode, int in_size, int out_size)
         self->trans_recv = trans_tcp_recv;
         self->trans_send = trans_tcp_send;
         self->trans_can_recv = trans_tcp_can_recv;
+        trans_update_mem_account(self);
     }
 
     return self;
@@ -132,6 +168,7 @@ trans_delete(struct trans *self)
         self->extra_destructor(self);
     }
 
+    mem_account_sub(MEM_TAG_TRANS, self->mem_account_bytes);
     free_stream(self->in_s);
     free_stream(self->out_s);
 
@@ -312,6 +349,8 @@ trans_check_wait_objs(struct trans *self)
     unsigned int to_read = 0;
     unsigned int read_so_far = 0;
     int rv = 0;
+    int accept_limit;
+    int accepted;
     enum xrdp_source cur_source;
 
     if (self == 0)
@@ -324,29 +363,34 @@ trans_check_wait_objs(struct trans *self)
         return 1;
     }
 
+    trans_update_mem_account(self);
     rv = 0;
 
     if (self->type1 == TRANS_TYPE_LISTENER) /* listening */
     {
         if (g_sck_can_recv(self->sck, 0))
         {
-            in_sck = g_sck_accept(self->sck);
-            if (in_sck == -1)
+            /* Listeners which opt in take everything in the backlog (up
+             * to a limit) so a burst of connections doesn't need a wakeup
+             * for each one */
+            accept_limit = (self->accept_limit > 0) ?
+                           self->accept_limit : DEFAULT_ACCEPT_LIMIT;
+            for (accepted = 0 ; accepted < accept_limit ; ++accepted)
             {
-                if (g_tcp_last_error_would_block(self->sck))
-                {
-                    /* ok, but shouldn't happen */
-                }
-                else
+                in_sck = g_sck_accept(self->sck);
+                if (in_sck == -1)
                 {
+                    if (g_tcp_last_error_would_block(self->sck))
+                    {
+                        /* Backlog is empty, or another process sharing
+                         * the listener got there first */
+                        break;
+                    }
                     /* error */
                     self->status = TRANS_STATUS_DOWN;
                     return 1;
                 }
-            }
 
-            if (in_sck != -1)
-            {
                 if (self->trans_conn_in != 0) /* is function assigned */
                 {
                     in_trans = trans_create(self->mode, self->in_s->size,
@@ -429,6 +473,13 @@ trans_check_wait_objs(struct trans *self)
                 }
                 else
                 {
+#if defined(USE_DEVEL_RECORD)
+                    if (self->record_type != 0)
+                    {
+                        proto_record_data(self->record_type, self->in_s->end,
+                                          read_bytes);
+                    }
+#endif
                     self->in_s->end += read_bytes;
                 }
             }
@@ -510,6 +561,12 @@ trans_force_read_s(struct trans *self, struct stream *in_s, int size)
         }
         else
         {
+#if defined(USE_DEVEL_RECORD)
+            if (self->record_type != 0)
+            {
+                proto_record_data(self->record_type, in_s->end, rcvd);
+            }
+#endif
             in_s->end += rcvd;
             size -= rcvd;
         }
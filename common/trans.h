@@ -30,6 +30,9 @@
 #define TRANS_MODE_TCP4 4 /* tcp4 only */
 #define TRANS_MODE_TCP6 6 /* tcp6 only */
 
+/* accept_limit for busy listeners */
+#define TRANS_BURST_ACCEPT_LIMIT 32
+
 #define TRANS_TYPE_LISTENER 1
 #define TRANS_TYPE_SERVER 2
 #define TRANS_TYPE_CLIENT 3
@@ -57,6 +60,7 @@ enum xrdp_source
     XRDP_SOURCE_SESMAN,
     XRDP_SOURCE_CHANSRV,
     XRDP_SOURCE_MOD,
+    XRDP_SOURCE_API, /* chansrv: xrdpapi applications */
 
     XRDP_SOURCE_MAX_COUNT
 };
@@ -117,6 +121,12 @@ struct trans
     trans_can_recv_proc trans_can_recv;
     struct source_info *si;
     enum xrdp_source my_source;
+    size_t mem_account_bytes; /* Stream bytes charged to MEM_TAG_TRANS */
+    int accept_limit; /* listener only: max accepts per check, 0 = 1.
+                         Only raise this if trans_conn_in never deletes
+                         the listener */
+    int record_type; /* PROTO_RECORD_* type for data received, or 0.
+                        Only used with --enable-devel-record */
 };
 
 struct trans *
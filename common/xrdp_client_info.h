@@ -255,6 +255,11 @@ struct xrdp_client_info
 
     enum unicode_input_state unicode_input_support;
     enum xrdp_capture_code capture_code;
+
+    int low_memory; /* Trade performance for a smaller memory footprint */
+    int memory_accounting; /* Report memory used by the session */
+    /* Only pass on the last of consecutive mouse moves in an input PDU */
+    int coalesce_mouse_motion;
 };
 
 enum xrdp_encoder_flags
@@ -274,6 +279,6 @@ enum xrdp_encoder_flags
 
 /* yyyymmdd of last incompatible change to xrdp_client_info */
 /* also used for changes to all the xrdp installed headers */
-#define CLIENT_INFO_CURRENT_VERSION 20240805
+#define CLIENT_INFO_CURRENT_VERSION 20261019
 
 #endif
@@ -61,6 +61,8 @@
 
 #define XRDP_MAX_BITMAP_CACHE_ID  3
 #define XRDP_MAX_BITMAP_CACHE_IDX 2000
+/* Bitmap cache entries per cache ID with the low memory profile */
+#define XRDP_LOW_MEMORY_BITMAP_CACHE_IDX 256
 #define XRDP_BITMAP_CACHE_ENTRIES 2048
 
 /*
@@ -280,6 +282,9 @@
 
 #define WM_INVALIDATE  200
 #define WM_CHANNEL_DATA 201
+/* Events between these two all came from one client PDU */
+#define WM_INPUT_BATCH_BEGIN 202
+#define WM_INPUT_BATCH_END 203
 
 #define CB_ITEMCHANGE  300
 
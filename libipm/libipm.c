@@ -144,6 +144,7 @@ libipm_trans_destructor(struct trans *trans)
                      trans->in_s->end - trans->in_s->data);
         }
 
+        free_stream(priv->batch_s);
         g_free(priv);
         trans->extra_data = NULL;
         trans->extra_destructor = NULL;
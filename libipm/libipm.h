@@ -222,6 +222,33 @@ enum libipm_status
 libipm_msg_out_simple_send(struct trans *trans, unsigned short msgno,
                            const char *format, ...);
 
+/**
+ * Starts a batch of messages
+ *
+ * Until libipm_msg_out_batch_end() is called, messages sent with
+ * libipm_msg_out_simple_send() are collected and written to the transport
+ * together, saving a system call per message. Messages which carry
+ * file descriptors are not batched, but are still sent in order.
+ *
+ * Don't batch messages containing sensitive data, as the batch buffer
+ * is not erased.
+ *
+ * @param trans libipm transport
+ * @return != 0 for error
+ */
+enum libipm_status
+libipm_msg_out_batch_begin(struct trans *trans);
+
+/**
+ * Sends any messages collected since libipm_msg_out_batch_begin(),
+ * and ends the batch
+ *
+ * @param trans libipm transport
+ * @return != 0 for error
+ */
+enum libipm_status
+libipm_msg_out_batch_end(struct trans *trans);
+
 /**
  * Erase (rather than just ignore) the contents of an output buffer
  *
@@ -44,7 +44,12 @@ enum
     /**
      * Max number of file descriptors in a message
      */
-    MAX_FD_PER_MSG = 8
+    MAX_FD_PER_MSG = 8,
+
+    /**
+     * Max size of a batch of messages waiting to be sent
+     */
+    LIBIPM_MAX_BATCH_SIZE = 8 * LIBIPM_MAX_MSG_SIZE
 };
 
 /**
@@ -59,6 +64,9 @@ struct libipm_priv
     unsigned short out_param_count;
     unsigned short out_fd_count;
     int out_fds[MAX_FD_PER_MSG];
+    /** Messages waiting to be sent by libipm_msg_out_batch_end() */
+    struct stream *batch_s;
+    int batching;
     unsigned short in_msgno;
     unsigned short in_param_count;
     /** Pointer to next fd to be consumed by the app */
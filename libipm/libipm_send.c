@@ -315,7 +315,7 @@ append_char_ptr_type(char c, struct trans *trans, va_list *argptr)
  * @return != 0 for error
  */
 static enum libipm_status
-append_fd_type(char c, va_list *argptr, struct trans *trans)
+append_fd_type(char c, struct trans *trans, va_list *argptr)
 {
     enum libipm_status rv = E_LI_SUCCESS;
     struct stream *s = trans->out_s;
@@ -405,17 +405,12 @@ libipm_msg_out_appendv(struct trans *trans, const char *format, va_list *argptr)
 
     if (format != NULL)
     {
+        /* The switch covers every valid type character, so the format
+         * doesn't need checking against libipm_valid_type_chars */
         for (cp = format; rv == 0 && *cp != '\0' ; ++cp)
         {
             char c = *cp;
             ++priv->out_param_count; /* Count the parameter */
-            if (g_strchr(libipm_valid_type_chars, c) == NULL)
-            {
-                log_append_error(trans,
-                                 "Type code '%c' is not supported", c);
-                rv = E_LI_UNSUPPORTED_TYPE;
-                break;
-            }
 
             switch (c)
             {
@@ -447,19 +442,27 @@ libipm_msg_out_appendv(struct trans *trans, const char *format, va_list *argptr)
                     break;
 
                 case 'h':
-                    rv = append_fd_type(c, argptr, trans);
+                    rv = append_fd_type(c, trans, argptr);
                     break;
 
                 case 'B':
                     rv = append_fsb_type(c, trans, argptr);
                     break;
 
-                default:
+                case 'd':
+                case 'o':
+                case 'g':
                     log_append_error(trans,
                                      "Reserved type code '%c' "
                                      "is unimplemented", c);
                     rv = E_LI_UNIMPLEMENTED_TYPE;
                     break;
+
+                default:
+                    log_append_error(trans,
+                                     "Type code '%c' is not supported", c);
+                    rv = E_LI_UNSUPPORTED_TYPE;
+                    break;
             }
         }
     }
@@ -569,6 +572,72 @@ libipm_msg_out_mark_end(struct trans *trans)
     }
 }
 
+/**************************************************************************//**
+ * Sends any batched messages
+ *
+ * @param trans libipm transport
+ * @return != 0 for error
+ */
+static enum libipm_status
+flush_batch(struct trans *trans)
+{
+    enum libipm_status rv = E_LI_SUCCESS;
+    struct libipm_priv *priv = (struct libipm_priv *)trans->extra_data;
+    struct stream *bs = priv->batch_s;
+
+    if (bs != NULL && bs->p > bs->data)
+    {
+        s_mark_end(bs);
+        if (trans_force_write_s(trans, bs) != 0)
+        {
+            rv = E_LI_TRANSPORT_ERROR;
+        }
+        bs->p = bs->data;
+    }
+
+    return rv;
+}
+
+/**************************************************************************//**
+ * Sends the completed message in the output buffer, or adds it to the
+ * current batch
+ *
+ * @param trans libipm transport
+ * @return != 0 for error
+ */
+static enum libipm_status
+send_or_batch(struct trans *trans)
+{
+    enum libipm_status rv = E_LI_SUCCESS;
+    struct libipm_priv *priv = (struct libipm_priv *)trans->extra_data;
+    struct stream *s = trans->out_s;
+    unsigned int len = s->end - s->data;
+
+    /* File descriptors have to go with the first byte of their own
+     * message, so those messages are never batched */
+    if (priv->batching && priv->out_fd_count == 0)
+    {
+        if (!s_check_rem_out(priv->batch_s, len))
+        {
+            rv = flush_batch(trans);
+        }
+        if (rv == E_LI_SUCCESS)
+        {
+            out_uint8a(priv->batch_s, s->data, len);
+        }
+        return rv;
+    }
+
+    /* Keep the messages in order */
+    if ((rv = flush_batch(trans)) == E_LI_SUCCESS &&
+            trans_force_write(trans) != 0)
+    {
+        rv = E_LI_TRANSPORT_ERROR;
+    }
+
+    return rv;
+}
+
 /*****************************************************************************/
 enum libipm_status
 libipm_msg_out_simple_send(struct trans *trans, unsigned short msgno,
@@ -592,10 +661,7 @@ libipm_msg_out_simple_send(struct trans *trans, unsigned short msgno,
         if (rv == E_LI_SUCCESS)
         {
             libipm_msg_out_mark_end(trans);
-            if (trans_force_write(trans) != 0)
-            {
-                rv = E_LI_TRANSPORT_ERROR;
-            }
+            rv = send_or_batch(trans);
         }
         va_end(argptr);
     }
@@ -614,3 +680,48 @@ libipm_msg_out_erase(struct trans *trans)
         g_memset(s->data, '\0', s->p - s->data);
     }
 }
+
+/*****************************************************************************/
+enum libipm_status
+libipm_msg_out_batch_begin(struct trans *trans)
+{
+    enum libipm_status rv = E_LI_SUCCESS;
+    struct libipm_priv *priv = (struct libipm_priv *)trans->extra_data;
+    if (priv == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "uninitialised transport");
+        rv = E_LI_PROGRAM_ERROR;
+    }
+    else
+    {
+        if (priv->batch_s == NULL)
+        {
+            make_stream(priv->batch_s);
+            init_stream(priv->batch_s, LIBIPM_MAX_BATCH_SIZE);
+        }
+        priv->batch_s->p = priv->batch_s->data;
+        priv->batching = 1;
+    }
+
+    return rv;
+}
+
+/*****************************************************************************/
+enum libipm_status
+libipm_msg_out_batch_end(struct trans *trans)
+{
+    enum libipm_status rv;
+    struct libipm_priv *priv = (struct libipm_priv *)trans->extra_data;
+    if (priv == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "uninitialised transport");
+        rv = E_LI_PROGRAM_ERROR;
+    }
+    else
+    {
+        priv->batching = 0;
+        rv = flush_batch(trans);
+    }
+
+    return rv;
+}
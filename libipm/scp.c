@@ -276,6 +276,22 @@ scp_msg_in_reset(struct trans *trans)
     libipm_msg_in_reset(trans);
 }
 
+/*****************************************************************************/
+
+int
+scp_msg_out_batch_begin(struct trans *trans)
+{
+    return libipm_msg_out_batch_begin(trans);
+}
+
+/*****************************************************************************/
+
+int
+scp_msg_out_batch_end(struct trans *trans)
+{
+    return libipm_msg_out_batch_end(trans);
+}
+
 /*****************************************************************************/
 int
 scp_send_set_peername_request(struct trans *trans,
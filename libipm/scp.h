@@ -202,6 +202,26 @@ scp_msg_in_get_msgno(const struct trans *trans);
 void
 scp_msg_in_reset(struct trans *trans);
 
+/**
+ * Starts collecting SCP output messages to send together
+ *
+ * See libipm_msg_out_batch_begin() for details
+ *
+ * @param trans SCP transport
+ * @return != 0 for error
+ */
+int
+scp_msg_out_batch_begin(struct trans *trans);
+
+/**
+ * Sends the SCP output messages collected since scp_msg_out_batch_begin()
+ *
+ * @param trans SCP transport
+ * @return != 0 for error
+ */
+int
+scp_msg_out_batch_end(struct trans *trans);
+
 /* -------------------- Setup messages--------------------  */
 
 /**
@@ -80,6 +80,10 @@ struct xrdp_fastpath
     struct xrdp_session *session;
     int numEvents;
     int secFlags;
+    /* mouse move held back by coalesce_mouse_motion */
+    int pending_move;
+    int pending_move_x;
+    int pending_move_y;
 };
 
 /* Encryption Methods */
@@ -271,6 +275,31 @@ struct xrdp_orders_state
 
 };
 
+/* most primary orders held for reordering at one time */
+#define XRDP_ORDERS_BATCH_MAX 64
+
+/* a primary order held back in the batch */
+struct xrdp_orders_batch_item
+{
+    int order_type; /* RDP_ORDER_RECT, RDP_ORDER_SCREENBLT etc */
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int rop;
+    int color;
+    int srcx;
+    int srcy;
+    int cache_id;
+    int color_table;
+    int cache_idx;
+    int has_clip;
+    struct xrdp_rect clip;
+    struct xrdp_rect dest; /* screen area written, after clipping */
+    struct xrdp_rect src; /* screen area read, empty if none */
+    tui64 deps; /* bit n set if this must follow batch item n */
+};
+
 /* orders */
 struct xrdp_orders
 {
@@ -288,6 +317,10 @@ struct xrdp_orders
     /* shared */
     struct stream *s;
     struct stream *temp_s;
+    /* primary orders waiting to be reordered and sent */
+    struct xrdp_orders_batch_item batch[XRDP_ORDERS_BATCH_MAX];
+    int batch_count;
+    int batch_flushing;
 };
 
 #define PROTO_RDP_40 1
@@ -489,6 +522,8 @@ xrdp_orders_force_send(struct xrdp_orders *self);
 int
 xrdp_orders_check(struct xrdp_orders *self, int max_size);
 int
+xrdp_orders_flush_batch(struct xrdp_orders *self);
+int
 xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
                  int color, struct xrdp_rect *rect);
 int
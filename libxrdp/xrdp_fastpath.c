@@ -183,6 +183,21 @@ get_slowpath_keyboard_event_flags(int fp_flags)
     return flags;
 }
 
+/*****************************************************************************/
+/* passes on a mouse move held back by coalesce_mouse_motion */
+static void
+xrdp_fastpath_flush_move(struct xrdp_fastpath *self)
+{
+    if (self->pending_move)
+    {
+        self->pending_move = 0;
+        xrdp_fastpath_session_callback(self, RDP_INPUT_MOUSE,
+                                       self->pending_move_x,
+                                       self->pending_move_y,
+                                       PTRFLAGS_MOVE, 0);
+    }
+}
+
 /*****************************************************************************/
 /* FASTPATH_INPUT_EVENT_SCANCODE */
 static int
@@ -203,6 +218,7 @@ xrdp_fastpath_process_EVENT_SCANCODE(struct xrdp_fastpath *self,
 
     flags = get_slowpath_keyboard_event_flags(eventFlags);
 
+    xrdp_fastpath_flush_move(self);
     xrdp_fastpath_session_callback(self, RDP_INPUT_SCANCODE,
                                    code, 0, flags, 0);
 
@@ -236,6 +252,17 @@ xrdp_fastpath_process_EVENT_MOUSE(struct xrdp_fastpath *self,
               "eventHeader.eventFlags 0x00, eventHeader.eventCode (ignored), "
               "pointerFlags 0x%4.4x, xPos %d, yPos %d", pointerFlags, xPos, yPos);
 
+    if (pointerFlags == PTRFLAGS_MOVE &&
+            self->session->client_info->coalesce_mouse_motion)
+    {
+        /* a later move in this PDU replaces this one */
+        self->pending_move = 1;
+        self->pending_move_x = xPos;
+        self->pending_move_y = yPos;
+        return 0;
+    }
+
+    xrdp_fastpath_flush_move(self);
     xrdp_fastpath_session_callback(self, RDP_INPUT_MOUSE,
                                    xPos, yPos, pointerFlags, 0);
 
@@ -271,6 +298,7 @@ xrdp_fastpath_process_EVENT_MOUSEX(struct xrdp_fastpath *self,
               "pointerFlags 0x%4.4x, xPos %d, yPos %d",
               eventFlags, pointerFlags, xPos, yPos);
 
+    xrdp_fastpath_flush_move(self);
     xrdp_fastpath_session_callback(self, RDP_INPUT_MOUSEX,
                                    xPos, yPos, pointerFlags, 0);
 
@@ -295,6 +323,7 @@ xrdp_fastpath_process_EVENT_SYNC(struct xrdp_fastpath *self,
               "eventHeader.eventFlags 0x%2.2x, eventHeader.eventCode (ignored), ",
               eventFlags);
 
+    xrdp_fastpath_flush_move(self);
     xrdp_fastpath_session_callback(self, RDP_INPUT_SYNCHRONIZE,
                                    eventFlags, 0, 0, 0);
 
@@ -322,16 +351,17 @@ xrdp_fastpath_process_EVENT_UNICODE(struct xrdp_fastpath *self,
 
     flags = get_slowpath_keyboard_event_flags(eventFlags);
 
+    xrdp_fastpath_flush_move(self);
     xrdp_fastpath_session_callback(self, RDP_INPUT_UNICODE,
                                    code, 0, flags, 0);
     return 0;
 }
 
 /*****************************************************************************/
-/* FASTPATH_INPUT_EVENT */
-int
-xrdp_fastpath_process_input_event(struct xrdp_fastpath *self,
-                                  struct stream *s)
+/* TS_FP_INPUT_EVENT array */
+static int
+xrdp_fastpath_process_input_events(struct xrdp_fastpath *self,
+                                   struct stream *s)
 {
     int i;
     int eventHeader;
@@ -403,3 +433,26 @@ xrdp_fastpath_process_input_event(struct xrdp_fastpath *self,
     }
     return 0;
 }
+
+/*****************************************************************************/
+/* FASTPATH_INPUT_EVENT */
+int
+xrdp_fastpath_process_input_event(struct xrdp_fastpath *self,
+                                  struct stream *s)
+{
+    int rv;
+
+    /* Let the module send the events of a PDU in one go */
+    if (self->numEvents > 1)
+    {
+        xrdp_fastpath_session_callback(self, 0x555b, 1, 0, 0, 0);
+    }
+    rv = xrdp_fastpath_process_input_events(self, s);
+    /* pass on a move held back at the end of the PDU */
+    xrdp_fastpath_flush_move(self);
+    if (self->numEvents > 1)
+    {
+        xrdp_fastpath_session_callback(self, 0x555b, 0, 0, 0, 0);
+    }
+    return rv;
+}
@@ -23,6 +23,7 @@
 #endif
 
 #include "libxrdp.h"
+#include "mem_account.h"
 
 /* local defines */
 
@@ -453,7 +454,8 @@ mppc_enc_new(int protocol_type)
     }
 
     enc->flagsHold = PACKET_AT_FRONT;
-    enc->historyBuffer = (char *) g_malloc(enc->buf_len, 1);
+    enc->historyBuffer = (char *) mem_account_malloc(MEM_TAG_MPPC,
+                                                     enc->buf_len, 1);
 
     if (enc->historyBuffer == 0)
     {
@@ -461,22 +463,24 @@ mppc_enc_new(int protocol_type)
         return 0;
     }
 
-    enc->outputBufferPlus = (char *) g_malloc(enc->buf_len + 64, 1);
+    enc->outputBufferPlus = (char *) mem_account_malloc(MEM_TAG_MPPC,
+                                                        enc->buf_len + 64, 1);
 
     if (enc->outputBufferPlus == 0)
     {
-        g_free(enc->historyBuffer);
+        mem_account_free(enc->historyBuffer);
         g_free(enc);
         return 0;
     }
 
     enc->outputBuffer = enc->outputBufferPlus + 64;
-    enc->hash_table = (tui16 *) g_malloc(enc->buf_len * 2, 1);
+    enc->hash_table = (tui16 *) mem_account_malloc(MEM_TAG_MPPC,
+                                                   enc->buf_len * 2, 1);
 
     if (enc->hash_table == 0)
     {
-        g_free(enc->historyBuffer);
-        g_free(enc->outputBufferPlus);
+        mem_account_free(enc->historyBuffer);
+        mem_account_free(enc->outputBufferPlus);
         g_free(enc);
         return 0;
     }
@@ -497,9 +501,9 @@ mppc_enc_free(struct xrdp_mppc_enc *enc)
     {
         return;
     }
-    g_free(enc->historyBuffer);
-    g_free(enc->outputBufferPlus);
-    g_free(enc->hash_table);
+    mem_account_free(enc->historyBuffer);
+    mem_account_free(enc->outputBufferPlus);
+    mem_account_free(enc->hash_table);
     g_free(enc);
 }
 
@@ -148,6 +148,10 @@ xrdp_orders_send(struct xrdp_orders *self)
     rv = 0;
     if (self->order_level > 0)
     {
+        if (self->order_level == 1 && xrdp_orders_flush_batch(self) != 0)
+        {
+            rv = 1;
+        }
         self->order_level--;
         if ((self->order_level == 0) && (self->order_count > 0))
         {
@@ -190,6 +194,10 @@ xrdp_orders_force_send(struct xrdp_orders *self)
     {
         return 1;
     }
+    if (xrdp_orders_flush_batch(self) != 0)
+    {
+        return 1;
+    }
     if ((self->order_level > 0) && (self->order_count > 0))
     {
         s_mark_end(self->out_s);
@@ -229,6 +237,12 @@ xrdp_orders_check(struct xrdp_orders *self, int max_size)
     int max_order_size;
     struct xrdp_client_info *ci;
 
+    /* anything other than a batched primary order goes after the batch */
+    if (xrdp_orders_flush_batch(self) != 0)
+    {
+        return 1;
+    }
+
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
 
@@ -499,9 +513,9 @@ xrdp_order_pack_small_or_tiny(struct xrdp_orders *self,
 /* returns error */
 /* send a solid rect to client */
 /* max size 23 */
-int
-xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
-                 int color, struct xrdp_rect *rect)
+static int
+xrdp_orders_out_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                     int color, struct xrdp_rect *rect)
 {
     int order_flags;
     int vals[8];
@@ -669,10 +683,10 @@ xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
 /* returns error */
 /* send a screen blt order */
 /* max size 25 */
-int
-xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
-                       int cx, int cy, int srcx, int srcy,
-                       int rop, struct xrdp_rect *rect)
+static int
+xrdp_orders_out_screen_blt(struct xrdp_orders *self, int x, int y,
+                           int cx, int cy, int srcx, int srcy,
+                           int rop, struct xrdp_rect *rect)
 {
     int order_flags = 0;
     int vals[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -1078,10 +1092,10 @@ xrdp_orders_pat_blt(struct xrdp_orders *self, int x, int y,
 /* returns error */
 /* send a dest blt order */
 /* max size 21 */
-int
-xrdp_orders_dest_blt(struct xrdp_orders *self, int x, int y,
-                     int cx, int cy, int rop,
-                     struct xrdp_rect *rect)
+static int
+xrdp_orders_out_dest_blt(struct xrdp_orders *self, int x, int y,
+                         int cx, int cy, int rop,
+                         struct xrdp_rect *rect)
 {
     int order_flags;
     int vals[8];
@@ -1450,11 +1464,11 @@ xrdp_orders_line(struct xrdp_orders *self, int mix_mode,
 /* returns error */
 /* send a mem blt order */
 /* max size  30 */
-int
-xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
-                    int color_table, int x, int y, int cx, int cy,
-                    int rop, int srcx, int srcy,
-                    int cache_idx, struct xrdp_rect *rect)
+static int
+xrdp_orders_out_mem_blt(struct xrdp_orders *self, int cache_id,
+                        int color_table, int x, int y, int cx, int cy,
+                        int rop, int srcx, int srcy,
+                        int cache_idx, struct xrdp_rect *rect)
 {
     int order_flags = 0;
     int vals[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -1654,6 +1668,322 @@ xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
     return 0;
 }
 
+/*****************************************************************************/
+/* returns boolean */
+static int
+xrdp_orders_batch_overlap(const struct xrdp_rect *a, const struct xrdp_rect *b)
+{
+    return a->left < a->right && a->top < a->bottom &&
+           b->left < b->right && b->top < b->bottom &&
+           a->left < b->right && b->left < a->right &&
+           a->top < b->bottom && b->top < a->bottom;
+}
+
+/*****************************************************************************/
+/* start a new primary order in the batch
+   returns NULL if the order can't be held back and must be sent now */
+static struct xrdp_orders_batch_item *
+xrdp_orders_batch_add(struct xrdp_orders *self, int order_type,
+                      int x, int y, int cx, int cy, struct xrdp_rect *rect)
+{
+    struct xrdp_orders_batch_item *item;
+
+    /* orders outside xrdp_orders_init() / xrdp_orders_send() are not
+       batched, nor are orders sent by xrdp_orders_flush_batch() */
+    if (self->order_level < 1 || self->batch_flushing)
+    {
+        return NULL;
+    }
+    if (self->batch_count >= XRDP_ORDERS_BATCH_MAX)
+    {
+        if (xrdp_orders_flush_batch(self) != 0)
+        {
+            return NULL;
+        }
+    }
+
+    item = self->batch + self->batch_count;
+    g_memset(item, 0, sizeof(struct xrdp_orders_batch_item));
+    item->order_type = order_type;
+    item->x = x;
+    item->y = y;
+    item->cx = cx;
+    item->cy = cy;
+    item->dest.left = x;
+    item->dest.top = y;
+    item->dest.right = x + cx;
+    item->dest.bottom = y + cy;
+    if (rect != 0)
+    {
+        item->has_clip = 1;
+        item->clip = *rect;
+        item->dest.left = MAX(item->dest.left, rect->left);
+        item->dest.top = MAX(item->dest.top, rect->top);
+        item->dest.right = MIN(item->dest.right, rect->right);
+        item->dest.bottom = MIN(item->dest.bottom, rect->bottom);
+    }
+    return item;
+}
+
+/*****************************************************************************/
+/* add an order started with xrdp_orders_batch_add() to the batch, noting
+   the earlier orders it must not be moved in front of */
+static void
+xrdp_orders_batch_commit(struct xrdp_orders *self,
+                         struct xrdp_orders_batch_item *item)
+{
+    struct xrdp_orders_batch_item *prev;
+    int index;
+
+    for (index = 0; index < self->batch_count; index++)
+    {
+        prev = self->batch + index;
+        if (xrdp_orders_batch_overlap(&prev->dest, &item->dest) ||
+                xrdp_orders_batch_overlap(&prev->dest, &item->src) ||
+                xrdp_orders_batch_overlap(&prev->src, &item->dest))
+        {
+            item->deps |= ((tui64)1) << index;
+        }
+    }
+    self->batch_count++;
+}
+
+/*****************************************************************************/
+/* how much the next order's encoding would reuse from the last order sent
+   returns score, higher is better */
+static int
+xrdp_orders_batch_score(struct xrdp_orders *self,
+                        struct xrdp_orders_batch_item *item)
+{
+    int score;
+
+    score = 0;
+    if (item->order_type == self->orders_state.last_order)
+    {
+        /* no order type byte, and coordinates can be sent as deltas */
+        score += 4;
+    }
+    if (item->has_clip && xrdp_orders_last_bounds(self, &item->clip))
+    {
+        score += 2;
+    }
+    switch (item->order_type)
+    {
+        case RDP_ORDER_RECT:
+            if (item->color == self->orders_state.rect_color)
+            {
+                score++;
+            }
+            break;
+        case RDP_ORDER_SCREENBLT:
+            if (item->rop == self->orders_state.scr_blt_rop)
+            {
+                score++;
+            }
+            break;
+        case RDP_ORDER_MEMBLT:
+            if (item->cache_id == self->orders_state.mem_blt_cache_id &&
+                    item->cache_idx == self->orders_state.mem_blt_cache_idx)
+            {
+                score++;
+            }
+            break;
+    }
+    return score;
+}
+
+/*****************************************************************************/
+/* returns error */
+static int
+xrdp_orders_batch_out(struct xrdp_orders *self,
+                      struct xrdp_orders_batch_item *item)
+{
+    struct xrdp_rect *clip;
+
+    clip = item->has_clip ? &item->clip : NULL;
+    switch (item->order_type)
+    {
+        case RDP_ORDER_RECT:
+            return xrdp_orders_out_rect(self, item->x, item->y,
+                                        item->cx, item->cy,
+                                        item->color, clip);
+        case RDP_ORDER_SCREENBLT:
+            return xrdp_orders_out_screen_blt(self, item->x, item->y,
+                                              item->cx, item->cy,
+                                              item->srcx, item->srcy,
+                                              item->rop, clip);
+        case RDP_ORDER_DESTBLT:
+            return xrdp_orders_out_dest_blt(self, item->x, item->y,
+                                            item->cx, item->cy,
+                                            item->rop, clip);
+        case RDP_ORDER_MEMBLT:
+            return xrdp_orders_out_mem_blt(self, item->cache_id,
+                                           item->color_table,
+                                           item->x, item->y,
+                                           item->cx, item->cy, item->rop,
+                                           item->srcx, item->srcy,
+                                           item->cache_idx, clip);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* send the batched primary orders
+   Orders are sent in the order which lets each one reuse the most of the
+   previous order's fields, clip and type. An order is never moved in
+   front of an earlier one which draws to, or reads from, the same part
+   of the screen, so the result on the client is unchanged.
+   returns error */
+int
+xrdp_orders_flush_batch(struct xrdp_orders *self)
+{
+    tui64 pending;
+    int index;
+    int best;
+    int score;
+    int best_score;
+    int rv;
+
+    if (self->batch_count < 1 || self->batch_flushing)
+    {
+        return 0;
+    }
+    self->batch_flushing = 1;
+    pending = 0;
+    for (index = 0; index < self->batch_count; index++)
+    {
+        pending |= ((tui64)1) << index;
+    }
+    rv = 0;
+    while (pending != 0 && rv == 0)
+    {
+        /* the first pending order is always ready to go */
+        best = -1;
+        best_score = -1;
+        for (index = 0; index < self->batch_count; index++)
+        {
+            if ((pending & (((tui64)1) << index)) == 0 ||
+                    (self->batch[index].deps & pending) != 0)
+            {
+                continue;
+            }
+            score = xrdp_orders_batch_score(self, self->batch + index);
+            if (score > best_score)
+            {
+                best = index;
+                best_score = score;
+            }
+        }
+        pending &= ~(((tui64)1) << best);
+        rv = xrdp_orders_batch_out(self, self->batch + best);
+    }
+    if (rv != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "xrdp_orders_flush_batch: sending order failed");
+    }
+    self->batch_count = 0;
+    self->batch_flushing = 0;
+    return rv;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* send a solid rect to client */
+int
+xrdp_orders_rect(struct xrdp_orders *self, int x, int y, int cx, int cy,
+                 int color, struct xrdp_rect *rect)
+{
+    struct xrdp_orders_batch_item *item;
+
+    item = xrdp_orders_batch_add(self, RDP_ORDER_RECT, x, y, cx, cy, rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_rect(self, x, y, cx, cy, color, rect);
+    }
+    item->color = color;
+    xrdp_orders_batch_commit(self, item);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* send a screen blt order */
+int
+xrdp_orders_screen_blt(struct xrdp_orders *self, int x, int y,
+                       int cx, int cy, int srcx, int srcy,
+                       int rop, struct xrdp_rect *rect)
+{
+    struct xrdp_orders_batch_item *item;
+
+    item = xrdp_orders_batch_add(self, RDP_ORDER_SCREENBLT, x, y, cx, cy,
+                                 rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_screen_blt(self, x, y, cx, cy, srcx, srcy,
+                                          rop, rect);
+    }
+    item->srcx = srcx;
+    item->srcy = srcy;
+    item->rop = rop;
+    item->src.left = srcx;
+    item->src.top = srcy;
+    item->src.right = srcx + cx;
+    item->src.bottom = srcy + cy;
+    xrdp_orders_batch_commit(self, item);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* send a dest blt order */
+int
+xrdp_orders_dest_blt(struct xrdp_orders *self, int x, int y,
+                     int cx, int cy, int rop,
+                     struct xrdp_rect *rect)
+{
+    struct xrdp_orders_batch_item *item;
+
+    item = xrdp_orders_batch_add(self, RDP_ORDER_DESTBLT, x, y, cx, cy,
+                                 rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_dest_blt(self, x, y, cx, cy, rop, rect);
+    }
+    item->rop = rop;
+    xrdp_orders_batch_commit(self, item);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+/* send a mem blt order */
+int
+xrdp_orders_mem_blt(struct xrdp_orders *self, int cache_id,
+                    int color_table, int x, int y, int cx, int cy,
+                    int rop, int srcx, int srcy,
+                    int cache_idx, struct xrdp_rect *rect)
+{
+    struct xrdp_orders_batch_item *item;
+
+    item = xrdp_orders_batch_add(self, RDP_ORDER_MEMBLT, x, y, cx, cy, rect);
+    if (item == NULL)
+    {
+        return xrdp_orders_out_mem_blt(self, cache_id, color_table,
+                                       x, y, cx, cy, rop, srcx, srcy,
+                                       cache_idx, rect);
+    }
+    /* the bitmap cache can only be changed by a secondary order, which
+       flushes the batch first */
+    item->cache_id = cache_id;
+    item->color_table = color_table;
+    item->rop = rop;
+    item->srcx = srcx;
+    item->srcy = srcy;
+    item->cache_idx = cache_idx;
+    xrdp_orders_batch_commit(self, item);
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error */
 int
@@ -2265,6 +2595,12 @@ xrdp_orders_send_raw_bitmap(struct xrdp_orders *self,
 
     Bpp = (bpp + 7) / 8;
     bufsize = (width + e) * height * Bpp;
+    /* anything other than a batched primary order goes after the batch */
+    if (xrdp_orders_flush_batch(self) != 0)
+    {
+        return 1;
+    }
+
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
     while (bufsize + 16 > max_order_size)
@@ -2382,6 +2718,12 @@ xrdp_orders_send_bitmap(struct xrdp_orders *self,
         return 1;
     }
 
+    /* anything other than a batched primary order goes after the batch */
+    if (xrdp_orders_flush_batch(self) != 0)
+    {
+        return 1;
+    }
+
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
 
@@ -2682,6 +3024,12 @@ xrdp_orders_send_raw_bitmap2(struct xrdp_orders *self,
         return 1;
     }
 
+    /* anything other than a batched primary order goes after the batch */
+    if (xrdp_orders_flush_batch(self) != 0)
+    {
+        return 1;
+    }
+
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
 
@@ -2810,6 +3158,12 @@ xrdp_orders_send_bitmap2(struct xrdp_orders *self,
         return 1;
     }
 
+    /* anything other than a batched primary order goes after the batch */
+    if (xrdp_orders_flush_batch(self) != 0)
+    {
+        return 1;
+    }
+
     ci = &(self->rdp_layer->client_info);
     max_order_size = MAX_ORDERS_SIZE(ci);
 
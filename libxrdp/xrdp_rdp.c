@@ -25,6 +25,10 @@
 #include "libxrdp.h"
 #include "ms-rdpbcgr.h"
 #include "log.h"
+#include "mem_account.h"
+#if defined(USE_DEVEL_RECORD)
+#include "proto_record.h"
+#endif
 #include "ssl_calls.h"
 #include "string_calls.h"
 
@@ -80,6 +84,18 @@ xrdp_rdp_read_config(const char *xrdp_ini, struct xrdp_client_info *client_info)
         {
             client_info->use_bulk_comp = g_text2bool(value);
         }
+        else if (g_strcasecmp(item, "coalesce_mouse_motion") == 0)
+        {
+            client_info->coalesce_mouse_motion = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "low_memory") == 0)
+        {
+            client_info->low_memory = g_text2bool(value);
+        }
+        else if (g_strcasecmp(item, "memory_accounting") == 0)
+        {
+            client_info->memory_accounting = g_text2bool(value);
+        }
         else if (g_strcasecmp(item, "crypt_level") == 0)
         {
             if (g_strcasecmp(value, "none") == 0)
@@ -360,6 +376,10 @@ struct xrdp_rdp *
 xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
 {
     struct xrdp_rdp *self = (struct xrdp_rdp *)NULL;
+#if defined(USE_DEVEL_RECORD)
+    const char *record_dir;
+    char record_file[256];
+#endif
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "in xrdp_rdp_create");
     self = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
@@ -367,6 +387,23 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     self->share_id = 66538;
     /* read ini settings */
     xrdp_rdp_read_config(session->xrdp_ini, &self->client_info);
+    if (self->client_info.memory_accounting)
+    {
+        mem_account_enable();
+    }
+#if defined(USE_DEVEL_RECORD)
+    /* For test systems only. See tools/devel/replay */
+    record_dir = g_getenv("XRDP_RECORD_DIR");
+    if (record_dir != NULL && record_dir[0] != '\0')
+    {
+        g_snprintf(record_file, sizeof(record_file), "%s/xrdp-%d.rec",
+                   record_dir, g_getpid());
+        if (proto_record_open(record_file) == 0)
+        {
+            trans->record_type = PROTO_RECORD_CLIENT_IN;
+        }
+    }
+#endif
     /* create sec layer */
     self->sec_layer = xrdp_sec_create(self, trans);
     /* default 8 bit v1 color bitmap cache entries and size */
@@ -384,7 +421,6 @@ xrdp_rdp_create(struct xrdp_session *session, struct trans *trans)
     g_sck_get_peer_description(trans->sck,
                                self->client_info.client_description,
                                sizeof(self->client_info.client_description));
-    self->mppc_enc = mppc_enc_new(PROTO_RDP_50);
 #if defined(XRDP_NEUTRINORDP)
     self->rfx_enc = rfx_context_new();
     rfx_context_set_cpu_opt(self->rfx_enc, xrdp_rdp_detect_cpu());
@@ -405,6 +441,9 @@ xrdp_rdp_delete(struct xrdp_rdp *self)
     }
 
     xrdp_sec_delete(self->sec_layer);
+#if defined(USE_DEVEL_RECORD)
+    proto_record_close();
+#endif
     mppc_enc_free(self->mppc_enc);
 #if defined(XRDP_NEUTRINORDP)
     rfx_context_free((RFX_CONTEXT *)(self->rfx_enc));
@@ -584,6 +623,26 @@ xrdp_rdp_send(struct xrdp_rdp *self, struct stream *s, int pdu_type)
     return 0;
 }
 
+/*****************************************************************************/
+/* Get the bulk compressor, creating it on first use. Its history and hash
+ * tables are quite large, so we don't allocate them for clients which
+ * don't use bulk compression.
+ * returns NULL on error */
+static struct xrdp_mppc_enc *
+xrdp_rdp_get_mppc_enc(struct xrdp_rdp *self)
+{
+    if (self->mppc_enc == NULL)
+    {
+        self->mppc_enc = mppc_enc_new(PROTO_RDP_50);
+        if (self->mppc_enc == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "xrdp_rdp_get_mppc_enc: "
+                "can't create bulk compressor");
+        }
+    }
+    return self->mppc_enc;
+}
+
 /*****************************************************************************/
 /* Send a [MS-RDPBCGR] Data PDU for the given pduType2 from
  * the specified source with the headers
@@ -617,9 +676,9 @@ xrdp_rdp_send_data_from_channel(struct xrdp_rdp *self, struct stream *s,
     tocomplen = pdulen - 18;
 
     if (compress && self->client_info.rdp_compression &&
-            self->session->up_and_running)
+            self->session->up_and_running &&
+            (mppc_enc = xrdp_rdp_get_mppc_enc(self)) != NULL)
     {
-        mppc_enc = self->mppc_enc;
         if (compress_rdp(mppc_enc, (tui8 *)(s->p + 18), tocomplen))
         {
             clen = mppc_enc->bytes_in_opb + 18;
@@ -803,10 +862,10 @@ xrdp_rdp_send_fastpath(struct xrdp_rdp *self, struct stream *s,
         send_len = no_comp_len;
         LOG_DEVEL(LOG_LEVEL_DEBUG, "xrdp_rdp_send_fastpath: no_comp_len %d, fragmentation %d",
                   no_comp_len, fragmentation);
-        if ((compression != 0) && (no_comp_len > header_bytes + 16))
+        if ((compression != 0) && (no_comp_len > header_bytes + 16) &&
+                (mppc_enc = xrdp_rdp_get_mppc_enc(self)) != NULL)
         {
             to_comp_len = no_comp_len - header_bytes;
-            mppc_enc = self->mppc_enc;
             if (compress_rdp(mppc_enc, (tui8 *)(frag_s.p + header_bytes),
                              to_comp_len))
             {
@@ -529,6 +529,10 @@ lxrdp_event(struct mod *mod, int msg, long param1, long param2,
 
             break;
 
+        case WM_INPUT_BATCH_BEGIN:
+        case WM_INPUT_BATCH_END:
+            break;
+
         default:
             LOG(LOG_LEVEL_WARNING, "Unhandled message type in eventhandler %d", msg);
             break;
@@ -55,6 +55,12 @@
 static struct trans *g_lis_trans = 0;
 static struct trans *g_con_trans = 0;
 static struct trans *g_api_lis_trans = 0;
+/* Counts data from xrdpapi applications which is waiting to be sent to
+ * xrdp. While there is any, the applications aren't read from */
+static struct source_info g_si;
+/* Rail drawing orders waiting to be sent to xrdp, as messages without
+ * the block header */
+static struct stream *g_rail_orders_s = NULL;
 static struct list *g_api_con_trans_list = 0; /* list of apps using api functions */
 static struct chan_item g_chan_items[32];
 static int g_num_chan_items = 0;
@@ -278,6 +284,11 @@ send_channel_data(int chan_id, const char *data, int size)
         /* bad param */
         return 1;
     }
+    /* keep the channel data in order with any rail orders */
+    if (flush_rail_drawing_orders() != 0)
+    {
+        return 1;
+    }
     total_size = size;
     chan_flags = 1; /* first */
     while (size > 0)
@@ -315,25 +326,72 @@ send_channel_data(int chan_id, const char *data, int size)
 }
 
 /*****************************************************************************/
-/* returns error */
+/* returns error
+   queues an order for flush_rail_drawing_orders(), so that all the orders
+   for a batch of X events go to xrdp in as few blocks as possible */
 int
 send_rail_drawing_orders(char *data, int size)
 {
     LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::send_rail_drawing_orders: size %d", size);
 
     struct stream *s;
+
+    if (size < 1 || 8 + 8 + size > 8192)
+    {
+        LOG(LOG_LEVEL_ERROR, "send_rail_drawing_orders: bad order size %d",
+            size);
+        return 1;
+    }
+    if (g_rail_orders_s == NULL)
+    {
+        make_stream(g_rail_orders_s);
+        init_stream(g_rail_orders_s, 8192);
+    }
+    s = g_rail_orders_s;
+    if (8 + (int)(s->p - s->data) + 8 + size > 8192)
+    {
+        if (flush_rail_drawing_orders() != 0)
+        {
+            return 1;
+        }
+    }
+    out_uint32_le(s, 10); /* msg id */
+    out_uint32_le(s, 8 + size); /* size */
+    out_uint8a(s, data, size);
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+flush_rail_drawing_orders(void)
+{
+    struct stream *s;
+    int bytes;
     int error;
 
+    if (g_rail_orders_s == NULL || g_rail_orders_s->p == g_rail_orders_s->data)
+    {
+        return 0;
+    }
+    bytes = (int)(g_rail_orders_s->p - g_rail_orders_s->data);
+    g_rail_orders_s->p = g_rail_orders_s->data;
+    if (g_con_trans == NULL)
+    {
+        /* xrdp has gone, nothing to send to */
+        return 0;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::flush_rail_drawing_orders: size %d",
+              bytes);
+
     s = trans_get_out_s(g_con_trans, 8192);
     if (s == NULL)
     {
         return 1;
     }
     out_uint32_le(s, 0); /* version */
-    out_uint32_le(s, 8 + 8 + size); /* size */
-    out_uint32_le(s, 10); /* msg id */
-    out_uint32_le(s, 8 + size); /* size */
-    out_uint8a(s, data, size);
+    out_uint32_le(s, 8 + bytes); /* size */
+    out_uint8a(s, g_rail_orders_s->data, bytes);
     s_mark_end(s);
     error = trans_force_write(g_con_trans);
     if (error != 0)
@@ -822,30 +880,61 @@ chansrv_drdynvc_data(int chan_id, const char *data, int data_bytes)
 }
 
 /*****************************************************************************/
+/* Sends data as a data_first message followed by data messages, each
+ * carrying up to 1590 bytes. As many messages as will fit are written
+ * in each block, up to the 8192 bytes xrdp reads in one go */
 int
 chansrv_drdynvc_send_data(int chan_id, const char *data, int data_bytes)
 {
+    struct stream *s;
+    int total_data_bytes;
     int this_send_bytes;
+    int first;
 
     // LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv_drdynvc_send_data: data_bytes %d", data_bytes);
-    if (data_bytes > 1590)
+    total_data_bytes = data_bytes;
+    first = (data_bytes > 1590);
+    while (data_bytes > 0)
     {
-        if (chansrv_drdynvc_data_first(chan_id, data, 1590, data_bytes) != 0)
+        s = trans_get_out_s(g_con_trans, 8192);
+        if (s == NULL)
         {
             return 1;
         }
-        data_bytes -= 1590;
-        data += 1590;
-    }
-    while (data_bytes > 0)
-    {
-        this_send_bytes = MIN(1590, data_bytes);
-        if (chansrv_drdynvc_data(chan_id, data, this_send_bytes) != 0)
+        out_uint32_le(s, 0); /* version */
+        s_push_layer(s, channel_hdr, 4);
+        do
+        {
+            this_send_bytes = MIN(1590, data_bytes);
+            if (first)
+            {
+                out_uint32_le(s, 16); /* msg id */
+                out_uint32_le(s, 20 + this_send_bytes);
+                out_uint32_le(s, chan_id);
+                out_uint32_le(s, this_send_bytes);
+                out_uint32_le(s, total_data_bytes);
+                first = 0;
+            }
+            else
+            {
+                out_uint32_le(s, 18); /* msg id */
+                out_uint32_le(s, 16 + this_send_bytes);
+                out_uint32_le(s, chan_id);
+                out_uint32_le(s, this_send_bytes);
+            }
+            out_uint8a(s, data, this_send_bytes);
+            data_bytes -= this_send_bytes;
+            data += this_send_bytes;
+        }
+        while (data_bytes > 0 &&
+                (int)(s->p - s->data) + 16 + MIN(1590, data_bytes) <= 8192);
+        s_mark_end(s);
+        s_pop_layer(s, channel_hdr);
+        out_uint32_le(s, (int)(s->end - s->data));
+        if (trans_write_copy(g_con_trans) != 0)
         {
             return 1;
         }
-        data_bytes -= this_send_bytes;
-        data += this_send_bytes;
     }
     return 0;
 }
@@ -1301,6 +1390,9 @@ my_trans_conn_in(struct trans *trans, struct trans *new_trans)
     g_con_trans = new_trans;
     g_con_trans->trans_data_in = my_trans_data_in;
     g_con_trans->header_size = 8;
+    /* Anything buffered for a previous xrdp connection went with it */
+    g_memset(&g_si, 0, sizeof(g_si));
+    g_con_trans->si = &g_si;
     /* stop listening */
     trans_delete(g_lis_trans);
     g_lis_trans = 0;
@@ -1325,6 +1417,8 @@ my_api_trans_conn_in(struct trans *trans, struct trans *new_trans)
     new_trans->trans_data_in = my_api_trans_data_in;
     new_trans->header_size = 8;
     new_trans->no_stream_init_on_data_in = 1;
+    new_trans->si = &g_si;
+    new_trans->my_source = XRDP_SOURCE_API;
     ad = g_new0(struct xrdp_api_data, 1);
     if (ad == NULL)
     {
@@ -1562,6 +1656,7 @@ channel_thread_loop(void *in_val)
             /* check the wait_objs in g_api_con_trans_list */
             api_con_trans_list_check_wait_objs();
             xcommon_check_wait_objs();
+            rail_check_wait_objs();
             sound_check_wait_objs();
             devredir_check_wait_objs();
             xfuse_check_wait_objs();
@@ -1596,6 +1691,8 @@ channel_thread_loop(void *in_val)
     g_api_lis_trans = 0;
     api_con_trans_list_remove_all();
     list_delete(g_api_con_trans_list);
+    free_stream(g_rail_orders_s);
+    g_rail_orders_s = NULL;
     LOG_DEVEL(LOG_LEVEL_INFO, "channel_thread_loop: thread stop");
     g_set_wait_obj(g_thread_done_event);
     return rv;
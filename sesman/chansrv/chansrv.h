@@ -36,6 +36,7 @@ g_is_term(void);
 
 int send_channel_data(int chan_id, const char *data, int size);
 int send_rail_drawing_orders(char *data, int size);
+int flush_rail_drawing_orders(void);
 int main_cleanup(void);
 int add_timeout(int msoffset, void (*callback)(void *data), void *data);
 
@@ -43,6 +43,8 @@
 #define DEFAULT_FUSE_DIRECT_IO              0
 #define DEFAULT_FILE_UMASK                  077
 #define DEFAULT_USE_NAUTILUS3_FLIST_FORMAT  0
+#define DEFAULT_CLIPBOARD_FILE_WINDOW       8
+#define MAX_CLIPBOARD_FILE_WINDOW           256
 #define DEFAULT_NUM_SILENT_FRAMES_AAC       4
 #define DEFAULT_NUM_SILENT_FRAMES_MP3       2
 #define DEFAULT_MSEC_DO_NOT_SEND            1000
@@ -231,6 +233,19 @@ read_config_chansrv(log_func_t logmsg,
         {
             cfg->use_nautilus3_flist_format = g_text2bool(value);
         }
+        else if (g_strcasecmp(name, "ClipboardFileWindow") == 0)
+        {
+            cfg->clipboard_file_window = g_atoi(value);
+            if (cfg->clipboard_file_window < 1 ||
+                    cfg->clipboard_file_window > MAX_CLIPBOARD_FILE_WINDOW)
+            {
+                logmsg(LOG_LEVEL_WARNING, "ClipboardFileWindow must be "
+                       "between 1 and %d. Using default of %d",
+                       MAX_CLIPBOARD_FILE_WINDOW,
+                       DEFAULT_CLIPBOARD_FILE_WINDOW);
+                cfg->clipboard_file_window = DEFAULT_CLIPBOARD_FILE_WINDOW;
+            }
+        }
         else if (g_strcasecmp(name, "SoundNumSilentFramesAAC") == 0)
         {
             cfg->num_silent_frames_aac = strtoul(value, NULL, 0);
@@ -276,6 +291,7 @@ new_config(void)
         cfg->fuse_direct_io = DEFAULT_FUSE_DIRECT_IO;
         cfg->file_umask = DEFAULT_FILE_UMASK;
         cfg->use_nautilus3_flist_format = DEFAULT_USE_NAUTILUS3_FLIST_FORMAT;
+        cfg->clipboard_file_window = DEFAULT_CLIPBOARD_FILE_WINDOW;
         cfg->num_silent_frames_aac = DEFAULT_NUM_SILENT_FRAMES_AAC;
         cfg->num_silent_frames_mp3 = DEFAULT_NUM_SILENT_FRAMES_MP3;
         cfg->msec_do_not_send = DEFAULT_MSEC_DO_NOT_SEND;
@@ -375,6 +391,8 @@ config_dump(struct config_chansrv *config)
     g_writeln("    FileMask:                  0%o", config->file_umask);
     g_writeln("    Nautilus 3 Flist Format:   %s",
               g_bool2text(config->use_nautilus3_flist_format));
+    g_writeln("    ClipboardFileWindow:       %d",
+              config->clipboard_file_window);
 }
 
 /******************************************************************************/
@@ -45,6 +45,10 @@ struct config_chansrv
     /** Whether to use nautilus3-compatible file lists for the clipboard */
     int use_nautilus3_flist_format;
 
+    /** ClipboardFileWindow from sesman.ini. Number of file contents
+     *  requests which can be waiting for the client at once */
+    int clipboard_file_window;
+
     /** Number of silent frames to send before SNDC_CLOSE is sent, setting from sesman.ini */
     unsigned int num_silent_frames_aac;
     unsigned int num_silent_frames_mp3;
@@ -71,7 +71,7 @@ int xfuse_clear_clip_dir(void)
 {
     return 0;
 }
-int xfuse_file_contents_range(int stream_id, const char *data, int data_bytes)
+int xfuse_file_contents_ready(void)
 {
     return 0;
 }
@@ -80,7 +80,7 @@ int xfuse_file_contents_size(int stream_id, int file_size)
     return 0;
 }
 int xfuse_add_clip_dir_item(const char *filename,
-                            int flags, int size, int lindex)
+                            int flags, tui64 size, int lindex)
 {
     return 0;
 }
@@ -319,13 +319,14 @@ struct xfuse_handle
 };
 typedef struct xfuse_handle XFUSE_HANDLE;
 
-/* used for file data request sent to client */
+/* a FUSE read of a file in the clipboard directory, waiting for data
+   from the client */
 struct req_list_item
 {
     fuse_req_t req;
-    int stream_id;
     int lindex;
-    int off;
+    off_t file_size;
+    off_t off;
     int size;
 };
 
@@ -775,46 +776,55 @@ int xfuse_clear_clip_dir(void)
 /**
  * Return clipboard data to fuse
  *
+ * Called when more file data has arrived from the client. Reads waiting
+ * for it are answered in whatever order their data becomes available.
+ *
  * @return 0 on success, -1 on failure
  *****************************************************************************/
 
 int
-xfuse_file_contents_range(int stream_id, const char *data, int data_bytes)
+xfuse_file_contents_ready(void)
 {
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "entered: stream_id=%d data_bytes=%d", stream_id, data_bytes);
-
     struct req_list_item *rli;
+    char *buf;
+    int index;
+    int rv;
 
-    if ((rli = (struct req_list_item *) list_get_item(g_req_list, 0)) == NULL)
+    if (g_req_list == NULL)
     {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "range error!");
-        return -1;
-    }
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "lindex=%d off=%d size=%d", rli->lindex, rli->off, rli->size);
-
-    fuse_reply_buf(rli->req, data, data_bytes);
-
-    list_remove_item(g_req_list, 0);
-    if (g_req_list->count <= 0)
-    {
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "completed all requests");
         return 0;
     }
 
-    /* send next request */
-    rli = (struct req_list_item *) list_get_item(g_req_list, 0);
-    if (rli == NULL)
+    for (index = 0; index < g_req_list->count; )
     {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "range error!");
-        return -1;
+        rli = (struct req_list_item *) list_get_item(g_req_list, index);
+        if ((buf = (char *)malloc(rli->size)) == NULL)
+        {
+            return -1;
+        }
+        rv = clipboard_file_read(rli->lindex, rli->file_size, rli->off,
+                                 rli->size, buf);
+        if (rv == CB_FILE_READ_PENDING)
+        {
+            ++index;
+        }
+        else
+        {
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "lindex=%d off=%lld size=%d rv=%d",
+                      rli->lindex, (long long) rli->off, rli->size, rv);
+            if (rv < 0)
+            {
+                fuse_reply_err(rli->req, EIO);
+            }
+            else
+            {
+                fuse_reply_buf(rli->req, buf, rv);
+            }
+            list_remove_item(g_req_list, index);
+        }
+        free(buf);
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data");
-
-    clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                rli->off, rli->size);
-
     return 0;
 }
 
@@ -827,11 +837,12 @@ xfuse_file_contents_range(int stream_id, const char *data, int data_bytes)
  *****************************************************************************/
 
 int
-xfuse_add_clip_dir_item(const char *filename, int flags, int size, int lindex)
+xfuse_add_clip_dir_item(const char *filename, int flags, tui64 size,
+                        int lindex)
 {
     LOG_DEVEL(LOG_LEVEL_DEBUG,
-              "entered: filename=%s flags=%d size=%d lindex=%d",
-              filename, flags, size, lindex);
+              "entered: filename=%s flags=%d size=%llu lindex=%d",
+              filename, flags, (unsigned long long) size, lindex);
 
     int result = -1;
 
@@ -2345,23 +2356,30 @@ static void xfuse_cb_read(fuse_req_t req, fuse_ino_t ino, size_t size,
             return;
         }
 
-        rli = g_new0(struct req_list_item, 1);
+        if (off >= xinode->size || size == 0)
+        {
+            fuse_reply_buf(req, 0, 0);
+            return;
+        }
 
-        rli->stream_id = 0;
+        rli = g_new0(struct req_list_item, 1);
+        if (rli == NULL)
+        {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
         rli->req = req;
         rli->lindex = xinode->lindex;
+        rli->file_size = xinode->size;
         rli->off = off;
-        rli->size = size;
+        rli->size = MIN(size, (size_t)(xinode->size - off));
         list_add_item(g_req_list, (tbus) rli);
 
-        if (g_req_list->count == 1)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "requesting clipboard file data lindex = %d off = %lld size = %zd",
-                      rli->lindex, (long long) off, size);
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "reading clipboard file data lindex = %d off = %lld size = %zd",
+                  rli->lindex, (long long) off, size);
 
-            clipboard_request_file_data(rli->stream_id, rli->lindex,
-                                        (int) off, (int) size);
-        }
+        /* Replies at once if the data has already been read ahead */
+        xfuse_file_contents_ready();
     }
     else
     {
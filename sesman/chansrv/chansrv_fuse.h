@@ -54,10 +54,10 @@ int xfuse_create_share(tui32 share_id, const char *dirname);
 void xfuse_delete_share(tui32 share_id);
 
 int xfuse_clear_clip_dir(void);
-int xfuse_file_contents_range(int stream_id, const char *data, int data_bytes);
+int xfuse_file_contents_ready(void);
 int xfuse_file_contents_size(int stream_id, int file_size);
 int xfuse_add_clip_dir_item(const char *filename,
-                            int flags, int size, int lindex);
+                            int flags, tui64 size, int lindex);
 
 /* State pointer types (opaque outside this module), used for
  * callback data
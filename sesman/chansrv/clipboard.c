@@ -163,6 +163,9 @@ x-special/gnome-copied-files
 #include <config_ac.h>
 #endif
 
+#include <limits.h>
+#include <stdlib.h>
+
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/Xfixes.h>
@@ -492,6 +495,7 @@ clipboard_deinit(void)
     }
 
     xfuse_deinit();
+    clipboard_file_clear_chunks();
 
     g_free(g_clip_c2s.data);
     g_clip_c2s.data = 0;
@@ -882,6 +886,46 @@ clipboard_provide_selection_c2s(XSelectionRequestEvent *req, Atom type)
     return 0;
 }
 
+/*****************************************************************************/
+/* sends the next INCR chunk of client data to the requestor, after it has
+   deleted the property. If the client is still sending, and nothing new
+   has arrived yet, this waits for clipboard_c2s_stream_data() to call it
+   again */
+static void
+clipboard_c2s_incr_send_next(void)
+{
+    tui8 *data;
+    int data_bytes;
+
+    data = (tui8 *)(g_clip_c2s.data + g_clip_c2s.incr_bytes_done);
+    data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
+    if ((data_bytes < 1) && g_clip_c2s.streaming)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_incr_send_next: "
+                  "waiting for the client");
+        g_clip_c2s.incr_waiting = 1;
+        return;
+    }
+    g_clip_c2s.incr_waiting = 0;
+    if (data_bytes > g_incr_max_req_size)
+    {
+        data_bytes = g_incr_max_req_size;
+    }
+    g_clip_c2s.incr_bytes_done += data_bytes;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_incr_send_next: data_bytes %d",
+              data_bytes);
+    XChangeProperty(g_display, g_clip_c2s.window, g_clip_c2s.property,
+                    g_clip_c2s.type, 8, PropModeReplace, data, data_bytes);
+    if (data_bytes < 1)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_incr_send_next: INCR done");
+        g_clip_c2s.incr_in_progress = 0;
+        /* we no longer need property notify */
+        XSelectInput(g_display, g_clip_c2s.window, NoEventMask);
+        g_clip_c2s.converted = 1;
+    }
+}
+
 /*****************************************************************************/
 static int
 clipboard_provide_selection(XSelectionRequestEvent *req, Atom type, int format,
@@ -1113,6 +1157,32 @@ clipboard_process_data_request(struct stream *s, int clip_msg_status,
     return 0;
 }
 
+/*****************************************************************************/
+/* writes a bitmap file header to the start of data
+   https://en.wikipedia.org/wiki/BMP_file_format#Bitmap_file_header
+   returns error */
+static int
+clipboard_out_bmp_file_header(char *data, int total_bytes)
+{
+    struct stream *bmp_hs;
+
+    make_stream(bmp_hs);
+    if (bmp_hs == 0)
+    {
+        return 1;
+    }
+    init_stream(bmp_hs, BMPFILEHEADER_LEN);
+    out_uint8(bmp_hs, 'B');
+    out_uint8(bmp_hs, 'M');
+    out_uint32_le(bmp_hs, total_bytes);
+    out_uint16_le(bmp_hs, 0);
+    out_uint16_le(bmp_hs, 0);
+    out_uint32_le(bmp_hs, BMPFILEHEADER_LEN + BMPINFOHEADER_LEN);
+    g_memcpy(data, bmp_hs->data, BMPFILEHEADER_LEN);
+    free_stream(bmp_hs);
+    return 0;
+}
+
 /**************************************************************************//**
  * Process a CB_FORMAT_DATA_RESPONSE for an X client requesting an image
  *
@@ -1129,7 +1199,6 @@ clipboard_process_data_response_for_image(struct stream *s,
 {
     XSelectionRequestEvent *lxev;
     int len;
-    struct stream *bmp_hs;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response_for_image: "
               "CLIPRDR_DATA_RESPONSE_FOR_IMAGE");
@@ -1154,30 +1223,16 @@ clipboard_process_data_response_for_image(struct stream *s,
     g_clip_c2s.total_bytes = len + BMPFILEHEADER_LEN;
     g_clip_c2s.read_bytes_done = g_clip_c2s.total_bytes;
 
-    /*
-     * Assemble bitmap file header
-     * https://en.wikipedia.org/wiki/BMP_file_format#Bitmap_file_header
-     */
-    make_stream(bmp_hs);
-    if (bmp_hs == 0)
+    if (clipboard_out_bmp_file_header(g_clip_c2s.data,
+                                      g_clip_c2s.total_bytes) != 0)
     {
         g_free(g_clip_c2s.data);
+        g_clip_c2s.data = 0;
         g_clip_c2s.total_bytes = 0;
         return 0;
     }
-    init_stream(bmp_hs, BMPFILEHEADER_LEN);
-    out_uint8(bmp_hs, 'B');
-    out_uint8(bmp_hs, 'M');
-    out_uint32_le(bmp_hs, g_clip_c2s.total_bytes);
-    out_uint16_le(bmp_hs, 0);
-    out_uint16_le(bmp_hs, 0);
-    out_uint32_le(bmp_hs, BMPFILEHEADER_LEN + BMPINFOHEADER_LEN);
-
-    /* Copy header and data to output stream */
-    g_memcpy(g_clip_c2s.data, bmp_hs->data, BMPFILEHEADER_LEN);
     in_uint8a(s, g_clip_c2s.data + BMPFILEHEADER_LEN, len);
 
-    free_stream(bmp_hs);
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_data_response_for_image: calling "
               "clipboard_provide_selection_c2s");
     clipboard_provide_selection_c2s(lxev, lxev->target);
@@ -1417,6 +1472,100 @@ clipboard_process_clip_caps(struct stream *s, int clip_msg_status,
     return 0;
 }
 
+/*****************************************************************************/
+/* called with the first chunk of a PDU which is split over several virtual
+   channel chunks. A large bitmap response is copied straight into
+   g_clip_c2s.data as it arrives, and offered to the X client with INCR
+   before the client has finished sending it.
+   Other PDUs are assembled in g_ins as usual.
+   returns non-zero if the PDU is streamed */
+static int
+clipboard_c2s_stream_start(struct stream *s, int total_length)
+{
+    XSelectionRequestEvent *lxev = &g_saved_selection_req_event;
+    int clip_msg_id;
+    int clip_msg_status;
+    int clip_msg_len;
+
+    if (!s_check_rem(s, 8))
+    {
+        return 0;
+    }
+    in_uint16_le(s, clip_msg_id);
+    in_uint16_le(s, clip_msg_status);
+    in_uint32_le(s, clip_msg_len);
+    if (clip_msg_id != CB_FORMAT_DATA_RESPONSE ||
+            (clip_msg_status & CB_RESPONSE_OK) == 0 ||
+            !g_clip_c2s.in_request ||
+            g_clip_c2s.xrdp_clip_type != XRDP_CB_BITMAP ||
+            g_clip_c2s.type != g_image_bmp_atom ||
+            g_clip_c2s.incr_in_progress ||
+            clip_msg_len != total_length - 8 ||
+            clip_msg_len > INT_MAX - BMPFILEHEADER_LEN ||
+            clip_msg_len + BMPFILEHEADER_LEN < g_incr_max_req_size)
+    {
+        s->p -= 8;
+        return 0;
+    }
+
+    g_free(g_clip_c2s.data);
+    g_clip_c2s.data = (char *)g_malloc(clip_msg_len + BMPFILEHEADER_LEN, 0);
+    if (g_clip_c2s.data == NULL)
+    {
+        g_clip_c2s.total_bytes = 0;
+        s->p -= 8;
+        return 0;
+    }
+    g_clip_c2s.total_bytes = clip_msg_len + BMPFILEHEADER_LEN;
+    if (clipboard_out_bmp_file_header(g_clip_c2s.data,
+                                      g_clip_c2s.total_bytes) != 0)
+    {
+        g_free(g_clip_c2s.data);
+        g_clip_c2s.data = NULL;
+        g_clip_c2s.total_bytes = 0;
+        s->p -= 8;
+        return 0;
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_stream_start: streaming %d bytes",
+              clip_msg_len);
+    g_clip_c2s.read_bytes_done = BMPFILEHEADER_LEN;
+    g_clip_c2s.streaming = 1;
+    g_clip_c2s.incr_waiting = 0;
+    g_clip_c2s.in_request = 0;
+    clipboard_provide_selection_c2s(lxev, lxev->target);
+    return 1;
+}
+
+/*****************************************************************************/
+/* adds a chunk of a streamed bitmap response, and passes it on if the
+   X client is waiting for it */
+static void
+clipboard_c2s_stream_data(struct stream *s, int bytes, int last)
+{
+    int space = g_clip_c2s.total_bytes - g_clip_c2s.read_bytes_done;
+
+    if (bytes > space)
+    {
+        bytes = space;
+    }
+    if (bytes > 0)
+    {
+        in_uint8a(s, g_clip_c2s.data + g_clip_c2s.read_bytes_done, bytes);
+        g_clip_c2s.read_bytes_done += bytes;
+    }
+    if (last)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_stream_data: done, %d of %d "
+                  "bytes", g_clip_c2s.read_bytes_done, g_clip_c2s.total_bytes);
+        g_clip_c2s.streaming = 0;
+        g_clip_c2s.total_bytes = g_clip_c2s.read_bytes_done;
+    }
+    if (g_clip_c2s.incr_in_progress && g_clip_c2s.incr_waiting)
+    {
+        clipboard_c2s_incr_send_next();
+    }
+}
+
 /*****************************************************************************/
 int
 clipboard_data_in(struct stream *s, int chan_id, int chan_flags, int length,
@@ -1446,10 +1595,27 @@ clipboard_data_in(struct stream *s, int chan_id, int chan_flags, int length,
     {
         ls = s;
     }
+    else if (g_clip_c2s.streaming && (chan_flags & 1) == 0)
+    {
+        clipboard_c2s_stream_data(s, length, chan_flags & 2);
+        XFlush(g_display);
+        return 0;
+    }
     else
     {
         if (chan_flags & 1)
         {
+            if (g_clip_c2s.streaming)
+            {
+                /* the last response was cut short */
+                clipboard_c2s_stream_data(s, 0, 1);
+            }
+            if (clipboard_c2s_stream_start(s, total_length))
+            {
+                clipboard_c2s_stream_data(s, length - 8, 0);
+                XFlush(g_display);
+                return 0;
+            }
             init_stream(g_ins, total_length);
         }
 
@@ -1750,6 +1916,7 @@ clipboard_event_selection_notify(XEvent *xevent)
             g_clip_s2c.property = lxevent->property;
             g_clip_s2c.type = lxevent->target;
             g_clip_s2c.total_bytes = 0;
+            g_clip_s2c.alloc_bytes = 0;
             g_free(g_clip_s2c.data);
             g_clip_s2c.data = 0;
             //LOG_DEVEL_HEXDUMP(LOG_LEVEL_TRACE, "", data, sizeof(long));
@@ -2363,6 +2530,40 @@ clipboard_event_selection_clear(XEvent *xevent)
     return 0;
 }
 
+/*****************************************************************************/
+/* makes room for another bytes of INCR data at the end of g_clip_s2c.data.
+   The buffer grows geometrically, so that a large transfer isn't copied
+   again for every chunk
+   returns error */
+static int
+clipboard_s2c_reserve(int bytes)
+{
+    char *data;
+    int alloc_bytes;
+
+    if (bytes < 0 || bytes > INT_MAX - g_clip_s2c.total_bytes)
+    {
+        return 1;
+    }
+    if (g_clip_s2c.total_bytes + bytes <= g_clip_s2c.alloc_bytes)
+    {
+        return 0;
+    }
+    alloc_bytes = MAX(g_clip_s2c.alloc_bytes, 64 * 1024);
+    while (alloc_bytes < g_clip_s2c.total_bytes + bytes)
+    {
+        alloc_bytes = (alloc_bytes > INT_MAX / 2) ? INT_MAX : alloc_bytes * 2;
+    }
+    data = (char *)realloc(g_clip_s2c.data, alloc_bytes);
+    if (data == NULL)
+    {
+        return 1;
+    }
+    g_clip_s2c.data = data;
+    g_clip_s2c.alloc_bytes = alloc_bytes;
+    return 0;
+}
+
 /*****************************************************************************/
 /* returns error
    typedef struct {
@@ -2386,8 +2587,6 @@ clipboard_event_property_notify(XEvent *xevent)
     int rv;
     int format_in_bytes;
     int new_data_len;
-    int data_bytes;
-    char *cptr;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: PropertyNotify .window %ld "
               ".state %d .atom %ld %s", xevent->xproperty.window,
@@ -2408,32 +2607,7 @@ clipboard_event_property_notify(XEvent *xevent)
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR error");
             return 0;
         }
-        data = (tui8 *)(g_clip_c2s.data + g_clip_c2s.incr_bytes_done);
-        data_bytes = g_clip_c2s.read_bytes_done - g_clip_c2s.incr_bytes_done;
-        if ((data_bytes < 1) &&
-                (g_clip_c2s.read_bytes_done < g_clip_c2s.total_bytes))
-        {
-            g_clip_c2s.incr_in_progress = 0;
-            return 0;
-        }
-        if (data_bytes > g_incr_max_req_size)
-        {
-            data_bytes = g_incr_max_req_size;
-        }
-        g_clip_c2s.incr_bytes_done += data_bytes;
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: data_bytes %d", data_bytes);
-        XChangeProperty(xevent->xproperty.display, xevent->xproperty.window,
-                        xevent->xproperty.atom, g_clip_c2s.type, 8,
-                        PropModeReplace, data, data_bytes);
-        if (data_bytes < 1)
-        {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: INCR done");
-            g_clip_c2s.incr_in_progress = 0;
-            /* we no longer need property notify */
-            XSelectInput(xevent->xproperty.display, xevent->xproperty.window,
-                         NoEventMask);
-            g_clip_c2s.converted = 1;
-        }
+        clipboard_c2s_incr_send_next();
     }
     if (g_clip_s2c.incr_in_progress &&
             (xevent->xproperty.window == g_wnd) &&
@@ -2500,12 +2674,13 @@ clipboard_event_property_notify(XEvent *xevent)
 
             format_in_bytes = FORMAT_TO_BYTES(actual_format_return);
             new_data_len = nitems_returned * format_in_bytes;
-            cptr = (char *) g_malloc(g_clip_s2c.total_bytes + new_data_len, 0);
-            if (cptr == NULL)
+            if (clipboard_s2c_reserve(new_data_len) != 0)
             {
                 /* cannot add any more data */
                 g_free(g_clip_s2c.data);
                 g_clip_s2c.data = 0;
+                g_clip_s2c.alloc_bytes = 0;
+                g_clip_s2c.total_bytes = 0;
 
                 if (data != 0)
                 {
@@ -2515,11 +2690,8 @@ clipboard_event_property_notify(XEvent *xevent)
                 XDeleteProperty(g_display, g_wnd, g_clip_s2c.property);
                 return 0;
             }
-            g_memcpy(cptr, g_clip_s2c.data, g_clip_s2c.total_bytes);
-            g_free(g_clip_s2c.data);
 
             LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_event_property_notify: new_data_len %d", new_data_len);
-            g_clip_s2c.data = cptr;
             if (data)
             {
                 g_memcpy(g_clip_s2c.data + g_clip_s2c.total_bytes, data, new_data_len);
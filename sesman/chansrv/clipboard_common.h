@@ -31,6 +31,7 @@ struct clip_s2c /* server to client, pasting from linux app to mstsc */
 {
     int incr_in_progress;
     int total_bytes;
+    int alloc_bytes; /* size of data while an INCR transfer is received */
     char *data;
     Atom type; /* UTF8_STRING, image/bmp, ... */
     Atom property; /* XRDP_CLIP_PROPERTY_ATOM, _QT_SELECTION, ... */
@@ -42,8 +43,10 @@ struct clip_s2c /* server to client, pasting from linux app to mstsc */
 struct clip_c2s /* client to server, pasting from mstsc to linux app */
 {
     int incr_in_progress;
+    int incr_waiting; /* INCR requestor is waiting for data from the client */
     int incr_bytes_done;
     int read_bytes_done;
+    int streaming; /* data response is still arriving from the client */
     int total_bytes;
     char *data;
     Atom type; /* UTF8_STRING, image/bmp, ... */
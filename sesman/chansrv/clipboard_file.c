@@ -37,6 +37,7 @@
 #include "string_calls.h"
 #include "list.h"
 #include "chansrv.h"
+#include "chansrv_config.h"
 #include "clipboard.h"
 #include "clipboard_file.h"
 #include "clipboard_common.h"
@@ -51,6 +52,8 @@ extern struct clip_c2s g_clip_c2s; /* in clipboard.c */
 
 extern char g_fuse_clipboard_path[];
 
+extern struct config_chansrv *g_cfg; /* in chansrv.c */
+
 struct cb_file_info
 {
     char *pathname;
@@ -65,6 +68,33 @@ static struct list *g_files_list = 0;
 /* used when server is asking for file info from the client */
 static int g_file_request_sent_type = 0;
 
+/* Files copied from the client are read in chunks of this size. A FUSE
+   read is satisfied from the chunks which cover it, and the chunks which
+   follow are requested ahead of time */
+#define CB_FILE_CHUNK_SIZE (64 * 1024)
+
+enum cb_chunk_state
+{
+    CB_CHUNK_REQUESTED,
+    CB_CHUNK_RECEIVED,
+    CB_CHUNK_FAILED
+};
+
+struct cb_file_chunk
+{
+    int stream_id; /* streamId of the CLIPRDR_FILECONTENTS_REQUEST */
+    int lindex;
+    tui64 offset;
+    int bytes; /* bytes requested, then bytes received */
+    enum cb_chunk_state state;
+    char *data;
+};
+
+/* requested and received chunks, oldest first */
+static struct list *g_file_chunks = 0;
+static int g_file_chunks_requested = 0;
+static int g_file_chunk_stream_id = 0;
+
 /* number of seconds from 1 Jan. 1601 00:00 to 1 Jan 1970 00:00 UTC */
 #define CB_EPOCH_DIFF 11644473600LL
 
@@ -568,23 +598,19 @@ clipboard_send_file_data(int streamId, int lindex,
 }
 
 /*****************************************************************************/
-/* ask the client to send the file size */
-int
-clipboard_request_file_data(int stream_id, int lindex, int offset,
+/* ask the client to send part of a file */
+static int
+clipboard_request_file_data(int stream_id, int lindex, tui64 offset,
                             int request_bytes)
 {
     struct stream *s;
     int size;
     int rv;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_request_file_data: stream_id=%d lindex=%d off=%d request_bytes=%d",
-              stream_id, lindex, offset, request_bytes);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_request_file_data: stream_id=%d "
+              "lindex=%d off=%llu request_bytes=%d", stream_id, lindex,
+              (unsigned long long)offset, request_bytes);
 
-    if (g_file_request_sent_type != 0)
-    {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_request_file_data: warning, still waiting "
-                  "for CB_FILECONTENTS_RESPONSE");
-    }
     make_stream(s);
     init_stream(s, 8192);
     out_uint16_le(s, CB_FILECONTENTS_REQUEST); /* 8 */
@@ -593,8 +619,8 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     out_uint32_le(s, stream_id);
     out_uint32_le(s, lindex);
     out_uint32_le(s, CB_FILECONTENTS_RANGE);
-    out_uint32_le(s, offset); /* nPositionLow */
-    out_uint32_le(s, 0); /* nPositionHigh */
+    out_uint32_le(s, offset & 0xffffffff); /* nPositionLow */
+    out_uint32_le(s, offset >> 32); /* nPositionHigh */
     out_uint32_le(s, request_bytes); /* cbRequested */
     out_uint32_le(s, 0); /* clipDataId */
     out_uint32_le(s, 0);
@@ -602,10 +628,262 @@ clipboard_request_file_data(int stream_id, int lindex, int offset,
     size = (int)(s->end - s->data);
     rv = send_channel_data(g_cliprdr_chan_id, s->data, size);
     free_stream(s);
-    g_file_request_sent_type = CB_FILECONTENTS_RANGE;
     return rv;
 }
 
+/*****************************************************************************/
+static void
+clipboard_file_chunk_delete(struct cb_file_chunk *chunk)
+{
+    if (chunk != NULL)
+    {
+        if (chunk->state == CB_CHUNK_REQUESTED)
+        {
+            --g_file_chunks_requested;
+        }
+        g_free(chunk->data);
+        g_free(chunk);
+    }
+}
+
+/*****************************************************************************/
+/* returns the chunk of a file which starts at offset, or NULL */
+static struct cb_file_chunk *
+clipboard_file_chunk_find(int lindex, tui64 offset)
+{
+    struct cb_file_chunk *chunk;
+    int index;
+
+    for (index = 0; index < g_file_chunks->count; ++index)
+    {
+        chunk = (struct cb_file_chunk *)list_get_item(g_file_chunks, index);
+        if (chunk->lindex == lindex && chunk->offset == offset)
+        {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/* frees the oldest received chunk which is outside the range being read */
+static void
+clipboard_file_chunk_evict(int lindex, tui64 first, tui64 last)
+{
+    struct cb_file_chunk *chunk;
+    int index;
+
+    for (index = 0; index < g_file_chunks->count; ++index)
+    {
+        chunk = (struct cb_file_chunk *)list_get_item(g_file_chunks, index);
+        if (chunk->state != CB_CHUNK_REQUESTED &&
+                (chunk->lindex != lindex ||
+                 chunk->offset < first || chunk->offset > last))
+        {
+            list_remove_item(g_file_chunks, index);
+            clipboard_file_chunk_delete(chunk);
+            return;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* requests a chunk of a file from the client, unless we already have it
+   returns error */
+static int
+clipboard_file_chunk_request(int lindex, tui64 file_size, tui64 offset,
+                             tui64 first, tui64 last)
+{
+    struct cb_file_chunk *chunk;
+
+    if (clipboard_file_chunk_find(lindex, offset) != NULL)
+    {
+        return 0;
+    }
+    /* Keep the received chunks to a couple of windows' worth */
+    if (g_file_chunks->count >= 2 * g_cfg->clipboard_file_window + 2)
+    {
+        clipboard_file_chunk_evict(lindex, first, last);
+    }
+    chunk = g_new0(struct cb_file_chunk, 1);
+    if (chunk == NULL)
+    {
+        return 1;
+    }
+    if (++g_file_chunk_stream_id <= 0)
+    {
+        g_file_chunk_stream_id = 1;
+    }
+    chunk->stream_id = g_file_chunk_stream_id;
+    chunk->lindex = lindex;
+    chunk->offset = offset;
+    chunk->bytes = MIN(file_size - offset, CB_FILE_CHUNK_SIZE);
+    chunk->state = CB_CHUNK_REQUESTED;
+    if (!list_add_item(g_file_chunks, (tintptr)chunk))
+    {
+        g_free(chunk);
+        return 1;
+    }
+    ++g_file_chunks_requested;
+    return clipboard_request_file_data(chunk->stream_id, lindex, offset,
+                                       chunk->bytes);
+}
+
+/*****************************************************************************/
+int
+clipboard_file_read(int lindex, tui64 file_size, tui64 offset, int bytes,
+                    char *buf)
+{
+    struct cb_file_chunk *chunk;
+    tui64 first;
+    tui64 last;
+    tui64 pos;
+    int copied;
+    int len;
+
+    if (offset >= file_size || bytes < 1)
+    {
+        return 0;
+    }
+    if (bytes > file_size - offset)
+    {
+        bytes = file_size - offset;
+    }
+    if (g_file_chunks == NULL && (g_file_chunks = list_create()) == NULL)
+    {
+        return -1;
+    }
+    first = offset - offset % CB_FILE_CHUNK_SIZE;
+    last = (offset + bytes - 1) - (offset + bytes - 1) % CB_FILE_CHUNK_SIZE;
+
+    /* The chunks for this read are always requested. After that, chunks
+     * are read ahead while the window has room */
+    for (pos = first; pos <= last; pos += CB_FILE_CHUNK_SIZE)
+    {
+        if (clipboard_file_chunk_request(lindex, file_size, pos,
+                                         first, last) != 0)
+        {
+            return -1;
+        }
+    }
+    for (pos = last + CB_FILE_CHUNK_SIZE;
+            pos < file_size &&
+            g_file_chunks_requested < g_cfg->clipboard_file_window &&
+            pos <= last + (tui64)g_cfg->clipboard_file_window *
+            CB_FILE_CHUNK_SIZE;
+            pos += CB_FILE_CHUNK_SIZE)
+    {
+        if (clipboard_file_chunk_request(lindex, file_size, pos,
+                                         first, last) != 0)
+        {
+            break;
+        }
+    }
+
+    /* Copy the data out, if it's all here */
+    for (pos = first; pos <= last; pos += CB_FILE_CHUNK_SIZE)
+    {
+        chunk = clipboard_file_chunk_find(lindex, pos);
+        if (chunk == NULL || chunk->state == CB_CHUNK_FAILED)
+        {
+            return -1;
+        }
+        if (chunk->state == CB_CHUNK_REQUESTED)
+        {
+            return CB_FILE_READ_PENDING;
+        }
+    }
+    copied = 0;
+    for (pos = first; pos <= last; pos += CB_FILE_CHUNK_SIZE)
+    {
+        chunk = clipboard_file_chunk_find(lindex, pos);
+        len = chunk->bytes - (int)(offset + copied - pos);
+        if (len > bytes - copied)
+        {
+            len = bytes - copied;
+        }
+        if (len <= 0)
+        {
+            break; /* short chunk - the client's file is smaller */
+        }
+        g_memcpy(buf + copied, chunk->data + (offset + copied - pos), len);
+        copied += len;
+        if (chunk->bytes < CB_FILE_CHUNK_SIZE)
+        {
+            break;
+        }
+    }
+    return copied;
+}
+
+/*****************************************************************************/
+void
+clipboard_file_clear_chunks(void)
+{
+    int index;
+
+    if (g_file_chunks != NULL)
+    {
+        for (index = 0; index < g_file_chunks->count; ++index)
+        {
+            clipboard_file_chunk_delete((struct cb_file_chunk *)
+                                        list_get_item(g_file_chunks, index));
+        }
+        list_delete(g_file_chunks);
+        g_file_chunks = NULL;
+    }
+}
+
+/*****************************************************************************/
+/* stores a CLIPRDR_FILECONTENTS_RESPONSE for a chunk of a file
+   returns 0 if the response isn't for a chunk we asked for */
+static int
+clipboard_file_chunk_response(struct stream *s, int clip_msg_status,
+                              int stream_id, int data_bytes)
+{
+    struct cb_file_chunk *chunk = NULL;
+    int index;
+
+    for (index = 0; g_file_chunks != NULL && index < g_file_chunks->count;
+            ++index)
+    {
+        chunk = (struct cb_file_chunk *)list_get_item(g_file_chunks, index);
+        if (chunk->stream_id == stream_id &&
+                chunk->state == CB_CHUNK_REQUESTED)
+        {
+            break;
+        }
+        chunk = NULL;
+    }
+    if (chunk == NULL)
+    {
+        return 0;
+    }
+
+    --g_file_chunks_requested;
+    if (data_bytes > chunk->bytes)
+    {
+        data_bytes = chunk->bytes;
+    }
+    if ((clip_msg_status & CB_RESPONSE_OK) == 0 || data_bytes < 0 ||
+            !s_check_rem(s, data_bytes) ||
+            (chunk->data = (char *)g_malloc(MAX(data_bytes, 1), 0)) == NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "Can't get clipboard file %d offset %llu "
+            "from the client", chunk->lindex,
+            (unsigned long long)chunk->offset);
+        chunk->state = CB_CHUNK_FAILED;
+    }
+    else
+    {
+        in_uint8a(s, chunk->data, data_bytes);
+        chunk->bytes = data_bytes;
+        chunk->state = CB_CHUNK_RECEIVED;
+    }
+    xfuse_file_contents_ready();
+    return 1;
+}
+
 
 /*****************************************************************************/
 /* client is asking from info about a file */
@@ -651,21 +929,24 @@ clipboard_process_file_response(struct stream *s, int clip_msg_status,
     int file_size;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_file_response:");
-    if (g_file_request_sent_type == CB_FILECONTENTS_SIZE)
+    if (!s_check_rem(s, 4))
+    {
+        return 0;
+    }
+    in_uint32_le(s, streamId);
+    if (clipboard_file_chunk_response(s, clip_msg_status, streamId,
+                                      clip_msg_len - 4))
+    {
+        /* range response, already dealt with */
+    }
+    else if (g_file_request_sent_type == CB_FILECONTENTS_SIZE)
     {
         g_file_request_sent_type = 0;
-        in_uint32_le(s, streamId);
         in_uint32_le(s, file_size);
         LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_process_file_response: streamId %d "
                   "file_size %d", streamId, file_size);
         xfuse_file_contents_size(streamId, file_size);
     }
-    else if (g_file_request_sent_type == CB_FILECONTENTS_RANGE)
-    {
-        g_file_request_sent_type = 0;
-        in_uint32_le(s, streamId);
-        xfuse_file_contents_range(streamId, s->p, clip_msg_len - 4);
-    }
     else
     {
         LOG_DEVEL(LOG_LEVEL_ERROR, "clipboard_process_file_response: error");
@@ -749,6 +1030,7 @@ clipboard_c2s_in_files(struct stream *s, char *file_list, int file_list_size,
         return 1;
     }
     xfuse_clear_clip_dir();
+    clipboard_file_clear_chunks();
     LOG_DEVEL(LOG_LEVEL_DEBUG, "clipboard_c2s_in_files: cItems %d", citems);
     ptr = file_list;
     last = file_list + file_list_size - 1;
@@ -787,7 +1069,9 @@ clipboard_c2s_in_files(struct stream *s, char *file_list, int file_list_size,
             continue;
         }
 
-        if (xfuse_add_clip_dir_item(cfd.cFileName, 0, cfd.fileSizeLow, lindex) == -1)
+        if (xfuse_add_clip_dir_item(cfd.cFileName, 0,
+                                    ((tui64)cfd.fileSizeHigh << 32) |
+                                    cfd.fileSizeLow, lindex) == -1)
         {
             LOG(LOG_LEVEL_WARNING, "clipboard_c2s_in_files: "
                 "failed to add clip dir item %s", cfd.cFileName);
@@ -54,8 +54,33 @@ clipboard_c2s_in_files(struct stream *s, char *file_list, int file_list_size,
 int
 clipboard_request_file_size(int stream_id, int lindex);
 
+/* returned by clipboard_file_read() while chunks are still arriving */
+#define CB_FILE_READ_PENDING -2
+
+/**
+ * Reads part of a file which is being copied from the client
+ *
+ * The chunks of the file which cover the read are requested from the
+ * client if we haven't got them, along with the chunks which follow, up
+ * to the ClipboardFileWindow setting. Call again after
+ * xfuse_file_contents_ready() to see if the data has arrived.
+ *
+ * @param lindex Index of the file in the client's file list
+ * @param file_size Size of the file
+ * @param offset Offset of the read
+ * @param bytes Bytes to read
+ * @param buf Output buffer, with room for 'bytes' bytes
+ *
+ * @return Bytes read, CB_FILE_READ_PENDING, or -1 for an error
+ */
 int
-clipboard_request_file_data(int stream_id, int lindex, int offset,
-                            int request_bytes);
+clipboard_file_read(int lindex, tui64 file_size, tui64 offset, int bytes,
+                    char *buf);
+
+/**
+ * Discards the chunks read from the client's files
+ */
+void
+clipboard_file_clear_chunks(void);
 
 #endif
@@ -25,13 +25,85 @@
 #include <config_ac.h>
 #endif
 
+#include <stddef.h>
+
 #include "chansrv.h"
 #include "parse.h"
 #include "os_calls.h"
 #include "string_calls.h"
 #include "irp.h"
 
+/* Number of hash buckets for each lookup table. Must be a power of 2.
+ * Completion IDs are allocated in sequence, and clients generally
+ * allocate FileIds in sequence too, so the chains stay short */
+#define IRP_HASH_SIZE 256
+#define IRP_HASH(id) ((id) & (IRP_HASH_SIZE - 1))
+
 IRP *g_irp_head = NULL;
+static IRP *g_irp_tail = NULL;
+static IRP *g_irp_by_completion_id[IRP_HASH_SIZE];
+static IRP *g_irp_by_file_id[IRP_HASH_SIZE];
+static unsigned int g_irp_count = 0;
+static unsigned int g_irp_max_count = 0;
+
+/*****************************************************************************/
+/* adds an IRP to the end of a hash chain, so the oldest IRP with a key
+ * is found first, as it is in the linked list */
+static void
+hash_add(IRP **table, tui32 key, IRP *irp, size_t next_offset)
+{
+    IRP **pp = &table[IRP_HASH(key)];
+
+    while (*pp != NULL)
+    {
+        pp = (IRP **)((char *)*pp + next_offset);
+    }
+    *pp = irp;
+    *(IRP **)((char *)irp + next_offset) = NULL;
+}
+
+/*****************************************************************************/
+static void
+hash_remove(IRP **table, tui32 key, IRP *irp, size_t next_offset)
+{
+    IRP **pp = &table[IRP_HASH(key)];
+
+    while (*pp != NULL)
+    {
+        if (*pp == irp)
+        {
+            *pp = *(IRP **)((char *)irp + next_offset);
+            break;
+        }
+        pp = (IRP **)((char *)*pp + next_offset);
+    }
+}
+
+#define CID_NEXT offsetof(IRP, completion_id_next)
+#define FID_NEXT offsetof(IRP, file_id_next)
+
+/*****************************************************************************/
+/* appends a new IRP to the linked list */
+static void
+irp_append(IRP *irp)
+{
+    if (g_irp_tail == NULL)
+    {
+        /* list is empty, this is the first entry */
+        g_irp_head = irp;
+    }
+    else
+    {
+        g_irp_tail->next = irp;
+        irp->prev = g_irp_tail;
+    }
+    g_irp_tail = irp;
+
+    if (++g_irp_count > g_irp_max_count)
+    {
+        g_irp_max_count = g_irp_count;
+    }
+}
 
 /**
  * Create a new IRP and append to linked list
@@ -42,7 +114,6 @@ IRP *g_irp_head = NULL;
 IRP *devredir_irp_new(void)
 {
     IRP *irp;
-    IRP *irp_last;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entered");
 
@@ -54,17 +125,7 @@ IRP *devredir_irp_new(void)
         return NULL;
     }
 
-    /* insert at end of linked list */
-    if ((irp_last = devredir_irp_get_last()) == NULL)
-    {
-        /* list is empty, this is the first entry */
-        g_irp_head = irp;
-    }
-    else
-    {
-        irp_last->next = irp;
-        irp->prev = irp_last;
-    }
+    irp_append(irp);
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "new IRP=%p", irp);
     return irp;
@@ -104,7 +165,6 @@ IRP *devredir_irp_with_pathname_new(const char *pathname)
 IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
 {
     IRP *irp;
-    IRP *irp_last;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "entered");
 
@@ -118,20 +178,46 @@ IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
 
     irp->pathname = (char *)irp + sizeof(IRP); /* Initialise pathname pointer */
 
-    /* insert at end of linked list */
-    if ((irp_last = devredir_irp_get_last()) == NULL)
+    irp_append(irp);
+
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "new IRP=%p", irp);
+    return irp;
+}
+
+/**
+ * Set the CompletionId of an IRP, so it can be found with
+ * devredir_irp_find()
+ *****************************************************************************/
+
+void devredir_irp_set_completion_id(IRP *irp, tui32 completion_id)
+{
+    if (irp->CompletionId != 0)
     {
-        /* list is empty, this is the first entry */
-        g_irp_head = irp;
+        hash_remove(g_irp_by_completion_id, irp->CompletionId, irp, CID_NEXT);
     }
-    else
+    irp->CompletionId = completion_id;
+    if (completion_id != 0)
     {
-        irp_last->next = irp;
-        irp->prev = irp_last;
+        hash_add(g_irp_by_completion_id, completion_id, irp, CID_NEXT);
     }
+}
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "new IRP=%p", irp);
-    return irp;
+/**
+ * Set the FileId of an IRP, so it can be found with
+ * devredir_irp_find_by_fileid()
+ *****************************************************************************/
+
+void devredir_irp_set_file_id(IRP *irp, tui32 FileId)
+{
+    if (irp->FileId != 0)
+    {
+        hash_remove(g_irp_by_file_id, irp->FileId, irp, FID_NEXT);
+    }
+    irp->FileId = FileId;
+    if (FileId != 0)
+    {
+        hash_add(g_irp_by_file_id, FileId, irp, FID_NEXT);
+    }
 }
 
 /**
@@ -142,63 +228,46 @@ IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen)
 
 int devredir_irp_delete(IRP *irp)
 {
-    IRP *lirp = g_irp_head;
-
-    if ((irp == NULL) || (lirp == NULL))
+    if (irp == NULL || (irp->prev == NULL && irp != g_irp_head))
     {
-        return -1;
+        return -1;    /* not in the list */
     }
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "irp=%p completion_id=%d type=%d",
               irp, irp->CompletionId, irp->completion_type);
 
-    devredir_irp_dump(); // LK_TODO
-
-    while (lirp)
+    if (irp->CompletionId != 0)
     {
-        if (lirp == irp)
-        {
-            break;
-        }
-
-        lirp = lirp->next;
+        hash_remove(g_irp_by_completion_id, irp->CompletionId, irp, CID_NEXT);
     }
-
-    if (lirp == NULL)
+    if (irp->FileId != 0)
     {
-        return -1;    /* did not find specified irp */
+        hash_remove(g_irp_by_file_id, irp->FileId, irp, FID_NEXT);
     }
 
-    if (lirp->prev == NULL)
+    if (irp->prev == NULL)
     {
         /* we are at head of linked list */
-        if (lirp->next == NULL)
-        {
-            /* only one element in list */
-            g_free(lirp);
-            g_irp_head = NULL;
-            devredir_irp_dump(); // LK_TODO
-            return 0;
-        }
-
-        lirp->next->prev = NULL;
-        g_irp_head = lirp->next;
-        g_free(lirp);
+        g_irp_head = irp->next;
     }
-    else if (lirp->next == NULL)
+    else
+    {
+        irp->prev->next = irp->next;
+    }
+
+    if (irp->next == NULL)
     {
         /* we are at tail of linked list */
-        lirp->prev->next = NULL;
-        g_free(lirp);
+        g_irp_tail = irp->prev;
     }
     else
     {
-        /* we are in between */
-        lirp->prev->next = lirp->next;
-        lirp->next->prev = lirp->prev;
-        g_free(lirp);
+        irp->next->prev = irp->prev;
     }
 
+    --g_irp_count;
+    g_free(irp);
+
     devredir_irp_dump(); // LK_TODO
 
     return 0;
@@ -210,40 +279,58 @@ int devredir_irp_delete(IRP *irp)
 
 IRP *devredir_irp_find(tui32 completion_id)
 {
-    IRP *irp = g_irp_head;
+    IRP *irp;
 
-    while (irp)
+    if (completion_id == 0)
     {
-        if (irp->CompletionId == completion_id)
+        /* Not hashed - look for one which hasn't been given an ID yet */
+        for (irp = g_irp_head; irp != NULL; irp = irp->next)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-            return irp;
+            if (irp->CompletionId == 0)
+            {
+                break;
+            }
+        }
+    }
+    else
+    {
+        irp = g_irp_by_completion_id[IRP_HASH(completion_id)];
+        while (irp != NULL && irp->CompletionId != completion_id)
+        {
+            irp = irp->completion_id_next;
         }
-
-        irp = irp->next;
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=NULL");
-    return NULL;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
+    return irp;
 }
 
 IRP *devredir_irp_find_by_fileid(tui32 FileId)
 {
-    IRP *irp = g_irp_head;
+    IRP *irp;
 
-    while (irp)
+    if (FileId == 0)
     {
-        if (irp->FileId == FileId)
+        /* Not hashed */
+        for (irp = g_irp_head; irp != NULL; irp = irp->next)
         {
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-            return irp;
+            if (irp->FileId == 0)
+            {
+                break;
+            }
+        }
+    }
+    else
+    {
+        irp = g_irp_by_file_id[IRP_HASH(FileId)];
+        while (irp != NULL && irp->FileId != FileId)
+        {
+            irp = irp->file_id_next;
         }
-
-        irp = irp->next;
     }
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=NULL");
-    return NULL;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
+    return irp;
 }
 
 /**
@@ -252,27 +339,31 @@ IRP *devredir_irp_find_by_fileid(tui32 FileId)
 
 IRP *devredir_irp_get_last(void)
 {
-    IRP *irp = g_irp_head;
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", g_irp_tail);
+    return g_irp_tail;
+}
 
-    while (irp)
-    {
-        if (irp->next == NULL)
-        {
-            break;
-        }
+/**
+ * Return the number of outstanding IRPs, and optionally the most
+ * there have been at once
+ *****************************************************************************/
 
-        irp = irp->next;
+unsigned int devredir_irp_get_count(unsigned int *max_count)
+{
+    if (max_count != NULL)
+    {
+        *max_count = g_irp_max_count;
     }
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "returning irp=%p", irp);
-    return irp;
+    return g_irp_count;
 }
 
 void devredir_irp_dump(void)
 {
+#ifdef USE_DEVEL_LOGGING
     IRP *irp = g_irp_head;
 
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "------- dumping IRPs --------");
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "------- dumping %u IRPs (max %u) --------",
+              g_irp_count, g_irp_max_count);
     while (irp)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "        completion_id=%d\tcompletion_type=%d\tFileId=%d",
@@ -281,4 +372,5 @@ void devredir_irp_dump(void)
         irp = irp->next;
     }
     LOG_DEVEL(LOG_LEVEL_DEBUG, "------- dumping IRPs done ---");
+#endif
 }
@@ -98,6 +98,8 @@ struct irp
     void      *fuse_info;           /* Fuse info pointer for FUSE calls  */
     IRP       *next;                /* point to next IRP                 */
     IRP       *prev;                /* point to previous IRP             */
+    IRP       *completion_id_next;  /* hash chain, private to irp.c      */
+    IRP       *file_id_next;        /* hash chain, private to irp.c      */
     int        scard_index;         /* used to smart card to locate dev  */
 
     void     (*callback)(struct stream *s, IRP *irp, tui32 DeviceId,
@@ -114,9 +116,16 @@ IRP *devredir_irp_with_pathname_new(const char *pathname);
  * significantly */
 IRP *devredir_irp_with_pathnamelen_new(unsigned int pathnamelen);
 int   devredir_irp_delete(IRP *irp);
+/* Use these rather than setting CompletionId and FileId directly, or
+ * the IRP can't be found by devredir_irp_find() and
+ * devredir_irp_find_by_fileid() */
+void  devredir_irp_set_completion_id(IRP *irp, tui32 completion_id);
+void  devredir_irp_set_file_id(IRP *irp, tui32 FileId);
 IRP *devredir_irp_find(tui32 completion_id);
 IRP *devredir_irp_find_by_fileid(tui32 FileId);
 IRP *devredir_irp_get_last(void);
+/* Number of outstanding IRPs, and optionally the most there have been */
+unsigned int devredir_irp_get_count(unsigned int *max_count);
 void  devredir_irp_dump(void);
 
 #endif /* end ifndef __IRP_H */
@@ -59,8 +59,6 @@ extern Atom g_utf8_string;           /* in xcommon.c */
 extern Atom g_net_wm_name;           /* in xcommon.c */
 extern Atom g_wm_state;              /* in xcommon.c */
 
-static Atom g_rwd_atom = 0;
-
 int g_rail_up = 0;
 
 /* for rail_is_another_wm_running */
@@ -95,6 +93,42 @@ struct rail_window_data
     int title_crc; /* crc of title for compare */
 };
 
+/* used in flags field of struct rail_window */
+#define RW_HAVE_RWD         (1 << 0) /* rwd has been set */
+#define RW_SELECTED         (1 << 1) /* rail_select_input() has been called */
+#define RW_TRANSIENT_VALID  (1 << 2) /* transient_for is current */
+#define RW_TITLE_STALE      (1 << 3) /* title may have changed since sent */
+
+/*
+ * What we know about a window. This is kept up to date from the
+ * structure and property events we get for it, so handling an event
+ * doesn't need a round trip to the X server.
+ */
+struct rail_window
+{
+    Window window_id;
+    Window parent;
+    int x;
+    int y;
+    int width;
+    int height;
+    int border_width;
+    int override_redirect;
+    int map_state; /* IsUnmapped or IsViewable */
+    Window transient_for;
+    int flags; /* RW_* bits */
+    struct rail_window_data rwd; /* what the client was last sent */
+    struct rail_window *next; /* hash chain */
+};
+
+/* Number of hash buckets for the window table. Must be a power of 2. */
+#define RAIL_WINDOW_HASH_SIZE 256
+#define RAIL_WINDOW_HASH(id) ((id) & (RAIL_WINDOW_HASH_SIZE - 1))
+
+static struct rail_window *g_rail_windows[RAIL_WINDOW_HASH_SIZE];
+/* set when a mapped window's title has changed */
+static int g_titles_stale = 0;
+
 /* Indicates a Client Execute PDU from client to server. */
 #define TS_RAIL_ORDER_EXEC 0x0001
 /* Indicates a Client Activate PDU from client to server. */
@@ -161,7 +195,6 @@ struct rail_window_data
 #define RAIL_STYLE_DIALOG (0x80000000)
 #define RAIL_EXT_STYLE_DIALOG (0x00040000)
 
-static int rail_win_get_state(Window win);
 static int rail_create_window(Window window_id, Window owner_id);
 static int rail_win_set_state(Window win, unsigned long state);
 static int rail_show_window(Window window_id, int show_state);
@@ -186,94 +219,164 @@ rail_send_key_esc(int window_id)
 }
 
 /*****************************************************************************/
-static struct rail_window_data *
-rail_get_window_data(Window window)
+static struct rail_window *
+rail_window_find(Window window_id)
 {
-    unsigned int bytes;
-    Atom actual_type_return;
-    int actual_format_return;
-    unsigned long nitems_return;
-    unsigned long bytes_after_return;
-    unsigned char *prop_return;
-    struct rail_window_data *rv;
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_get_window_data:");
-    rv = 0;
-    actual_type_return = 0;
-    actual_format_return = 0;
-    nitems_return = 0;
-    prop_return = 0;
-    bytes = sizeof(struct rail_window_data);
-    XGetWindowProperty(g_display, window, g_rwd_atom, 0, bytes, 0,
-                       XA_STRING, &actual_type_return,
-                       &actual_format_return, &nitems_return,
-                       &bytes_after_return, &prop_return);
-    if (prop_return == 0)
+    struct rail_window *rw;
+
+    rw = g_rail_windows[RAIL_WINDOW_HASH(window_id)];
+    while (rw != NULL && rw->window_id != window_id)
     {
-        return 0;
+        rw = rw->next;
     }
-    if (nitems_return == bytes)
+    return rw;
+}
+
+/*****************************************************************************/
+/* adds a window to the table, or clears its entry if it's already there */
+static struct rail_window *
+rail_window_add(Window window_id, Window parent)
+{
+    struct rail_window *rw;
+    struct rail_window *next;
+
+    rw = rail_window_find(window_id);
+    if (rw != NULL)
     {
-        rv = (struct rail_window_data *)prop_return;
+        next = rw->next;
     }
-    return rv;
+    else
+    {
+        rw = g_new(struct rail_window, 1);
+        if (rw == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "rail_window_add: out of memory");
+            return NULL;
+        }
+        next = g_rail_windows[RAIL_WINDOW_HASH(window_id)];
+        g_rail_windows[RAIL_WINDOW_HASH(window_id)] = rw;
+    }
+    g_memset(rw, 0, sizeof(struct rail_window));
+    rw->window_id = window_id;
+    rw->parent = parent;
+    rw->map_state = IsUnmapped;
+    rw->next = next;
+    return rw;
 }
 
 /*****************************************************************************/
-static int
-rail_set_window_data(Window window, struct rail_window_data *rwd)
+static void
+rail_window_remove(Window window_id)
 {
-    int bytes;
+    struct rail_window **prw;
+    struct rail_window *rw;
 
-    bytes = sizeof(struct rail_window_data);
-    XChangeProperty(g_display, window, g_rwd_atom, XA_STRING, 8,
-                    PropModeReplace, (unsigned char *)rwd, bytes);
-    return 0;
+    prw = &g_rail_windows[RAIL_WINDOW_HASH(window_id)];
+    while ((rw = *prw) != NULL)
+    {
+        if (rw->window_id == window_id)
+        {
+            *prw = rw->next;
+            g_free(rw);
+            return;
+        }
+        prw = &rw->next;
+    }
 }
 
 /*****************************************************************************/
-/* get the rail window data, if not exist, try to create it and return */
-static struct rail_window_data *
-rail_get_window_data_safe(Window window)
+static void
+rail_window_remove_all(void)
 {
-    struct rail_window_data *rv;
+    struct rail_window *rw;
+    int index;
 
-    rv = rail_get_window_data(window);
-    if (rv != 0)
+    for (index = 0; index < RAIL_WINDOW_HASH_SIZE; index++)
     {
-        return rv;
+        while ((rw = g_rail_windows[index]) != NULL)
+        {
+            g_rail_windows[index] = rw->next;
+            g_free(rw);
+        }
     }
-    rv = g_new0(struct rail_window_data, 1);
-    rail_set_window_data(window, rv);
-    g_free(rv);
-    return rail_get_window_data(window);
 }
 
-/******************************************************************************/
-static int
-is_window_valid_child_of_root(unsigned int window_id)
+/*****************************************************************************/
+static void
+rail_window_set_geometry(struct rail_window *rw, int x, int y,
+                         int width, int height, int border_width)
 {
-    int found;
-    unsigned int i;
-    unsigned int nchild;
-    Window r;
-    Window p;
+    rw->x = x;
+    rw->y = y;
+    rw->width = width;
+    rw->height = height;
+    rw->border_width = border_width;
+}
+
+/*****************************************************************************/
+/* returns the entry for a window. Windows which were created before we
+   started managing windows are fetched from the X server the first time
+   they are asked for.
+   returns NULL if the window doesn't exist */
+static struct rail_window *
+rail_window_get(Window window_id)
+{
+    struct rail_window *rw;
+    XWindowAttributes attributes;
+    Window root;
+    Window parent;
     Window *children;
+    unsigned int nchild;
 
-    found = 0;
-    XQueryTree(g_display, g_root_window, &r, &p, &children, &nchild);
+    rw = rail_window_find(window_id);
+    if (rw != NULL)
+    {
+        return rw;
+    }
+    if (!XGetWindowAttributes(g_display, window_id, &attributes))
+    {
+        return NULL;
+    }
+    if (!XQueryTree(g_display, window_id, &root, &parent, &children, &nchild))
+    {
+        return NULL;
+    }
+    if (children != NULL)
+    {
+        XFree(children);
+    }
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "rail_window_get: fetched window 0x%8.8lx",
+              window_id);
+    rw = rail_window_add(window_id, parent);
+    if (rw != NULL)
+    {
+        rail_window_set_geometry(rw, attributes.x, attributes.y,
+                                 attributes.width, attributes.height,
+                                 attributes.border_width);
+        rw->override_redirect = attributes.override_redirect;
+        rw->map_state = attributes.map_state;
+    }
+    return rw;
+}
 
-    for (i = 0; i < nchild; i++)
+/*****************************************************************************/
+static Window
+rail_window_get_transient_for(struct rail_window *rw)
+{
+    Window transient_for;
+
+    if ((rw->flags & RW_TRANSIENT_VALID) == 0)
     {
-        if (window_id == children[i])
+        transient_for = 0;
+        XGetTransientForHint(g_display, rw->window_id, &transient_for);
+        rw->transient_for = transient_for;
+        /* we're only told about changes if we've asked for PropertyNotify */
+        if (rw->flags & RW_SELECTED)
         {
-            found = 1;
-            break;
+            rw->flags |= RW_TRANSIENT_VALID;
         }
     }
-
-    XFree(children);
-    return found;
+    return rw->transient_for;
 }
 
 /*****************************************************************************/
@@ -352,6 +455,7 @@ rail_deinit(void)
     {
         list_delete(g_window_list);
         g_window_list = 0;
+        rail_window_remove_all();
         /* no longer window manager */
         XSelectInput(g_display, g_root_window, 0);
         g_rail_up = 0;
@@ -376,9 +480,9 @@ rail_startup(void)
 
     list_delete(g_window_list);
     g_window_list = list_create();
+    rail_window_remove_all();
     rail_send_init();
     g_rail_up = 1;
-    g_rwd_atom = XInternAtom(g_display, "XRDP_RAIL_WINDOW_DATA", 0);
 
     if (!XRRQueryExtension(g_display, &g_xrr_event_base, &dummy))
     {
@@ -515,7 +619,7 @@ rail_win_popdown(void)
     Window r;
     Window p;
     Window *children;
-    XWindowAttributes window_attributes;
+    struct rail_window *rw;
 
     /*
      * Check the tree of current existing X windows and dismiss
@@ -526,10 +630,13 @@ rail_win_popdown(void)
     XQueryTree(g_display, g_root_window, &r, &p, &children, &nchild);
     for (i = nchild - 1; i >= 0; i--)
     {
-        XGetWindowAttributes(g_display, children[i], &window_attributes);
-        if (window_attributes.override_redirect &&
-                window_attributes.map_state == IsViewable &&
-                list_index_of(g_window_list, children[i]) >= 0)
+        if (list_index_of(g_window_list, children[i]) < 0)
+        {
+            continue;
+        }
+        rw = rail_window_get(children[i]);
+        if (rw != NULL && rw->override_redirect &&
+                rw->map_state == IsViewable)
         {
             LOG_DEVEL(LOG_LEVEL_DEBUG, "  dismiss pop up 0x%8.8lx", children[i]);
             rail_send_key_esc(children[i]);
@@ -583,8 +690,8 @@ rail_process_activate(struct stream *s, int size)
     unsigned int window_id;
     int enabled;
     int index;
-    XWindowAttributes window_attributes;
-    Window transient_for = 0;
+    struct rail_window *rw;
+    Window transient_for;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_process_activate:");
     in_uint32_le(s, window_id);
@@ -602,7 +709,11 @@ rail_process_activate(struct stream *s, int size)
     g_got_focus = enabled;
     LOG_DEVEL(LOG_LEVEL_DEBUG, "  window_id 0x%8.8x enabled %d", window_id, enabled);
 
-    XGetWindowAttributes(g_display, window_id, &window_attributes);
+    rw = rail_window_get(window_id);
+    if (rw == NULL)
+    {
+        return 0;
+    }
 
     if (enabled)
     {
@@ -614,12 +725,12 @@ rail_process_activate(struct stream *s, int size)
         else
         {
             rail_win_popdown();
-            if (window_attributes.map_state != IsViewable)
+            if (rw->map_state != IsViewable)
             {
                 /* In case that window is unmapped upon minimization and not yet mapped */
                 XMapWindow(g_display, window_id);
             }
-            XGetTransientForHint(g_display, window_id, &transient_for);
+            transient_for = rail_window_get_transient_for(rw);
             if (transient_for > 0)
             {
                 /* Owner window should be raised up as well */
@@ -638,7 +749,7 @@ rail_process_activate(struct stream *s, int size)
     else
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "  window attributes: override_redirect %d",
-                  window_attributes.override_redirect);
+                  rw->override_redirect);
         add_timeout(200, my_timeout, (void *)(long)g_focus_counter);
     }
     return 0;
@@ -648,11 +759,17 @@ rail_process_activate(struct stream *s, int size)
 static int
 rail_select_input(Window window_id)
 {
+    struct rail_window *rw;
+
     XSelectInput(g_display, window_id,
                  PropertyChangeMask | StructureNotifyMask |
                  SubstructureNotifyMask | FocusChangeMask |
                  EnterWindowMask | LeaveWindowMask);
-    XSync(g_display, 0);
+    rw = rail_window_find(window_id);
+    if (rw != NULL)
+    {
+        rw->flags |= RW_SELECTED;
+    }
     return 0;
 }
 
@@ -665,16 +782,16 @@ rail_restore_windows(void)
     Window r;
     Window p;
     Window *children;
+    struct rail_window *rw;
 
     XQueryTree(g_display, g_root_window, &r, &p, &children, &nchild);
     for (i = 0; i < nchild; i++)
     {
-        XWindowAttributes window_attributes;
-        XGetWindowAttributes(g_display, children[i], &window_attributes);
-        if (!window_attributes.override_redirect)
+        rw = rail_window_get(children[i]);
+        if (rw != NULL && !rw->override_redirect)
         {
             rail_select_input(children[i]);
-            if (window_attributes.map_state == IsViewable)
+            if (rw->map_state == IsViewable)
             {
                 rail_win_set_state(children[i], 0x0); /* WithdrawnState */
                 rail_create_window(children[i], g_root_window);
@@ -749,50 +866,16 @@ rail_get_property(Display *display, Window target, Atom type, Atom property,
     return 0;
 }
 
-/*****************************************************************************/
-static int
-rail_win_get_state(Window win)
-{
-    unsigned long nitems = 0;
-    int rv = -1;
-    char *data = 0;
-
-    rail_get_property(g_display, win, g_wm_state, g_wm_state,
-                      (unsigned char **)&data,
-                      &nitems);
-
-    if (data && nitems > 0)
-    {
-        rv = *(unsigned long *)data;
-        XFree(data);
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "  rail_win_get_state: %d", rv);
-    }
-
-    return rv;
-}
-
 /*****************************************************************************/
 static int
 rail_win_set_state(Window win, unsigned long state)
 {
-    int old_state;
     unsigned long data[2] = { state, None };
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "  rail_win_set_state: %ld", state);
-    /* check whether WM_STATE exists */
-    old_state = rail_win_get_state(win);
-    if (old_state == -1)
-    {
-        /* create WM_STATE property */
-        XChangeProperty(g_display, win, g_wm_state, g_wm_state, 32, PropModeAppend,
-                        (unsigned char *)data, 2);
-        LOG_DEVEL(LOG_LEVEL_DEBUG, "  rail_win_set_state: create WM_STATE property");
-    }
-    else
-    {
-        XChangeProperty(g_display, win, g_wm_state, g_wm_state, 32, PropModeReplace,
-                        (unsigned char *)data, 2);
-    }
+    /* PropModeReplace creates WM_STATE if it isn't there */
+    XChangeProperty(g_display, win, g_wm_state, g_wm_state, 32, PropModeReplace,
+                    (unsigned char *)data, 2);
     return 0;
 }
 
@@ -861,11 +944,11 @@ rail_minmax_window(int window_id, int max)
 static int
 rail_restore_window(int window_id)
 {
-    XWindowAttributes window_attributes;
+    struct rail_window *rw;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_restore_window 0x%8.8x:", window_id);
-    XGetWindowAttributes(g_display, window_id, &window_attributes);
-    if (window_attributes.map_state != IsViewable)
+    rw = rail_window_get(window_id);
+    if (rw == NULL || rw->map_state != IsViewable)
     {
         XMapWindow(g_display, window_id);
     }
@@ -974,7 +1057,7 @@ rail_process_window_move(struct stream *s, int size)
     int right;
     int bottom;
     tsi16 si16;
-    struct rail_window_data *rwd;
+    struct rail_window *rw;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_process_window_move:");
     in_uint32_le(s, window_id);
@@ -989,14 +1072,16 @@ rail_process_window_move(struct stream *s, int size)
     LOG_DEVEL(LOG_LEVEL_DEBUG, "  window_id 0x%8.8x left %d top %d right %d bottom %d width %d height %d",
               window_id, left, top, right, bottom, right - left, bottom - top);
     XMoveResizeWindow(g_display, window_id, left, top, right - left, bottom - top);
-    rwd = (struct rail_window_data *)
-          g_malloc(sizeof(struct rail_window_data), 1);
-    rwd->x = left;
-    rwd->y = top;
-    rwd->width = right - left;
-    rwd->height = bottom - top;
-    rail_set_window_data(window_id, rwd);
-    g_free(rwd);
+    rw = rail_window_get(window_id);
+    if (rw != NULL)
+    {
+        g_memset(&rw->rwd, 0, sizeof(rw->rwd));
+        rw->rwd.x = left;
+        rw->rwd.y = top;
+        rw->rwd.width = right - left;
+        rw->rwd.height = bottom - top;
+        rw->flags |= RW_HAVE_RWD;
+    }
     return 0;
 }
 
@@ -1253,34 +1338,38 @@ rail_win_send_text(Window win)
     int len = 0;
     int flags;
     int crc;
-    struct rail_window_data *rwd;
+    struct rail_window *rw;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_win_send_text:");
+    rw = rail_window_get(win);
+    if (rw == NULL)
+    {
+        LOG_DEVEL(LOG_LEVEL_ERROR, "chansrv::rail_win_send_text: error rail_window_get failed");
+        return 1;
+    }
+    rw->flags |= RW_HAVE_RWD;
+    /* if we'd have been told about a change, there's no need to look */
+    if ((rw->rwd.valid & RWD_TITLE) && (rw->flags & RW_SELECTED) &&
+            (rw->flags & RW_TITLE_STALE) == 0)
+    {
+        LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_win_send_text: skipping, title not changed");
+        return 0;
+    }
+    rw->flags &= ~RW_TITLE_STALE;
     len = rail_win_get_text(win, &data);
-    rwd = rail_get_window_data_safe(win);
-    if (rwd != 0)
+    if (data != 0)
     {
-        if (data != 0)
+        if (rw->rwd.valid & RWD_TITLE)
         {
-            if (rwd->valid & RWD_TITLE)
+            crc = get_string_crc(data);
+            if (rw->rwd.title_crc == crc)
             {
-                crc = get_string_crc(data);
-                if (rwd->title_crc == crc)
-                {
-                    LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_win_send_text: skipping, title not changed");
-                    g_free(data);
-                    XFree(rwd);
-                    return 0;
-                }
+                LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_win_send_text: skipping, title not changed");
+                g_free(data);
+                return 0;
             }
         }
     }
-    else
-    {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "chansrv::rail_win_send_text: error rail_get_window_data_safe failed");
-        g_free(data);
-        return 1;
-    }
     if (data && len > 0)
     {
         LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_win_send_text: 0x%8.8lx text %s length %d",
@@ -1297,13 +1386,11 @@ rail_win_send_text(Window win)
         send_rail_drawing_orders(s->data, (int)(s->end - s->data));
         free_stream(s);
         /* update rail window data */
-        rwd->valid |= RWD_TITLE;
+        rw->rwd.valid |= RWD_TITLE;
         crc = get_string_crc(data);
-        rwd->title_crc = crc;
-        rail_set_window_data(win, rwd);
+        rw->rwd.title_crc = crc;
     }
     g_free(data);
-    XFree(rwd);
     return 0;
 }
 
@@ -1354,14 +1441,10 @@ rail_create_window(Window window_id, Window owner_id)
 {
     int x;
     int y;
-    tui32 width;
-    tui32 height;
-    tui32 border;
-    Window root;
-    tui32 depth;
+    int width;
+    int height;
     char *title_bytes = 0;
     int title_size = 0;
-    XWindowAttributes attributes;
     int style;
     int ext_style;
     int num_window_rects = 1;
@@ -1371,24 +1454,28 @@ rail_create_window(Window window_id, Window owner_id)
     int flags;
     int index;
     int crc;
-    Window transient_for = 0;
+    Window transient_for;
+    struct rail_window *rw;
     struct rail_window_data *rwd;
     struct stream *s;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_create_window 0x%8.8lx", window_id);
 
-    rwd = rail_get_window_data_safe(window_id);
-    if (rwd == 0)
+    rw = rail_window_get(window_id);
+    if (rw == NULL)
     {
-        LOG_DEVEL(LOG_LEVEL_ERROR, "chansrv::rail_create_window: error rail_get_window_data_safe failed");
+        LOG_DEVEL(LOG_LEVEL_ERROR, "chansrv::rail_create_window: error rail_window_get failed");
         return 0;
     }
-    XGetGeometry(g_display, window_id, &root, &x, &y, &width, &height,
-                 &border, &depth);
-    XGetWindowAttributes(g_display, window_id, &attributes);
+    rw->flags |= RW_HAVE_RWD;
+    rwd = &rw->rwd;
+    x = rw->x;
+    y = rw->y;
+    width = rw->width;
+    height = rw->height;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "  x %d y %d width %d height %d border_width %d", x, y, width,
-              height, border);
+              height, rw->border_width);
 
     index = list_index_of(g_window_list, window_id);
     if (index == -1)
@@ -1406,9 +1493,13 @@ rail_create_window(Window window_id, Window owner_id)
     title_size = 0;
     title_bytes = 0;
 
-    XGetTransientForHint(g_display, window_id, &transient_for);
+    transient_for = 0;
+    if (!rw->override_redirect)
+    {
+        transient_for = rail_window_get_transient_for(rw);
+    }
 
-    if (attributes.override_redirect)
+    if (rw->override_redirect)
     {
         style = RAIL_STYLE_TOOLTIP;
         ext_style = RAIL_EXT_STYLE_TOOLTIP;
@@ -1427,6 +1518,7 @@ rail_create_window(Window window_id, Window owner_id)
         ext_style = RAIL_EXT_STYLE_NORMAL;
         title_size = rail_win_get_text(window_id, &title_bytes);
     }
+    rw->flags &= ~RW_TITLE_STALE;
 
     make_stream(s);
     init_stream(s, title_size + 1024 + num_window_rects * 8 + num_visibility_rects * 8);
@@ -1503,8 +1595,6 @@ rail_create_window(Window window_id, Window owner_id)
     send_rail_drawing_orders(s->data, (int)(s->end - s->data));
     free_stream(s);
     g_free(title_bytes);
-    rail_set_window_data(window_id, rwd);
-    XFree(rwd);
     return 0;
 }
 
@@ -1521,6 +1611,7 @@ rail_configure_request_window(XConfigureRequestEvent *config)
     int window_id;
     int mask;
     int resized = 0;
+    struct rail_window *rw;
     struct rail_window_data *rwd;
 
     struct stream *s;
@@ -1540,17 +1631,20 @@ rail_configure_request_window(XConfigureRequestEvent *config)
             rail_show_window(window_id, 5);
         }
     }
-    rwd = rail_get_window_data(window_id);
-    if (rwd == 0)
+    rw = rail_window_get(window_id);
+    if (rw == NULL)
+    {
+        return 0;
+    }
+    rwd = &rw->rwd;
+    if ((rw->flags & RW_HAVE_RWD) == 0)
     {
-        rwd = (struct rail_window_data *)g_malloc(sizeof(struct rail_window_data), 1);
         rwd->x = config->x;
         rwd->y = config->y;
         rwd->width = config->width;
         rwd->height = config->height;
         rwd->valid |= RWD_X | RWD_Y | RWD_WIDTH | RWD_HEIGHT;
-        rail_set_window_data(window_id, rwd);
-        g_free(rwd);
+        rw->flags |= RW_HAVE_RWD;
         return 0;
     }
     if (!resized)
@@ -1633,14 +1727,8 @@ rail_configure_request_window(XConfigureRequestEvent *config)
             }
         }
     }
-    if (resized)
-    {
-        rail_set_window_data(window_id, rwd);
-        XFree(rwd);
-    }
-    else
+    if (!resized)
     {
-        XFree(rwd);
         return 0;
     }
 
@@ -1817,8 +1905,7 @@ rail_xevent(void *xevent)
     XWindowChanges xwc;
     int rv;
     int index;
-    XWindowAttributes wnd_attributes;
-    char *prop_name;
+    struct rail_window *rw;
 
     LOG_DEVEL(LOG_LEVEL_DEBUG, "chansrv::rail_xevent:");
 
@@ -1833,27 +1920,33 @@ rail_xevent(void *xevent)
     switch (lxevent->type)
     {
         case PropertyNotify:
-            prop_name = XGetAtomName(g_display, lxevent->xproperty.atom);
-            LOG_DEVEL(LOG_LEVEL_DEBUG, "  got PropertyNotify window_id 0x%8.8lx %s state new %d",
-                      lxevent->xproperty.window, prop_name,
+            LOG_DEVEL(LOG_LEVEL_DEBUG, "  got PropertyNotify window_id 0x%8.8lx atom %ld state new %d",
+                      lxevent->xproperty.window, lxevent->xproperty.atom,
                       lxevent->xproperty.state == PropertyNewValue);
 
-            if (list_index_of(g_window_list, lxevent->xproperty.window) < 0)
+            rw = rail_window_find(lxevent->xproperty.window);
+            if (rw == NULL)
             {
                 break;
             }
 
-            if (g_strcmp(prop_name, "WM_NAME") == 0 ||
-                    g_strcmp(prop_name, "_NET_WM_NAME") == 0)
+            if (lxevent->xproperty.atom == XA_WM_TRANSIENT_FOR)
             {
-                XGetWindowAttributes(g_display, lxevent->xproperty.window, &wnd_attributes);
-                if (wnd_attributes.map_state == IsViewable)
+                rw->flags &= ~RW_TRANSIENT_VALID;
+            }
+            else if (lxevent->xproperty.atom == XA_WM_NAME ||
+                     lxevent->xproperty.atom == g_net_wm_name)
+            {
+                /* the title is sent from rail_check_wait_objs(), so
+                   several changes in a row only cost one update */
+                rw->flags |= RW_TITLE_STALE;
+                if (rw->map_state == IsViewable &&
+                        list_index_of(g_window_list, rw->window_id) >= 0)
                 {
-                    rail_win_send_text(lxevent->xproperty.window);
+                    g_titles_stale = 1;
                     rv = 0;
                 }
             }
-            XFree(prop_name);
             break;
 
         case ConfigureRequest:
@@ -1877,12 +1970,25 @@ rail_xevent(void *xevent)
         case CreateNotify:
             LOG_DEVEL(LOG_LEVEL_DEBUG, " got CreateNotify window 0x%8.8lx parent 0x%8.8lx",
                       lxevent->xcreatewindow.window, lxevent->xcreatewindow.parent);
+            rw = rail_window_add(lxevent->xcreatewindow.window,
+                                 lxevent->xcreatewindow.parent);
+            if (rw != NULL)
+            {
+                rail_window_set_geometry(rw, lxevent->xcreatewindow.x,
+                                         lxevent->xcreatewindow.y,
+                                         lxevent->xcreatewindow.width,
+                                         lxevent->xcreatewindow.height,
+                                         lxevent->xcreatewindow.border_width);
+                rw->override_redirect =
+                    lxevent->xcreatewindow.override_redirect;
+            }
             rail_select_input(lxevent->xcreatewindow.window);
             break;
 
         case DestroyNotify:
             LOG_DEVEL(LOG_LEVEL_DEBUG, "  got DestroyNotify window 0x%8.8lx event 0x%8.8lx",
                       lxevent->xdestroywindow.window, lxevent->xdestroywindow.event);
+            rail_window_remove(lxevent->xdestroywindow.window);
             if (lxevent->xdestroywindow.window != lxevent->xdestroywindow.event)
             {
                 break;
@@ -1909,22 +2015,22 @@ rail_xevent(void *xevent)
                 break;
             }
 
-            if (!is_window_valid_child_of_root(lxevent->xmap.window))
+            rw = rail_window_get(lxevent->xmap.window);
+            if (rw == NULL || rw->parent != g_root_window)
             {
                 break;
             }
+            /* the root is always viewable, so its children are too */
+            rw->map_state = IsViewable;
+            rw->override_redirect = lxevent->xmap.override_redirect;
 
-            XGetWindowAttributes(g_display, lxevent->xmap.window, &wnd_attributes);
-            if (wnd_attributes.map_state == IsViewable)
+            rail_create_window(lxevent->xmap.window, g_root_window);
+            if (!rw->override_redirect)
             {
-                rail_create_window(lxevent->xmap.window, g_root_window);
-                if (!wnd_attributes.override_redirect)
-                {
-                    rail_win_set_state(lxevent->xmap.window, 0x1); /* NormalState */
-                    rail_win_send_text(lxevent->xmap.window);
-                }
-                rv = 0;
+                rail_win_set_state(lxevent->xmap.window, 0x1); /* NormalState */
+                rail_win_send_text(lxevent->xmap.window);
             }
+            rv = 0;
             break;
 
         case UnmapNotify:
@@ -1933,14 +2039,15 @@ rail_xevent(void *xevent)
             {
                 break;
             }
-            if (is_window_valid_child_of_root(lxevent->xunmap.window))
+            rw = rail_window_find(lxevent->xunmap.window);
+            if (rw != NULL && rw->parent == g_root_window)
             {
+                rw->map_state = IsUnmapped;
                 index = list_index_of(g_window_list, lxevent->xunmap.window);
                 LOG_DEVEL(LOG_LEVEL_DEBUG, "  window 0x%8.8lx is unmapped", lxevent->xunmap.window);
                 if (index >= 0)
                 {
-                    XGetWindowAttributes(g_display, lxevent->xunmap.window, &wnd_attributes);
-                    if (wnd_attributes.override_redirect)
+                    if (rw->override_redirect)
                     {
                         // remove popups
                         rail_destroy_window(lxevent->xunmap.window);
@@ -1960,6 +2067,16 @@ rail_xevent(void *xevent)
             LOG_DEVEL(LOG_LEVEL_DEBUG, "  got ConfigureNotify 0x%8.8lx event 0x%8.8lx", lxevent->xconfigure.window,
                       lxevent->xconfigure.event);
             rv = 0;
+            rw = rail_window_find(lxevent->xconfigure.window);
+            if (rw != NULL)
+            {
+                rail_window_set_geometry(rw, lxevent->xconfigure.x,
+                                         lxevent->xconfigure.y,
+                                         lxevent->xconfigure.width,
+                                         lxevent->xconfigure.height,
+                                         lxevent->xconfigure.border_width);
+                rw->override_redirect = lxevent->xconfigure.override_redirect;
+            }
             if (lxevent->xconfigure.event != lxevent->xconfigure.window ||
                     lxevent->xconfigure.override_redirect)
             {
@@ -1970,6 +2087,16 @@ rail_xevent(void *xevent)
                                           lxevent->xconfigure.window,
                                           ConfigureNotify, &lastevent))
             {
+                if (rw != NULL)
+                {
+                    rail_window_set_geometry(rw, lastevent.xconfigure.x,
+                                             lastevent.xconfigure.y,
+                                             lastevent.xconfigure.width,
+                                             lastevent.xconfigure.height,
+                                             lastevent.xconfigure.border_width);
+                    rw->override_redirect =
+                        lastevent.xconfigure.override_redirect;
+                }
                 if (lastevent.xconfigure.event == lastevent.xconfigure.window &&
                         lxevent->xconfigure.override_redirect == 0)
                 {
@@ -2009,6 +2136,15 @@ rail_xevent(void *xevent)
                       lxevent->xreparent.event, lxevent->xreparent.x,
                       lxevent->xreparent.y, lxevent->xreparent.override_redirect);
 
+            rw = rail_window_find(lxevent->xreparent.window);
+            if (rw != NULL)
+            {
+                rw->parent = lxevent->xreparent.parent;
+                rw->x = lxevent->xreparent.x;
+                rw->y = lxevent->xreparent.y;
+                rw->override_redirect = lxevent->xreparent.override_redirect;
+            }
+
             if (lxevent->xreparent.window != lxevent->xreparent.event)
             {
                 break;
@@ -2039,3 +2175,27 @@ rail_xevent(void *xevent)
 
     return rv;
 }
+
+/*****************************************************************************/
+/* sends the title updates and window orders queued by rail_xevent() */
+int
+rail_check_wait_objs(void)
+{
+    struct rail_window *rw;
+    int index;
+
+    if (g_rail_up && g_titles_stale)
+    {
+        g_titles_stale = 0;
+        for (index = 0; index < g_window_list->count; index++)
+        {
+            rw = rail_window_find((Window)list_get_item(g_window_list, index));
+            if (rw != NULL && (rw->flags & RW_TITLE_STALE) &&
+                    rw->map_state == IsViewable)
+            {
+                rail_win_send_text(rw->window_id);
+            }
+        }
+    }
+    return flush_rail_drawing_orders();
+}
@@ -32,6 +32,8 @@ rail_data_in(struct stream *s, int chan_id, int chan_flags,
              int length, int total_length);
 int
 rail_xevent(void *xevent);
+int
+rail_check_wait_objs(void);
 int rail_request_title(int window_id);
 
 #endif
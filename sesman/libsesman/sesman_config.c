@@ -80,6 +80,10 @@
 #define SESMAN_CFG_SESS_DISC_LIMIT   "DisconnectedTimeLimit"
 #define SESMAN_CFG_SESS_X11DISPLAYOFFSET "X11DisplayOffset"
 #define SESMAN_CFG_SESS_MAX_DISPLAY  "MaxDisplayNumber"
+#define SESMAN_CFG_SESS_SESEXEC_POOL "SesexecPoolSize"
+
+/* Upper limit on idle sesexec processes */
+#define MAX_SESEXEC_POOL_SIZE 32
 
 #define SESMAN_CFG_SESS_POLICY_S "Policy"
 #define SESMAN_CFG_SESS_POLICY_DFLT_S "Default"
@@ -418,6 +422,7 @@ config_read_sessions(int file, struct config_sessions *se, struct list *param_n,
     // https://www.iana.org/assignments/service-names-port-numbers/service-names-port-numbers.xhtml`
     se->max_display_number = 63;
     se->max_sessions = 0;
+    se->sesexec_pool_size = 0;
     se->max_idle_time = 0;
     se->max_disc_time = 0;
     se->kill_disconnected = 0;
@@ -457,6 +462,21 @@ config_read_sessions(int file, struct config_sessions *se, struct list *param_n,
             }
         }
 
+        else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_SESEXEC_POOL))
+        {
+            int ps = g_atoi(value);
+            if (ps > MAX_SESEXEC_POOL_SIZE)
+            {
+                LOG(LOG_LEVEL_WARNING, "%s limited to %d",
+                    SESMAN_CFG_SESS_SESEXEC_POOL, MAX_SESEXEC_POOL_SIZE);
+                ps = MAX_SESEXEC_POOL_SIZE;
+            }
+            if (ps >= 0)
+            {
+                se->sesexec_pool_size = ps;
+            }
+        }
+
         else if (0 == g_strcasecmp(buf, SESMAN_CFG_SESS_KILL_DISC))
         {
             se->kill_disconnected = g_text2bool(value);
@@ -662,6 +682,7 @@ config_dump(struct config_sesman *config)
 
     g_writeln("Session configuration:");
     g_writeln("    MaxSessions:              %d", se->max_sessions);
+    g_writeln("    SesexecPoolSize:          %d", se->sesexec_pool_size);
     g_writeln("    X11DisplayOffset:         %d", se->x11_display_offset);
     g_writeln("    KillDisconnected:         %d", se->kill_disconnected);
     g_writeln("    IdleTimeLimit:            %d", se->max_idle_time);
@@ -140,6 +140,11 @@ struct config_sessions
      * @brief maximum number of allowed sessions. 0 for unlimited
      */
     unsigned int max_sessions;
+    /**
+     * @var sesexec_pool_size
+     * @brief number of idle sesexec processes kept ready for logins
+     */
+    unsigned int sesexec_pool_size;
     /**
      * @var max_idle_time
      * @brief maximum idle time for each session
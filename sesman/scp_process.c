@@ -510,8 +510,9 @@ process_create_session_request(struct pre_session_item *psi)
                     psi->sesexec_pid = 0;
 
                     // Add the display to the session item so we don't try
-                    // to allocate it to another session
-                    s_item->display = display;
+                    // to allocate it to another session. This can't fail,
+                    // as the display bitmap has already been sized for it
+                    (void)session_list_set_display(s_item, display);
                 }
             }
         }
@@ -557,6 +558,8 @@ process_list_sessions_request(struct pre_session_item *psi)
 
         info = session_list_get_byuid(psi->uid, &cnt, 0);
 
+        // Send the list with as few writes as possible
+        rv = scp_msg_out_batch_begin(psi->client_trans);
         for (i = 0; rv == 0 && i < cnt; ++i)
         {
             rv = scp_send_list_sessions_response(psi->client_trans,
@@ -571,6 +574,10 @@ process_list_sessions_request(struct pre_session_item *psi)
                                                  E_SCP_LS_END_OF_LIST,
                                                  NULL);
         }
+        if (scp_msg_out_batch_end(psi->client_trans) != 0)
+        {
+            rv = 1;
+        }
     }
 
     return rv;
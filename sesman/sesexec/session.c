@@ -68,6 +68,10 @@ struct session_data
 #endif
 };
 
+/* Write end of the pipe the X server uses to say it's ready (-displayfd).
+ * Only valid in the X server child process */
+static int g_xserver_ready_fd = -1;
+
 /******************************************************************************/
 /**
  * Create a new session_data structure from a session_parameters object
@@ -380,6 +384,15 @@ prepare_xorg_xserver_params(const struct session_parameters *s,
                               "-auth", authfile,
                               NULL);
 
+        /* Ask the X server to tell us when it's ready, rather than
+         * polling it. The display number written back is ignored */
+        if (g_xserver_ready_fd >= 0)
+        {
+            g_snprintf(text, sizeof(text), "%d", g_xserver_ready_fd);
+            list_add_strdup_multi(params, "-displayfd", text, NULL);
+            g_file_set_cloexec(g_xserver_ready_fd, 0);
+        }
+
         /* additional parameters from sesman.ini file */
         list_append_list_strdup(g_cfg->xorg_params, params, 1);
     }
@@ -565,6 +578,7 @@ session_start_wrapped(struct login_info *login_info,
     int chansrv_pid;
     int display_pid;
     int window_manager_pid;
+    int ready_fd[2] = {-1, -1};
     enum scp_screate_status status = E_SCP_SCREATE_GENERAL_ERROR;
 
     if (auth_start_session(login_info->auth_info, s->display) != 0)
@@ -606,6 +620,26 @@ session_start_wrapped(struct login_info *login_info,
     }
 #endif
 
+    /* Xorg writes the display number to this pipe (-displayfd) once it
+     * is ready for clients. Xvnc builds vary too much to rely on
+     * -displayfd, so for those waitforx polls the display instead */
+    if (s->type == SCP_SESSION_TYPE_XORG)
+    {
+        if (g_pipe(ready_fd) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING, "Can't create X server ready pipe: %s",
+                g_get_strerror());
+            ready_fd[0] = -1;
+            ready_fd[1] = -1;
+        }
+        else
+        {
+            g_file_set_cloexec(ready_fd[0], 1);
+            g_file_set_cloexec(ready_fd[1], 1);
+            g_xserver_ready_fd = ready_fd[1];
+        }
+    }
+
     /* start the X server in a new process group.
      *
      * We group the X server, window manager and chansrv in a single
@@ -614,13 +648,21 @@ session_start_wrapped(struct login_info *login_info,
      * important when debugging sesexec as we don't want a SIGINT in
      * the debugger to be passed to the children */
     display_pid = fork_child(start_x_server, login_info, s, 0);
+    g_xserver_ready_fd = -1;
+    if (ready_fd[1] >= 0)
+    {
+        /* Only the X server holds the write end now, so waitforx sees
+         * EOF if it exits without becoming ready */
+        g_file_close(ready_fd[1]);
+    }
     if (display_pid > 0)
     {
         enum xwait_status xws;
         xws = wait_for_xserver(login_info->uid,
                                g_cfg->env_names,
                                g_cfg->env_values,
-                               s->display);
+                               s->display,
+                               ready_fd[0]);
 
         if (xws != XW_STATUS_OK)
         {
@@ -680,6 +722,11 @@ session_start_wrapped(struct login_info *login_info,
         }
     }
 
+    if (ready_fd[0] >= 0)
+    {
+        g_file_close(ready_fd[0]);
+    }
+
     return status;
 }
 
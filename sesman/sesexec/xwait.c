@@ -56,10 +56,11 @@ log_waitforx_messages(FILE *dp)
  * Contruct the command to run to check the X server
  */
 static struct list *
-make_xwait_command(int display)
+make_xwait_command(int display, int ready_fd)
 {
     const char exe[] = XRDP_LIBEXEC_PATH "/waitforx";
     char displaystr[64];
+    char fdstr[64];
 
     struct list *cmd = list_create();
     if (cmd != NULL)
@@ -72,6 +73,15 @@ make_xwait_command(int display)
             list_delete(cmd);
             cmd = NULL;
         }
+        else if (ready_fd >= 0)
+        {
+            g_snprintf(fdstr, sizeof(fdstr), "%d", ready_fd);
+            if (!list_add_strdup_multi(cmd, "-f", fdstr, NULL))
+            {
+                list_delete(cmd);
+                cmd = NULL;
+            }
+        }
     }
 
     return cmd;
@@ -82,11 +92,12 @@ enum xwait_status
 wait_for_xserver(uid_t uid,
                  struct list *env_names,
                  struct list *env_values,
-                 int display)
+                 int display,
+                 int ready_fd)
 {
     enum xwait_status rv = XW_STATUS_MISC_ERROR;
     int fd[2] = {-1, -1};
-    struct list *cmd = make_xwait_command(display);
+    struct list *cmd = make_xwait_command(display, ready_fd);
 
 
     // Construct the command to execute to check the display
@@ -113,6 +124,10 @@ wait_for_xserver(uid_t uid,
             g_file_close(fd[0]);
             g_file_duplicate_on(fd[1], 1);
             g_file_duplicate_on(fd[1], 2);
+            if (ready_fd >= 0)
+            {
+                g_file_set_cloexec(ready_fd, 0);
+            }
 
             /* Move to the user context... */
             env_set_user(uid,
@@ -18,6 +18,8 @@ enum xwait_status
  * @param env_names Environment to set for user (names)
  * @param env_values Environment to set for user (values)
  * @param display number
+ * @param ready_fd Read end of the pipe passed to the X server with
+ *                 -displayfd, or -1 to poll the display instead
  * @return status
  *
  */
@@ -25,5 +27,6 @@ enum xwait_status
 wait_for_xserver(uid_t uid,
                  struct list *env_names,
                  struct list *env_values,
-                 int display);
+                 int display,
+                 int ready_fd);
 #endif
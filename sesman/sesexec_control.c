@@ -30,6 +30,7 @@
 
 #include "sesman_config.h"
 #include "eicp.h"
+#include "list.h"
 #include "log.h"
 #include "os_calls.h"
 #include "pre_session_list.h"
@@ -52,6 +53,19 @@
 #define USE_BSD_SETLOGIN 1
 #endif
 
+/**
+ * A sesexec started ahead of time, which is waiting to be given a login
+ * to handle.
+ */
+struct idle_sesexec
+{
+    struct trans *trans; ///< EICP link to sesexec
+    pid_t pid; ///< PID of sesexec
+};
+
+static struct list *g_idle_sesexecs = NULL;
+static int g_pool_refill_needed = 1;
+
 /*****************************************************************************/
 /**
  * Adds entries to the args list for running sesexec
@@ -103,8 +117,15 @@ create_exec_args(void)
 }
 
 /*****************************************************************************/
-int
-sesexec_start(struct pre_session_item *psi)
+/**
+ * Forks and executes a sesexec process
+ *
+ * @param[out] trans EICP transport to the new process
+ * @param[out] sesexec_pid PID of the new process
+ * @return 0 for success. Errors are logged
+ */
+static int
+spawn_sesexec(struct trans **trans, pid_t *sesexec_pid)
 {
     // Local socket pair used to set up the EICP channel for sesexec
     // We also use the socket pair to communicate the PID of sesexec back
@@ -213,10 +234,8 @@ sesexec_start(struct pre_session_item *psi)
                 }
                 else
                 {
-                    t->trans_data_in = sesman_eicp_data_in;
-                    t->callback_data = (void *)psi;
-                    psi->sesexec_trans = t;
-                    psi->sesexec_pid = pid;
+                    *trans = t;
+                    *sesexec_pid = pid;
                     rv = 0;
                 }
             }
@@ -226,3 +245,201 @@ sesexec_start(struct pre_session_item *psi)
     list_delete(args);
     return rv;
 }
+
+/*****************************************************************************/
+/**
+ * Called if an idle sesexec sends us anything. It shouldn't, as it has
+ * nothing to talk about until it's given a login to handle.
+ */
+static int
+idle_sesexec_data_in(struct trans *self)
+{
+    LOG(LOG_LEVEL_WARNING, "Unexpected message from idle sesexec");
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+idle_sesexec_delete(struct idle_sesexec *idle)
+{
+    if (idle != NULL)
+    {
+        trans_delete(idle->trans);
+        g_free(idle);
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Removes an idle sesexec from the pool, if one is available
+ *
+ * @param[out] trans EICP transport to the process
+ * @param[out] sesexec_pid PID of the process
+ * @return 0 if a sesexec was taken from the pool
+ */
+static int
+take_idle_sesexec(struct trans **trans, pid_t *sesexec_pid)
+{
+    struct idle_sesexec *idle;
+
+    while (g_idle_sesexecs != NULL && g_idle_sesexecs->count > 0)
+    {
+        /* Take the oldest first */
+        idle = (struct idle_sesexec *)list_get_item(g_idle_sesexecs, 0);
+        list_remove_item(g_idle_sesexecs, 0);
+        g_pool_refill_needed = 1;
+        if (idle->trans->status == TRANS_STATUS_UP)
+        {
+            *trans = idle->trans;
+            *sesexec_pid = idle->pid;
+            g_free(idle);
+            return 0;
+        }
+        idle_sesexec_delete(idle);
+    }
+
+    return 1;
+}
+
+/*****************************************************************************/
+int
+sesexec_start(struct pre_session_item *psi)
+{
+    struct trans *t;
+    pid_t pid;
+
+    if (take_idle_sesexec(&t, &pid) != 0 && spawn_sesexec(&t, &pid) != 0)
+    {
+        return 1;
+    }
+
+    t->trans_data_in = sesman_eicp_data_in;
+    t->callback_data = (void *)psi;
+    psi->sesexec_trans = t;
+    psi->sesexec_pid = pid;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+sesexec_pool_fill(void)
+{
+    struct idle_sesexec *idle;
+    unsigned int pool_size = g_cfg->sess.sesexec_pool_size;
+
+    if (!g_pool_refill_needed)
+    {
+        return 0;
+    }
+    g_pool_refill_needed = 0;
+
+    if (g_idle_sesexecs == NULL)
+    {
+        if (pool_size == 0)
+        {
+            return 0;
+        }
+        if ((g_idle_sesexecs = list_create()) == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "Can't allocate sesexec pool");
+            return 1;
+        }
+        g_idle_sesexecs->auto_free = 0;
+    }
+
+    while ((unsigned int)g_idle_sesexecs->count < pool_size)
+    {
+        if ((idle = g_new0(struct idle_sesexec, 1)) == NULL)
+        {
+            LOG(LOG_LEVEL_ERROR, "Out of memory filling sesexec pool");
+            return 1;
+        }
+        if (spawn_sesexec(&idle->trans, &idle->pid) != 0)
+        {
+            /* Errors are already logged. Don't try again until the
+             * pool is next used */
+            g_free(idle);
+            return 1;
+        }
+        idle->trans->trans_data_in = idle_sesexec_data_in;
+        if (!list_add_item(g_idle_sesexecs, (tintptr)idle))
+        {
+            idle_sesexec_delete(idle);
+            return 1;
+        }
+        LOG(LOG_LEVEL_DEBUG, "Started idle sesexec with pid %d",
+            (int)idle->pid);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+void
+sesexec_pool_drain(void)
+{
+    int i;
+
+    if (g_idle_sesexecs != NULL)
+    {
+        for (i = 0 ; i < g_idle_sesexecs->count ; ++i)
+        {
+            struct idle_sesexec *idle;
+            idle = (struct idle_sesexec *)list_get_item(g_idle_sesexecs, i);
+            (void)eicp_send_logout_request(idle->trans);
+            idle_sesexec_delete(idle);
+        }
+        list_delete(g_idle_sesexecs);
+        g_idle_sesexecs = NULL;
+    }
+    g_pool_refill_needed = 1;
+}
+
+/*****************************************************************************/
+int
+sesexec_pool_get_wait_objs(tbus robjs[], int *robjs_count)
+{
+    struct idle_sesexec *idle;
+    int i;
+
+    for (i = 0 ; g_idle_sesexecs != NULL && i < g_idle_sesexecs->count ; ++i)
+    {
+        idle = (struct idle_sesexec *)list_get_item(g_idle_sesexecs, i);
+        if (idle->trans->status == TRANS_STATUS_UP)
+        {
+            robjs[(*robjs_count)++] = idle->trans->sck;
+        }
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+int
+sesexec_pool_check_wait_objs(void)
+{
+    struct idle_sesexec *idle;
+    int i = 0;
+
+    while (g_idle_sesexecs != NULL && i < g_idle_sesexecs->count)
+    {
+        idle = (struct idle_sesexec *)list_get_item(g_idle_sesexecs, i);
+        if (idle->trans->status != TRANS_STATUS_UP ||
+                trans_check_wait_objs(idle->trans) != 0 ||
+                idle->trans->status != TRANS_STATUS_UP)
+        {
+            /* The pool isn't refilled here, in case the process is
+             * failing on startup */
+            LOG(LOG_LEVEL_WARNING, "Idle sesexec with pid %d has gone away",
+                (int)idle->pid);
+            idle_sesexec_delete(idle);
+            list_remove_item(g_idle_sesexecs, i);
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    return 0;
+}
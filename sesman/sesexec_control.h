@@ -30,6 +30,8 @@
 
 #include <sys/types.h>
 
+#include "arch.h"
+
 struct trans;
 struct pre_session_item;
 
@@ -46,4 +48,42 @@ struct pre_session_item;
 int
 sesexec_start(struct pre_session_item *psi);
 
+/**
+ * Tops up the pool of idle sesexec processes
+ * @result 0 for success
+ *
+ * The pool size is set by SesexecPoolSize in sesman.ini. To keep this
+ * work out of the login path, the pool is only refilled after it has
+ * been used or drained. Errors are logged.
+ */
+int
+sesexec_pool_fill(void);
+
+/**
+ * Stops all idle sesexec processes
+ *
+ * This is used on exit, and on a configuration reload as the idle
+ * processes have read the old configuration.
+ */
+void
+sesexec_pool_drain(void);
+
+/**
+ * @brief Get the wait objs for the idle sesexec processes
+ * @param @robjs Objects array to update
+ * @param robjs_count Elements in robjs (by reference)
+ * @return 0 for success
+ */
+int
+sesexec_pool_get_wait_objs(tbus robjs[], int *robjs_count);
+
+/**
+ * @brief Check the wait objs for the idle sesexec processes
+ * @return 0 for success
+ *
+ * Idle processes which have exited are removed from the pool
+ */
+int
+sesexec_pool_check_wait_objs(void);
+
 #endif // SESEXEC_H
@@ -209,6 +209,7 @@ sesman_close_all(void)
 
     pre_session_list_cleanup();
     session_list_cleanup();
+    sesexec_pool_drain();
 
     g_delete_wait_obj(g_reload_event);
     g_delete_wait_obj(g_sigchld_event);
@@ -427,6 +428,7 @@ sesman_create_listening_transport(const struct config_sesman *cfg)
         else
         {
             g_list_trans->trans_conn_in = sesman_listen_conn_in;
+            g_list_trans->accept_limit = TRANS_BURST_ACCEPT_LIMIT;
         }
         g_umask_hex(entry_umask);
     }
@@ -474,6 +476,8 @@ sesman_main_loop(void)
     }
     LOG(LOG_LEVEL_INFO, "Sesman now listening on %s", g_cfg->listen_port);
 
+    (void)sesexec_pool_fill();
+
     error = 0;
     while (!error)
     {
@@ -511,6 +515,8 @@ sesman_main_loop(void)
             break;
         }
 
+        (void)sesexec_pool_get_wait_objs(robjs, &robjs_count);
+
         if (g_obj_wait(robjs, robjs_count, NULL, 0, -1) != 0)
         {
             /* should not get here */
@@ -568,6 +574,11 @@ sesman_main_loop(void)
                 "session_list_check_wait_objs failed");
             break;
         }
+
+        (void)sesexec_pool_check_wait_objs();
+
+        /* Replace any idle sesexec processes used by logins above */
+        (void)sesexec_pool_fill();
     }
 
     return error;
@@ -47,6 +47,27 @@
 
 static struct list *g_session_list = NULL;
 
+/* Seconds before displays found in use by something else are probed
+ * again */
+#define FOREIGN_DISPLAY_RECHECK_TIME 60
+
+/*
+ * Display allocation bitmaps, indexed by display number.
+ *
+ * g_displays_in_use tracks the displays of our own sessions, and is
+ * updated as sessions start and finish. g_displays_foreign tracks the
+ * displays which probing has found to be in use by something else.
+ * These are forgotten every FOREIGN_DISPLAY_RECHECK_TIME seconds, so
+ * displays which have become free are picked up again.
+ */
+static tui32 *g_displays_in_use = NULL;
+static tui32 *g_displays_foreign = NULL;
+static unsigned int g_display_bitmap_words = 0;
+static int g_foreign_recheck_time = 0;
+
+#define DISPLAY_WORD(display) ((display) / 32)
+#define DISPLAY_BIT(display) ((tui32)1 << ((display) % 32))
+
 #define SESSION_IN_USE(si) \
     ((si) != NULL && \
      (si)->sesexec_trans != NULL && \
@@ -93,6 +114,13 @@ free_session(struct session_item *si)
         {
             trans_delete(si->sesexec_trans);
         }
+        if (si->display >= 0 &&
+                (unsigned int)DISPLAY_WORD(si->display) <
+                g_display_bitmap_words)
+        {
+            g_displays_in_use[DISPLAY_WORD(si->display)] &=
+                ~DISPLAY_BIT(si->display);
+        }
         g_free(si);
     }
 }
@@ -113,6 +141,12 @@ session_list_cleanup(void)
         list_delete(g_session_list);
         g_session_list = NULL;
     }
+
+    g_free(g_displays_in_use);
+    g_free(g_displays_foreign);
+    g_displays_in_use = NULL;
+    g_displays_foreign = NULL;
+    g_display_bitmap_words = 0;
 }
 
 /******************************************************************************/
@@ -130,6 +164,7 @@ session_list_new(void)
     if (result != NULL)
     {
         result->state = E_SESSION_STARTING;
+        result->display = -1;
         if (!list_add_item(g_session_list, (tintptr)result))
         {
             g_free(result);
@@ -206,110 +241,133 @@ x_server_running_check_ports(int display)
     return x_running;
 }
 
-/******************************************************************************/
-/* Helper function for get_sorted_display_list():qsort() */
-static int
-icmp(const void *v1, const void *v2)
-{
-    // Pointers point to unsigned ints
-    unsigned int i1 = *(unsigned int *)v1;
-    unsigned int i2 = *(unsigned int *)v2;
-    return (i1 < i2) ? -1 : (i1 > i2) ? 1 : 0;
-}
-
 /******************************************************************************/
 /**
- * Get a sorted array of all the displays allocated to sessions
- * @param[out] cnt Count of displays in list
- * @return Allocated array of displays or NULL for no memory
+ * Makes sure the display bitmaps can hold a display number
+ * @param display Display number
+ * @return 0 for success
  *
- * Result must always be freed, even if cnt == 0
+ * If the bitmaps are reallocated, the in-use bitmap is rebuilt from the
+ * session list, and the foreign displays are forgotten.
  */
-
-static unsigned int *
-get_sorted_session_displays(unsigned int *cnt)
+static int
+display_bitmaps_ensure(unsigned int display)
 {
-    unsigned int *displays;
+    unsigned int words = DISPLAY_WORD(display) + 1;
+    tui32 *in_use;
+    tui32 *foreign;
+    int i;
 
-    *cnt = 0;
-    displays = g_new(unsigned int, session_list_get_count() + 1);
-    if (displays == NULL)
+    if (words <= g_display_bitmap_words)
     {
-        LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display list");
+        return 0;
     }
-    else if (g_session_list != NULL)
+
+    in_use = g_new0(tui32, words);
+    foreign = g_new0(tui32, words);
+    if (in_use == NULL || foreign == NULL)
     {
-        int i;
+        LOG(LOG_LEVEL_ERROR, "Can't allocate memory for display bitmap");
+        g_free(in_use);
+        g_free(foreign);
+        return 1;
+    }
 
-        for (i = 0 ; i < g_session_list->count ; ++i)
+    g_free(g_displays_in_use);
+    g_free(g_displays_foreign);
+    g_displays_in_use = in_use;
+    g_displays_foreign = foreign;
+    g_display_bitmap_words = words;
+
+    for (i = 0 ; g_session_list != NULL && i < g_session_list->count ; ++i)
+    {
+        const struct session_item *si;
+        si = (const struct session_item *)list_get_item(g_session_list, i);
+        if (si->display >= 0 && (unsigned int)si->display <= display)
         {
-            const struct session_item *si;
-            si = (const struct session_item *)list_get_item(g_session_list, i);
-            if (SESSION_IN_USE(si) && si->display >= 0)
-            {
-                displays[(*cnt)++] = si->display;
-            }
+            in_use[DISPLAY_WORD(si->display)] |= DISPLAY_BIT(si->display);
         }
-        qsort(displays, *cnt, sizeof(displays[0]), icmp);
     }
 
-    return displays;
+    return 0;
+}
+
+/******************************************************************************/
+int
+session_list_set_display(struct session_item *si, int display)
+{
+    if (display < 0 || display_bitmaps_ensure(display) != 0)
+    {
+        return 1;
+    }
+
+    si->display = display;
+    g_displays_in_use[DISPLAY_WORD(display)] |= DISPLAY_BIT(display);
+    return 0;
 }
 
 /******************************************************************************/
 int
 session_list_get_available_display(void)
 {
-    int rv = -1;
-    unsigned int max_alloc = 0;
-
-    // Find all displays already allocated. We do this to prevent
-    // unnecessary file system accesses, and also to prevent us allocating
-    // the same display number to two callers who call in quick
-    // succession  i.e. if the first caller has not created its X server
-    // by the time we service the second request
-    unsigned int *allocated_displays = get_sorted_session_displays(&max_alloc);
-    if (allocated_displays != NULL)
+    unsigned int display = g_cfg->sess.x11_display_offset;
+    unsigned int max_display = g_cfg->sess.max_display_number;
+    unsigned int probes = 0;
+    unsigned int word;
+    tui32 used;
+    int now;
+
+    if (display > max_display || display_bitmaps_ensure(max_display) != 0)
+    {
+        display = max_display + 1;
+    }
+    else
     {
-        unsigned int i = 0;
-        unsigned int display;
+        now = g_time1();
+        if (now >= g_foreign_recheck_time)
+        {
+            g_memset(g_displays_foreign, 0,
+                     g_display_bitmap_words * sizeof(tui32));
+            g_foreign_recheck_time = now + FOREIGN_DISPLAY_RECHECK_TIME;
+        }
 
-        for (display = g_cfg->sess.x11_display_offset;
-                display <= g_cfg->sess.max_display_number;
-                ++display)
+        // Only displays which are free in the bitmaps are probed. This
+        // is normally just the first one, unless something other than
+        // sesman has started an X server.
+        while (display <= max_display)
         {
-            // Have we already allocated this one?
-            while (i < max_alloc && display > allocated_displays[i])
+            word = DISPLAY_WORD(display);
+            used = g_displays_in_use[word] | g_displays_foreign[word];
+            if (used == 0xffffffff)
             {
-                ++i;
+                display = (word + 1) * 32;
+                continue;
             }
-            if (i < max_alloc && display == allocated_displays[i])
+            if ((used & DISPLAY_BIT(display)) == 0)
             {
-                continue; // Already allocated
-            }
-
-            if (!x_server_running_check_ports(display))
-            {
-                break;
+                ++probes;
+                if (!x_server_running_check_ports(display))
+                {
+                    break;
+                }
+                g_displays_foreign[word] |= DISPLAY_BIT(display);
             }
+            ++display;
         }
+    }
 
-        g_free(allocated_displays);
+    LOG(LOG_LEVEL_DEBUG, "%s: %u displays probed", __func__, probes);
 
-        if (display > g_cfg->sess.max_display_number)
-        {
-            LOG(LOG_LEVEL_ERROR,
-                "X server -- no display in range (%d to %d) is available",
-                g_cfg->sess.x11_display_offset,
-                g_cfg->sess.max_display_number);
-        }
-        else
-        {
-            rv = display;
-        }
+    if (display > max_display)
+    {
+        LOG(LOG_LEVEL_ERROR,
+            "X server -- no display in range (%d to %d) is available",
+            g_cfg->sess.x11_display_offset,
+            g_cfg->sess.max_display_number);
+        return -1;
     }
 
-    return rv;
+    return (int)display;
 }
 
 /******************************************************************************/
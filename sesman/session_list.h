@@ -111,11 +111,28 @@ session_list_new(void);
  * Get the next available display
  *
  * The display isn't reserved until the caller has allocated a new session
- * (with session_list_new()) and put the new display in it.
+ * (with session_list_new()) and put the new display in it with
+ * session_list_set_display().
+ *
+ * Displays used by our own sessions are skipped without being probed.
+ * Displays found to be in use by something else are remembered for
+ * a short while, and are not probed again during that time.
  */
 int
 session_list_get_available_display(void);
 
+/**
+ * Sets the display for a session, and reserves it
+ *
+ * @param si Session item
+ * @param display Display number
+ * @return 0 for success
+ *
+ * The display is released when the session is removed from the list.
+ */
+int
+session_list_set_display(struct session_item *si, int display);
+
 /**
  *
  * @brief finds a session matching the supplied parameters
@@ -34,6 +34,7 @@
 #include "sesman_config.h"
 #include "log.h"
 #include "os_calls.h"
+#include "sesexec_control.h"
 #include "sesman.h"
 #include "session_list.h"
 #include "string_calls.h"
@@ -75,6 +76,10 @@ sig_sesman_reload_cfg(void)
     /* replace old config with newly read one */
     g_cfg = cfg;
 
+    /* Idle sesexec processes are running with the old config. They are
+     * replaced from the main loop */
+    sesexec_pool_drain();
+
     /* Restart logging subsystem */
     error = log_start(g_cfg->sesman_ini, "xrdp-sesman", LOG_START_RESTART);
 
@@ -0,0 +1,376 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file sesload.c
+ * @brief Login load test for sesman
+ *
+ * Makes concurrent system logins to a running sesman, and reports
+ * the login latencies. Successful logins are logged out again without
+ * creating a session.
+ *
+ * Authentication is done by a sesexec process for each login, so a slow
+ * authentication shouldn't delay other logins. To check this, give the
+ * xrdp-sesman PAM service a slow stub, for example:-
+ *
+ *     auth     required pam_exec.so quiet /bin/sleep 1
+ *     auth     required pam_permit.so
+ *     account  required pam_permit.so
+ *
+ * Then run, as a user who can connect to sesman:-
+ *
+ *     xrdp-sesload -n 50 -P 50 -p anything someuser
+ *
+ * If logins are serialized, the p99 latency will be around 50 seconds
+ * rather than 1 second.
+ *
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "trans.h"
+#include "os_calls.h"
+#include "sesman_config.h"
+#include "log.h"
+#include "string_calls.h"
+
+#include "scp.h"
+
+#if !defined(PACKAGE_VERSION)
+#define PACKAGE_VERSION "???"
+#endif
+
+#define DEFAULT_LOGIN_COUNT 20
+#define MAX_PARALLEL 256
+
+/**
+ * A login in progress
+ */
+struct login
+{
+    struct trans *t;
+    int start_time; ///< Milliseconds
+    int done;
+    int ok;
+};
+
+/**
+ * Results for the whole run
+ */
+struct results
+{
+    int *latencies; ///< Milliseconds, for completed logins
+    int count;
+    int failed;
+};
+
+static const char *g_username;
+static const char *g_password = "";
+static struct results g_results;
+
+/**************************************************************************//**
+ * Prints a brief summary of options and defaults
+ */
+static void
+usage(void)
+{
+    g_printf("xrdp sesman login load test v" PACKAGE_VERSION "\n");
+    g_printf("\nusage:\n");
+    g_printf("sesload [options] username\n\n");
+    g_printf("options:\n");
+    g_printf("    -n <count>            Number of logins. Default:%d\n"
+             "    -P <parallel>         Logins in progress at once."
+             " Default: all\n"
+             "    -p <password>         TESTING ONLY - DO NOT USE IN"
+             " PRODUCTION\n"
+             "    -c <sesman_ini>       Alternative sesman.ini file\n",
+             DEFAULT_LOGIN_COUNT);
+}
+
+/**************************************************************************//**
+ * Called when data is available on a login connection
+ */
+static int
+login_data_in(struct trans *t)
+{
+    struct login *login = (struct login *)t->callback_data;
+    enum scp_login_status login_result;
+    int server_closed;
+    int available;
+    int rv;
+
+    rv = scp_msg_in_check_available(t, &available);
+    if (rv != 0 || !available)
+    {
+        return rv;
+    }
+
+    if (scp_msg_in_get_msgno(t) == E_SCP_LOGIN_RESPONSE)
+    {
+        rv = scp_get_login_response(t, &login_result, &server_closed, NULL);
+        if (rv == 0)
+        {
+            g_results.latencies[g_results.count++] =
+                g_time3() - login->start_time;
+            login->done = 1;
+            login->ok = (login_result == E_SCP_LOGIN_OK);
+            if (login->ok)
+            {
+                /* Don't leave a sesexec waiting for a session request */
+                (void)scp_send_logout_request(t);
+            }
+            else
+            {
+                char msg[256];
+                scp_login_status_to_str(login_result, msg, sizeof(msg));
+                LOG(LOG_LEVEL_WARNING, "Login failed; %s", msg);
+            }
+        }
+    }
+    scp_msg_in_reset(t);
+
+    return rv;
+}
+
+/**************************************************************************//**
+ * Starts a login
+ *
+ * @return 0 for success
+ */
+static int
+login_start(struct login *login, const char *port)
+{
+    g_memset(login, 0, sizeof(*login));
+    login->t = scp_connect(port, "xrdp-sesload", NULL);
+    if (login->t == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "connect error - %s", g_get_strerror());
+        return 1;
+    }
+    login->t->trans_data_in = login_data_in;
+    login->t->callback_data = (void *)login;
+    login->start_time = g_time3();
+    if (scp_send_sys_login_request(login->t, g_username, g_password,
+                                   "127.0.0.1") != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Error sending login request to sesman");
+        trans_delete(login->t);
+        login->t = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+icmp(const void *v1, const void *v2)
+{
+    int i1 = *(const int *)v1;
+    int i2 = *(const int *)v2;
+    return (i1 < i2) ? -1 : (i1 > i2) ? 1 : 0;
+}
+
+/**************************************************************************//**
+ * Returns a percentile from a sorted array
+ */
+static int
+percentile(const int *sorted, int count, int pc)
+{
+    int index = (count * pc + 99) / 100 - 1;
+    if (index < 0)
+    {
+        index = 0;
+    }
+    return sorted[index];
+}
+
+/**************************************************************************//**
+ * Runs the logins
+ *
+ * @return 0 if all the logins completed
+ */
+static int
+run_logins(const char *port, int count, int parallel)
+{
+    struct login logins[MAX_PARALLEL] = {{0}};
+    intptr_t robjs[MAX_PARALLEL];
+    int robjs_count;
+    int started = 0;
+    int in_progress;
+    int i;
+
+    for (;;)
+    {
+        /* Start more logins, and collect the ones in progress */
+        robjs_count = 0;
+        in_progress = 0;
+        for (i = 0 ; i < parallel ; ++i)
+        {
+            struct login *login = &logins[i];
+            if (login->t != NULL && (login->done ||
+                                     login->t->status != TRANS_STATUS_UP))
+            {
+                if (!login->done || !login->ok)
+                {
+                    ++g_results.failed;
+                }
+                trans_delete(login->t);
+                login->t = NULL;
+            }
+            if (login->t == NULL && started < count)
+            {
+                ++started;
+                if (login_start(login, port) != 0)
+                {
+                    return 1;
+                }
+            }
+            if (login->t != NULL)
+            {
+                ++in_progress;
+                (void)trans_get_wait_objs(login->t, robjs, &robjs_count);
+            }
+        }
+
+        if (in_progress == 0)
+        {
+            break;
+        }
+
+        if (g_obj_wait(robjs, robjs_count, NULL, 0, -1) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "Unexpected error from g_obj_wait()");
+            return 1;
+        }
+
+        for (i = 0 ; i < parallel ; ++i)
+        {
+            struct login *login = &logins[i];
+            if (login->t != NULL && !login->done &&
+                    trans_check_wait_objs(login->t) != 0)
+            {
+                login->t->status = TRANS_STATUS_DOWN;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
+int
+main(int argc, char **argv)
+{
+    const char *sesman_ini = XRDP_CFG_PATH "/sesman.ini";
+    struct config_sesman *cfg = NULL;
+    struct log_config *logging;
+    int count = DEFAULT_LOGIN_COUNT;
+    int parallel = 0;
+    int start_time;
+    int elapsed;
+    int opt;
+    int rv = 1;
+
+    logging = log_config_init_for_console(LOG_LEVEL_WARNING,
+                                          g_getenv("SESLOAD_LOG_LEVEL"));
+    log_start_from_param(logging);
+    log_config_free(logging);
+
+    while ((opt = getopt(argc, argv, "n:P:p:c:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                count = g_atoi(optarg);
+                break;
+            case 'P':
+                parallel = g_atoi(optarg);
+                break;
+            case 'p':
+                g_password = optarg;
+                break;
+            case 'c':
+                sesman_ini = optarg;
+                break;
+            default:
+                usage();
+                log_end();
+                return 1;
+        }
+    }
+
+    if (optind + 1 != argc || count < 1)
+    {
+        usage();
+        log_end();
+        return 1;
+    }
+    g_username = argv[optind];
+    if (parallel < 1 || parallel > count)
+    {
+        parallel = count;
+    }
+    if (parallel > MAX_PARALLEL)
+    {
+        parallel = MAX_PARALLEL;
+    }
+
+    if ((cfg = config_read(sesman_ini)) == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "error reading config file %s : %s",
+            sesman_ini, g_get_strerror());
+    }
+    else if ((g_results.latencies = g_new(int, count)) == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "Out of memory");
+    }
+    else
+    {
+        start_time = g_time3();
+        rv = run_logins(cfg->listen_port, count, parallel);
+        elapsed = g_time3() - start_time;
+
+        g_printf("logins:    %d (%d parallel)\n", count, parallel);
+        g_printf("completed: %d\n", g_results.count);
+        g_printf("failed:    %d\n", g_results.failed);
+        g_printf("elapsed:   %d ms\n", elapsed);
+        if (g_results.count > 0)
+        {
+            qsort(g_results.latencies, g_results.count, sizeof(int), icmp);
+            g_printf("latency:   min %d ms, p50 %d ms, p99 %d ms, max %d ms\n",
+                     g_results.latencies[0],
+                     percentile(g_results.latencies, g_results.count, 50),
+                     percentile(g_results.latencies, g_results.count, 99),
+                     g_results.latencies[g_results.count - 1]);
+        }
+        if (g_results.count < count)
+        {
+            rv = 1;
+        }
+    }
+
+    g_free(g_results.latencies);
+    config_free(cfg);
+    log_end();
+
+    return rv;
+}
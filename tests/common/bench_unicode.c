@@ -0,0 +1,248 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmark for the UTF-8 / UTF-16LE stream converters
+ *
+ * This is built by 'make check' but not run by it. Run it by hand:-
+ *
+ *     ./bench_unicode [seconds]
+ *
+ * A few megabytes of text are converted in each direction, as for a
+ * clipboard paste. MB of UTF-8 per second are reported for
+ * out_utf8_as_utf16_le() and in_utf16_le_terminated_as_utf8(), and
+ * for character at a time loops like the ones they replaced.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "string_calls.h"
+#include "unicode_defines.h"
+
+#define TEXT_BYTES (4 * 1024 * 1024)
+
+/*****************************************************************************/
+/* fills text with repeats of a sample, and terminates it */
+static int
+make_text(char *text, const char *sample)
+{
+    int sample_len = strlen(sample);
+    int len = 0;
+
+    while (len + sample_len < TEXT_BYTES)
+    {
+        memcpy(text + len, sample, sample_len);
+        len += sample_len;
+    }
+    text[len] = '\0';
+    return len;
+}
+
+/*****************************************************************************/
+/* reference UTF-8 to UTF-16LE, a character at a time */
+static void
+ref_out_utf8_as_utf16_le(struct stream *s, const char *v, unsigned int vn)
+{
+    while (vn > 0)
+    {
+        char32_t c32 = utf8_get_next_char(&v, &vn);
+        if (c32 < 0x10000)
+        {
+            out_uint16_le(s, c32);
+        }
+        else
+        {
+            out_uint16_le(s, HIGH_SURROGATE_FROM_C32(c32));
+            out_uint16_le(s, LOW_SURROGATE_FROM_C32(c32));
+        }
+    }
+}
+
+/*****************************************************************************/
+/* reference UTF-16LE to UTF-8, a character at a time */
+static unsigned int
+ref_in_utf16_le_terminated_as_utf8(struct stream *s, char *v,
+                                   unsigned int vn)
+{
+    unsigned int rv = 0;
+    char u8str[MAXLEN_UTF8_CHAR];
+    unsigned int u8len;
+    unsigned int i;
+    char32_t c32;
+    char16_t w;
+    char16_t low;
+
+    while (s_check_rem(s, 2))
+    {
+        in_uint16_le(s, w);
+        c32 = UCS_REPLACEMENT_CHARACTER;
+        if (IS_HIGH_SURROGATE(w))
+        {
+            if (s_check_rem(s, 2))
+            {
+                in_uint16_le(s, low);
+                if (IS_LOW_SURROGATE(low))
+                {
+                    c32 = C32_FROM_SURROGATE_PAIR(low, w);
+                }
+                else
+                {
+                    s->p -= 2;
+                }
+            }
+        }
+        else if (!IS_LOW_SURROGATE(w) &&
+                 !IS_PLANE_END_NON_CHARACTER(w) &&
+                 !IS_ARABIC_NON_CHARACTER(w))
+        {
+            c32 = w;
+        }
+        if (c32 == 0)
+        {
+            break;
+        }
+        u8len = utf_char32_to_utf8(c32, u8str);
+        if (u8len + 1 <= vn)
+        {
+            for (i = 0; i < u8len; i++)
+            {
+                v[i] = u8str[i];
+            }
+            vn -= u8len;
+            v += u8len;
+        }
+        else if (vn > 1)
+        {
+            vn = 1;
+        }
+        rv += u8len;
+    }
+    if (vn > 0)
+    {
+        *v = '\0';
+    }
+    return rv + 1;
+}
+
+/*****************************************************************************/
+static void
+run(const char *name, const char *sample, int msecs)
+{
+    char *text;
+    char *out;
+    struct stream *s;
+    int len;
+    int words;
+    int count;
+    int start;
+    int elapsed;
+    double rate[4];
+    int i;
+
+    text = (char *)malloc(TEXT_BYTES);
+    out = (char *)malloc(TEXT_BYTES);
+    make_stream(s);
+    if (text == NULL || out == NULL || s == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    len = make_text(text, sample);
+    words = utf8_as_utf16_word_count(text, len + 1);
+    init_stream(s, words * 2);
+
+    for (i = 0; i < 4; i++)
+    {
+        count = 0;
+        start = g_time3();
+        do
+        {
+            s->p = s->data;
+            switch (i)
+            {
+                case 0:
+                    ref_out_utf8_as_utf16_le(s, text, len + 1);
+                    break;
+                case 1:
+                    out_utf8_as_utf16_le(s, text, len + 1);
+                    break;
+                case 2:
+                    s->end = s->data + words * 2;
+                    ref_in_utf16_le_terminated_as_utf8(s, out, TEXT_BYTES);
+                    break;
+                default:
+                    s->end = s->data + words * 2;
+                    in_utf16_le_terminated_as_utf8(s, out, TEXT_BYTES);
+                    break;
+            }
+            count++;
+            elapsed = g_time3() - start;
+        }
+        while (elapsed < msecs);
+        rate[i] = (double)len * count / (1024.0 * 1024.0) * 1000.0 / elapsed;
+    }
+    if (strcmp(out, text) != 0)
+    {
+        fprintf(stderr, "%s: round trip failed\n", name);
+        exit(1);
+    }
+
+    printf("%-8s UTF-8 to UTF-16 %8.0f MB/s (%6.0f MB/s, %4.1fx)\n",
+           name, rate[1], rate[0], rate[1] / rate[0]);
+    printf("%-8s UTF-16 to UTF-8 %8.0f MB/s (%6.0f MB/s, %4.1fx)\n",
+           name, rate[3], rate[2], rate[3] / rate[2]);
+
+    free_stream(s);
+    free(out);
+    free(text);
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    int msecs = 1000;
+
+    if (argc > 1)
+    {
+        msecs = atoi(argv[1]) * 1000;
+        if (msecs <= 0)
+        {
+            fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("Character at a time rates are in brackets\n");
+    run("ASCII",
+        "The quick brown fox jumps over the lazy dog.\n"
+        "    if (rv == 0) { return 1; }\n", msecs);
+    run("Latin-1",
+        "Le c\xc5\x93ur d\xc3\xa9\xc3\xa7u mais l'\xc3\xa2me plut\xc3\xb4t "
+        "na\xc3\xafve, Lou\xc3\xbfs r\xc3\xaava de crapa\xc3\xbcter.\n",
+        msecs);
+    run("CJK",
+        "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe3\x83\x86"
+        "\xe3\x82\xad\xe3\x82\xb9\xe3\x83\x88\xe3\x80\x82\n", msecs);
+    return 0;
+}
@@ -9,6 +9,7 @@ bin_to_hex(const char *input, int length);
 
 Suite *make_suite_test_fifo(void);
 Suite *make_suite_test_list(void);
+Suite *make_suite_test_mem_account(void);
 Suite *make_suite_test_parse(void);
 Suite *make_suite_test_string(void);
 Suite *make_suite_test_string_unicode(void);
@@ -17,6 +18,7 @@ Suite *make_suite_test_ssl_calls(void);
 Suite *make_suite_test_base64(void);
 Suite *make_suite_test_guid(void);
 Suite *make_suite_test_scancode(void);
+Suite *make_suite_test_trans(void);
 
 TCase *make_tcase_test_os_calls_signals(void);
 
@@ -0,0 +1,112 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "mem_account.h"
+#include "os_calls.h"
+
+#include "test_common.h"
+
+/******************************************************************************/
+
+START_TEST(test_mem_account__disabled)
+{
+    struct mem_account_usage usage;
+    char *p;
+
+    /* This test must run before accounting is enabled */
+    ck_assert_int_eq(mem_account_is_enabled(), 0);
+
+    p = (char *)mem_account_malloc(MEM_TAG_ENCODER, 1000, 1);
+    ck_assert_ptr_ne(p, NULL);
+    mem_account_add(MEM_TAG_TRANS, 500);
+
+    mem_account_get_usage(MEM_TAG_COUNT, &usage);
+    ck_assert_int_eq(usage.current, 0);
+    ck_assert_int_eq(usage.peak, 0);
+
+    mem_account_free(p);
+}
+END_TEST
+
+/******************************************************************************/
+
+START_TEST(test_mem_account__tagged_alloc)
+{
+    struct mem_account_usage before;
+    struct mem_account_usage after;
+    struct mem_account_usage total;
+    char *p;
+    int i;
+
+    mem_account_enable();
+    ck_assert_int_ne(mem_account_is_enabled(), 0);
+
+    mem_account_get_usage(MEM_TAG_ENCODER, &before);
+
+    p = (char *)mem_account_malloc(MEM_TAG_ENCODER, 4096, 1);
+    ck_assert_ptr_ne(p, NULL);
+    for (i = 0 ; i < 4096 ; ++i)
+    {
+        ck_assert_int_eq(p[i], 0);
+    }
+
+    mem_account_get_usage(MEM_TAG_ENCODER, &after);
+    ck_assert_int_eq(after.current, before.current + 4096);
+    ck_assert_int_ge(after.peak, before.current + 4096);
+
+    mem_account_get_usage(MEM_TAG_COUNT, &total);
+    ck_assert_int_ge(total.current, 4096);
+
+    mem_account_free(p);
+    mem_account_free(NULL);
+
+    mem_account_get_usage(MEM_TAG_ENCODER, &after);
+    ck_assert_int_eq(after.current, before.current);
+    ck_assert_int_ge(after.peak, before.current + 4096);
+}
+END_TEST
+
+/******************************************************************************/
+
+START_TEST(test_mem_account__add_sub)
+{
+    struct mem_account_usage before;
+    struct mem_account_usage after;
+
+    mem_account_enable();
+    mem_account_get_usage(MEM_TAG_CACHE, &before);
+
+    mem_account_add(MEM_TAG_CACHE, 1000);
+    mem_account_add(MEM_TAG_CACHE, 2000);
+    mem_account_sub(MEM_TAG_CACHE, 2500);
+
+    mem_account_get_usage(MEM_TAG_CACHE, &after);
+    ck_assert_int_eq(after.current, before.current + 500);
+    ck_assert_int_ge(after.peak, before.current + 3000);
+
+    /* Over-crediting a tag doesn't underflow */
+    mem_account_sub(MEM_TAG_CACHE, after.current + 1);
+    mem_account_get_usage(MEM_TAG_CACHE, &after);
+    ck_assert_int_eq(after.current, 0);
+}
+END_TEST
+
+/******************************************************************************/
+
+Suite *
+make_suite_test_mem_account(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("MemAccount");
+
+    tc = tcase_create("mem_account");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_mem_account__disabled);
+    tcase_add_test(tc, test_mem_account__tagged_alloc);
+    tcase_add_test(tc, test_mem_account__add_sub);
+
+    return s;
+}
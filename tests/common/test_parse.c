@@ -2,13 +2,22 @@
 #include "config_ac.h"
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "arch.h"
+#include "defines.h"
 #include "os_calls.h"
 #include "string_calls.h"
 #include "parse.h"
+#include "unicode_defines.h"
 
 #include "test_common.h"
 
+#ifndef TOP_SRCDIR
+#define TOP_SRCDIR "."
+#endif
+
 #define ELEMENTS(x) (sizeof(x) / sizeof(x[0]))
 
 const static char
@@ -298,6 +307,213 @@ START_TEST(test_in_utf16_le_significant_chars)
 }
 END_TEST
 
+/******************************************************************************/
+/**
+ * Converts UTF-8 to UTF-16 a character at a time, as a reference for
+ * out_utf8_as_utf16_le()
+ *
+ * @return Number of words written to out
+ */
+static unsigned int
+ref_utf8_to_utf16(const char *v, unsigned int vn, char16_t *out)
+{
+    unsigned int rv = 0;
+    while (vn > 0)
+    {
+        char32_t c32 = utf8_get_next_char(&v, &vn);
+        if (c32 < 0x10000)
+        {
+            out[rv++] = (char16_t)c32;
+        }
+        else
+        {
+            out[rv++] = HIGH_SURROGATE_FROM_C32(c32);
+            out[rv++] = LOW_SURROGATE_FROM_C32(c32);
+        }
+    }
+    return rv;
+}
+
+/******************************************************************************/
+/**
+ * Converts UTF-8 to UTF-16 and back again, checking the results against
+ * a character at a time conversion
+ */
+static void
+check_utf8_round_trip(const char *utf8, unsigned int len)
+{
+    struct stream *s;
+    char16_t *ref16 = (char16_t *)malloc((len + 1) * sizeof(char16_t));
+    char *ref8 = (char *)malloc(len * 3 + 1);
+    char *out8 = (char *)malloc(len * 3 + 1);
+    unsigned int ref16_len;
+    unsigned int ref8_len;
+    unsigned int rv;
+    unsigned int i;
+    char16_t w;
+
+    ck_assert_ptr_nonnull(ref16);
+    ck_assert_ptr_nonnull(ref8);
+    ck_assert_ptr_nonnull(out8);
+
+    ref16_len = ref_utf8_to_utf16(utf8, len, ref16);
+    ck_assert_int_eq(utf8_as_utf16_word_count(utf8, len), ref16_len);
+
+    make_stream(s);
+    init_stream(s, (ref16_len + 1) * 2);
+    out_utf8_as_utf16_le(s, utf8, len);
+    s_mark_end(s);
+    ck_assert_int_eq(s->end - s->data, ref16_len * 2);
+    s->p = s->data;
+    for (i = 0; i < ref16_len; ++i)
+    {
+        in_uint16_le(s, w);
+        if (w != ref16[i])
+        {
+            ck_abort_msg("UTF-16 word %u expected %x, got %x",
+                         i, ref16[i], w);
+        }
+    }
+
+    /* Back again, a word at a time and then all at once */
+    s->p = s->data;
+    ref8_len = 0;
+    for (i = 0; i < ref16_len; ++i)
+    {
+        unsigned int n = 1;
+        if (IS_HIGH_SURROGATE(ref16[i]) && i + 1 < ref16_len &&
+                IS_LOW_SURROGATE(ref16[i + 1]))
+        {
+            n = 2;
+        }
+        ref8_len += in_utf16_le_fixed_as_utf8(s, n, ref8 + ref8_len,
+                                              len * 3 + 1 - ref8_len) - 1;
+        i += n - 1;
+    }
+
+    s->p = s->data;
+    rv = in_utf16_le_fixed_as_utf8(s, ref16_len, out8, len * 3 + 1);
+    ck_assert_int_eq(rv, ref8_len + 1);
+    ck_assert_mem_eq(out8, ref8, ref8_len + 1);
+    ck_assert_int_eq(s_check_end(s), 1);
+
+    free_stream(s);
+    free(out8);
+    free(ref8);
+    free(ref16);
+}
+
+/******************************************************************************/
+/* The Markus Kuhn UTF-8 decoder test file has plenty of valid and invalid
+ * sequences, between runs of ASCII of all lengths */
+START_TEST(test_utf8_test_file_round_trip)
+{
+    const char *filename = TOP_SRCDIR "/tests/common/UTF-8-test.txt";
+    int size = g_file_get_size(filename);
+    char *data;
+    int fd;
+    int offset;
+
+    ck_assert_int_gt(size, 0);
+    data = (char *)malloc(size);
+    ck_assert_ptr_nonnull(data);
+    fd = g_file_open_ro(filename);
+    ck_assert_int_ge(fd, 0);
+    ck_assert_int_eq(g_file_read(fd, data, size), size);
+    g_file_close(fd);
+
+    check_utf8_round_trip(data, size);
+    /* Start at odd places, so the word loads aren't aligned */
+    for (offset = 1; offset < 8; ++offset)
+    {
+        check_utf8_round_trip(data + offset, size - offset);
+    }
+
+    free(data);
+}
+END_TEST
+
+/******************************************************************************/
+/* Checks truncation and terminators at every position around the
+ * ASCII runs */
+START_TEST(test_in_utf16_le_ascii_runs)
+{
+    char text[32];
+    char buff[32];
+    char16_t words[32];
+    struct stream *s;
+    unsigned int len;
+    unsigned int pos;
+    unsigned int vn;
+    unsigned int i;
+    unsigned int rv;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    for (len = 1; len < 20; ++len)
+    {
+        for (pos = 0; pos < len; ++pos)
+        {
+            /* An ASCII string with an e-acute at pos */
+            for (i = 0; i < len; ++i)
+            {
+                words[i] = 'a' + i;
+                text[i] = 'a' + i;
+            }
+            words[pos] = 0xe9;
+
+            init_stream(s, 8192);
+            for (i = 0; i < len; ++i)
+            {
+                out_uint16_le(s, words[i]);
+            }
+            s_mark_end(s);
+
+            for (vn = 0; vn < len + 3; ++vn)
+            {
+                /* What fits is the characters before any which don't */
+                unsigned int expect = 0;
+                for (i = 0; i < len; ++i)
+                {
+                    unsigned int clen = (i == pos) ? 2 : 1;
+                    if (expect + clen + 1 > vn)
+                    {
+                        break;
+                    }
+                    expect += clen;
+                }
+
+                s->p = s->data;
+                memset(buff, 'X', sizeof(buff));
+                rv = in_utf16_le_fixed_as_utf8(s, len, buff, vn);
+                ck_assert_int_eq(rv, len + 2);
+                if (vn > 0)
+                {
+                    ck_assert_int_eq(buff[expect], '\0');
+                    ck_assert_int_eq(buff[expect + 1], 'X');
+                    ck_assert_mem_eq(buff, text, MIN(expect, pos));
+                }
+                else
+                {
+                    ck_assert_int_eq(buff[0], 'X');
+                }
+            }
+
+            /* Terminate the string at pos instead */
+            s->p = s->data + pos * 2;
+            out_uint16_le(s, 0);
+            s->p = s->data;
+            rv = in_utf16_le_terminated_as_utf8(s, buff, sizeof(buff));
+            ck_assert_int_eq(rv, pos + 1);
+            ck_assert_mem_eq(buff, text, pos);
+            ck_assert_int_eq(buff[pos], '\0');
+            ck_assert_ptr_eq(s->p, s->data + pos * 2 + 2);
+        }
+    }
+    free_stream(s);
+}
+END_TEST
+
 /******************************************************************************/
 
 Suite *
@@ -314,6 +530,8 @@ make_suite_test_parse(void)
     tcase_add_test(tc_unicode, test_in_utf16_le_fixed_as_utf8);
     tcase_add_test(tc_unicode, test_in_utf16_le_terminated_as_utf8);
     tcase_add_test(tc_unicode, test_in_utf16_le_significant_chars);
+    tcase_add_test(tc_unicode, test_utf8_test_file_round_trip);
+    tcase_add_test(tc_unicode, test_in_utf16_le_ascii_runs);
 
     return s;
 }
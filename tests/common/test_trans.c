@@ -0,0 +1,129 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "os_calls.h"
+#include "trans.h"
+
+#include "test_common.h"
+
+#define NUM_CLIENTS 3
+
+static char g_sock_path[256];
+static int g_client_sck[NUM_CLIENTS];
+static struct trans *g_lis;
+static int g_conn_in_count;
+
+/******************************************************************************/
+/* Connection callback which deletes its own listener, as chansrv does */
+static int
+conn_in_delete_listener(struct trans *self, struct trans *new_self)
+{
+    ++g_conn_in_count;
+    trans_delete(new_self);
+    trans_delete(self);
+    g_lis = NULL;
+    return 0;
+}
+
+/******************************************************************************/
+static int
+conn_in_count(struct trans *self, struct trans *new_self)
+{
+    ++g_conn_in_count;
+    trans_delete(new_self);
+    return 0;
+}
+
+/******************************************************************************/
+static void
+setup(void)
+{
+    int i;
+
+    g_snprintf(g_sock_path, sizeof(g_sock_path),
+               "/tmp/xrdp_test_trans_%d.socket", g_getpid());
+    g_conn_in_count = 0;
+
+    g_lis = trans_create(TRANS_MODE_UNIX, 8192, 8192);
+    ck_assert_ptr_ne(g_lis, NULL);
+    ck_assert_int_eq(trans_listen(g_lis, g_sock_path), 0);
+
+    /* Leave a few connections waiting in the backlog */
+    for (i = 0 ; i < NUM_CLIENTS ; ++i)
+    {
+        g_client_sck[i] = g_sck_local_socket();
+        ck_assert_int_ge(g_client_sck[i], 0);
+        ck_assert_int_eq(g_sck_local_connect(g_client_sck[i], g_sock_path), 0);
+    }
+}
+
+/******************************************************************************/
+static void
+teardown(void)
+{
+    int i;
+
+    for (i = 0 ; i < NUM_CLIENTS ; ++i)
+    {
+        g_sck_close(g_client_sck[i]);
+    }
+    trans_delete(g_lis);
+    g_lis = NULL;
+}
+
+/******************************************************************************/
+START_TEST(test_trans__listener_deleted_in_conn_in)
+{
+    g_lis->trans_conn_in = conn_in_delete_listener;
+
+    /* Must not touch the listener again once the callback has run */
+    ck_assert_int_eq(trans_check_wait_objs(g_lis), 0);
+    ck_assert_int_eq(g_conn_in_count, 1);
+    ck_assert_ptr_eq(g_lis, NULL);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__default_accept_limit)
+{
+    g_lis->trans_conn_in = conn_in_count;
+
+    ck_assert_int_eq(trans_check_wait_objs(g_lis), 0);
+    ck_assert_int_eq(g_conn_in_count, 1);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_trans__burst_accept_limit)
+{
+    g_lis->trans_conn_in = conn_in_count;
+    g_lis->accept_limit = TRANS_BURST_ACCEPT_LIMIT;
+
+    ck_assert_int_eq(trans_check_wait_objs(g_lis), 0);
+    ck_assert_int_eq(g_conn_in_count, NUM_CLIENTS);
+
+    /* Backlog is now empty */
+    ck_assert_int_eq(trans_check_wait_objs(g_lis), 0);
+    ck_assert_int_eq(g_conn_in_count, NUM_CLIENTS);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_trans(void)
+{
+    Suite *s;
+    TCase *tc_accept;
+
+    s = suite_create("Trans");
+
+    tc_accept = tcase_create("trans_accept");
+    tcase_add_checked_fixture(tc_accept, setup, teardown);
+    suite_add_tcase(s, tc_accept);
+    tcase_add_test(tc_accept, test_trans__listener_deleted_in_conn_in);
+    tcase_add_test(tc_accept, test_trans__default_accept_limit);
+    tcase_add_test(tc_accept, test_trans__burst_accept_limit);
+
+    return s;
+}
@@ -0,0 +1,157 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmark for sending libipm messages
+ *
+ * This is built by 'make check' but not run by it. Run it by hand:-
+ *
+ *     ./bench_libipm [seconds]
+ *
+ * Messages like the ones sesman sends for a session list are written to
+ * a socketpair, and a child process reads them. Messages per second are
+ * reported for libipm_msg_out_simple_send(), with and without batching.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "libipm.h"
+#include "log.h"
+#include "trans.h"
+#include "os_calls.h"
+
+#define BENCH_MESSAGE_NO 1
+#define BATCH_LENGTH 32
+
+/*****************************************************************************/
+/* reads and discards everything from the socket, until it's closed */
+static void
+drain(int sck)
+{
+    char buff[16384];
+
+    while (read(sck, buff, sizeof(buff)) > 0)
+    {
+    }
+}
+
+/*****************************************************************************/
+static double
+run(const char *name, int batch, int msecs)
+{
+    struct trans *t;
+    int sck[2];
+    pid_t pid;
+    int count;
+    int start;
+    int elapsed;
+    int i;
+    double rate;
+
+    t = trans_create(TRANS_MODE_UNIX, 128, 128);
+    if (t == NULL || g_sck_local_socketpair(sck) < 0)
+    {
+        fprintf(stderr, "Can't create test transport\n");
+        exit(1);
+    }
+    pid = fork();
+    if (pid == 0)
+    {
+        close(sck[0]);
+        drain(sck[1]);
+        _exit(0);
+    }
+    close(sck[1]);
+    t->sck = sck[0];
+    t->type1 = TRANS_TYPE_CLIENT;
+    t->status = TRANS_STATUS_UP;
+    if (libipm_init_trans(t, LIBIPM_FAC_TEST, NULL) != E_LI_SUCCESS)
+    {
+        fprintf(stderr, "libipm_init_trans() call failed\n");
+        exit(1);
+    }
+
+    count = 0;
+    start = g_time3();
+    do
+    {
+        if (batch)
+        {
+            libipm_msg_out_batch_begin(t);
+        }
+        for (i = 0; i < BATCH_LENGTH; i++)
+        {
+            if (libipm_msg_out_simple_send(t, BENCH_MESSAGE_NO, "iuiqqqsxs",
+                                           10 + i, 0, 10 + i, 1920, 1080, 32,
+                                           "xorg", (int64_t)1700000000,
+                                           "192.168.1.1:34567") !=
+                    E_LI_SUCCESS)
+            {
+                fprintf(stderr, "Send failed\n");
+                exit(1);
+            }
+        }
+        if (batch)
+        {
+            libipm_msg_out_batch_end(t);
+        }
+        count += BATCH_LENGTH;
+        elapsed = g_time3() - start;
+    }
+    while (elapsed < msecs);
+
+    rate = (double)count * 1000.0 / elapsed;
+    printf("%-20s %12.0f msgs/s\n", name, rate);
+
+    trans_delete(t);
+    waitpid(pid, NULL, 0);
+    return rate;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    int msecs = 1000;
+    double single_rate;
+    double batch_rate;
+    struct log_config *logging;
+
+    if (argc > 1)
+    {
+        msecs = atoi(argv[1]) * 1000;
+        if (msecs <= 0)
+        {
+            fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    logging = log_config_init_for_console(LOG_LEVEL_WARNING, NULL);
+    log_start_from_param(logging);
+    log_config_free(logging);
+
+    single_rate = run("one write each", 0, msecs);
+    batch_rate = run("batched", 1, msecs);
+    printf("%-20s %12.1fx\n", "speedup", batch_rate / single_rate);
+    log_end();
+    return 0;
+}
@@ -304,6 +304,69 @@ START_TEST(test_libipm_send_recv_all_test)
 }
 END_TEST
 
+/***************************************************************************//**
+ * Checks batched messages are held back until the end of the batch, and
+ * arrive in order. A message carrying a file descriptor flushes the batch
+ * before it is sent.
+ */
+START_TEST(test_libipm_send_recv_batch)
+{
+    enum libipm_status status;
+    unsigned int i;
+    uint32_t u;
+    int h = -1;
+
+    status = libipm_msg_out_batch_begin(g_t_out);
+    ck_assert_int_eq(status, E_LI_SUCCESS);
+
+    for (i = 0 ; i < 3; ++i)
+    {
+        status = libipm_msg_out_simple_send(g_t_out, TEST_MESSAGE_NO + i,
+                                            "u", i);
+        ck_assert_int_eq(status, E_LI_SUCCESS);
+    }
+
+    /* Nothing has been sent yet */
+    ck_assert_int_eq(g_sck_can_recv(g_t_in->sck, 0), 0);
+
+    status = libipm_msg_out_simple_send(g_t_out, TEST_MESSAGE_NO + 3,
+                                        "h", g_fd);
+    ck_assert_int_eq(status, E_LI_SUCCESS);
+
+    status = libipm_msg_out_simple_send(g_t_out, TEST_MESSAGE_NO + 4,
+                                        "u", 4);
+    ck_assert_int_eq(status, E_LI_SUCCESS);
+
+    status = libipm_msg_out_batch_end(g_t_out);
+    ck_assert_int_eq(status, E_LI_SUCCESS);
+
+    for (i = 0 ; i < 5; ++i)
+    {
+        check_for_incoming_message(TEST_MESSAGE_NO + i);
+        if (i == 3)
+        {
+            status = libipm_msg_in_parse(g_t_in, "h", &h);
+            ck_assert_int_eq(status, E_LI_SUCCESS);
+            check_fd_is_dev_zero(h);
+            g_file_close(h);
+        }
+        else
+        {
+            status = libipm_msg_in_parse(g_t_in, "u", &u);
+            ck_assert_int_eq(status, E_LI_SUCCESS);
+            ck_assert_int_eq(u, i);
+        }
+    }
+    libipm_msg_in_reset(g_t_in);
+
+    /* Messages are sent straight away after the batch ends */
+    status = libipm_msg_out_simple_send(g_t_out, TEST_MESSAGE_NO, "u", 5);
+    ck_assert_int_eq(status, E_LI_SUCCESS);
+    check_for_incoming_message(TEST_MESSAGE_NO);
+    libipm_msg_in_reset(g_t_in);
+}
+END_TEST
+
 /***************************************************************************//**
  * Checks various receive errors for 'y'
  */
@@ -898,6 +961,7 @@ make_suite_test_libipm_recv_calls(void)
     tc = tcase_create("libipm_recv");
     suite_add_tcase(s, tc);
     tcase_add_test(tc, test_libipm_send_recv_all_test);
+    tcase_add_test(tc, test_libipm_send_recv_batch);
     tcase_add_test(tc, test_libipm_receive_y_type);
     tcase_add_test(tc, test_libipm_receive_b_type);
     tcase_add_test(tc, test_libipm_receive_n_type);
@@ -5,5 +5,7 @@
 
 Suite *make_suite_test_xrdp_sec_process_mcs_data_monitors(void);
 Suite *make_suite_test_monitor_processing(void);
+Suite *make_suite_test_xrdp_fastpath_input(void);
+Suite *make_suite_test_xrdp_orders_batch(void);
 
 #endif /* TEST_LIBXRDP_H */
@@ -0,0 +1,196 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpbcgr.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define MAX_EVENTS 32
+
+/* Events passed to the session callback */
+struct event
+{
+    int msg;
+    intptr_t param1;
+    intptr_t param2;
+    intptr_t param3;
+};
+
+static struct event events[MAX_EVENTS];
+static int event_count;
+
+static struct xrdp_rdp *rdp_layer;
+static struct xrdp_session *session;
+static struct xrdp_fastpath *fastpath;
+
+/******************************************************************************/
+static int
+record_callback(intptr_t id, int msg, intptr_t param1, intptr_t param2,
+                intptr_t param3, intptr_t param4)
+{
+    if (event_count < MAX_EVENTS)
+    {
+        events[event_count].msg = msg;
+        events[event_count].param1 = param1;
+        events[event_count].param2 = param2;
+        events[event_count].param3 = param3;
+        ++event_count;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+static void setup(void)
+{
+    rdp_layer = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
+    session = (struct xrdp_session *)g_malloc(sizeof(struct xrdp_session), 1);
+    session->rdp = rdp_layer;
+    session->client_info = &(rdp_layer->client_info);
+    session->id = 1;
+    session->callback = record_callback;
+    fastpath = (struct xrdp_fastpath *)
+               g_malloc(sizeof(struct xrdp_fastpath), 1);
+    fastpath->session = session;
+    event_count = 0;
+}
+
+static void teardown(void)
+{
+    g_free(fastpath);
+    g_free(session);
+    g_free(rdp_layer);
+}
+
+/******************************************************************************/
+static void
+out_mouse_event(struct stream *s, int flags, int x, int y)
+{
+    out_uint8(s, FASTPATH_INPUT_EVENT_MOUSE << 5);
+    out_uint16_le(s, flags);
+    out_uint16_le(s, x);
+    out_uint16_le(s, y);
+}
+
+/******************************************************************************/
+/* Moves, a click, more moves and a key press */
+static void
+process_test_pdu(void)
+{
+    struct stream *s;
+
+    make_stream(s);
+    init_stream(s, 64);
+    out_mouse_event(s, PTRFLAGS_MOVE, 10, 10);
+    out_mouse_event(s, PTRFLAGS_MOVE, 20, 20);
+    out_mouse_event(s, PTRFLAGS_DOWN | PTRFLAGS_BUTTON1, 20, 20);
+    out_mouse_event(s, PTRFLAGS_MOVE, 30, 30);
+    out_mouse_event(s, PTRFLAGS_MOVE, 40, 40);
+    out_uint8(s, FASTPATH_INPUT_EVENT_SCANCODE << 5);
+    out_uint8(s, 30);
+    out_mouse_event(s, PTRFLAGS_MOVE, 50, 50);
+    s_mark_end(s);
+    s->p = s->data;
+    fastpath->numEvents = 7;
+
+    ck_assert_int_eq(xrdp_fastpath_process_input_event(fastpath, s), 0);
+    ck_assert(s_check_end(s));
+
+    free_stream(s);
+}
+
+/******************************************************************************/
+static void
+check_move(int index, int x, int y)
+{
+    ck_assert_int_lt(index, event_count);
+    ck_assert_int_eq(events[index].msg, RDP_INPUT_MOUSE);
+    ck_assert_int_eq(events[index].param1, x);
+    ck_assert_int_eq(events[index].param2, y);
+    ck_assert_int_eq(events[index].param3, PTRFLAGS_MOVE);
+}
+
+/******************************************************************************/
+START_TEST(test_fastpath_input__without_coalescing__all_moves_passed)
+{
+    process_test_pdu();
+
+    /* 7 events plus the start and end of the batch */
+    ck_assert_int_eq(event_count, 9);
+    ck_assert_int_eq(events[0].msg, 0x555b);
+    ck_assert_int_eq(events[0].param1, 1);
+    check_move(1, 10, 10);
+    check_move(2, 20, 20);
+    check_move(4, 30, 30);
+    check_move(5, 40, 40);
+    check_move(7, 50, 50);
+    ck_assert_int_eq(events[8].msg, 0x555b);
+    ck_assert_int_eq(events[8].param1, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fastpath_input__with_coalescing__order_preserved)
+{
+    session->client_info->coalesce_mouse_motion = 1;
+    process_test_pdu();
+
+    ck_assert_int_eq(event_count, 7);
+    ck_assert_int_eq(events[0].msg, 0x555b);
+    /* the last move before the click is passed on before it */
+    check_move(1, 20, 20);
+    ck_assert_int_eq(events[2].msg, RDP_INPUT_MOUSE);
+    ck_assert_int_eq(events[2].param3, PTRFLAGS_DOWN | PTRFLAGS_BUTTON1);
+    /* the last move before the key is passed on before it */
+    check_move(3, 40, 40);
+    ck_assert_int_eq(events[4].msg, RDP_INPUT_SCANCODE);
+    ck_assert_int_eq(events[4].param1, 30);
+    /* a move at the end of the PDU is passed on before the batch ends */
+    check_move(5, 50, 50);
+    ck_assert_int_eq(events[6].msg, 0x555b);
+    ck_assert_int_eq(events[6].param1, 0);
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_fastpath_input__single_event__no_batch)
+{
+    struct stream *s;
+
+    session->client_info->coalesce_mouse_motion = 1;
+    make_stream(s);
+    init_stream(s, 16);
+    out_mouse_event(s, PTRFLAGS_MOVE, 10, 10);
+    s_mark_end(s);
+    s->p = s->data;
+    fastpath->numEvents = 1;
+
+    ck_assert_int_eq(xrdp_fastpath_process_input_event(fastpath, s), 0);
+    ck_assert_int_eq(event_count, 1);
+    check_move(0, 10, 10);
+
+    free_stream(s);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_fastpath_input(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_fastpath_input");
+
+    tc = tcase_create("xrdp_fastpath_process_input_event");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_fastpath_input__without_coalescing__all_moves_passed);
+    tcase_add_test(tc, test_fastpath_input__with_coalescing__order_preserved);
+    tcase_add_test(tc, test_fastpath_input__single_event__no_batch);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
@@ -0,0 +1,185 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "libxrdp.h"
+#include "ms-rdpegdi.h"
+#include "os_calls.h"
+
+#include "test_libxrdp.h"
+
+#define RED 0xff0000
+#define BLUE 0x0000ff
+
+static struct xrdp_rdp *rdp_layer;
+static struct xrdp_session *session;
+/* orders object under test */
+static struct xrdp_orders *orders;
+/* orders object sent one order at a time, in an expected order */
+static struct xrdp_orders *expected;
+
+/******************************************************************************/
+/* Sets up an orders object as if xrdp_orders_init() had been called.
+ * Nothing is sent, so the orders build up in out_s */
+static struct xrdp_orders *
+make_orders(void)
+{
+    struct xrdp_orders *o = xrdp_orders_create(session, rdp_layer);
+
+    ck_assert_ptr_nonnull(o);
+    o->order_level = 1;
+    o->order_count_ptr = o->out_s->p;
+    out_uint8s(o->out_s, 2);
+    return o;
+}
+
+/******************************************************************************/
+static void setup(void)
+{
+    rdp_layer = (struct xrdp_rdp *)g_malloc(sizeof(struct xrdp_rdp), 1);
+    session = (struct xrdp_session *)g_malloc(sizeof(struct xrdp_session), 1);
+    session->rdp = rdp_layer;
+    session->client_info = &(rdp_layer->client_info);
+    orders = make_orders();
+    expected = make_orders();
+}
+
+static void teardown(void)
+{
+    xrdp_orders_delete(expected);
+    xrdp_orders_delete(orders);
+    g_free(session);
+    g_free(rdp_layer);
+}
+
+/******************************************************************************/
+static void
+expect_rect(int x, int y, int color)
+{
+    ck_assert_int_eq(xrdp_orders_rect(expected, x, y, 10, 10, color, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_flush_batch(expected), 0);
+}
+
+/******************************************************************************/
+static void
+expect_screen_blt(int x, int y, int srcx, int srcy)
+{
+    ck_assert_int_eq(xrdp_orders_screen_blt(expected, x, y, 10, 10,
+                                            srcx, srcy, 0xcc, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_flush_batch(expected), 0);
+}
+
+/******************************************************************************/
+static void
+check_output(void)
+{
+    int bytes;
+
+    ck_assert_int_eq(xrdp_orders_flush_batch(orders), 0);
+    ck_assert_int_eq(orders->order_count, expected->order_count);
+    bytes = (int)(expected->out_s->p - expected->out_s->data);
+    ck_assert_int_eq((int)(orders->out_s->p - orders->out_s->data), bytes);
+    ck_assert_mem_eq(orders->out_s->data, expected->out_s->data, bytes);
+}
+
+/******************************************************************************/
+START_TEST(test_orders_batch__separate_rects__grouped_by_color)
+{
+    ck_assert_int_eq(xrdp_orders_rect(orders, 0, 0, 10, 10, RED, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 20, 0, 10, 10, BLUE, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 40, 0, 10, 10, RED, NULL), 0);
+    ck_assert_int_eq(orders->batch_count, 3);
+    ck_assert_int_eq(orders->order_count, 0);
+
+    expect_rect(0, 0, RED);
+    expect_rect(40, 0, RED);
+    expect_rect(20, 0, BLUE);
+    check_output();
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_batch__overlapping_rects__not_reordered)
+{
+    ck_assert_int_eq(xrdp_orders_rect(orders, 0, 0, 10, 10, RED, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 20, 0, 10, 10, BLUE, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 25, 5, 10, 10, RED, NULL), 0);
+
+    expect_rect(0, 0, RED);
+    expect_rect(20, 0, BLUE);
+    expect_rect(25, 5, RED);
+    check_output();
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_batch__screen_blt_source__not_overwritten_early)
+{
+    /* the second rect draws over the area the screen blt copies from */
+    ck_assert_int_eq(xrdp_orders_rect(orders, 0, 0, 10, 10, RED, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_screen_blt(orders, 200, 0, 10, 10,
+                                            400, 0, 0xcc, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 400, 0, 10, 10, RED, NULL), 0);
+
+    expect_rect(0, 0, RED);
+    expect_screen_blt(200, 0, 400, 0);
+    expect_rect(400, 0, RED);
+    check_output();
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_batch__clipped_away__reordered)
+{
+    struct xrdp_rect clip = {0, 0, 30, 30};
+
+    /* the third rect overlaps the first, but it is clipped so nothing
+     * is drawn over it. The last one shares its clip, so follows it */
+    ck_assert_int_eq(xrdp_orders_rect(orders, 0, 0, 10, 10, RED, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 50, 0, 10, 10, BLUE, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 25, 5, 10, 10, RED, &clip), 0);
+    ck_assert_int_eq(xrdp_orders_rect(orders, 5, 5, 50, 10, BLUE, &clip), 0);
+
+    expect_rect(0, 0, RED);
+    ck_assert_int_eq(xrdp_orders_rect(expected, 25, 5, 10, 10, RED,
+                                      &clip), 0);
+    ck_assert_int_eq(xrdp_orders_flush_batch(expected), 0);
+    ck_assert_int_eq(xrdp_orders_rect(expected, 5, 5, 50, 10, BLUE,
+                                      &clip), 0);
+    ck_assert_int_eq(xrdp_orders_flush_batch(expected), 0);
+    expect_rect(50, 0, BLUE);
+    check_output();
+}
+END_TEST
+
+/******************************************************************************/
+START_TEST(test_orders_batch__other_order__flushes_batch)
+{
+    ck_assert_int_eq(xrdp_orders_rect(orders, 0, 0, 10, 10, RED, NULL), 0);
+    ck_assert_int_eq(xrdp_orders_send_switch_os_surface(orders, 1), 0);
+    ck_assert_int_eq(orders->batch_count, 0);
+    ck_assert_int_eq(orders->order_count, 2);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_xrdp_orders_batch(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("test_xrdp_orders_batch");
+
+    tc = tcase_create("xrdp_orders_flush_batch");
+    tcase_add_checked_fixture(tc, setup, teardown);
+    tcase_add_test(tc, test_orders_batch__separate_rects__grouped_by_color);
+    tcase_add_test(tc, test_orders_batch__overlapping_rects__not_reordered);
+    tcase_add_test(tc, test_orders_batch__screen_blt_source__not_overwritten_early);
+    tcase_add_test(tc, test_orders_batch__clipped_away__reordered);
+    tcase_add_test(tc, test_orders_batch__other_order__flushes_batch);
+
+    suite_add_tcase(s, tc);
+
+    return s;
+}
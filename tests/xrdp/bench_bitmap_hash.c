@@ -0,0 +1,174 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmark for the bitmap cache copy and hash
+ *
+ * This is built by 'make check' but not run by it. Run it by hand:-
+ *
+ *     ./bench_bitmap_hash [seconds]
+ *
+ * The screen is split into 64x64 tiles, as xrdp_painter_copy() does.
+ * Tiles per second are reported for xrdp_bitmap_copy_box_with_crc(),
+ * and for a byte-at-a-time CRC32 copy like the one it replaced.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xrdp.h"
+
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+#define TILE_SIZE 64
+
+static unsigned int g_crc_table[256];
+
+/*****************************************************************************/
+static void
+crc_table_init(void)
+{
+    unsigned int c;
+    int n;
+    int k;
+
+    for (n = 0; n < 256; n++)
+    {
+        c = (unsigned int)n;
+        for (k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[n] = c;
+    }
+}
+
+/*****************************************************************************/
+/* reference copy, with a table CRC32 pass per byte */
+static int
+crc_copy_box(struct xrdp_bitmap *src, struct xrdp_bitmap *dst,
+             int x, int y, int cx, int cy)
+{
+    int Bpp = (src->bpp == 24) ? 4 : (src->bpp + 7) / 8;
+    unsigned int crc = 0xffffffff;
+    const unsigned char *s;
+    unsigned char *d;
+    int i;
+    int j;
+
+    for (i = 0; i < cy; i++)
+    {
+        s = (const unsigned char *)src->data +
+            ((y + i) * src->width + x) * Bpp;
+        d = (unsigned char *)dst->data + i * dst->width * Bpp;
+        for (j = 0; j < cx * Bpp; j++)
+        {
+            d[j] = s[j];
+            crc = g_crc_table[(crc ^ s[j]) & 0xff] ^ (crc >> 8);
+        }
+    }
+    dst->crc32 = (int)(crc ^ 0xffffffff);
+    return 0;
+}
+
+/*****************************************************************************/
+static double
+run(const char *name, int bpp, int msecs,
+    int (*copy_box)(struct xrdp_bitmap *, struct xrdp_bitmap *,
+                    int, int, int, int))
+{
+    struct xrdp_bitmap *screen;
+    struct xrdp_bitmap *tile;
+    int bytes;
+    int tiles;
+    int x;
+    int y;
+    int start;
+    int elapsed;
+    int i;
+    double rate;
+
+    screen = xrdp_bitmap_create(SCREEN_WIDTH, SCREEN_HEIGHT, bpp,
+                                WND_TYPE_IMAGE, NULL);
+    tile = xrdp_bitmap_create(TILE_SIZE, TILE_SIZE, bpp, WND_TYPE_IMAGE, NULL);
+    if (screen == NULL || tile == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    bytes = SCREEN_WIDTH * SCREEN_HEIGHT * ((bpp == 24) ? 4 : (bpp + 7) / 8);
+    for (i = 0; i < bytes; i++)
+    {
+        screen->data[i] = (char)(i * 7 + (i >> 9));
+    }
+
+    tiles = 0;
+    start = g_time3();
+    do
+    {
+        for (y = 0; y + TILE_SIZE <= SCREEN_HEIGHT; y += TILE_SIZE)
+        {
+            for (x = 0; x + TILE_SIZE <= SCREEN_WIDTH; x += TILE_SIZE)
+            {
+                copy_box(screen, tile, x, y, TILE_SIZE, TILE_SIZE);
+                tiles++;
+            }
+        }
+        elapsed = g_time3() - start;
+    }
+    while (elapsed < msecs);
+
+    rate = (double)tiles * 1000.0 / elapsed;
+    printf("%-30s %2d bpp %10.0f tiles/s\n", name, bpp, rate);
+
+    xrdp_bitmap_delete(tile);
+    xrdp_bitmap_delete(screen);
+    return rate;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static const int bpps[] = { 32, 24, 16, 8 };
+    int msecs = 1000;
+    double crc_rate;
+    double rate;
+    unsigned int i;
+
+    if (argc > 1)
+    {
+        msecs = atoi(argv[1]) * 1000;
+        if (msecs <= 0)
+        {
+            fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    crc_table_init();
+    for (i = 0; i < sizeof(bpps) / sizeof(bpps[0]); i++)
+    {
+        crc_rate = run("byte CRC32 copy", bpps[i], msecs, crc_copy_box);
+        rate = run("xrdp_bitmap_copy_box_with_crc", bpps[i], msecs,
+                   xrdp_bitmap_copy_box_with_crc);
+        printf("%-30s %2d bpp %10.1fx\n", "speedup", bpps[i],
+               rate / crc_rate);
+    }
+    return 0;
+}
@@ -0,0 +1,299 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Benchmark for dirty region accumulation
+ *
+ * This is built by 'make check' but not run by it. Run it by hand:-
+ *
+ *     ./bench_region [seconds]
+ *
+ * Each frame, a damage pattern is added to a dirty region one rect at a
+ * time, the bounds of the damage on each of three 1920x1080 monitors
+ * are found, and the region is emptied, as xrdp_mm_draw_dirty() does.
+ * Frames per second are reported for xrdp_region, and for pixman used
+ * the way xrdp_region used it before, with a union per rect and a copy
+ * of the region per monitor.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "xrdp.h"
+
+#if defined(XRDP_PIXMAN)
+#include <pixman.h>
+#else
+#include "pixman-region.h"
+#endif
+
+#define MONITOR_WIDTH 1920
+#define MONITOR_HEIGHT 1080
+#define NUM_MONITORS 3
+#define MAX_RECTS 2048
+
+struct pattern
+{
+    const char *name;
+    int num_rects;
+    struct xrdp_rect rects[MAX_RECTS];
+};
+
+/*****************************************************************************/
+static void
+add(struct pattern *p, int x, int y, int cx, int cy)
+{
+    struct xrdp_rect *rect;
+
+    if (p->num_rects < MAX_RECTS)
+    {
+        rect = p->rects + p->num_rects++;
+        rect->left = x;
+        rect->top = y;
+        rect->right = x + cx;
+        rect->bottom = y + cy;
+    }
+}
+
+/*****************************************************************************/
+/* text typed into three terminals, a glyph and a cursor at a time */
+static void
+make_typing(struct pattern *p)
+{
+    int mon;
+    int index;
+
+    p->name = "typing";
+    for (mon = 0; mon < NUM_MONITORS; mon++)
+    {
+        for (index = 0; index < 80; index++)
+        {
+            add(p, mon * MONITOR_WIDTH + 100 + index * 8, 500, 8, 16);
+            add(p, mon * MONITOR_WIDTH + 108 + index * 8, 500, 2, 16);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* a terminal scrolling, redrawn a line at a time */
+static void
+make_scrolling(struct pattern *p)
+{
+    int index;
+
+    p->name = "scrolling";
+    for (index = 0; index < 60; index++)
+    {
+        add(p, MONITOR_WIDTH + 40, 40 + index * 16, 1200 + (index % 7) * 40,
+            16);
+    }
+}
+
+/*****************************************************************************/
+/* a window dragged across the monitors, and the desktop it uncovers */
+static void
+make_drag(struct pattern *p)
+{
+    int index;
+    int x;
+
+    p->name = "window drag";
+    for (index = 0; index < 40; index++)
+    {
+        x = 1500 + index * 24;
+        add(p, x, 300 + index * 4, 640, 480);
+        add(p, x - 24, 300 + index * 4, 24, 480);
+        add(p, x - 24, 296 + index * 4, 664, 4);
+    }
+}
+
+/*****************************************************************************/
+/* small updates all over the desktop, such as icons and tooltips */
+static void
+make_scattered(struct pattern *p)
+{
+    unsigned int seed = 1;
+    int index;
+
+    p->name = "scattered";
+    for (index = 0; index < 1000; index++)
+    {
+        seed = seed * 1103515245 + 12345;
+        add(p, (seed >> 8) % (NUM_MONITORS * MONITOR_WIDTH - 32),
+            (seed >> 3) % (MONITOR_HEIGHT - 32),
+            8 + (seed >> 24) % 24, 8 + (seed >> 16) % 24);
+    }
+}
+
+/*****************************************************************************/
+/* a frame, the way xrdp_region and xrdp_mm_draw_dirty() used to do it */
+static int
+frame_pixman(struct pattern *p)
+{
+    struct pixman_region16 dirty;
+    struct pixman_region16 mon_reg;
+    struct pixman_region16 lreg;
+    struct pixman_box16 *boxes;
+    struct pixman_box16 *box;
+    int count;
+    int index;
+    int mon;
+    int area;
+    struct xrdp_rect *rect;
+
+    pixman_region_init(&dirty);
+    for (index = 0; index < p->num_rects; index++)
+    {
+        rect = p->rects + index;
+        pixman_region_init_rect(&lreg, rect->left, rect->top,
+                                rect->right - rect->left,
+                                rect->bottom - rect->top);
+        pixman_region_union(&dirty, &dirty, &lreg);
+        pixman_region_fini(&lreg);
+    }
+    area = 0;
+    for (mon = 0; mon < NUM_MONITORS; mon++)
+    {
+        pixman_region_init(&mon_reg);
+        boxes = pixman_region_rectangles(&dirty, &count);
+        for (index = 0; index < count; index++)
+        {
+            pixman_region_init_rect(&lreg, boxes[index].x1, boxes[index].y1,
+                                    boxes[index].x2 - boxes[index].x1,
+                                    boxes[index].y2 - boxes[index].y1);
+            pixman_region_union(&mon_reg, &mon_reg, &lreg);
+            pixman_region_fini(&lreg);
+        }
+        pixman_region_init_rect(&lreg, mon * MONITOR_WIDTH, 0,
+                                MONITOR_WIDTH, MONITOR_HEIGHT);
+        pixman_region_intersect(&mon_reg, &mon_reg, &lreg);
+        pixman_region_fini(&lreg);
+        if (pixman_region_not_empty(&mon_reg))
+        {
+            box = pixman_region_extents(&mon_reg);
+            area += (box->x2 - box->x1) * (box->y2 - box->y1);
+        }
+        pixman_region_fini(&mon_reg);
+    }
+    pixman_region_fini(&dirty);
+    return area;
+}
+
+/*****************************************************************************/
+static int
+frame_xrdp_region(struct pattern *p, struct xrdp_region *dirty)
+{
+    struct xrdp_rect mon_rect;
+    struct xrdp_rect rect;
+    int index;
+    int mon;
+    int area;
+
+    for (index = 0; index < p->num_rects; index++)
+    {
+        xrdp_region_add_rect(dirty, p->rects + index);
+    }
+    area = 0;
+    for (mon = 0; mon < NUM_MONITORS; mon++)
+    {
+        mon_rect.left = mon * MONITOR_WIDTH;
+        mon_rect.top = 0;
+        mon_rect.right = mon_rect.left + MONITOR_WIDTH;
+        mon_rect.bottom = MONITOR_HEIGHT;
+        if (xrdp_region_get_clipped_bounds(dirty, &mon_rect, &rect) == 0)
+        {
+            area += (rect.right - rect.left) * (rect.bottom - rect.top);
+        }
+    }
+    xrdp_region_clear(dirty);
+    return area;
+}
+
+/*****************************************************************************/
+/* frames per second for one pattern, with pixman or xrdp_region */
+static double
+run(struct pattern *p, int msecs, int use_xrdp_region, int *area)
+{
+    struct xrdp_region *dirty;
+    int frames;
+    int start;
+    int elapsed;
+
+    dirty = xrdp_region_create(NULL);
+    if (dirty == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    frames = 0;
+    start = g_time3();
+    do
+    {
+        *area = use_xrdp_region ? frame_xrdp_region(p, dirty) :
+                frame_pixman(p);
+        frames++;
+        elapsed = g_time3() - start;
+    }
+    while (elapsed < msecs);
+    xrdp_region_delete(dirty);
+    return (double)frames * 1000.0 / elapsed;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    static struct pattern patterns[4];
+    int msecs = 1000;
+    double pixman_rate;
+    double rate;
+    int pixman_area;
+    int area;
+    unsigned int i;
+
+    if (argc > 1)
+    {
+        msecs = atoi(argv[1]) * 1000;
+        if (msecs <= 0)
+        {
+            fprintf(stderr, "usage: %s [seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    make_typing(patterns + 0);
+    make_scrolling(patterns + 1);
+    make_drag(patterns + 2);
+    make_scattered(patterns + 3);
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++)
+    {
+        pixman_rate = run(patterns + i, msecs, 0, &pixman_area);
+        rate = run(patterns + i, msecs, 1, &area);
+        if (area != pixman_area)
+        {
+            fprintf(stderr, "%s: damage differs, %d pixels, not %d\n",
+                    patterns[i].name, area, pixman_area);
+            return 1;
+        }
+        printf("%-12s %5d rects %10.1f frames/s pixman, "
+               "%10.1f xrdp_region, %6.1fx\n",
+               patterns[i].name, patterns[i].num_rects, pixman_rate, rate,
+               rate / pixman_rate);
+    }
+    return 0;
+}
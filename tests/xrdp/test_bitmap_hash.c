@@ -0,0 +1,155 @@
+#if defined(HAVE_CONFIG_H)
+#include "config_ac.h"
+#endif
+
+#include "xrdp.h"
+
+#include "test_xrdp.h"
+
+#define SRC_WIDTH 100
+#define SRC_HEIGHT 80
+
+/* Makes a bitmap with pseudo-random contents */
+static struct xrdp_bitmap *
+make_source(int bpp)
+{
+    struct xrdp_bitmap *b;
+    unsigned int seed = 12345;
+    int bytes;
+    int i;
+
+    b = xrdp_bitmap_create(SRC_WIDTH, SRC_HEIGHT, bpp, WND_TYPE_IMAGE, NULL);
+    ck_assert_ptr_nonnull(b);
+    bytes = SRC_WIDTH * SRC_HEIGHT * ((bpp + 7) / 8);
+    if (bpp == 24)
+    {
+        bytes = SRC_WIDTH * SRC_HEIGHT * 4;
+    }
+    for (i = 0; i < bytes; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        b->data[i] = (char)(seed >> 16);
+    }
+    return b;
+}
+
+/* Copies a box from the source, checking the copy and the hash */
+static void
+check_copy_box(int bpp, int x, int y, int cx, int cy)
+{
+    struct xrdp_bitmap *src = make_source(bpp);
+    struct xrdp_bitmap *b = xrdp_bitmap_create(cx, cy, bpp, WND_TYPE_IMAGE,
+                            NULL);
+    int Bpp = (bpp == 24) ? 4 : (bpp + 7) / 8;
+    tui64 hash;
+    int row;
+
+    ck_assert_int_eq(xrdp_bitmap_copy_box_with_crc(src, b, x, y, cx, cy), 0);
+    for (row = 0; row < cy; ++row)
+    {
+        ck_assert_mem_eq(b->data + row * cx * Bpp,
+                         src->data + ((y + row) * SRC_WIDTH + x) * Bpp,
+                         cx * Bpp);
+    }
+
+    /* Hashing the copy gives the same key */
+    hash = b->hash;
+    b->hash = 0;
+    ck_assert_int_eq(xrdp_bitmap_hash_crc(b), 0);
+    ck_assert(b->hash == hash);
+    ck_assert_int_eq(b->crc32, (int)(hash & 0xffffffff));
+    ck_assert_int_eq(b->crc16, (int)(hash >> 48));
+
+    /* Changing any one byte changes the key */
+    b->data[(cy - 1) * cx * Bpp] ^= 1;
+    ck_assert_int_eq(xrdp_bitmap_hash_crc(b), 0);
+    ck_assert(b->hash != hash);
+
+    xrdp_bitmap_delete(b);
+    xrdp_bitmap_delete(src);
+}
+
+START_TEST(test_bitmap_hash__copy_box_32bpp)
+{
+    check_copy_box(32, 3, 5, 64, 64);
+    check_copy_box(32, 0, 0, 13, 7);
+}
+END_TEST
+
+START_TEST(test_bitmap_hash__copy_box_24bpp)
+{
+    check_copy_box(24, 3, 5, 64, 64);
+    check_copy_box(24, 1, 1, 13, 7);
+}
+END_TEST
+
+START_TEST(test_bitmap_hash__copy_box_16bpp)
+{
+    check_copy_box(16, 3, 5, 64, 64);
+    check_copy_box(16, 1, 1, 13, 7);
+}
+END_TEST
+
+START_TEST(test_bitmap_hash__copy_box_8bpp)
+{
+    check_copy_box(8, 3, 5, 64, 64);
+    check_copy_box(8, 1, 1, 13, 7);
+}
+END_TEST
+
+/* The unused byte of a 24bpp pixel doesn't affect the key */
+START_TEST(test_bitmap_hash__24bpp_ignores_pad_byte)
+{
+    struct xrdp_bitmap *b = make_source(24);
+    tui64 hash;
+
+    ck_assert_int_eq(xrdp_bitmap_hash_crc(b), 0);
+    hash = b->hash;
+    ((tui32 *)b->data)[17] ^= 0xff000000;
+    ck_assert_int_eq(xrdp_bitmap_hash_crc(b), 0);
+    ck_assert(b->hash == hash);
+    ((tui32 *)b->data)[17] ^= 0x00000001;
+    ck_assert_int_eq(xrdp_bitmap_hash_crc(b), 0);
+    ck_assert(b->hash != hash);
+
+    xrdp_bitmap_delete(b);
+}
+END_TEST
+
+/* The same data with different dimensions gives a different key */
+START_TEST(test_bitmap_hash__dimensions_are_hashed)
+{
+    struct xrdp_bitmap *b1 = xrdp_bitmap_create(16, 4, 32, WND_TYPE_IMAGE,
+                             NULL);
+    struct xrdp_bitmap *b2 = xrdp_bitmap_create(4, 16, 32, WND_TYPE_IMAGE,
+                             NULL);
+
+    ck_assert_int_eq(xrdp_bitmap_hash_crc(b1), 0);
+    ck_assert_int_eq(xrdp_bitmap_hash_crc(b2), 0);
+    ck_assert(b1->hash != b2->hash);
+
+    xrdp_bitmap_delete(b1);
+    xrdp_bitmap_delete(b2);
+}
+END_TEST
+
+/******************************************************************************/
+Suite *
+make_suite_test_bitmap_hash(void)
+{
+    Suite *s;
+    TCase *tc;
+
+    s = suite_create("BitmapHash");
+
+    tc = tcase_create("xrdp_bitmap_hash");
+    suite_add_tcase(s, tc);
+    tcase_add_test(tc, test_bitmap_hash__copy_box_32bpp);
+    tcase_add_test(tc, test_bitmap_hash__copy_box_24bpp);
+    tcase_add_test(tc, test_bitmap_hash__copy_box_16bpp);
+    tcase_add_test(tc, test_bitmap_hash__copy_box_8bpp);
+    tcase_add_test(tc, test_bitmap_hash__24bpp_ignores_pad_byte);
+    tcase_add_test(tc, test_bitmap_hash__dimensions_are_hashed);
+
+    return s;
+}
@@ -55,6 +55,7 @@ int main (void)
     setvbuf(stdout, NULL, _IONBF, 0);
 
     sr = srunner_create (make_suite_test_bitmap_load());
+    srunner_add_suite(sr, make_suite_test_bitmap_hash());
     srunner_add_suite(sr, make_suite_test_keymap_load());
     srunner_add_suite(sr, make_suite_egfx_base_functions());
     srunner_add_suite(sr, make_suite_region());
@@ -133,13 +133,197 @@ static void test_xrdp_region_not_empty__happy_path(void **state)
     g_free(region);
 }
 
+static void set_rect(struct xrdp_rect *rect,
+                     int left, int top, int right, int bottom)
+{
+    rect->left = left;
+    rect->top = top;
+    rect->right = right;
+    rect->bottom = bottom;
+}
+
+static void assert_rect(const struct xrdp_rect *rect,
+                        int left, int top, int right, int bottom)
+{
+    assert_int_equal(left, rect->left);
+    assert_int_equal(top, rect->top);
+    assert_int_equal(right, rect->right);
+    assert_int_equal(bottom, rect->bottom);
+}
+
+static void test_xrdp_region_add_rects__merges(void **state)
+{
+    struct xrdp_region *region = xrdp_region_create(NULL);
+    struct xrdp_rect rects[4];
+    struct xrdp_rect rect;
+
+    UNUSED(state);
+    /* two overlapping, one touching, one empty */
+    set_rect(&rects[0], 0, 0, 10, 10);
+    set_rect(&rects[1], 5, 5, 15, 15);
+    set_rect(&rects[2], 15, 5, 20, 15);
+    set_rect(&rects[3], 50, 50, 50, 60);
+    assert_int_equal(0, xrdp_region_add_rects(region, rects, 4));
+
+    assert_int_equal(0, xrdp_region_get_rect(region, 0, &rect));
+    assert_rect(&rect, 0, 0, 10, 5);
+    assert_int_equal(0, xrdp_region_get_rect(region, 1, &rect));
+    assert_rect(&rect, 0, 5, 20, 10);
+    assert_int_equal(0, xrdp_region_get_rect(region, 2, &rect));
+    assert_rect(&rect, 5, 10, 20, 15);
+    assert_int_equal(1, xrdp_region_get_rect(region, 3, &rect));
+
+    xrdp_region_delete(region);
+}
+
+static void test_xrdp_region_add_rect__many(void **state)
+{
+    struct xrdp_region *region = xrdp_region_create(NULL);
+    struct xrdp_rect rect;
+    int index;
+
+    UNUSED(state);
+    /* more rects than are queued, in reverse order, making one strip */
+    for (index = 999; index >= 0; index--)
+    {
+        set_rect(&rect, index * 2, 0, index * 2 + 2, 4);
+        assert_int_equal(0, xrdp_region_add_rect(region, &rect));
+    }
+    assert_int_equal(0, xrdp_region_get_rect(region, 0, &rect));
+    assert_rect(&rect, 0, 0, 2000, 4);
+    assert_int_equal(1, xrdp_region_get_rect(region, 1, &rect));
+
+    xrdp_region_delete(region);
+}
+
+static void test_xrdp_region_add_region__happy_path(void **state)
+{
+    struct xrdp_region *region = xrdp_region_create(NULL);
+    struct xrdp_region *other = xrdp_region_create(NULL);
+    struct xrdp_rect rect;
+
+    UNUSED(state);
+    set_rect(&rect, 0, 0, 10, 10);
+    xrdp_region_add_rect(region, &rect);
+    set_rect(&rect, 10, 0, 20, 10);
+    xrdp_region_add_rect(other, &rect);
+    assert_int_equal(0, xrdp_region_add_region(region, other));
+
+    assert_int_equal(0, xrdp_region_get_rect(region, 0, &rect));
+    assert_rect(&rect, 0, 0, 20, 10);
+    assert_int_equal(1, xrdp_region_get_rect(region, 1, &rect));
+    /* the region added is left alone */
+    assert_int_equal(0, xrdp_region_get_rect(other, 0, &rect));
+    assert_rect(&rect, 10, 0, 20, 10);
+
+    xrdp_region_delete(other);
+    xrdp_region_delete(region);
+}
+
+static void test_xrdp_region_clear__reuse(void **state)
+{
+    struct xrdp_region *region = xrdp_region_create(NULL);
+    struct xrdp_rect rect;
+
+    UNUSED(state);
+    set_rect(&rect, 0, 0, 10, 10);
+    xrdp_region_add_rect(region, &rect);
+    set_rect(&rect, 20, 20, 30, 30);
+    xrdp_region_add_rect(region, &rect);
+    assert_int_equal(0, xrdp_region_get_rect(region, 1, &rect));
+
+    xrdp_region_clear(region);
+    assert_int_equal(1, xrdp_region_get_rect(region, 0, &rect));
+
+    set_rect(&rect, 5, 5, 6, 6);
+    xrdp_region_add_rect(region, &rect);
+    assert_int_equal(0, xrdp_region_get_rect(region, 0, &rect));
+    assert_rect(&rect, 5, 5, 6, 6);
+    assert_int_equal(1, xrdp_region_get_rect(region, 1, &rect));
+
+    xrdp_region_delete(region);
+}
+
+static void test_xrdp_region_get_clipped_bounds__monitors(void **state)
+{
+    struct xrdp_region *region = xrdp_region_create(NULL);
+    struct xrdp_rect clip;
+    struct xrdp_rect rect;
+
+    UNUSED(state);
+    set_rect(&rect, 10, 10, 20, 20);
+    xrdp_region_add_rect(region, &rect);
+    set_rect(&rect, 90, 50, 110, 60);
+    xrdp_region_add_rect(region, &rect);
+
+    /* left monitor */
+    set_rect(&clip, 0, 0, 100, 100);
+    assert_int_equal(0, xrdp_region_get_clipped_bounds(region, &clip, &rect));
+    assert_rect(&rect, 10, 10, 100, 60);
+    /* right monitor */
+    set_rect(&clip, 100, 0, 200, 100);
+    assert_int_equal(0, xrdp_region_get_clipped_bounds(region, &clip, &rect));
+    assert_rect(&rect, 100, 50, 110, 60);
+    /* nothing below */
+    set_rect(&clip, 0, 100, 200, 200);
+    assert_int_equal(1, xrdp_region_get_clipped_bounds(region, &clip, &rect));
+
+    /* the region isn't clipped */
+    assert_int_equal(0, xrdp_region_get_rect(region, 0, &rect));
+    assert_rect(&rect, 10, 10, 20, 20);
+
+    xrdp_region_delete(region);
+}
+
+static void test_xrdp_tile_map__runs(void **state)
+{
+    struct xrdp_tile_map *map = xrdp_tile_map_create(2100, 100);
+    struct xrdp_rect rect;
+    int index = 0;
+
+    UNUSED(state);
+    assert_non_null(map);
+    assert_int_equal(33, map->tiles_x);
+    assert_int_equal(2, map->tiles_y);
+
+    /* tiles 0 and 1 of row 0 */
+    set_rect(&rect, 10, 10, 70, 20);
+    xrdp_tile_map_add_rect(map, &rect);
+    /* tiles 31 and 32 of row 1, across a word, the last one clipped */
+    set_rect(&rect, 2000, 70, 3000, 80);
+    xrdp_tile_map_add_rect(map, &rect);
+    /* off screen */
+    set_rect(&rect, -100, -100, -1, -1);
+    xrdp_tile_map_add_rect(map, &rect);
+    assert_int_equal(4, map->num_dirty);
+
+    assert_int_equal(0, xrdp_tile_map_get_run(map, &index, &rect));
+    assert_rect(&rect, 0, 0, 128, 64);
+    assert_int_equal(0, xrdp_tile_map_get_run(map, &index, &rect));
+    assert_rect(&rect, 1984, 64, 2100, 100);
+    assert_int_equal(1, xrdp_tile_map_get_run(map, &index, &rect));
+
+    xrdp_tile_map_clear(map);
+    assert_int_equal(0, map->num_dirty);
+    index = 0;
+    assert_int_equal(1, xrdp_tile_map_get_run(map, &index, &rect));
+
+    xrdp_tile_map_delete(map);
+}
+
 START_TEST(execute_suite)
 {
     const struct CMUnitTest tests[] =
     {
         cmocka_unit_test(test_xrdp_region_get_bounds__negligent_path),
         cmocka_unit_test(test_xrdp_region_get_bounds__happy_path),
-        cmocka_unit_test(test_xrdp_region_not_empty__happy_path)
+        cmocka_unit_test(test_xrdp_region_not_empty__happy_path),
+        cmocka_unit_test(test_xrdp_region_add_rects__merges),
+        cmocka_unit_test(test_xrdp_region_add_rect__many),
+        cmocka_unit_test(test_xrdp_region_add_region__happy_path),
+        cmocka_unit_test(test_xrdp_region_clear__reuse),
+        cmocka_unit_test(test_xrdp_region_get_clipped_bounds__monitors),
+        cmocka_unit_test(test_xrdp_tile_map__runs)
     };
 
     ck_assert_int_eq(cmocka_run_group_tests(tests, NULL, NULL), 0);
@@ -0,0 +1,625 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file loadtest.c
+ * @brief Runs many made up sessions through xrdp, to see how many it can
+ *        carry
+ *
+ * Each session has a minimal RDP client at one end, and a stand-in for
+ * the X server at the other, which paints made up damage for xup. Neither
+ * costs much, so what is measured is xrdp itself.
+ *
+ * Give xrdp an xrdp.ini section which connects xup to this program rather
+ * than to an X server, and turn off bulk compression, which the client
+ * can't undo:-
+ *
+ *     [Globals]
+ *     bulk_compression=false
+ *     autorun=loadtest
+ *
+ *     [loadtest]
+ *     name=loadtest
+ *     lib=libxup.so
+ *     port=/tmp/xrdp-loadtest.sock
+ *     username=na
+ *     password=na
+ *
+ * The clients log in as loadtest, with a made up password, which the
+ * section's username and password override. xrdp won't autorun with an
+ * empty password.
+ *
+ * Then run, for example:-
+ *
+ *     xrdp-loadtest -n 20 -t 60
+ *
+ * Once every session is painting, the sessions are measured for the
+ * given time. The CPU used by the xrdp processes is read from /proc, so
+ * xrdp must be on this host.
+ *
+ * The client asks for plain bitmap updates, so the sessions use xrdp's
+ * bitmap compressor rather than an encoder.
+ *
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "log.h"
+#include "os_calls.h"
+#include "rdp_sink.h"
+#include "stats.h"
+#include "string_calls.h"
+#include "xup_synth.h"
+
+#if !defined(PACKAGE_VERSION)
+#define PACKAGE_VERSION "???"
+#endif
+
+#define DEFAULT_SOCKET_PATH "/tmp/xrdp-loadtest.sock"
+/* How long to wait for every xup to connect and send its client info,
+   after the clients have logged in */
+#define CONNECT_TIMEOUT 10000
+/* How long to wait for the last frames to be acked */
+#define DRAIN_TIMEOUT 1000
+
+static const char *g_pattern_names[] = { "text", "video", "drag" };
+
+/**
+ * Options
+ */
+struct loadtest_options
+{
+    const char *host;
+    const char *port;
+    const char *socket_path;
+    int sessions;
+    int seconds;
+    int fps; ///< Frames per second, 0 to send each frame when acked
+    int width;
+    int height;
+    int pattern; ///< enum xup_synth_pattern, or XUP_SYNTH_PATTERNS to mix
+};
+
+/**
+ * The sessions under test
+ */
+struct loadtest
+{
+    int listen_sck;
+    struct rdp_sink **sinks; ///< one per session
+    struct xup_synth **synths; ///< in the order xup connected
+    int num_synths;
+    long long *cpu_start; ///< CPU of each xrdp process, from the start
+    struct pollfd *pfds;
+};
+
+/*****************************************************************************/
+/**
+ * Prints a brief summary of options and defaults
+ */
+static void
+usage(void)
+{
+    g_printf("xrdp load test v" PACKAGE_VERSION "\n");
+    g_printf("\nusage:\n");
+    g_printf("xrdp-loadtest [options]\n\n");
+    g_printf("options:\n");
+    g_printf("    -h <host>      xrdp host. Default: 127.0.0.1\n"
+             "    -p <port>      xrdp port. Default: 3389\n"
+             "    -s <path>      Socket for xup to connect to."
+             " Default: " DEFAULT_SOCKET_PATH "\n"
+             "    -n <sessions>  Sessions to run. Default: 1\n"
+             "    -t <seconds>   Time to measure for. Default: 30\n"
+             "    -f <fps>       Frames per second for each session,"
+             " or 0 to paint as\n"
+             "                   fast as xrdp acks. Default: 30\n"
+             "    -g <WxH>       Screen size. Default: 1024x768\n"
+             "    -d <pattern>   text, video, drag, or mix to give the"
+             " sessions each in\n"
+             "                   turn. Default: mix\n");
+}
+
+/*****************************************************************************/
+/**
+ * Parses the command line
+ *
+ * @return 0 for success
+ */
+static int
+parse_options(int argc, char **argv, struct loadtest_options *opts)
+{
+    int opt;
+    int index;
+
+    opts->host = "127.0.0.1";
+    opts->port = "3389";
+    opts->socket_path = DEFAULT_SOCKET_PATH;
+    opts->sessions = 1;
+    opts->seconds = 30;
+    opts->fps = 30;
+    opts->width = 1024;
+    opts->height = 768;
+    opts->pattern = XUP_SYNTH_PATTERNS;
+
+    while ((opt = getopt(argc, argv, "h:p:s:n:t:f:g:d:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                opts->host = optarg;
+                break;
+            case 'p':
+                opts->port = optarg;
+                break;
+            case 's':
+                opts->socket_path = optarg;
+                break;
+            case 'n':
+                opts->sessions = g_atoi(optarg);
+                break;
+            case 't':
+                opts->seconds = g_atoi(optarg);
+                break;
+            case 'f':
+                opts->fps = g_atoi(optarg);
+                break;
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &opts->width,
+                           &opts->height) != 2)
+                {
+                    return 1;
+                }
+                break;
+            case 'd':
+                opts->pattern = -1;
+                for (index = 0; index < XUP_SYNTH_PATTERNS; index++)
+                {
+                    if (g_strcmp(optarg, g_pattern_names[index]) == 0)
+                    {
+                        opts->pattern = index;
+                    }
+                }
+                if (g_strcmp(optarg, "mix") == 0)
+                {
+                    opts->pattern = XUP_SYNTH_PATTERNS;
+                }
+                if (opts->pattern < 0)
+                {
+                    return 1;
+                }
+                break;
+            default:
+                return 1;
+        }
+    }
+    if (optind != argc || opts->sessions < 1 || opts->seconds < 1 ||
+            opts->fps < 0 || opts->width < 64 || opts->height < 64 ||
+            opts->width > 8192 || opts->height > 8192)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Logs on the clients, one after the other
+ *
+ * @return 0 for success
+ */
+static int
+start_clients(struct loadtest *lt, const struct loadtest_options *opts)
+{
+    int index;
+
+    for (index = 0; index < opts->sessions; index++)
+    {
+        lt->sinks[index] = rdp_sink_connect(opts->host, opts->port);
+        if (lt->sinks[index] == NULL ||
+                rdp_sink_login(lt->sinks[index], opts->width, opts->height,
+                               "loadtest", "loadtest") != 0)
+        {
+            fprintf(stderr, "Session %d couldn't log in\n", index + 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Services the sockets, and sends the frames which are due
+ *
+ * @param sending Non-zero to send frames
+ * @param wait Longest time to wait for a socket, in milliseconds
+ * @return 0 for success
+ */
+static int
+service(struct loadtest *lt, const struct loadtest_options *opts,
+        int sending, int wait)
+{
+    struct xup_synth *synth;
+    int num_pfds;
+    int num_polled;
+    int index;
+    int sck;
+
+    for (index = 0; sending && index < lt->num_synths; index++)
+    {
+        synth = lt->synths[index];
+        if (xup_synth_can_send(synth, &wait) && xup_synth_send(synth) != 0)
+        {
+            fprintf(stderr, "Error sending to xup\n");
+            return 1;
+        }
+    }
+
+    num_pfds = 0;
+    lt->pfds[num_pfds].fd = lt->listen_sck;
+    lt->pfds[num_pfds++].events = POLLIN;
+    for (index = 0; index < opts->sessions; index++)
+    {
+        lt->pfds[num_pfds].fd = lt->sinks[index]->sck;
+        lt->pfds[num_pfds++].events = POLLIN;
+    }
+    num_polled = lt->num_synths;
+    for (index = 0; index < num_polled; index++)
+    {
+        lt->pfds[num_pfds].fd = lt->synths[index]->sck;
+        lt->pfds[num_pfds++].events = POLLIN;
+    }
+    for (index = 0; index < num_pfds; index++)
+    {
+        lt->pfds[index].revents = 0;
+    }
+    if (poll(lt->pfds, num_pfds, wait > 0 ? wait : 0) < 0)
+    {
+        return 0;
+    }
+
+    if (lt->pfds[0].revents & POLLIN)
+    {
+        sck = g_sck_accept(lt->listen_sck);
+        if (sck >= 0)
+        {
+            if (lt->num_synths >= opts->sessions)
+            {
+                fprintf(stderr, "More xup connections than sessions\n");
+                g_sck_close(sck);
+                return 1;
+            }
+            synth = xup_synth_create(sck,
+                                     opts->pattern < XUP_SYNTH_PATTERNS ?
+                                     opts->pattern :
+                                     lt->num_synths % XUP_SYNTH_PATTERNS,
+                                     opts->fps > 0 ? 1000 / opts->fps : 0);
+            if (synth == NULL)
+            {
+                return 1;
+            }
+            lt->synths[lt->num_synths++] = synth;
+        }
+    }
+    for (index = 0; index < opts->sessions; index++)
+    {
+        if ((lt->pfds[1 + index].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                rdp_sink_check(lt->sinks[index]) != 0)
+        {
+            fprintf(stderr, "xrdp closed session %d\n", index + 1);
+            return 1;
+        }
+    }
+    for (index = 0; index < num_polled; index++)
+    {
+        if ((lt->pfds[1 + opts->sessions + index].revents &
+                (POLLIN | POLLHUP | POLLERR)) &&
+                xup_synth_check(lt->synths[index]) != 0)
+        {
+            fprintf(stderr, "xup closed the connection\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Returns the number of sessions painting
+ */
+static int
+sessions_started(const struct loadtest *lt)
+{
+    int count = 0;
+    int index;
+
+    for (index = 0; index < lt->num_synths; index++)
+    {
+        if (lt->synths[index]->fb != NULL)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*****************************************************************************/
+/**
+ * Returns the CPU used by the xrdp processes since the start, or -1
+ */
+static long long
+xrdp_cpu_ms(const struct loadtest *lt)
+{
+    long long total = 0;
+    long long cpu;
+    int index;
+
+    for (index = 0; index < lt->num_synths; index++)
+    {
+        cpu = lt->synths[index]->xrdp_pid > 0 ?
+              process_cpu_ms(lt->synths[index]->xrdp_pid) : -1;
+        if (cpu < 0 || lt->cpu_start[index] < 0)
+        {
+            return -1;
+        }
+        total += cpu - lt->cpu_start[index];
+    }
+    return total;
+}
+
+/*****************************************************************************/
+/**
+ * Prints the results
+ */
+static void
+report(struct loadtest *lt, const struct loadtest_options *opts,
+       int elapsed, long long cpu_ms)
+{
+    struct latency_list all;
+    struct xup_synth *synth;
+    long long bytes_in = 0;
+    long long pixels = 0;
+    int frames = 0;
+    int lost = 0;
+    int min_frames = -1;
+    int max_frames = 0;
+    int index;
+    double fps;
+
+    g_memset(&all, 0, sizeof(all));
+    for (index = 0; index < lt->num_synths; index++)
+    {
+        synth = lt->synths[index];
+        frames += synth->latencies.count;
+        lost += synth->frames_lost;
+        pixels += synth->pixels;
+        if (min_frames < 0 || synth->latencies.count < min_frames)
+        {
+            min_frames = synth->latencies.count;
+        }
+        max_frames = MAX(max_frames, synth->latencies.count);
+        latency_list_add_list(&all, &synth->latencies);
+    }
+    for (index = 0; index < opts->sessions; index++)
+    {
+        bytes_in += lt->sinks[index]->bytes_in;
+    }
+    fps = (double)frames * 1000.0 / elapsed;
+
+    g_printf("sessions:      %d, %dx%d\n", lt->num_synths,
+             opts->width, opts->height);
+    g_printf("elapsed:       %d ms\n", elapsed);
+    g_printf("frames:        %d acked, %d lost\n", frames, lost);
+    g_printf("frame rate:    %.1f frames/s in all, per session min %.1f, "
+             "mean %.1f, max %.1f\n", fps,
+             (double)min_frames * 1000.0 / elapsed,
+             fps / lt->num_synths, (double)max_frames * 1000.0 / elapsed);
+    g_printf("damage:        %.1f Mpixels/s\n",
+             (double)pixels / elapsed / 1000.0);
+    g_printf("to clients:    %lld bytes, %.2f MB/s\n", bytes_in,
+             (double)bytes_in / (1024.0 * 1024.0) * 1000.0 / elapsed);
+    if (cpu_ms >= 0)
+    {
+        g_printf("xrdp CPU:      %lld ms, %.1f%% of a core", cpu_ms,
+                 (double)cpu_ms * 100.0 / elapsed);
+        if (cpu_ms > 0)
+        {
+            g_printf(", %.1f sessions/core",
+                     (double)lt->num_synths * elapsed / cpu_ms);
+        }
+        g_printf("\n");
+        if (frames > 0)
+        {
+            g_printf("               %.3f ms/frame\n",
+                     (double)cpu_ms / frames);
+        }
+    }
+    latency_list_print(&all, "latency:");
+    if (opts->fps > 0 && fps / lt->num_synths < opts->fps * 0.9)
+    {
+        g_printf("warning:       sessions didn't reach %d frames/s, so "
+                 "xrdp is overloaded\n", opts->fps);
+    }
+    for (index = 0; index < opts->sessions; index++)
+    {
+        if (lt->sinks[index]->compressed > 0)
+        {
+            g_printf("warning:       compressed PDUs couldn't be read. "
+                     "Set bulk_compression=false\n");
+            break;
+        }
+    }
+    latency_list_free(&all);
+}
+
+/*****************************************************************************/
+/**
+ * Starts the sessions, then measures them for the given time
+ *
+ * @return 0 for success
+ */
+static int
+run(struct loadtest *lt, const struct loadtest_options *opts)
+{
+    int start;
+    int now;
+    int index;
+    long long cpu_ms;
+
+    if (start_clients(lt, opts) != 0)
+    {
+        return 1;
+    }
+
+    /* wait for each xup to connect and send its screen size, painting
+       the sessions which have */
+    start = g_time3();
+    while (sessions_started(lt) < opts->sessions)
+    {
+        if (g_time3() - start > CONNECT_TIMEOUT)
+        {
+            fprintf(stderr, "Only %d of %d sessions started. Check the "
+                    "xrdp.ini section, and autorun\n",
+                    sessions_started(lt), opts->sessions);
+            return 1;
+        }
+        if (service(lt, opts, 1, 100) != 0)
+        {
+            return 1;
+        }
+    }
+
+    for (index = 0; index < lt->num_synths; index++)
+    {
+        xup_synth_clear_results(lt->synths[index]);
+        lt->cpu_start[index] = lt->synths[index]->xrdp_pid > 0 ?
+                               process_cpu_ms(lt->synths[index]->xrdp_pid) :
+                               -1;
+    }
+    for (index = 0; index < opts->sessions; index++)
+    {
+        lt->sinks[index]->bytes_in = 0;
+    }
+    start = g_time3();
+    while ((now = g_time3()) - start < opts->seconds * 1000)
+    {
+        if (service(lt, opts, 1,
+                    MIN(100, opts->seconds * 1000 - (now - start))) != 0)
+        {
+            return 1;
+        }
+    }
+    cpu_ms = xrdp_cpu_ms(lt);
+    report(lt, opts, g_time3() - start, cpu_ms);
+
+    /* let the last frames finish, so xrdp isn't stuck painting */
+    start = g_time3();
+    while (g_time3() - start < DRAIN_TIMEOUT)
+    {
+        if (service(lt, opts, 0, 100) != 0)
+        {
+            break;
+        }
+    }
+    for (index = 0; index < opts->sessions; index++)
+    {
+        rdp_sink_disconnect(lt->sinks[index]);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct log_config *logging;
+    struct loadtest_options opts;
+    struct loadtest lt;
+    int index;
+    int rv = 1;
+
+    logging = log_config_init_for_console(LOG_LEVEL_WARNING,
+                                          g_getenv("LOADTEST_LOG_LEVEL"));
+    log_start_from_param(logging);
+    log_config_free(logging);
+
+    if (parse_options(argc, argv, &opts) != 0)
+    {
+        usage();
+        log_end();
+        return 1;
+    }
+
+    g_memset(&lt, 0, sizeof(lt));
+    lt.sinks = (struct rdp_sink **)
+               g_malloc(opts.sessions * sizeof(struct rdp_sink *), 1);
+    lt.synths = (struct xup_synth **)
+                g_malloc(opts.sessions * sizeof(struct xup_synth *), 1);
+    lt.cpu_start = (long long *)
+                   g_malloc(opts.sessions * sizeof(long long), 1);
+    lt.pfds = (struct pollfd *)
+              g_malloc((1 + 2 * opts.sessions) * sizeof(struct pollfd), 1);
+
+    if (g_file_exist(opts.socket_path))
+    {
+        g_file_delete(opts.socket_path);
+    }
+    lt.listen_sck = g_sck_local_socket();
+    if (lt.sinks == NULL || lt.synths == NULL || lt.cpu_start == NULL ||
+            lt.pfds == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+    }
+    else if (lt.listen_sck < 0 ||
+             g_sck_local_bind(lt.listen_sck, opts.socket_path) != 0 ||
+             g_sck_listen(lt.listen_sck) != 0)
+    {
+        fprintf(stderr, "Can't listen on %s [%s]\n", opts.socket_path,
+                g_get_strerror());
+    }
+    else
+    {
+        rv = run(&lt, &opts);
+    }
+
+    for (index = 0; lt.sinks != NULL && index < opts.sessions; index++)
+    {
+        rdp_sink_delete(lt.sinks[index]);
+    }
+    for (index = 0; index < lt.num_synths; index++)
+    {
+        xup_synth_delete(lt.synths[index]);
+    }
+    if (lt.listen_sck >= 0)
+    {
+        g_sck_close(lt.listen_sck);
+    }
+    g_file_delete(opts.socket_path);
+    g_free(lt.sinks);
+    g_free(lt.synths);
+    g_free(lt.cpu_start);
+    g_free(lt.pfds);
+    log_end();
+    return rv;
+}
@@ -0,0 +1,1634 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/rdp_sink.c
+ * @brief   Client end of an RDP connection which discards the output
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "arch.h"
+#include "ms-rdpbcgr.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "rdp_sink.h"
+#include "string_calls.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define TLS_client_method SSLv23_client_method
+#endif
+
+/* [ITU-T T.125] DomainMCSPDU choices */
+#define MCS_DPUM 8
+#define MCS_AUCF 11
+#define MCS_SDRQ 25
+#define MCS_SDIN 26
+
+/* [MS-RDPBCGR] values not in ms-rdpbcgr.h */
+#define PDUTYPE2_FRAME_ACKNOWLEDGE 56
+#define SURFCMD_FRAMEACTION_END 1
+#define CS_NET 0xC003
+
+/* [MS-RDPEDYC] commands */
+#define DVC_CMD_CREATE 1
+#define DVC_CMD_DATA_FIRST 2
+#define DVC_CMD_DATA 3
+
+/* [MS-RDPEGFX] */
+#define GFX_CHANNEL_NAME "Microsoft::Windows::RDS::Graphics"
+#define RDP_SEGMENTED_DATA_SINGLE 0xE0
+#define RDP_SEGMENTED_DATA_MULTIPART 0xE1
+#define RDPGFX_CMDID_ENDFRAME 0x000C
+#define RDPGFX_CMDID_FRAMEACKNOWLEDGE 0x000D
+#define RDPGFX_CMDID_QOEFRAMEACKNOWLEDGE 0x0016
+
+/*****************************************************************************/
+static int
+get_uint16_le(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8);
+}
+
+/*****************************************************************************/
+static int
+get_uint16_be(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (u[0] << 8) | u[1];
+}
+
+/*****************************************************************************/
+static unsigned int
+get_uint32_le(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+/*****************************************************************************/
+static void
+put_uint16_le(char *p, int v)
+{
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+}
+
+/*****************************************************************************/
+static void
+put_uint16_be(char *p, int v)
+{
+    p[0] = (char)(v >> 8);
+    p[1] = (char)v;
+}
+
+/*****************************************************************************/
+static void
+put_uint32_le(char *p, unsigned int v)
+{
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    p[2] = (char)(v >> 16);
+    p[3] = (char)(v >> 24);
+}
+
+/*****************************************************************************/
+/* appends data to a growable buffer */
+static int
+append(char **buf, int *bytes, int *size, const char *data, int len)
+{
+    char *new_buf;
+    int new_size;
+
+    if (*bytes + len > *size)
+    {
+        new_size = *size < 8192 ? 8192 : *size;
+        while (new_size < *bytes + len)
+        {
+            new_size *= 2;
+        }
+        new_buf = (char *)g_malloc(new_size, 0);
+        if (new_buf == NULL)
+        {
+            return 1;
+        }
+        if (*bytes > 0)
+        {
+            g_memcpy(new_buf, *buf, *bytes);
+        }
+        g_free(*buf);
+        *buf = new_buf;
+        *size = new_size;
+    }
+    g_memcpy(*buf + *bytes, data, len);
+    *bytes += len;
+    return 0;
+}
+
+/*****************************************************************************/
+struct rdp_sink *
+rdp_sink_connect(const char *host, const char *port)
+{
+    struct rdp_sink *self;
+
+    self = (struct rdp_sink *)g_malloc(sizeof(struct rdp_sink), 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->gfx_chid = -1;
+    self->sck = g_tcp_socket();
+    if (self->sck < 0)
+    {
+        g_free(self);
+        return NULL;
+    }
+    if (g_tcp_connect(self->sck, host, port) != 0)
+    {
+        fprintf(stderr, "Can't connect to %s:%s\n", host, port);
+        rdp_sink_delete(self);
+        return NULL;
+    }
+    g_tcp_set_no_delay(self->sck);
+    return self;
+}
+
+/*****************************************************************************/
+void
+rdp_sink_delete(struct rdp_sink *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    if (self->ssl != NULL)
+    {
+        SSL_shutdown((SSL *)self->ssl);
+        SSL_free((SSL *)self->ssl);
+    }
+    if (self->ssl_ctx != NULL)
+    {
+        SSL_CTX_free((SSL_CTX *)self->ssl_ctx);
+    }
+    if (self->sck >= 0)
+    {
+        g_sck_close(self->sck);
+    }
+    g_free(self->in_data);
+    g_free(self->chan_data);
+    g_free(self->gfx_data);
+    g_free(self->frag_data);
+    g_free(self);
+}
+
+/*****************************************************************************/
+/* blocking read, used before TLS is started */
+static int
+read_raw(struct rdp_sink *self, char *data, int bytes)
+{
+    int rv;
+
+    while (bytes > 0)
+    {
+        rv = g_sck_recv(self->sck, data, bytes, 0);
+        if (rv < 1)
+        {
+            return 1;
+        }
+        data += rv;
+        bytes -= rv;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdp_sink_read_connection_confirm(struct rdp_sink *self,
+                                 int *selected_protocol)
+{
+    char pdu[512];
+    int len;
+
+    *selected_protocol = 0;
+    if (read_raw(self, pdu, 4) != 0 || pdu[0] != 3)
+    {
+        return 1;
+    }
+    len = get_uint16_be(pdu + 2);
+    if (len < 11 || len > (int)sizeof(pdu) ||
+            read_raw(self, pdu + 4, len - 4) != 0)
+    {
+        return 1;
+    }
+    if ((pdu[5] & 0xf0) != 0xd0) /* X.224 connection confirm */
+    {
+        return 1;
+    }
+    self->bytes_in += len;
+    /* RDP_NEG_RSP */
+    if (len >= 19 && pdu[11] == 2)
+    {
+        *selected_protocol = (int)get_uint32_le(pdu + 15);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdp_sink_start_tls(struct rdp_sink *self)
+{
+    SSL_CTX *ctx;
+    SSL *ssl;
+
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL)
+    {
+        return 1;
+    }
+    self->ssl_ctx = ctx;
+    /* xrdp's certificate is usually self-signed, and nothing here is
+       worth protecting */
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+    ssl = SSL_new(ctx);
+    if (ssl == NULL)
+    {
+        return 1;
+    }
+    self->ssl = ssl;
+    SSL_set_fd(ssl, self->sck);
+    if (SSL_connect(ssl) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        return 1;
+    }
+    g_sck_set_non_blocking(self->sck);
+    return 0;
+}
+
+/*****************************************************************************/
+/* reads what is available into in_data, without processing it.
+   Returns non-zero if the connection has closed */
+static int
+read_available(struct rdp_sink *self)
+{
+    char buf[16 * 1024];
+    int rv;
+    int err;
+
+    for (;;)
+    {
+        if (self->ssl != NULL)
+        {
+            rv = SSL_read((SSL *)self->ssl, buf, sizeof(buf));
+            if (rv <= 0)
+            {
+                err = SSL_get_error((SSL *)self->ssl, rv);
+                if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+                {
+                    return 0;
+                }
+                return 1;
+            }
+        }
+        else
+        {
+            rv = g_sck_recv(self->sck, buf, sizeof(buf), 0);
+            if (rv < 0 && g_sck_last_error_would_block(self->sck))
+            {
+                return 0;
+            }
+            if (rv < 1)
+            {
+                return 1;
+            }
+        }
+        if (append(&self->in_data, &self->in_bytes, &self->in_size,
+                   buf, rv) != 0)
+        {
+            return 1;
+        }
+    }
+}
+
+/*****************************************************************************/
+int
+rdp_sink_write(struct rdp_sink *self, const char *data, int bytes)
+{
+    struct pollfd pfd;
+    int rv;
+    int err;
+
+    while (bytes > 0)
+    {
+        if (self->ssl != NULL)
+        {
+            rv = SSL_write((SSL *)self->ssl, data, bytes);
+            err = rv > 0 ? SSL_ERROR_NONE :
+                  SSL_get_error((SSL *)self->ssl, rv);
+            if (err != SSL_ERROR_NONE && err != SSL_ERROR_WANT_READ &&
+                    err != SSL_ERROR_WANT_WRITE)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            rv = g_sck_send(self->sck, data, bytes, 0);
+            if (rv < 0 && !g_sck_last_error_would_block(self->sck))
+            {
+                return 1;
+            }
+        }
+        if (rv > 0)
+        {
+            data += rv;
+            bytes -= rv;
+            continue;
+        }
+        /* xrdp may be blocked sending to us, so keep reading while we
+           wait for it to read */
+        pfd.fd = self->sck;
+        pfd.events = POLLIN | POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 1000);
+        if ((pfd.revents & POLLIN) && read_available(self) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* sends data on an MCS channel, in a send data request */
+static int
+send_mcs(struct rdp_sink *self, int chanid, const char *data, int bytes)
+{
+    char *pdu;
+    int hdr;
+    int len;
+    int rv;
+
+    hdr = bytes < 0x80 ? 14 : 15;
+    len = hdr + bytes;
+    pdu = (char *)g_malloc(len, 0);
+    if (pdu == NULL)
+    {
+        return 1;
+    }
+    pdu[0] = 3; /* TPKT */
+    pdu[1] = 0;
+    pdu[2] = (char)(len >> 8);
+    pdu[3] = (char)len;
+    pdu[4] = 2; /* X.224 data */
+    pdu[5] = (char)0xf0;
+    pdu[6] = (char)0x80;
+    pdu[7] = MCS_SDRQ << 2;
+    pdu[8] = (char)(self->userid >> 8);
+    pdu[9] = (char)self->userid;
+    pdu[10] = (char)(chanid >> 8);
+    pdu[11] = (char)chanid;
+    pdu[12] = 0x70; /* high priority, begin and end segment */
+    if (bytes < 0x80)
+    {
+        pdu[13] = (char)bytes;
+    }
+    else
+    {
+        pdu[13] = (char)(0x80 | (bytes >> 8));
+        pdu[14] = (char)bytes;
+    }
+    g_memcpy(pdu + hdr, data, bytes);
+    rv = rdp_sink_write(self, pdu, len);
+    g_free(pdu);
+    return rv;
+}
+
+/*****************************************************************************/
+/* sends a [MS-RDPRFX] TS_FRAME_ACKNOWLEDGE_PDU */
+static int
+send_frame_ack(struct rdp_sink *self, unsigned int frame_id)
+{
+    char pdu[22];
+
+    put_uint16_le(pdu + 0, sizeof(pdu)); /* totalLength */
+    put_uint16_le(pdu + 2, 0x10 | PDUTYPE_DATAPDU);
+    put_uint16_le(pdu + 4, self->userid + 1001); /* pduSource */
+    put_uint32_le(pdu + 6, self->share_id);
+    pdu[10] = 0; /* pad1 */
+    pdu[11] = 1; /* streamId, low priority */
+    put_uint16_le(pdu + 12, sizeof(pdu) - 14); /* uncompressedLength */
+    pdu[14] = PDUTYPE2_FRAME_ACKNOWLEDGE;
+    pdu[15] = 0; /* compressedType */
+    put_uint16_le(pdu + 16, 0); /* compressedLength */
+    put_uint32_le(pdu + 18, frame_id);
+    self->frames++;
+    return send_mcs(self, RDP_SINK_IO_CHANNEL, pdu, sizeof(pdu));
+}
+
+/*****************************************************************************/
+/* sends an RDPGFX_FRAME_ACKNOWLEDGE_PDU */
+static int
+send_gfx_frame_ack(struct rdp_sink *self, unsigned int frame_id)
+{
+    char pdu[8 + 6 + 20];
+    int chid = self->gfx_chid;
+    int hdr;
+
+    if (self->drdynvc_chanid == 0)
+    {
+        return 0;
+    }
+    /* DVC data, with a 1, 2 or 4 byte channel id */
+    if (chid < 0x100)
+    {
+        pdu[8] = (DVC_CMD_DATA << 4) | 0;
+        pdu[9] = (char)chid;
+        hdr = 10;
+    }
+    else if (chid < 0x10000)
+    {
+        pdu[8] = (DVC_CMD_DATA << 4) | 1;
+        put_uint16_le(pdu + 9, chid);
+        hdr = 11;
+    }
+    else
+    {
+        pdu[8] = (DVC_CMD_DATA << 4) | 2;
+        put_uint32_le(pdu + 9, chid);
+        hdr = 13;
+    }
+    put_uint16_le(pdu + hdr + 0, RDPGFX_CMDID_FRAMEACKNOWLEDGE);
+    put_uint16_le(pdu + hdr + 2, 0); /* flags */
+    put_uint32_le(pdu + hdr + 4, 20); /* pduLength */
+    put_uint32_le(pdu + hdr + 8, 0); /* queueDepth */
+    put_uint32_le(pdu + hdr + 12, frame_id);
+    put_uint32_le(pdu + hdr + 16, self->gfx_frames + 1);
+    /* channel PDU header */
+    put_uint32_le(pdu + 0, hdr + 20 - 8);
+    put_uint32_le(pdu + 4, XR_CHANNEL_FLAG_FIRST | XR_CHANNEL_FLAG_LAST);
+    self->gfx_frames++;
+    return send_mcs(self, self->drdynvc_chanid, pdu, hdr + 20);
+}
+
+/*****************************************************************************/
+/* processes reassembled, unsegmented GFX PDUs */
+static int
+process_gfx_pdus(struct rdp_sink *self, const char *data, int bytes)
+{
+    int cmd_id;
+    int pdu_len;
+
+    while (bytes >= 8)
+    {
+        cmd_id = get_uint16_le(data);
+        pdu_len = (int)get_uint32_le(data + 4);
+        if (pdu_len < 8 || pdu_len > bytes)
+        {
+            return 1;
+        }
+        if (cmd_id == RDPGFX_CMDID_ENDFRAME && pdu_len >= 12)
+        {
+            if (send_gfx_frame_ack(self, get_uint32_le(data + 8)) != 0)
+            {
+                return 1;
+            }
+        }
+        data += pdu_len;
+        bytes -= pdu_len;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes an RDP_SEGMENTED_DATA structure from the GFX channel */
+static int
+process_gfx(struct rdp_sink *self, const char *data, int bytes)
+{
+    char *whole;
+    int whole_bytes;
+    int whole_size;
+    int count;
+    int seg_bytes;
+    int rv;
+
+    if (bytes >= 2 && (unsigned char)data[0] == RDP_SEGMENTED_DATA_SINGLE)
+    {
+        if (data[1] & RDP_MPPC_COMPRESSED)
+        {
+            self->compressed++;
+            return 0;
+        }
+        return process_gfx_pdus(self, data + 2, bytes - 2);
+    }
+    if (bytes < 7 || (unsigned char)data[0] != RDP_SEGMENTED_DATA_MULTIPART)
+    {
+        return 1;
+    }
+    count = get_uint16_le(data + 1);
+    data += 7;
+    bytes -= 7;
+    whole = NULL;
+    whole_bytes = 0;
+    whole_size = 0;
+    rv = 0;
+    while (count-- > 0 && rv == 0)
+    {
+        if (bytes < 5)
+        {
+            rv = 1;
+            break;
+        }
+        seg_bytes = (int)get_uint32_le(data);
+        if (seg_bytes < 1 || seg_bytes > bytes - 4)
+        {
+            rv = 1;
+            break;
+        }
+        if (data[4] & RDP_MPPC_COMPRESSED)
+        {
+            self->compressed++;
+            g_free(whole);
+            return 0;
+        }
+        rv = append(&whole, &whole_bytes, &whole_size,
+                    data + 5, seg_bytes - 1);
+        data += 4 + seg_bytes;
+        bytes -= 4 + seg_bytes;
+    }
+    if (rv == 0)
+    {
+        rv = process_gfx_pdus(self, whole, whole_bytes);
+    }
+    g_free(whole);
+    return rv;
+}
+
+/*****************************************************************************/
+/* reads a DVC length field of 1, 2 or 4 bytes */
+static int
+get_dvc_value(const char **data, int *bytes, int size_code,
+              unsigned int *value)
+{
+    int len = size_code == 0 ? 1 : size_code == 1 ? 2 : 4;
+
+    if (*bytes < len)
+    {
+        return 1;
+    }
+    *value = len == 1 ? (unsigned char)**data :
+             len == 2 ? (unsigned int)get_uint16_le(*data) :
+             get_uint32_le(*data);
+    *data += len;
+    *bytes -= len;
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes a reassembled drdynvc PDU */
+static int
+process_dvc(struct rdp_sink *self, const char *data, int bytes)
+{
+    unsigned int chid;
+    unsigned int length;
+    int cmd;
+    int sp;
+    int cb_chid;
+
+    if (bytes < 1)
+    {
+        return 0;
+    }
+    cmd = (data[0] >> 4) & 0xf;
+    sp = (data[0] >> 2) & 3;
+    cb_chid = data[0] & 3;
+    data++;
+    bytes--;
+    if (cmd != DVC_CMD_CREATE && cmd != DVC_CMD_DATA_FIRST &&
+            cmd != DVC_CMD_DATA)
+    {
+        return 0;
+    }
+    if (get_dvc_value(&data, &bytes, cb_chid, &chid) != 0)
+    {
+        return 1;
+    }
+    if (cmd == DVC_CMD_CREATE)
+    {
+        if (bytes >= (int)sizeof(GFX_CHANNEL_NAME) &&
+                g_memcmp(data, GFX_CHANNEL_NAME,
+                         sizeof(GFX_CHANNEL_NAME)) == 0)
+        {
+            self->gfx_chid = (int)chid;
+            self->gfx_bytes = 0;
+            self->gfx_total = 0;
+        }
+        return 0;
+    }
+    if ((int)chid != self->gfx_chid)
+    {
+        return 0;
+    }
+    if (cmd == DVC_CMD_DATA_FIRST)
+    {
+        if (get_dvc_value(&data, &bytes, sp, &length) != 0)
+        {
+            return 1;
+        }
+        self->gfx_bytes = 0;
+        self->gfx_total = (int)length;
+    }
+    else if (self->gfx_total == 0)
+    {
+        /* a complete message */
+        return process_gfx(self, data, bytes);
+    }
+    if (append(&self->gfx_data, &self->gfx_bytes, &self->gfx_size,
+               data, bytes) != 0)
+    {
+        return 1;
+    }
+    if (self->gfx_bytes >= self->gfx_total)
+    {
+        self->gfx_total = 0;
+        return process_gfx(self, self->gfx_data, self->gfx_bytes);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes a static virtual channel PDU on drdynvc */
+static int
+process_drdynvc(struct rdp_sink *self, const char *data, int bytes)
+{
+    int flags;
+
+    if (bytes < 8)
+    {
+        return 1;
+    }
+    flags = (int)get_uint32_le(data + 4);
+    if (flags & XR_CHANNEL_FLAG_FIRST)
+    {
+        self->chan_bytes = 0;
+    }
+    if (append(&self->chan_data, &self->chan_bytes, &self->chan_size,
+               data + 8, bytes - 8) != 0)
+    {
+        return 1;
+    }
+    if (flags & XR_CHANNEL_FLAG_LAST)
+    {
+        return process_dvc(self, self->chan_data, self->chan_bytes);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes share control PDUs on the I/O channel */
+static int
+process_io(struct rdp_sink *self, const char *data, int bytes)
+{
+    int total_len;
+    int pdu_type;
+
+    while (bytes >= 6)
+    {
+        total_len = get_uint16_le(data);
+        pdu_type = get_uint16_le(data + 2);
+        if ((pdu_type & 0xfff0) != 0x10 || total_len < 6 ||
+                total_len > bytes)
+        {
+            /* licensing, or something else we don't need */
+            return 0;
+        }
+        if ((pdu_type & 0xf) == PDUTYPE_DEMANDACTIVEPDU && total_len >= 10)
+        {
+            self->share_id = (int)get_uint32_le(data + 6);
+        }
+        data += total_len;
+        bytes -= total_len;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes a TPKT PDU */
+static int
+process_tpkt(struct rdp_sink *self, const char *pdu, int bytes)
+{
+    const char *p;
+    int opcode;
+    int chanid;
+    int len;
+
+    if (bytes < 8 || (pdu[5] & 0xf0) != 0xf0) /* X.224 data */
+    {
+        return 0;
+    }
+    p = pdu + 7;
+    bytes -= 7;
+    opcode = (p[0] >> 2) & 0x3f;
+    switch (opcode)
+    {
+        case MCS_AUCF:
+            if (bytes >= 4)
+            {
+                self->userid = get_uint16_be(p + 2);
+            }
+            break;
+        case MCS_DPUM:
+            self->closed = 1;
+            break;
+        case MCS_SDIN:
+            if (bytes < 7)
+            {
+                return 1;
+            }
+            chanid = get_uint16_be(p + 3);
+            len = (unsigned char)p[6];
+            if (len & 0x80)
+            {
+                if (bytes < 8)
+                {
+                    return 1;
+                }
+                len = ((len & 0x7f) << 8) | (unsigned char)p[7];
+                p += 8;
+                bytes -= 8;
+            }
+            else
+            {
+                p += 7;
+                bytes -= 7;
+            }
+            if (len > bytes)
+            {
+                return 1;
+            }
+            if (chanid == RDP_SINK_IO_CHANNEL)
+            {
+                return process_io(self, p, len);
+            }
+            if (chanid == self->drdynvc_chanid)
+            {
+                return process_drdynvc(self, p, len);
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes the surface commands in a fastpath update */
+static int
+process_surface_commands(struct rdp_sink *self, const char *data, int bytes)
+{
+    int cmd_type;
+    int flags;
+    int len;
+
+    while (bytes >= 2)
+    {
+        cmd_type = get_uint16_le(data);
+        if (cmd_type == CMDTYPE_FRAME_MARKER)
+        {
+            if (bytes < 8)
+            {
+                return 1;
+            }
+            if (get_uint16_le(data + 2) == SURFCMD_FRAMEACTION_END &&
+                    send_frame_ack(self, get_uint32_le(data + 4)) != 0)
+            {
+                return 1;
+            }
+            len = 8;
+        }
+        else if (cmd_type == CMDTYPE_SET_SURFACE_BITS ||
+                 cmd_type == CMDTYPE_STREAM_SURFACE_BITS)
+        {
+            /* cmdType, destination, then TS_BITMAP_DATA_EX */
+            if (bytes < 22)
+            {
+                return 1;
+            }
+            flags = (unsigned char)data[11];
+            len = 22 + (int)get_uint32_le(data + 18);
+            if (flags & 1) /* EX_COMPRESSED_BITMAP_HEADER_PRESENT */
+            {
+                len += 24;
+            }
+        }
+        else
+        {
+            return 1;
+        }
+        if (len > bytes)
+        {
+            return 1;
+        }
+        data += len;
+        bytes -= len;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes a complete fastpath update */
+static int
+process_update(struct rdp_sink *self, int code, const char *data, int bytes)
+{
+    if (code == FASTPATH_UPDATETYPE_SURFCMDS)
+    {
+        return process_surface_commands(self, data, bytes);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* processes a fastpath PDU, after its header */
+static int
+process_fastpath(struct rdp_sink *self, const char *data, int bytes)
+{
+    int header;
+    int code;
+    int frag;
+    int size;
+
+    while (bytes >= 3)
+    {
+        header = (unsigned char)data[0];
+        code = header & 0xf;
+        frag = (header >> 4) & 3;
+        data++;
+        bytes--;
+        if ((header >> 6) & FASTPATH_OUTPUT_COMPRESSION_USED)
+        {
+            if (data[0] & RDP_MPPC_COMPRESSED)
+            {
+                self->compressed++;
+                return 0;
+            }
+            data++;
+            bytes--;
+        }
+        if (bytes < 2)
+        {
+            return 1;
+        }
+        size = get_uint16_le(data);
+        data += 2;
+        bytes -= 2;
+        if (size > bytes)
+        {
+            return 1;
+        }
+        if (frag == FASTPATH_FRAGMENT_SINGLE)
+        {
+            if (process_update(self, code, data, size) != 0)
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            if (frag == FASTPATH_FRAGMENT_FIRST)
+            {
+                self->frag_bytes = 0;
+            }
+            if (append(&self->frag_data, &self->frag_bytes, &self->frag_size,
+                       data, size) != 0)
+            {
+                return 1;
+            }
+            if (frag == FASTPATH_FRAGMENT_LAST &&
+                    process_update(self, code, self->frag_data,
+                                   self->frag_bytes) != 0)
+            {
+                return 1;
+            }
+        }
+        data += size;
+        bytes -= size;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* finds drdynvc in the TS_UD_CS_NET of an MCS connect initial */
+static void
+find_drdynvc(struct rdp_sink *self, const char *data, int bytes)
+{
+    int index;
+    int len;
+    int count;
+    int chan;
+
+    for (index = 0; index + 8 <= bytes; index++)
+    {
+        if (get_uint16_le(data + index) != CS_NET)
+        {
+            continue;
+        }
+        len = get_uint16_le(data + index + 2);
+        count = (int)get_uint32_le(data + index + 4);
+        if (count < 1 || count > MAX_STATIC_CHANNELS ||
+                len != 8 + count * 12 || index + len > bytes)
+        {
+            continue;
+        }
+        for (chan = 0; chan < count; chan++)
+        {
+            if (g_strncasecmp(data + index + 8 + chan * 12,
+                              DRDYNVC_SVC_CHANNEL_NAME,
+                              CHANNEL_NAME_LEN + 1) == 0)
+            {
+                self->drdynvc_chanid = RDP_SINK_IO_CHANNEL + 1 + chan;
+            }
+        }
+        return;
+    }
+}
+
+/*****************************************************************************/
+/* returns non-zero if channel data from the client is a GFX frame ack */
+static int
+is_gfx_ack(struct rdp_sink *self, const char *data, int bytes)
+{
+    unsigned int chid;
+    int cmd_id;
+    int header;
+
+    /* a complete channel PDU, holding a complete DVC data PDU */
+    if (bytes < 9 || (get_uint32_le(data + 4) & 3) != 3 ||
+            ((data[8] >> 4) & 0xf) != DVC_CMD_DATA)
+    {
+        return 0;
+    }
+    header = data[8];
+    bytes -= 9;
+    data += 9;
+    if (get_dvc_value(&data, &bytes, header & 3, &chid) != 0 ||
+            (int)chid != self->gfx_chid || bytes < 8)
+    {
+        return 0;
+    }
+    cmd_id = get_uint16_le(data);
+    return cmd_id == RDPGFX_CMDID_FRAMEACKNOWLEDGE ||
+           cmd_id == RDPGFX_CMDID_QOEFRAMEACKNOWLEDGE;
+}
+
+/*****************************************************************************/
+int
+rdp_sink_client_pdu(struct rdp_sink *self, const char *pdu, int bytes)
+{
+    const char *p;
+    int chanid;
+
+    if (bytes < 8 || pdu[0] != 3 || (pdu[5] & 0xf0) != 0xf0)
+    {
+        return 0;
+    }
+    p = pdu + 7;
+    bytes -= 7;
+    if ((unsigned char)p[0] == 0x7f && (unsigned char)p[1] == 0x65)
+    {
+        find_drdynvc(self, p, bytes);
+        return 0;
+    }
+    if (((p[0] >> 2) & 0x3f) != MCS_SDRQ || bytes < 8)
+    {
+        return 0;
+    }
+    chanid = get_uint16_be(p + 3);
+    if ((unsigned char)p[6] & 0x80)
+    {
+        p += 8;
+        bytes -= 8;
+    }
+    else
+    {
+        p += 7;
+        bytes -= 7;
+    }
+    if (chanid == RDP_SINK_IO_CHANNEL)
+    {
+        /* share data header, then pduType2 */
+        return bytes >= 18 &&
+               (get_uint16_le(p + 2) & 0xf) == PDUTYPE_DATAPDU &&
+               (unsigned char)p[14] == PDUTYPE2_FRAME_ACKNOWLEDGE;
+    }
+    if (chanid == self->drdynvc_chanid && self->drdynvc_chanid != 0)
+    {
+        return is_gfx_ack(self, p, bytes);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+rdp_sink_check(struct rdp_sink *self)
+{
+    const char *p;
+    int len;
+    int hdr;
+    int rv;
+
+    if (self->closed)
+    {
+        return 1;
+    }
+    if (read_available(self) != 0)
+    {
+        self->closed = 1;
+    }
+    p = self->in_data;
+    rv = 0;
+    while (rv == 0 && self->in_bytes - (p - self->in_data) >= 4)
+    {
+        len = self->in_bytes - (int)(p - self->in_data);
+        if (p[0] == 3)
+        {
+            hdr = 4;
+            len = get_uint16_be(p + 2);
+        }
+        else if ((p[0] & 3) == 0)
+        {
+            if ((unsigned char)p[1] & 0x80)
+            {
+                hdr = 3;
+                len = (((unsigned char)p[1] & 0x7f) << 8) |
+                      (unsigned char)p[2];
+            }
+            else
+            {
+                hdr = 2;
+                len = (unsigned char)p[1];
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unexpected data from xrdp\n");
+            rv = 1;
+            break;
+        }
+        if (len < hdr)
+        {
+            rv = 1;
+            break;
+        }
+        if (len > self->in_bytes - (int)(p - self->in_data))
+        {
+            break;
+        }
+        self->bytes_in += len;
+        self->pdus_in++;
+        if (p[0] == 3)
+        {
+            rv = process_tpkt(self, p, len);
+        }
+        else
+        {
+            rv = process_fastpath(self, p + hdr, len - hdr);
+        }
+        p += len;
+    }
+    /* move any partial PDU to the start of the buffer */
+    len = self->in_bytes - (int)(p - self->in_data);
+    if (len > 0 && p != self->in_data)
+    {
+        g_memmove(self->in_data, p, len);
+    }
+    self->in_bytes = len;
+    if (rv != 0)
+    {
+        self->closed = 1;
+    }
+    return self->closed;
+}
+
+/*****************************************************************************/
+/* sends data in a TPKT and X.224 data header */
+static int
+send_x224(struct rdp_sink *self, const char *data, int bytes)
+{
+    char pdu[64];
+    int len = 7 + bytes;
+
+    if (len > (int)sizeof(pdu))
+    {
+        return 1;
+    }
+    pdu[0] = 3;
+    pdu[1] = 0;
+    pdu[2] = (char)(len >> 8);
+    pdu[3] = (char)len;
+    pdu[4] = 2;
+    pdu[5] = (char)0xf0;
+    pdu[6] = (char)0x80;
+    g_memcpy(pdu + 7, data, bytes);
+    return rdp_sink_write(self, pdu, len);
+}
+
+/*****************************************************************************/
+/* waits for xrdp to send what sets a value in the sink */
+static int
+wait_for_value(struct rdp_sink *self, const int *value)
+{
+    struct pollfd pfd;
+    int start = g_time3();
+
+    while (*value == 0)
+    {
+        if (g_time3() - start > RDP_SINK_LOGIN_TIMEOUT)
+        {
+            fprintf(stderr, "Timed out logging in\n");
+            return 1;
+        }
+        pfd.fd = self->sck;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, 100);
+        if (rdp_sink_check(self) != 0)
+        {
+            fprintf(stderr, "xrdp closed the connection while logging "
+                    "in\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* writes a string as UTF-16LE. The string is ASCII */
+static void
+out_unicode(struct stream *s, const char *text, int bytes)
+{
+    int index;
+
+    for (index = 0; index < bytes / 2; index++)
+    {
+        out_uint16_le(s, *text != '\0' ? (unsigned char)*text++ : 0);
+    }
+}
+
+/*****************************************************************************/
+/* writes an [ITU-T T.125] DomainParameters sequence */
+static void
+out_domain_params(struct stream *s, const int *params)
+{
+    char *len_p;
+    int index;
+
+    out_uint8(s, 0x30);
+    len_p = s->p;
+    out_uint8s(s, 1);
+    for (index = 0; index < 8; index++)
+    {
+        out_uint8(s, 2); /* INTEGER */
+        if (params[index] > 0xff)
+        {
+            out_uint8(s, 2);
+            out_uint16_be(s, params[index]);
+        }
+        else
+        {
+            out_uint8(s, 1);
+            out_uint8(s, params[index]);
+        }
+    }
+    *len_p = (char)(s->p - len_p - 1);
+}
+
+/*****************************************************************************/
+/* sends the X.224 connection request, asking for TLS */
+static int
+send_connection_request(struct rdp_sink *self)
+{
+    static const char cookie[] = "Cookie: mstshash=loadtest\r\n";
+    struct stream *s;
+    int rv;
+
+    make_stream(s);
+    init_stream(s, 256);
+    s_push_layer(s, iso_hdr, 4);
+    out_uint8(s, 6 + (sizeof(cookie) - 1) + 8); /* LI */
+    out_uint8(s, 0xe0); /* connection request */
+    out_uint8s(s, 5); /* DST-REF, SRC-REF, class */
+    out_uint8a(s, cookie, sizeof(cookie) - 1);
+    out_uint8(s, RDP_NEG_REQ);
+    out_uint8(s, 0); /* flags */
+    out_uint16_le(s, 8);
+    out_uint32_le(s, PROTOCOL_SSL);
+    s_mark_end(s);
+    s_pop_layer(s, iso_hdr);
+    out_uint8(s, 3);
+    out_uint8(s, 0);
+    out_uint16_be(s, s->end - s->data);
+    rv = rdp_sink_write(self, s->data, s->end - s->data);
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* sends the MCS connect initial, with the client's core, security and
+   network data */
+static int
+send_connect_initial(struct rdp_sink *self, int width, int height)
+{
+    static const int target_params[8] = { 34, 2, 0, 1, 0, 1, 0xffff, 2 };
+    static const int min_params[8] = { 1, 1, 1, 1, 0, 1, 0x420, 2 };
+    static const int max_params[8] =
+    {
+        0xffff, 0xfc17, 0xffff, 1, 0, 1, 0xffff, 2
+    };
+    struct stream *s;
+    char *ci_len;
+    char *gcc_len;
+    char *ccr_len;
+    char *ud_len;
+    int rv;
+
+    make_stream(s);
+    init_stream(s, 1024);
+    s_push_layer(s, iso_hdr, 7);
+    /* Connect-Initial, with two byte lengths so they can be filled in
+       afterwards */
+    out_uint16_be(s, 0x7f65);
+    out_uint8(s, 0x82);
+    ci_len = s->p;
+    out_uint8s(s, 2);
+    out_uint8a(s, "\x04\x01\x01", 3); /* callingDomainSelector */
+    out_uint8a(s, "\x04\x01\x01", 3); /* calledDomainSelector */
+    out_uint8a(s, "\x01\x01\xff", 3); /* upwardFlag */
+    out_domain_params(s, target_params);
+    out_domain_params(s, min_params);
+    out_domain_params(s, max_params);
+    out_uint8(s, 4); /* userData */
+    out_uint8(s, 0x82);
+    gcc_len = s->p;
+    out_uint8s(s, 2);
+    /* [ITU-T T.124] ConferenceCreateRequest. xrdp skips the 23 bytes
+       before the user data, so the PER lengths are always two bytes */
+    out_uint8a(s, "\x00\x05\x00\x14\x7c\x00\x01", 7);
+    ccr_len = s->p;
+    out_uint8s(s, 2);
+    out_uint8a(s, "\x00\x08\x00\x10\x00\x01\xc0\x00" "Duca", 12);
+    ud_len = s->p;
+    out_uint8s(s, 2);
+
+    /* TS_UD_CS_CORE */
+    out_uint16_le(s, SEC_TAG_CLI_INFO);
+    out_uint16_le(s, 216);
+    out_uint32_le(s, 0x00080004); /* version, RDP 5.0 and later */
+    out_uint16_le(s, width);
+    out_uint16_le(s, height);
+    out_uint16_le(s, RNS_UD_COLOR_8BPP);
+    out_uint16_le(s, 0xaa03); /* SASSequence */
+    out_uint32_le(s, 0x409); /* keyboardLayout, US */
+    out_uint32_le(s, 2600); /* clientBuild */
+    out_unicode(s, "loadtest", 32);
+    out_uint32_le(s, 4); /* keyboardType, IBM enhanced */
+    out_uint32_le(s, 0); /* keyboardSubType */
+    out_uint32_le(s, 12); /* keyboardFunctionKey */
+    out_uint8s(s, 64); /* imeFileName */
+    out_uint16_le(s, RNS_UD_COLOR_8BPP); /* postBeta2ColorDepth */
+    out_uint16_le(s, 1); /* clientProductId */
+    out_uint32_le(s, 0); /* serialNumber */
+    out_uint16_le(s, 24); /* highColorDepth */
+    out_uint16_le(s, RNS_UD_24BPP_SUPPORT | RNS_UD_16BPP_SUPPORT |
+                  RNS_UD_15BPP_SUPPORT | RNS_UD_32BPP_SUPPORT);
+    out_uint16_le(s, RNS_UD_CS_WANT_32BPP_SESSION | 1); /* and ERRINFO */
+    out_uint8s(s, 64); /* clientDigProductId */
+    out_uint8(s, CONNECTION_TYPE_LAN);
+    out_uint8(s, 0); /* pad1octet */
+    out_uint32_le(s, PROTOCOL_SSL); /* serverSelectedProtocol */
+    /* TS_UD_CS_SEC, no standard RDP security */
+    out_uint16_le(s, SEC_TAG_CLI_CRYPT);
+    out_uint16_le(s, 12);
+    out_uint32_le(s, 0);
+    out_uint32_le(s, 0);
+    /* TS_UD_CS_NET, no static virtual channels */
+    out_uint16_le(s, SEC_TAG_CLI_CHANNELS);
+    out_uint16_le(s, 8);
+    out_uint32_le(s, 0);
+    s_mark_end(s);
+
+    put_uint16_be(ud_len, 0x8000 | (int)(s->end - ud_len - 2));
+    put_uint16_be(ccr_len, 0x8000 | (int)(s->end - ccr_len - 2));
+    put_uint16_be(gcc_len, (int)(s->end - gcc_len - 2));
+    put_uint16_be(ci_len, (int)(s->end - ci_len - 2));
+    s_pop_layer(s, iso_hdr);
+    out_uint8(s, 3);
+    out_uint8(s, 0);
+    out_uint16_be(s, s->end - s->data);
+    out_uint8a(s, "\x02\xf0\x80", 3);
+    rv = rdp_sink_write(self, s->data, s->end - s->data);
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* sends the TS_INFO_PACKET */
+static int
+send_client_info(struct rdp_sink *self,
+                 const char *username, const char *password)
+{
+    struct stream *s;
+    int user_len = 2 * g_strlen(username);
+    int pass_len = 2 * g_strlen(password);
+    int rv;
+
+    make_stream(s);
+    init_stream(s, 1024 + user_len + pass_len);
+    out_uint16_le(s, SEC_INFO_PKT);
+    out_uint16_le(s, 0); /* flagsHi */
+    out_uint32_le(s, 0); /* CodePage */
+    out_uint32_le(s, RDP_LOGON_NORMAL | RDP_LOGON_AUTO);
+    out_uint16_le(s, 0); /* cbDomain */
+    out_uint16_le(s, user_len);
+    out_uint16_le(s, pass_len);
+    out_uint16_le(s, 0); /* cbAlternateShell */
+    out_uint16_le(s, 0); /* cbWorkingDir */
+    out_uint16_le(s, 0); /* Domain */
+    out_unicode(s, username, user_len + 2);
+    out_unicode(s, password, pass_len + 2);
+    out_uint16_le(s, 0); /* AlternateShell */
+    out_uint16_le(s, 0); /* WorkingDir */
+    s_mark_end(s);
+    rv = send_mcs(self, RDP_SINK_IO_CHANNEL, s->data, s->end - s->data);
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* sends the confirm active PDU. The client asks for bitmap updates, with
+   no drawing orders or codecs */
+static int
+send_confirm_active(struct rdp_sink *self, int width, int height)
+{
+    struct stream *s;
+    char *caps;
+    int rv;
+
+    make_stream(s);
+    init_stream(s, 1024);
+    s_push_layer(s, rdp_hdr, 6);
+    out_uint32_le(s, self->share_id);
+    out_uint16_le(s, 0x3ea); /* originatorId */
+    out_uint16_le(s, 6); /* lengthSourceDescriptor */
+    s_push_layer(s, sec_hdr, 2); /* lengthCombinedCapabilities */
+    out_uint8a(s, "MSTSC", 6);
+    caps = s->p;
+    out_uint16_le(s, 8); /* numberCapabilities */
+    out_uint16_le(s, 0); /* pad2Octets */
+
+    out_uint16_le(s, CAPSTYPE_GENERAL);
+    out_uint16_le(s, CAPSTYPE_GENERAL_LEN);
+    out_uint16_le(s, OSMAJORTYPE_WINDOWS);
+    out_uint16_le(s, OSMINORTYPE_WINDOWS_NT);
+    out_uint16_le(s, TS_CAPS_PROTOCOLVERSION);
+    out_uint16_le(s, 0); /* pad2octetsA */
+    out_uint16_le(s, 0); /* generalCompressionTypes */
+    out_uint16_le(s, FASTPATH_OUTPUT_SUPPORTED | NO_BITMAP_COMPRESSION_HDR |
+                  LONG_CREDENTIALS_SUPPORTED |
+                  0x18); /* AUTORECONNECT_SUPPORTED, ENC_SALTED_CHECKSUM */
+    out_uint16_le(s, 0); /* updateCapabilityFlag */
+    out_uint16_le(s, 0); /* remoteUnshareFlag */
+    out_uint16_le(s, 0); /* generalCompressionLevel */
+    out_uint8(s, 1); /* refreshRectSupport */
+    out_uint8(s, 1); /* suppressOutputSupport */
+
+    out_uint16_le(s, CAPSTYPE_BITMAP);
+    out_uint16_le(s, CAPSTYPE_BITMAP_LEN);
+    out_uint16_le(s, 32); /* preferredBitsPerPixel */
+    out_uint16_le(s, 1); /* receive1BitPerPixel */
+    out_uint16_le(s, 1); /* receive4BitsPerPixel */
+    out_uint16_le(s, 1); /* receive8BitsPerPixel */
+    out_uint16_le(s, width);
+    out_uint16_le(s, height);
+    out_uint16_le(s, 0); /* pad2Octets */
+    out_uint16_le(s, 1); /* desktopResizeFlag */
+    out_uint16_le(s, 1); /* bitmapCompressionFlag */
+    out_uint8(s, 0); /* highColorFlags */
+    out_uint8(s, 0); /* drawingFlags */
+    out_uint16_le(s, 1); /* multipleRectangleSupport */
+    out_uint16_le(s, 0); /* pad2OctetsB */
+
+    out_uint16_le(s, CAPSTYPE_ORDER);
+    out_uint16_le(s, CAPSTYPE_ORDER_LEN);
+    out_uint8s(s, 16); /* terminalDescriptor */
+    out_uint32_le(s, 0); /* pad4OctetsA */
+    out_uint16_le(s, 1); /* desktopSaveXGranularity */
+    out_uint16_le(s, 20); /* desktopSaveYGranularity */
+    out_uint16_le(s, 0); /* pad2OctetsA */
+    out_uint16_le(s, 1); /* maximumOrderLevel */
+    out_uint16_le(s, 0); /* numberFonts */
+    out_uint16_le(s, 0x2a); /* orderFlags */
+    /* orderSupport, only MemBlt, which xrdp paints bitmaps with */
+    out_uint8s(s, TS_NEG_MEMBLT_INDEX);
+    out_uint8(s, 1);
+    out_uint8s(s, 32 - TS_NEG_MEMBLT_INDEX - 1);
+    out_uint16_le(s, 0); /* textFlags */
+    out_uint16_le(s, 0); /* orderSupportExFlags */
+    out_uint32_le(s, 0); /* pad4OctetsB */
+    out_uint32_le(s, 230400); /* desktopSaveSize */
+    out_uint16_le(s, 0); /* pad2OctetsC */
+    out_uint16_le(s, 0); /* pad2OctetsD */
+    out_uint16_le(s, 0); /* textANSICodePage */
+    out_uint16_le(s, 0); /* pad2OctetsE */
+
+    /* revision 1 bitmap caches, with cells big enough for 16x16, 32x32
+       and 64x64 tiles at 32 bpp */
+    out_uint16_le(s, CAPSTYPE_BITMAPCACHE);
+    out_uint16_le(s, CAPSTYPE_BITMAPCACHE_LEN);
+    out_uint8s(s, 24); /* pad1 to pad6 */
+    out_uint16_le(s, 600); /* Cache0Entries */
+    out_uint16_le(s, 16 * 16 * 4); /* Cache0MaximumCellSize */
+    out_uint16_le(s, 300); /* Cache1Entries */
+    out_uint16_le(s, 32 * 32 * 4); /* Cache1MaximumCellSize */
+    out_uint16_le(s, 262); /* Cache2Entries */
+    out_uint16_le(s, 64 * 64 * 4); /* Cache2MaximumCellSize */
+
+    out_uint16_le(s, CAPSTYPE_POINTER);
+    out_uint16_le(s, CAPSTYPE_POINTER_LEN);
+    out_uint16_le(s, 1); /* colorPointerFlag */
+    out_uint16_le(s, 20); /* colorPointerCacheSize */
+    out_uint16_le(s, 20); /* pointerCacheSize */
+
+    out_uint16_le(s, CAPSTYPE_INPUT);
+    out_uint16_le(s, CAPSTYPE_INPUT_LEN);
+    out_uint16_le(s, 0x35); /* inputFlags */
+    out_uint16_le(s, 0); /* pad2OctetsA */
+    out_uint32_le(s, 0x409); /* keyboardLayout */
+    out_uint32_le(s, 4); /* keyboardType */
+    out_uint32_le(s, 0); /* keyboardSubType */
+    out_uint32_le(s, 12); /* keyboardFunctionKey */
+    out_uint8s(s, 64); /* imeFileName */
+
+    out_uint16_le(s, CAPSETTYPE_SURFACE_COMMANDS);
+    out_uint16_le(s, CAPSETTYPE_SURFACE_COMMANDS_LEN);
+    out_uint32_le(s, SURFCMDS_SETSURFACEBITS | SURFCMDS_FRAMEMARKER |
+                  SURFCMDS_STREAMSUFRACEBITS);
+    out_uint32_le(s, 0); /* reserved */
+
+    out_uint16_le(s, CAPSTYPE_FRAME_ACKNOWLEDGE);
+    out_uint16_le(s, CAPSTYPE_FRAME_ACKNOWLEDGE_LEN);
+    out_uint32_le(s, 2); /* maxUnacknowledgedFrameCount */
+    s_mark_end(s);
+
+    s_pop_layer(s, sec_hdr);
+    out_uint16_le(s, s->end - caps);
+    s_pop_layer(s, rdp_hdr);
+    out_uint16_le(s, s->end - s->data); /* totalLength */
+    out_uint16_le(s, 0x10 | PDUTYPE_CONFIRMACTIVEPDU);
+    out_uint16_le(s, self->userid + 1001); /* pduSource */
+    rv = send_mcs(self, RDP_SINK_IO_CHANNEL, s->data, s->end - s->data);
+    free_stream(s);
+    return rv;
+}
+
+/*****************************************************************************/
+/* sends a data PDU on the I/O channel */
+static int
+send_data_pdu(struct rdp_sink *self, int pdu_type2, const char *data,
+              int bytes)
+{
+    char pdu[64];
+    int len = 18 + bytes;
+
+    if (len > (int)sizeof(pdu))
+    {
+        return 1;
+    }
+    put_uint16_le(pdu + 0, len); /* totalLength */
+    put_uint16_le(pdu + 2, 0x10 | PDUTYPE_DATAPDU);
+    put_uint16_le(pdu + 4, self->userid + 1001); /* pduSource */
+    put_uint32_le(pdu + 6, self->share_id);
+    pdu[10] = 0; /* pad1 */
+    pdu[11] = 1; /* streamId, low priority */
+    put_uint16_le(pdu + 12, len - 14); /* uncompressedLength */
+    pdu[14] = (char)pdu_type2;
+    pdu[15] = 0; /* compressedType */
+    put_uint16_le(pdu + 16, 0); /* compressedLength */
+    g_memcpy(pdu + 18, data, bytes);
+    return send_mcs(self, RDP_SINK_IO_CHANNEL, pdu, len);
+}
+
+/*****************************************************************************/
+int
+rdp_sink_login(struct rdp_sink *self, int width, int height,
+               const char *username, const char *password)
+{
+    char pdu[8];
+    int protocol;
+
+    if (send_connection_request(self) != 0 ||
+            rdp_sink_read_connection_confirm(self, &protocol) != 0)
+    {
+        fprintf(stderr, "X.224 connection failed\n");
+        return 1;
+    }
+    if ((protocol & PROTOCOL_SSL) == 0)
+    {
+        fprintf(stderr, "xrdp selected protocol %d, but only TLS is "
+                "supported\n", protocol);
+        return 1;
+    }
+    if (rdp_sink_start_tls(self) != 0)
+    {
+        fprintf(stderr, "TLS handshake failed\n");
+        return 1;
+    }
+
+    /* MCS erect domain, attach user, then channel joins. xrdp replies to
+       the join requests in order, so there's no need to wait */
+    if (send_connect_initial(self, width, height) != 0 ||
+            send_x224(self, "\x04\x01\x00\x01\x00", 5) != 0 ||
+            send_x224(self, "\x28", 1) != 0 ||
+            wait_for_value(self, &self->userid) != 0)
+    {
+        return 1;
+    }
+    pdu[0] = 0x38; /* channel join request */
+    put_uint16_be(pdu + 1, self->userid);
+    put_uint16_be(pdu + 3, self->userid + 1001);
+    if (send_x224(self, pdu, 5) != 0)
+    {
+        return 1;
+    }
+    put_uint16_be(pdu + 3, RDP_SINK_IO_CHANNEL);
+    if (send_x224(self, pdu, 5) != 0)
+    {
+        return 1;
+    }
+
+    if (send_client_info(self, username, password) != 0 ||
+            wait_for_value(self, &self->share_id) != 0 ||
+            send_confirm_active(self, width, height) != 0)
+    {
+        return 1;
+    }
+    /* the connection finalization PDUs */
+    put_uint16_le(pdu + 0, 1); /* SYNCMSGTYPE_SYNC */
+    put_uint16_le(pdu + 2, 1002); /* targetUser */
+    if (send_data_pdu(self, RDP_DATA_PDU_SYNCHRONISE, pdu, 4) != 0)
+    {
+        return 1;
+    }
+    g_memset(pdu, 0, sizeof(pdu));
+    put_uint16_le(pdu + 0, RDP_CTL_COOPERATE);
+    if (send_data_pdu(self, RDP_DATA_PDU_CONTROL, pdu, 8) != 0)
+    {
+        return 1;
+    }
+    put_uint16_le(pdu + 0, RDP_CTL_REQUEST_CONTROL);
+    if (send_data_pdu(self, RDP_DATA_PDU_CONTROL, pdu, 8) != 0)
+    {
+        return 1;
+    }
+    put_uint16_le(pdu + 0, 0); /* numberFonts */
+    put_uint16_le(pdu + 2, 0); /* totalNumFonts */
+    put_uint16_le(pdu + 4, 3); /* FONTLIST_FIRST | FONTLIST_LAST */
+    put_uint16_le(pdu + 6, 50); /* entrySize */
+    return send_data_pdu(self, RDP_DATA_PDU_FONT2, pdu, 8);
+}
+
+/*****************************************************************************/
+int
+rdp_sink_disconnect(struct rdp_sink *self)
+{
+    if (self->closed)
+    {
+        return 0;
+    }
+    /* MCS disconnect provider ultimatum, reason user requested */
+    return send_x224(self, "\x21\x80", 2);
+}
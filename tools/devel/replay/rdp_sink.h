@@ -0,0 +1,168 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/rdp_sink.h
+ * @brief   Client end of an RDP connection which discards the output
+ *
+ * The sink reads what xrdp sends, and acknowledges the frames in it, so
+ * that xrdp keeps sending. It either replays a recorded client's PDUs,
+ * or logs on by itself as a minimal client. Frames are marked by surface command frame
+ * markers, or by GFX end frame PDUs on the dynamic virtual channel.
+ * Nothing is decoded.
+ *
+ * PDUs compressed by the bulk compressor can't be parsed, so xrdp must
+ * be run with bulk_compression=false. Standard RDP security isn't
+ * supported either, as the sink only does TLS.
+ */
+
+#ifndef _RDP_SINK_H
+#define _RDP_SINK_H
+
+#include "arch.h"
+
+#define RDP_SINK_IO_CHANNEL 1003
+/* Longest wait for each reply while logging on */
+#define RDP_SINK_LOGIN_TIMEOUT 10000
+
+struct rdp_sink
+{
+    int sck;
+    void *ssl_ctx; /* SSL_CTX */
+    void *ssl; /* SSL, once TLS is started */
+    int closed; /* set when xrdp disconnects */
+
+    /* connection state, learnt from the PDUs going past */
+    int userid; /* MCS user id, from the attach user confirm */
+    int share_id; /* from the demand active PDU */
+    int drdynvc_chanid; /* MCS channel of drdynvc, if known */
+    int gfx_chid; /* DVC channel id of the GFX channel, or -1 */
+
+    /* results */
+    long long bytes_in; /* decrypted bytes received */
+    int pdus_in;
+    int frames; /* surface command frames acked */
+    int gfx_frames; /* GFX frames acked */
+    int compressed; /* PDUs skipped as they were compressed */
+
+    /* PDU framing */
+    char *in_data;
+    int in_bytes;
+    int in_size;
+    /* reassembly of drdynvc chunks, GFX data, and fastpath fragments */
+    char *chan_data;
+    int chan_bytes;
+    int chan_size;
+    char *gfx_data;
+    int gfx_bytes;
+    int gfx_size;
+    int gfx_total; /* from the DVC data first PDU */
+    char *frag_data;
+    int frag_bytes;
+    int frag_size;
+};
+
+/**
+ * Connects to xrdp over TCP
+ *
+ * @param host Host name or address
+ * @param port Port
+ * @return the sink, or NULL for error
+ */
+struct rdp_sink *
+rdp_sink_connect(const char *host, const char *port);
+
+/**
+ * Closes the connection, and frees the sink
+ */
+void
+rdp_sink_delete(struct rdp_sink *self);
+
+/**
+ * Reads the X.224 connection confirm
+ *
+ * @param[out] selected_protocol Protocol selected by xrdp
+ * @return 0 for success
+ */
+int
+rdp_sink_read_connection_confirm(struct rdp_sink *self,
+                                 int *selected_protocol);
+
+/**
+ * Starts TLS, after the X.224 connection confirm
+ *
+ * @return 0 for success
+ */
+int
+rdp_sink_start_tls(struct rdp_sink *self);
+
+/**
+ * Logs on to xrdp as a minimal client, over TLS
+ *
+ * The client has no virtual channels, and asks for bitmap updates with
+ * no drawing orders or codecs, so it costs little to run many of them.
+ * Returns once the connection is finalized.
+ *
+ * @param width Desktop width
+ * @param height Desktop height
+ * @param username User name, in ASCII
+ * @param password Password, in ASCII
+ * @return 0 for success
+ */
+int
+rdp_sink_login(struct rdp_sink *self, int width, int height,
+               const char *username, const char *password);
+
+/**
+ * Tells xrdp the client is disconnecting
+ *
+ * @return 0 for success
+ */
+int
+rdp_sink_disconnect(struct rdp_sink *self);
+
+/**
+ * Sends data to xrdp, through TLS if it has been started
+ *
+ * @return 0 for success
+ */
+int
+rdp_sink_write(struct rdp_sink *self, const char *data, int bytes);
+
+/**
+ * Looks at a PDU sent by a recorded client, before it is replayed
+ *
+ * The MCS channel of drdynvc is learnt from the MCS connect initial.
+ *
+ * @return non-zero if the PDU is a frame acknowledgement. The sink sends
+ *         its own, so recorded ones must not be replayed
+ */
+int
+rdp_sink_client_pdu(struct rdp_sink *self, const char *pdu, int bytes);
+
+/**
+ * Reads and processes what xrdp has sent
+ *
+ * Call this when the socket is readable.
+ *
+ * @return 0 for success, non-zero if the connection has closed
+ */
+int
+rdp_sink_check(struct rdp_sink *self);
+
+#endif
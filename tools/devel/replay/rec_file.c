@@ -0,0 +1,152 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/rec_file.c
+ * @brief   Reader for recordings made by common/proto_record.c
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "proto_record.h"
+#include "rec_file.h"
+
+/*****************************************************************************/
+static unsigned int
+get_uint32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/*****************************************************************************/
+struct rec_file *
+rec_file_open(const char *filename, int type_mask)
+{
+    struct rec_file *self;
+    unsigned char header[12];
+
+    self = (struct rec_file *)g_malloc(sizeof(struct rec_file), 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->type_mask = type_mask;
+    self->fp = fopen(filename, "rb");
+    if (self->fp == NULL)
+    {
+        fprintf(stderr, "Can't open %s [%s]\n", filename, g_get_strerror());
+        g_free(self);
+        return NULL;
+    }
+    if (fread(header, 1, sizeof(header), self->fp) != sizeof(header) ||
+            g_memcmp(header, PROTO_RECORD_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "%s is not an xrdp recording\n", filename);
+        rec_file_close(self);
+        return NULL;
+    }
+    if (get_uint32(header + 8) != PROTO_RECORD_VERSION)
+    {
+        fprintf(stderr, "%s is a version %u recording. Only version %d "
+                "is supported\n", filename, get_uint32(header + 8),
+                PROTO_RECORD_VERSION);
+        rec_file_close(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+rec_file_close(struct rec_file *self)
+{
+    if (self != NULL)
+    {
+        if (self->fp != NULL)
+        {
+            fclose(self->fp);
+        }
+        g_free(self->next.data);
+        g_free(self);
+    }
+}
+
+/*****************************************************************************/
+const struct rec_record *
+rec_file_peek(struct rec_file *self)
+{
+    unsigned char header[PROTO_RECORD_HEADER_SIZE];
+    struct rec_record *rec = &self->next;
+    int length;
+
+    while (!self->have_next && !self->at_end)
+    {
+        if (fread(header, 1, sizeof(header), self->fp) != sizeof(header))
+        {
+            self->at_end = 1;
+            break;
+        }
+        length = (int)get_uint32(header + 8);
+        if (length < 0)
+        {
+            fprintf(stderr, "Bad record in recording\n");
+            self->at_end = 1;
+            break;
+        }
+        if (header[4] >= 32 || !(self->type_mask & (1 << header[4])))
+        {
+            fseek(self->fp, length, SEEK_CUR);
+            continue;
+        }
+        if (length > self->data_size)
+        {
+            g_free(rec->data);
+            rec->data = (char *)g_malloc(length, 0);
+            self->data_size = rec->data == NULL ? 0 : length;
+            if (rec->data == NULL)
+            {
+                self->at_end = 1;
+                break;
+            }
+        }
+        if (fread(rec->data, 1, length, self->fp) != (size_t)length)
+        {
+            fprintf(stderr, "Recording is truncated\n");
+            self->at_end = 1;
+            break;
+        }
+        rec->time = get_uint32(header);
+        rec->type = header[4];
+        rec->length = length;
+        self->have_next = 1;
+    }
+    return self->have_next ? rec : NULL;
+}
+
+/*****************************************************************************/
+void
+rec_file_next(struct rec_file *self)
+{
+    self->have_next = 0;
+}
@@ -0,0 +1,85 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/rec_file.h
+ * @brief   Reader for recordings made by common/proto_record.c
+ *
+ * A reader returns only the records of the types it was opened for, so
+ * a file can be opened twice to read the client and the module records
+ * independently.
+ */
+
+#ifndef _REC_FILE_H
+#define _REC_FILE_H
+
+#include <stdio.h>
+
+/* Makes a rec_file_open() type mask from a PROTO_RECORD_* type */
+#define REC_TYPE_MASK(type) (1 << (type))
+
+struct rec_record
+{
+    unsigned int time; /* milliseconds from the start of the recording */
+    int type; /* PROTO_RECORD_* */
+    int length;
+    char *data;
+};
+
+struct rec_file
+{
+    FILE *fp;
+    int type_mask;
+    int have_next; /* next has been read */
+    int at_end;
+    struct rec_record next;
+    int data_size; /* allocated size of next.data */
+};
+
+/**
+ * Opens a recording
+ *
+ * @param filename Recording to read
+ * @param type_mask REC_TYPE_MASK()s of the records to read
+ * @return the reader, or NULL for error, which is reported on stderr
+ */
+struct rec_file *
+rec_file_open(const char *filename, int type_mask);
+
+/**
+ * Closes a recording
+ */
+void
+rec_file_close(struct rec_file *self);
+
+/**
+ * Returns the next record, without consuming it
+ *
+ * @return the record, or NULL at the end of the file. The record is
+ *         valid until rec_file_next() is called
+ */
+const struct rec_record *
+rec_file_peek(struct rec_file *self);
+
+/**
+ * Consumes the record returned by rec_file_peek()
+ */
+void
+rec_file_next(struct rec_file *self);
+
+#endif
@@ -0,0 +1,544 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @file replay.c
+ * @brief Replays a recorded connection against xrdp, as a benchmark
+ *
+ * The recorder is only built into xrdp when it is configured with
+ * --enable-devel-record. Such an xrdp records a connection when
+ * XRDP_RECORD_DIR is set in its environment, each connection process
+ * writing xrdp-<pid>.rec there. Recordings contain the password, so only
+ * build and run it on test systems.
+ *
+ * To replay a recording, give xrdp an xrdp.ini section which connects
+ * xup to this program rather than to an X server, and turn off bulk
+ * compression, which this program can't undo:-
+ *
+ *     [Globals]
+ *     bulk_compression=false
+ *     autorun=replay
+ *
+ *     [replay]
+ *     name=replay
+ *     lib=libxup.so
+ *     port=/tmp/xrdp-replay.sock
+ *     username=na
+ *     password=na
+ *
+ * Then run:-
+ *
+ *     xrdp-replay xrdp-1234.rec
+ *
+ * This program connects to xrdp as the recorded client, sending what the
+ * client sent, and acknowledging the frames xrdp sends. When xup
+ * connects, it plays the part of the X server, sending what it sent.
+ * Paint messages are sent as soon as the previous frame is acked, so the
+ * frame rate is limited only by xrdp. Use -r to keep the recorded
+ * timing instead.
+ *
+ * Only recordings of TLS connections can be replayed.
+ *
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "log.h"
+#include "os_calls.h"
+#include "proto_record.h"
+#include "rdp_sink.h"
+#include "rec_file.h"
+#include "stats.h"
+#include "string_calls.h"
+#include "xup_stub.h"
+
+#if !defined(PACKAGE_VERSION)
+#define PACKAGE_VERSION "???"
+#endif
+
+#define DEFAULT_SOCKET_PATH "/tmp/xrdp-replay.sock"
+/* How long to wait for xup to connect, after the client has finished */
+#define CONNECT_TIMEOUT 10000
+
+/**
+ * A PDU sent by the recorded client
+ */
+struct client_pdu
+{
+    unsigned int time; ///< Recorded time, from the record completing it
+    int offset; ///< Offset in client_pdus.data
+    int bytes;
+};
+
+/**
+ * All the PDUs sent by the recorded client
+ */
+struct client_pdus
+{
+    char *data;
+    int data_bytes;
+    struct client_pdu *pdus;
+    int count;
+};
+
+/*****************************************************************************/
+/**
+ * Prints a brief summary of options and defaults
+ */
+static void
+usage(void)
+{
+    g_printf("xrdp protocol replay v" PACKAGE_VERSION "\n");
+    g_printf("\nusage:\n");
+    g_printf("xrdp-replay [options] recording\n\n");
+    g_printf("options:\n");
+    g_printf("    -h <host>      xrdp host. Default: 127.0.0.1\n"
+             "    -p <port>      xrdp port. Default: 3389\n"
+             "    -s <path>      Socket for xup to connect to."
+             " Default: " DEFAULT_SOCKET_PATH "\n"
+             "    -r             Send the X server messages with the"
+             " recorded timing\n");
+}
+
+/*****************************************************************************/
+/**
+ * Returns the length of the TPKT or fastpath PDU at the start of data,
+ * or 0 if more data is needed, or -1 for an error
+ */
+static int
+pdu_length(const unsigned char *data, int bytes)
+{
+    if (bytes < 4)
+    {
+        return 0;
+    }
+    if (data[0] == 3)
+    {
+        return (data[2] << 8) | data[3];
+    }
+    if ((data[0] & 3) == 0)
+    {
+        if (data[1] & 0x80)
+        {
+            return ((data[1] & 0x7f) << 8) | data[2];
+        }
+        return data[1];
+    }
+    return -1;
+}
+
+/*****************************************************************************/
+/**
+ * Reads the client's data from a recording, and splits it into PDUs
+ *
+ * @return 0 for success
+ */
+static int
+read_client_pdus(const char *filename, struct client_pdus *cp)
+{
+    struct rec_file *rec;
+    const struct rec_record *r;
+    void *p;
+    int data_size = 0;
+    int pdus_size = 0;
+    int start = 0;
+    int len;
+    int rv = 0;
+
+    rec = rec_file_open(filename, REC_TYPE_MASK(PROTO_RECORD_CLIENT_IN));
+    if (rec == NULL)
+    {
+        return 1;
+    }
+    while (rv == 0 && (r = rec_file_peek(rec)) != NULL)
+    {
+        if (cp->data_bytes + r->length > data_size)
+        {
+            data_size = (cp->data_bytes + r->length) * 2;
+            p = realloc(cp->data, data_size);
+            if (p == NULL)
+            {
+                rv = 1;
+                break;
+            }
+            cp->data = (char *)p;
+        }
+        g_memcpy(cp->data + cp->data_bytes, r->data, r->length);
+        cp->data_bytes += r->length;
+        /* the PDUs this record completes */
+        while ((len = pdu_length((unsigned char *)cp->data + start,
+                                 cp->data_bytes - start)) > 0 &&
+                start + len <= cp->data_bytes)
+        {
+            if (cp->count >= pdus_size)
+            {
+                pdus_size = pdus_size < 256 ? 256 : pdus_size * 2;
+                p = realloc(cp->pdus, pdus_size * sizeof(struct client_pdu));
+                if (p == NULL)
+                {
+                    rv = 1;
+                    break;
+                }
+                cp->pdus = (struct client_pdu *)p;
+            }
+            cp->pdus[cp->count].time = r->time;
+            cp->pdus[cp->count].offset = start;
+            cp->pdus[cp->count].bytes = len;
+            cp->count++;
+            start += len;
+        }
+        if (len < 0)
+        {
+            fprintf(stderr, "Recorded client data isn't RDP\n");
+            rv = 1;
+        }
+        rec_file_next(rec);
+    }
+    rec_file_close(rec);
+    if (rv == 0 && (cp->count == 0 || cp->data[0] != 3 ||
+                    (cp->data[5] & 0xf0) != 0xe0))
+    {
+        fprintf(stderr, "Recording doesn't start with a connection "
+                "request\n");
+        rv = 1;
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+/**
+ * Returns non-zero if a client PDU would end the connection
+ *
+ * These are held back until the replay is over.
+ */
+static int
+is_disconnect(const char *pdu, int bytes)
+{
+    /* MCS disconnect provider ultimatum */
+    return bytes >= 8 && pdu[0] == 3 && ((pdu[7] >> 2) & 0x3f) == 8;
+}
+
+/*****************************************************************************/
+/**
+ * Connects the sink, and sends the connection request
+ *
+ * @return 0 for success
+ */
+static int
+start_client(struct rdp_sink *sink, const struct client_pdus *cp)
+{
+    int protocol;
+
+    if (rdp_sink_write(sink, cp->data, cp->pdus[0].bytes) != 0 ||
+            rdp_sink_read_connection_confirm(sink, &protocol) != 0)
+    {
+        fprintf(stderr, "X.224 connection failed\n");
+        return 1;
+    }
+    if ((protocol & 1) == 0) /* PROTOCOL_SSL */
+    {
+        fprintf(stderr, "xrdp selected protocol %d. Only TLS connections "
+                "can be replayed\n", protocol);
+        return 1;
+    }
+    if (rdp_sink_start_tls(sink) != 0)
+    {
+        fprintf(stderr, "TLS handshake failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Prints the results of a replay
+ */
+static void
+report(struct rdp_sink *sink, struct xup_stub *stub, long long cpu_ms)
+{
+    int elapsed = stub->last_ack_time - stub->first_frame_time;
+    int acked = stub->latencies.count;
+
+    g_printf("messages:      %d sent, %d skipped\n",
+             stub->messages, stub->skipped);
+    g_printf("frames:        %d sent, %d acked, %d lost\n",
+             stub->frames, acked, stub->frames_lost);
+    if (acked > 0 && elapsed > 0)
+    {
+        g_printf("elapsed:       %d ms\n", elapsed);
+        g_printf("frame rate:    %.1f frames/s\n",
+                 (double)acked * 1000.0 / elapsed);
+        g_printf("to client:     %lld bytes, %.2f MB/s\n", sink->bytes_in,
+                 (double)sink->bytes_in / (1024.0 * 1024.0) * 1000.0 /
+                 elapsed);
+    }
+    if (acked > 0 && cpu_ms >= 0)
+    {
+        g_printf("xrdp CPU:      %lld ms, %.2f ms/frame\n",
+                 cpu_ms, (double)cpu_ms / acked);
+    }
+    latency_list_print(&stub->latencies, "latency:");
+    g_printf("client acks:   %d frames, %d gfx frames\n",
+             sink->frames, sink->gfx_frames);
+    if (sink->compressed > 0)
+    {
+        g_printf("warning:       %d compressed PDUs couldn't be read. "
+                 "Set bulk_compression=false\n", sink->compressed);
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Runs the replay until the X server's messages have all been sent and
+ * acked, or xrdp disconnects
+ *
+ * @return 0 for success
+ */
+static int
+run(struct rdp_sink *sink, struct xup_stub *stub,
+    const struct client_pdus *cp, int realtime, long long *cpu_ms)
+{
+    struct pollfd pfds[2];
+    const struct client_pdu *pdu;
+    unsigned int client_start_time;
+    unsigned int module_start_time = 0;
+    unsigned int msg_time;
+    long long cpu_start = -1;
+    long long cpu_end;
+    int next_pdu = 1;
+    int disconnect_pdu = -1;
+    int start = g_time3();
+    int connect_time = 0;
+    int client_done_time = 0;
+    int module_done = 0;
+    int now;
+    int wait;
+    int rv = 0;
+
+    client_start_time = cp->pdus[0].time;
+    while (rv == 0)
+    {
+        now = g_time3();
+        wait = 100;
+
+        /* the client's PDUs, with the recorded timing */
+        while (next_pdu < cp->count)
+        {
+            pdu = cp->pdus + next_pdu;
+            if ((int)(pdu->time - client_start_time) > now - start)
+            {
+                wait = MIN(wait, (int)(pdu->time - client_start_time) -
+                           (now - start));
+                break;
+            }
+            if (is_disconnect(cp->data + pdu->offset, pdu->bytes))
+            {
+                disconnect_pdu = next_pdu;
+                next_pdu = cp->count;
+                break;
+            }
+            if (!rdp_sink_client_pdu(sink, cp->data + pdu->offset,
+                                     pdu->bytes) &&
+                    rdp_sink_write(sink, cp->data + pdu->offset,
+                                   pdu->bytes) != 0)
+            {
+                fprintf(stderr, "Error sending to xrdp\n");
+                rv = 1;
+                break;
+            }
+            next_pdu++;
+        }
+        if (next_pdu >= cp->count && client_done_time == 0)
+        {
+            client_done_time = now;
+        }
+
+        /* the X server's messages */
+        while (stub->sck >= 0 && rv == 0)
+        {
+            if (xup_stub_peek(stub, &msg_time) != 0)
+            {
+                module_done = 1;
+                break;
+            }
+            if (realtime)
+            {
+                if ((int)(msg_time - module_start_time) > now - connect_time)
+                {
+                    wait = MIN(wait, (int)(msg_time - module_start_time) -
+                               (now - connect_time));
+                    break;
+                }
+            }
+            if (!xup_stub_can_send(stub))
+            {
+                break;
+            }
+            if (stub->frames == 0 && stub->msg_frame && stub->xrdp_pid > 0)
+            {
+                cpu_start = process_cpu_ms(stub->xrdp_pid);
+            }
+            rv = xup_stub_send(stub);
+            if (rv != 0)
+            {
+                fprintf(stderr, "Error sending to xup\n");
+            }
+        }
+        if (module_done && stub->in_flight == 0)
+        {
+            break;
+        }
+        if (stub->sck < 0 && client_done_time != 0 &&
+                now - client_done_time > CONNECT_TIMEOUT)
+        {
+            fprintf(stderr, "xup didn't connect. Check the xrdp.ini "
+                    "section, and autorun\n");
+            rv = 1;
+            break;
+        }
+
+        pfds[0].fd = sink->sck;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = stub->sck >= 0 ? stub->sck : stub->listen_sck;
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        if (poll(pfds, 2, wait > 0 ? wait : 0) < 0)
+        {
+            continue;
+        }
+        if ((pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                rdp_sink_check(sink) != 0)
+        {
+            fprintf(stderr, "xrdp closed the connection\n");
+            rv = 1;
+            break;
+        }
+        if (pfds[1].revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            if (stub->sck < 0)
+            {
+                if (xup_stub_accept(stub) == 0)
+                {
+                    connect_time = g_time3();
+                    if (xup_stub_peek(stub, &msg_time) == 0)
+                    {
+                        module_start_time = msg_time;
+                    }
+                }
+            }
+            else if (xup_stub_check(stub) != 0)
+            {
+                fprintf(stderr, "xup closed the connection\n");
+                rv = 1;
+            }
+        }
+    }
+
+    cpu_end = stub->xrdp_pid > 0 ? process_cpu_ms(stub->xrdp_pid) : -1;
+    *cpu_ms = (cpu_start >= 0 && cpu_end >= 0) ? cpu_end - cpu_start : -1;
+    if (disconnect_pdu >= 0 && !sink->closed)
+    {
+        pdu = cp->pdus + disconnect_pdu;
+        rdp_sink_write(sink, cp->data + pdu->offset, pdu->bytes);
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    const char *port = "3389";
+    const char *socket_path = DEFAULT_SOCKET_PATH;
+    struct log_config *logging;
+    struct client_pdus cp;
+    struct rec_file *module_rec = NULL;
+    struct xup_stub *stub = NULL;
+    struct rdp_sink *sink = NULL;
+    long long cpu_ms = -1;
+    int realtime = 0;
+    int opt;
+    int rv = 1;
+
+    logging = log_config_init_for_console(LOG_LEVEL_WARNING,
+                                          g_getenv("REPLAY_LOG_LEVEL"));
+    log_start_from_param(logging);
+    log_config_free(logging);
+
+    while ((opt = getopt(argc, argv, "h:p:s:r")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'r':
+                realtime = 1;
+                break;
+            default:
+                usage();
+                log_end();
+                return 1;
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        usage();
+        log_end();
+        return 1;
+    }
+
+    g_memset(&cp, 0, sizeof(cp));
+    if (read_client_pdus(argv[optind], &cp) == 0 &&
+            (module_rec = rec_file_open(argv[optind],
+                                        REC_TYPE_MASK(PROTO_RECORD_MODULE_IN) |
+                                        REC_TYPE_MASK(PROTO_RECORD_BUFFER)))
+            != NULL &&
+            (stub = xup_stub_create(socket_path, module_rec)) != NULL &&
+            (sink = rdp_sink_connect(host, port)) != NULL &&
+            start_client(sink, &cp) == 0)
+    {
+        rv = run(sink, stub, &cp, realtime, &cpu_ms);
+        report(sink, stub, cpu_ms);
+    }
+
+    rdp_sink_delete(sink);
+    xup_stub_delete(stub);
+    rec_file_close(module_rec);
+    g_file_delete(socket_path);
+    free(cp.data);
+    free(cp.pdus);
+    log_end();
+    return rv;
+}
@@ -0,0 +1,187 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/stats.c
+ * @brief   Measurements shared by xrdp-replay and xrdp-loadtest
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arch.h"
+#include "os_calls.h"
+#include "stats.h"
+#include "string_calls.h"
+
+/*****************************************************************************/
+/* makes room for count more values */
+static int
+latency_list_grow(struct latency_list *self, int count)
+{
+    int *new_values;
+    int new_size;
+
+    if (self->count + count <= self->size)
+    {
+        return 0;
+    }
+    new_size = self->size < 1024 ? 1024 : self->size;
+    while (new_size < self->count + count)
+    {
+        new_size *= 2;
+    }
+    new_values = (int *)g_malloc(new_size * sizeof(int), 0);
+    if (new_values == NULL)
+    {
+        return 1;
+    }
+    if (self->count > 0)
+    {
+        g_memcpy(new_values, self->values, self->count * sizeof(int));
+    }
+    g_free(self->values);
+    self->values = new_values;
+    self->size = new_size;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+latency_list_add(struct latency_list *self, int value)
+{
+    if (latency_list_grow(self, 1) != 0)
+    {
+        return 1;
+    }
+    self->values[self->count++] = value;
+    return 0;
+}
+
+/*****************************************************************************/
+int
+latency_list_add_list(struct latency_list *self,
+                      const struct latency_list *other)
+{
+    if (other->count == 0)
+    {
+        return 0;
+    }
+    if (latency_list_grow(self, other->count) != 0)
+    {
+        return 1;
+    }
+    g_memcpy(self->values + self->count, other->values,
+             other->count * sizeof(int));
+    self->count += other->count;
+    return 0;
+}
+
+/*****************************************************************************/
+void
+latency_list_clear(struct latency_list *self)
+{
+    self->count = 0;
+}
+
+/*****************************************************************************/
+void
+latency_list_free(struct latency_list *self)
+{
+    g_free(self->values);
+    self->values = NULL;
+    self->count = 0;
+    self->size = 0;
+}
+
+/*****************************************************************************/
+static int
+icmp(const void *v1, const void *v2)
+{
+    int i1 = *(const int *)v1;
+    int i2 = *(const int *)v2;
+    return (i1 < i2) ? -1 : (i1 > i2) ? 1 : 0;
+}
+
+/*****************************************************************************/
+/* returns a percentile from a sorted list */
+static int
+percentile(const struct latency_list *self, int pc)
+{
+    int index = (self->count * pc + 99) / 100 - 1;
+    if (index < 0)
+    {
+        index = 0;
+    }
+    return self->values[index];
+}
+
+/*****************************************************************************/
+void
+latency_list_print(struct latency_list *self, const char *label)
+{
+    if (self->count == 0)
+    {
+        return;
+    }
+    qsort(self->values, self->count, sizeof(int), icmp);
+    g_printf("%-15smin %d ms, p50 %d ms, p90 %d ms, p99 %d ms, max %d ms\n",
+             label, self->values[0], percentile(self, 50),
+             percentile(self, 90), percentile(self, 99),
+             self->values[self->count - 1]);
+}
+
+/*****************************************************************************/
+long long
+process_cpu_ms(int pid)
+{
+    char filename[64];
+    char buf[1024];
+    char *p;
+    unsigned long long utime;
+    unsigned long long stime;
+    long ticks;
+    FILE *fp;
+    int len;
+
+    g_snprintf(filename, sizeof(filename), "/proc/%d/stat", pid);
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        return -1;
+    }
+    len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len > 0 ? len : 0] = '\0';
+    /* skip the command, which may contain spaces, then fields 3 to 13 */
+    p = strrchr(buf, ')');
+    ticks = sysconf(_SC_CLK_TCK);
+    if (p == NULL || ticks <= 0 ||
+            sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                   "%llu %llu", &utime, &stime) != 2)
+    {
+        return -1;
+    }
+    return (long long)(utime + stime) * 1000 / ticks;
+}
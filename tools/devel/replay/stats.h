@@ -0,0 +1,82 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/stats.h
+ * @brief   Measurements shared by xrdp-replay and xrdp-loadtest
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+/**
+ * A growable list of latencies, in milliseconds
+ */
+struct latency_list
+{
+    int *values;
+    int count;
+    int size;
+};
+
+/**
+ * Adds a latency to a list
+ *
+ * @return 0 for success
+ */
+int
+latency_list_add(struct latency_list *self, int value);
+
+/**
+ * Adds all the latencies in one list to another
+ *
+ * @return 0 for success
+ */
+int
+latency_list_add_list(struct latency_list *self,
+                      const struct latency_list *other);
+
+/**
+ * Empties a list, keeping its memory
+ */
+void
+latency_list_clear(struct latency_list *self);
+
+/**
+ * Frees the memory of a list, leaving it empty
+ */
+void
+latency_list_free(struct latency_list *self);
+
+/**
+ * Prints min, p50, p90, p99 and max latencies on one line
+ *
+ * The list is sorted. Nothing is printed for an empty list.
+ *
+ * @param label Label for the line, padded to line up with the others
+ */
+void
+latency_list_print(struct latency_list *self, const char *label);
+
+/**
+ * Returns the CPU used by a process in milliseconds, or -1
+ */
+long long
+process_cpu_ms(int pid);
+
+#endif
@@ -0,0 +1,720 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/xup_stub.c
+ * @brief   Stands in for the X server, sending recorded messages to xup
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "proto_record.h"
+#include "xup_stub.h"
+
+/* Most fds passed with one message */
+#define MAX_PASSED_FDS 32
+
+/*****************************************************************************/
+static int
+get_uint16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8);
+}
+
+/*****************************************************************************/
+static unsigned int
+get_uint32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+/*****************************************************************************/
+/* appends data to a growable buffer */
+static int
+append(char **buf, int *bytes, int *size, const char *data, int len)
+{
+    char *new_buf;
+    int new_size;
+
+    if (*bytes + len > *size)
+    {
+        new_size = *size < 8192 ? 8192 : *size;
+        while (new_size < *bytes + len)
+        {
+            new_size *= 2;
+        }
+        new_buf = (char *)g_malloc(new_size, 0);
+        if (new_buf == NULL)
+        {
+            return 1;
+        }
+        if (*bytes > 0)
+        {
+            g_memcpy(new_buf, *buf, *bytes);
+        }
+        g_free(*buf);
+        *buf = new_buf;
+        *size = new_size;
+    }
+    g_memcpy(*buf + *bytes, data, len);
+    *bytes += len;
+    return 0;
+}
+
+/*****************************************************************************/
+/* frees the memfd of a buffer */
+static void
+buffer_free(struct xup_stub_buffer *buffer)
+{
+    if (buffer->ptr != NULL)
+    {
+        g_munmap(buffer->ptr, buffer->bytes);
+    }
+    if (buffer->fd >= 0)
+    {
+        close(buffer->fd);
+    }
+    buffer->id = 0;
+    buffer->fd = -1;
+    buffer->ptr = NULL;
+    buffer->bytes = 0;
+}
+
+/*****************************************************************************/
+/* makes a new zeroed memfd for a buffer */
+static int
+buffer_create(struct xup_stub_buffer *buffer, int id, int bytes)
+{
+    void *ptr;
+
+    buffer_free(buffer);
+    buffer->fd = memfd_create("xrdp-replay", MFD_CLOEXEC);
+    if (buffer->fd < 0)
+    {
+        fprintf(stderr, "Can't create a memfd [%s]\n", g_get_strerror());
+        return 1;
+    }
+    if (ftruncate(buffer->fd, bytes) != 0 ||
+            (bytes > 0 && g_file_map(buffer->fd, 1, 1, bytes, &ptr) != 0))
+    {
+        fprintf(stderr, "Can't make a %d byte buffer\n", bytes);
+        buffer_free(buffer);
+        return 1;
+    }
+    buffer->id = id;
+    buffer->ptr = bytes > 0 ? (char *)ptr : NULL;
+    buffer->bytes = bytes;
+    return 0;
+}
+
+/*****************************************************************************/
+struct xup_stub *
+xup_stub_create(const char *path, struct rec_file *rec)
+{
+    struct xup_stub *self;
+    int index;
+
+    self = (struct xup_stub *)g_malloc(sizeof(struct xup_stub), 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->sck = -1;
+    self->rec = rec;
+    for (index = 0; index < XUP_STUB_MAX_BUFFERS; index++)
+    {
+        self->buffers[index].fd = -1;
+    }
+    if (g_file_exist(path))
+    {
+        g_file_delete(path);
+    }
+    self->listen_sck = g_sck_local_socket();
+    if (self->listen_sck < 0 ||
+            g_sck_local_bind(self->listen_sck, path) != 0 ||
+            g_sck_listen(self->listen_sck) != 0)
+    {
+        fprintf(stderr, "Can't listen on %s [%s]\n", path, g_get_strerror());
+        xup_stub_delete(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xup_stub_delete(struct xup_stub *self)
+{
+    int index;
+
+    if (self == NULL)
+    {
+        return;
+    }
+    if (self->listen_sck >= 0)
+    {
+        g_sck_close(self->listen_sck);
+    }
+    if (self->sck >= 0)
+    {
+        g_sck_close(self->sck);
+    }
+    for (index = 0; index < XUP_STUB_MAX_BUFFERS; index++)
+    {
+        buffer_free(self->buffers + index);
+    }
+    g_free(self->msg_data);
+    g_free(self->buf_data);
+    g_free(self->in_data);
+    latency_list_free(&self->latencies);
+    g_free(self);
+}
+
+/*****************************************************************************/
+int
+xup_stub_accept(struct xup_stub *self)
+{
+    int uid;
+    int gid;
+
+    if (self->sck >= 0)
+    {
+        return 1;
+    }
+    self->sck = g_sck_accept(self->listen_sck);
+    if (self->sck < 0)
+    {
+        return 1;
+    }
+    if (g_sck_get_peer_cred(self->sck, &self->xrdp_pid, &uid, &gid) != 0)
+    {
+        self->xrdp_pid = 0;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* finds the first paint order in a type 3 message, and its frame id */
+static void
+find_frame(struct xup_stub *self)
+{
+    const char *p = self->msg_data + 8;
+    const char *end = self->msg_data + self->msg_bytes;
+    const char *q;
+    int type;
+    int len;
+
+    self->msg_frame = 0;
+    if (get_uint16(self->msg_data) != 3)
+    {
+        return;
+    }
+    while (p + 4 <= end)
+    {
+        type = get_uint16(p);
+        len = get_uint16(p + 2);
+        if (len < 4 || p + len > end)
+        {
+            return;
+        }
+        if (type == 64 || type == 66)
+        {
+            /* dirty and copied rect lists, flags, then frame_id */
+            q = p + 4;
+            q += 2 + get_uint16(q) * 8;
+            if (q + 2 > p + len)
+            {
+                return;
+            }
+            q += 2 + get_uint16(q) * 8;
+            if (q + 8 <= p + len)
+            {
+                self->msg_frame = 1;
+                self->msg_frame_id = get_uint32(q + 4);
+            }
+            return;
+        }
+        p += len;
+    }
+}
+
+/*****************************************************************************/
+int
+xup_stub_peek(struct xup_stub *self, unsigned int *time)
+{
+    const struct rec_record *rec;
+    int total;
+
+    if (self->msg_loaded)
+    {
+        *time = self->msg_time;
+        return 0;
+    }
+    self->msg_bytes = 0;
+    self->buf_bytes = 0;
+    total = 0;
+    while (total == 0 || self->msg_bytes < total)
+    {
+        rec = rec_file_peek(self->rec);
+        if (rec == NULL)
+        {
+            return 1;
+        }
+        if (rec->type != PROTO_RECORD_MODULE_IN)
+        {
+            /* a buffer without a message, from a part recording */
+            rec_file_next(self->rec);
+            continue;
+        }
+        if (self->msg_bytes == 0)
+        {
+            self->msg_time = rec->time;
+        }
+        if (append(&self->msg_data, &self->msg_bytes, &self->msg_size,
+                   rec->data, rec->length) != 0)
+        {
+            return 1;
+        }
+        rec_file_next(self->rec);
+        if (total == 0 && self->msg_bytes >= 8)
+        {
+            total = 8 + (int)get_uint32(self->msg_data + 4);
+        }
+    }
+    if (self->msg_bytes != total)
+    {
+        fprintf(stderr, "Recorded messages are out of step\n");
+        return 1;
+    }
+
+    /* the buffers passed, or changed, with the message */
+    while ((rec = rec_file_peek(self->rec)) != NULL &&
+            rec->type == PROTO_RECORD_BUFFER)
+    {
+        if (append(&self->buf_data, &self->buf_bytes, &self->buf_size,
+                   (const char *)&rec->length, sizeof(rec->length)) != 0 ||
+                append(&self->buf_data, &self->buf_bytes, &self->buf_size,
+                       rec->data, rec->length) != 0)
+        {
+            return 1;
+        }
+        rec_file_next(self->rec);
+    }
+
+    find_frame(self);
+    self->msg_loaded = 1;
+    *time = self->msg_time;
+    return 0;
+}
+
+/*****************************************************************************/
+/* gives up on frames xrdp hasn't acked in time */
+static void
+expire_frames(struct xup_stub *self)
+{
+    int now = g_time3();
+
+    while (self->in_flight > 0 &&
+            now - self->in_flight_times[0] > XUP_STUB_ACK_TIMEOUT)
+    {
+        self->frames_lost++;
+        self->in_flight--;
+        g_memmove(self->in_flight_ids, self->in_flight_ids + 1,
+                  sizeof(self->in_flight_ids[0]) * self->in_flight);
+        g_memmove(self->in_flight_times, self->in_flight_times + 1,
+                  sizeof(self->in_flight_times[0]) * self->in_flight);
+    }
+}
+
+/*****************************************************************************/
+int
+xup_stub_can_send(struct xup_stub *self)
+{
+    expire_frames(self);
+    if (!self->msg_loaded || self->sck < 0)
+    {
+        return 0;
+    }
+    if (self->msg_frame && self->in_flight >= XUP_STUB_MAX_FRAMES_IN_FLIGHT)
+    {
+        return 0;
+    }
+    if (self->buf_bytes > 0 && self->in_flight > 0)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/* applies one PROTO_RECORD_BUFFER record. Adds the fd to fds[] if it was
+   passed with the message, and to the transient buffers if it is only
+   used once */
+static int
+apply_buffer(struct xup_stub *self, const char *data, int length,
+             int *fds, int *num_fds,
+             struct xup_stub_buffer *transient, int *num_transient)
+{
+    struct xup_stub_buffer *buffer;
+    int id;
+    int bytes;
+    int flags;
+    int page;
+    int offset;
+    int len;
+    int index;
+
+    if (length < 12)
+    {
+        return 1;
+    }
+    id = (int)get_uint32(data);
+    bytes = (int)get_uint32(data + 4);
+    flags = (int)get_uint32(data + 8);
+    data += 12;
+    length -= 12;
+
+    buffer = NULL;
+    if (id == 0)
+    {
+        if (*num_transient >= MAX_PASSED_FDS)
+        {
+            return 1;
+        }
+        buffer = transient + (*num_transient)++;
+        buffer->fd = -1;
+        buffer->ptr = NULL;
+        if (buffer_create(buffer, 0, bytes) != 0)
+        {
+            (*num_transient)--;
+            return 1;
+        }
+    }
+    else
+    {
+        for (index = 0; index < XUP_STUB_MAX_BUFFERS; index++)
+        {
+            if (self->buffers[index].id == id)
+            {
+                buffer = self->buffers + index;
+                break;
+            }
+        }
+        if (buffer == NULL)
+        {
+            for (index = 0; index < XUP_STUB_MAX_BUFFERS; index++)
+            {
+                if (self->buffers[index].id == 0)
+                {
+                    buffer = self->buffers + index;
+                    break;
+                }
+            }
+            if (buffer == NULL)
+            {
+                fprintf(stderr, "Too many shared buffers\n");
+                return 1;
+            }
+            flags |= PROTO_RECORD_BUFFER_NEW;
+        }
+        if ((flags & PROTO_RECORD_BUFFER_NEW) || buffer->bytes != bytes)
+        {
+            if (buffer_create(buffer, id, bytes) != 0)
+            {
+                return 1;
+            }
+        }
+    }
+
+    while (length >= 4)
+    {
+        page = (int)get_uint32(data);
+        offset = page * PROTO_RECORD_PAGE_SIZE;
+        if (page < 0 || offset >= bytes)
+        {
+            return 1;
+        }
+        len = MIN(bytes - offset, PROTO_RECORD_PAGE_SIZE);
+        if (length < 4 + len)
+        {
+            return 1;
+        }
+        g_memcpy(buffer->ptr + offset, data + 4, len);
+        data += 4 + len;
+        length -= 4 + len;
+    }
+
+    if (flags & PROTO_RECORD_BUFFER_PASSED)
+    {
+        if (*num_fds >= MAX_PASSED_FDS)
+        {
+            return 1;
+        }
+        fds[(*num_fds)++] = buffer->fd;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* works out how many of the passed fds go with each order of a message.
+   Returns the number of orders which take fds, or -1 if the message
+   can't be replayed */
+static int
+group_fds(struct xup_stub *self, int *counts, int max_counts)
+{
+    const char *p = self->msg_data + 8;
+    const char *end = self->msg_data + self->msg_bytes;
+    int num_counts = 0;
+    int count;
+    int type;
+    int len;
+
+    if (get_uint16(self->msg_data) != 3)
+    {
+        return 0;
+    }
+    while (p + 4 <= end)
+    {
+        type = get_uint16(p);
+        len = get_uint16(p + 2);
+        if (len < 4 || p + len > end)
+        {
+            return -1;
+        }
+        switch (type)
+        {
+            case 60: /* SysV shared memory, not recorded */
+            case 61:
+                return -1;
+            case 62: /* cmd_bytes, cmd, shmem_bytes */
+                count = 0;
+                if (len >= 8 && 12 + (int)get_uint32(p + 4) <= len)
+                {
+                    count = get_uint32(p + 8 + get_uint32(p + 4)) != 0;
+                }
+                break;
+            case 63:
+            case 64:
+                count = 1;
+                break;
+            case 65: /* num_buffers, buffer_bytes */
+                count = len >= 8 ? (int)get_uint32(p + 4) : 0;
+                break;
+            default:
+                count = 0;
+                break;
+        }
+        if (count > 0)
+        {
+            if (num_counts >= max_counts)
+            {
+                return -1;
+            }
+            counts[num_counts++] = count;
+        }
+        p += len;
+    }
+    return num_counts;
+}
+
+/*****************************************************************************/
+/* blocking send of all the data */
+static int
+send_all(int sck, const char *data, int bytes)
+{
+    int rv;
+
+    while (bytes > 0)
+    {
+        rv = g_sck_send(sck, data, bytes, 0);
+        if (rv < 1)
+        {
+            return 1;
+        }
+        data += rv;
+        bytes -= rv;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+int
+xup_stub_send(struct xup_stub *self)
+{
+    struct xup_stub_buffer transient[MAX_PASSED_FDS];
+    int fds[MAX_PASSED_FDS];
+    int counts[MAX_PASSED_FDS];
+    char msg[4] = { 0 };
+    const char *p;
+    int num_transient = 0;
+    int num_fds = 0;
+    int num_counts;
+    int length;
+    int index;
+    int sent;
+    int rv = 0;
+
+    if (!self->msg_loaded)
+    {
+        return 1;
+    }
+    self->msg_loaded = 0;
+
+    for (p = self->buf_data; p < self->buf_data + self->buf_bytes;
+            p += sizeof(length) + length)
+    {
+        g_memcpy(&length, p, sizeof(length));
+        if (apply_buffer(self, p + sizeof(length), length, fds, &num_fds,
+                         transient, &num_transient) != 0)
+        {
+            fprintf(stderr, "Bad buffer record\n");
+            rv = 1;
+            break;
+        }
+    }
+
+    num_counts = rv == 0 ? group_fds(self, counts, MAX_PASSED_FDS) : -1;
+    sent = 0;
+    for (index = 0; index < num_counts; index++)
+    {
+        sent += counts[index];
+    }
+    if (rv == 0 && (num_counts < 0 || sent != num_fds))
+    {
+        /* xup would wait for fds we haven't got */
+        self->skipped++;
+    }
+    else if (rv == 0)
+    {
+        rv = send_all(self->sck, self->msg_data, self->msg_bytes);
+        sent = 0;
+        for (index = 0; index < num_counts && rv == 0; index++)
+        {
+            if (g_sck_send_fd_set(self->sck, msg, sizeof(msg),
+                                  fds + sent, counts[index]) != sizeof(msg))
+            {
+                rv = 1;
+            }
+            sent += counts[index];
+        }
+        if (rv == 0)
+        {
+            self->messages++;
+            self->bytes += self->msg_bytes;
+            if (self->msg_frame)
+            {
+                if (self->frames == 0)
+                {
+                    self->first_frame_time = g_time3();
+                }
+                self->frames++;
+                self->in_flight_ids[self->in_flight] = self->msg_frame_id;
+                self->in_flight_times[self->in_flight] = g_time3();
+                self->in_flight++;
+            }
+        }
+    }
+
+    for (index = 0; index < num_transient; index++)
+    {
+        buffer_free(transient + index);
+    }
+    return rv;
+}
+
+/*****************************************************************************/
+/* completes the frames up to and including frame_id */
+static void
+ack_frames(struct xup_stub *self, unsigned int frame_id)
+{
+    int now = g_time3();
+
+    while (self->in_flight > 0 &&
+            (int)(frame_id - self->in_flight_ids[0]) >= 0)
+    {
+        latency_list_add(&self->latencies, now - self->in_flight_times[0]);
+        self->last_ack_time = now;
+        self->in_flight--;
+        g_memmove(self->in_flight_ids, self->in_flight_ids + 1,
+                  sizeof(self->in_flight_ids[0]) * self->in_flight);
+        g_memmove(self->in_flight_times, self->in_flight_times + 1,
+                  sizeof(self->in_flight_times[0]) * self->in_flight);
+    }
+}
+
+/*****************************************************************************/
+int
+xup_stub_check(struct xup_stub *self)
+{
+    char buf[8192];
+    const char *p;
+    int rv;
+    int len;
+    int type;
+
+    rv = g_sck_recv(self->sck, buf, sizeof(buf), 0);
+    if (rv < 1)
+    {
+        return 1;
+    }
+    if (append(&self->in_data, &self->in_bytes, &self->in_size,
+               buf, rv) != 0)
+    {
+        return 1;
+    }
+    /* len including itself, type, then the body */
+    p = self->in_data;
+    while (self->in_bytes - (p - self->in_data) >= 6)
+    {
+        len = (int)get_uint32(p);
+        if (len < 6)
+        {
+            return 1;
+        }
+        if (len > self->in_bytes - (p - self->in_data))
+        {
+            break;
+        }
+        type = get_uint16(p + 4);
+        if ((type == 105 || type == 106) && len >= 14)
+        {
+            /* paint rect ack: flags, frame_id, ... */
+            ack_frames(self, get_uint32(p + 10));
+        }
+        p += len;
+    }
+    len = self->in_bytes - (int)(p - self->in_data);
+    if (len > 0 && p != self->in_data)
+    {
+        g_memmove(self->in_data, p, len);
+    }
+    self->in_bytes = len;
+    expire_frames(self);
+    return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/xup_stub.h
+ * @brief   Stands in for the X server, sending recorded messages to xup
+ *
+ * The stub listens on a unix socket, which xup connects to when its
+ * xrdp.ini section has port= set to the socket path. Recorded messages
+ * are sent as they were received, with the shared memory buffers they
+ * passed rebuilt in memfds.
+ *
+ * Like xorgxrdp, the stub doesn't paint a frame until xrdp has acked
+ * the last one, and doesn't change a shared buffer while xrdp may be
+ * reading it.
+ */
+
+#ifndef _XUP_STUB_H
+#define _XUP_STUB_H
+
+#include "rec_file.h"
+#include "stats.h"
+
+/* Most shared buffers in use at once */
+#define XUP_STUB_MAX_BUFFERS 32
+/* Frames xrdp may be asked to paint before it acks one */
+#define XUP_STUB_MAX_FRAMES_IN_FLIGHT 1
+/* A frame not acked in this time is given up on */
+#define XUP_STUB_ACK_TIMEOUT 5000
+
+struct xup_stub_buffer
+{
+    int id; /* id in the recording, 0 if the slot is unused */
+    int fd;
+    char *ptr;
+    int bytes;
+};
+
+struct xup_stub
+{
+    int listen_sck;
+    int sck; /* connection from xup, or -1 */
+    int xrdp_pid; /* pid of the xrdp process, from the socket */
+    struct rec_file *rec; /* for PROTO_RECORD_MODULE_IN and _BUFFER */
+
+    /* the next message to send */
+    int msg_loaded;
+    unsigned int msg_time; /* time it was recorded */
+    char *msg_data;
+    int msg_bytes;
+    int msg_size;
+    int msg_frame; /* non-zero if it paints a frame */
+    unsigned int msg_frame_id;
+    /* the buffer records which followed it, each with a length prefix */
+    char *buf_data;
+    int buf_bytes;
+    int buf_size;
+
+    struct xup_stub_buffer buffers[XUP_STUB_MAX_BUFFERS];
+
+    /* frames sent, and not yet acked */
+    unsigned int in_flight_ids[XUP_STUB_MAX_FRAMES_IN_FLIGHT];
+    int in_flight_times[XUP_STUB_MAX_FRAMES_IN_FLIGHT];
+    int in_flight;
+
+    /* data from xup */
+    char *in_data;
+    int in_bytes;
+    int in_size;
+
+    /* results */
+    int messages; /* messages sent */
+    int skipped; /* messages which couldn't be replayed */
+    long long bytes; /* message bytes sent */
+    int frames; /* frames sent */
+    int frames_lost; /* frames not acked in XUP_STUB_ACK_TIMEOUT */
+    int first_frame_time;
+    int last_ack_time;
+    struct latency_list latencies; /* from each frame to its ack */
+};
+
+/**
+ * Creates a stub, listening on a unix socket
+ *
+ * @param path Socket path. Any existing socket there is removed
+ * @param rec Recording to take the messages from
+ * @return the stub, or NULL for error
+ */
+struct xup_stub *
+xup_stub_create(const char *path, struct rec_file *rec);
+
+/**
+ * Closes the sockets, and frees the stub
+ *
+ * The recording isn't closed.
+ */
+void
+xup_stub_delete(struct xup_stub *self);
+
+/**
+ * Accepts the connection from xup
+ *
+ * Call this when the listening socket is readable.
+ *
+ * @return 0 for success
+ */
+int
+xup_stub_accept(struct xup_stub *self);
+
+/**
+ * Reads the next message from the recording, if it isn't read already
+ *
+ * @param[out] time Time the message was recorded
+ * @return 0 if there is a message, non-zero at the end of the recording
+ */
+int
+xup_stub_peek(struct xup_stub *self, unsigned int *time);
+
+/**
+ * Returns non-zero if the next message can be sent now
+ *
+ * A message can't be sent while it would paint too many frames, or
+ * change a shared buffer xrdp may still be reading.
+ */
+int
+xup_stub_can_send(struct xup_stub *self);
+
+/**
+ * Sends the next message, and the shared buffers passed with it
+ *
+ * @return 0 for success
+ */
+int
+xup_stub_send(struct xup_stub *self);
+
+/**
+ * Reads and processes what xup has sent
+ *
+ * Call this when the socket is readable. Frame acks are matched to the
+ * frames sent, and frames which were never acked are given up on.
+ *
+ * @return 0 for success, non-zero if the connection has closed
+ */
+int
+xup_stub_check(struct xup_stub *self);
+
+#endif
@@ -0,0 +1,658 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/xup_synth.c
+ * @brief   Stands in for the X server, painting made up damage for xup
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arch.h"
+#include "defines.h"
+#include "os_calls.h"
+#include "parse.h"
+#include "xrdp_client_info.h"
+#include "xup_synth.h"
+
+/* a terminal, scrolling a line each frame */
+#define TEXT_LINE_HEIGHT 16
+#define TEXT_CELL_WIDTH 8
+#define TEXT_BACKGROUND 0x000000
+#define TEXT_FOREGROUND 0xc0c0c0
+/* a video playing in a window */
+#define VIDEO_WIDTH 640
+#define VIDEO_HEIGHT 360
+/* a window, moving a few pixels each frame */
+#define DRAG_WIDTH 400
+#define DRAG_HEIGHT 300
+#define DRAG_TITLE_HEIGHT 24
+#define DRAG_STEP_X 12
+#define DRAG_STEP_Y 8
+
+/* Most damage rects in a frame */
+#define MAX_DAMAGE 2
+
+/*****************************************************************************/
+static int
+get_uint16(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8);
+}
+
+/*****************************************************************************/
+static unsigned int
+get_uint32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+/*****************************************************************************/
+/* xorshift32 */
+static unsigned int
+next_random(struct xup_synth *self)
+{
+    unsigned int x = self->seed;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self->seed = x;
+    return x;
+}
+
+/*****************************************************************************/
+/* frees the memfd holding the screen */
+static void
+screen_free(struct xup_synth *self)
+{
+    if (self->fb != NULL)
+    {
+        g_munmap(self->fb, self->fb_bytes);
+    }
+    if (self->fd >= 0)
+    {
+        close(self->fd);
+    }
+    self->fd = -1;
+    self->fb = NULL;
+    self->fb_bytes = 0;
+    self->width = 0;
+    self->height = 0;
+}
+
+/*****************************************************************************/
+/* makes a new memfd for the screen. The first frame then paints it all */
+static int
+screen_create(struct xup_synth *self, int width, int height)
+{
+    void *ptr;
+
+    screen_free(self);
+    self->fb_bytes = width * height * 4;
+    self->fd = memfd_create("xrdp-loadtest", MFD_CLOEXEC);
+    if (self->fd < 0)
+    {
+        fprintf(stderr, "Can't create a memfd [%s]\n", g_get_strerror());
+        return 1;
+    }
+    if (ftruncate(self->fd, self->fb_bytes) != 0 ||
+            g_file_map(self->fd, 1, 1, self->fb_bytes, &ptr) != 0)
+    {
+        fprintf(stderr, "Can't make a %dx%d screen\n", width, height);
+        screen_free(self);
+        return 1;
+    }
+    self->fb = (unsigned int *)ptr;
+    self->width = width;
+    self->height = height;
+    self->step = 0;
+    return 0;
+}
+
+/*****************************************************************************/
+/* blocking send of all the data */
+static int
+send_all(int sck, const char *data, int bytes)
+{
+    int rv;
+
+    while (bytes > 0)
+    {
+        rv = g_sck_send(sck, data, bytes, 0);
+        if (rv < 1)
+        {
+            return 1;
+        }
+        data += rv;
+        bytes -= rv;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+struct xup_synth *
+xup_synth_create(int sck, enum xup_synth_pattern pattern, int frame_interval)
+{
+    /* capabilities message, with none. xup replies with the client info */
+    static const char caps[8] = { 2, 0, 0, 0, 0, 0, 0, 0 };
+    struct xup_synth *self;
+    int uid;
+    int gid;
+
+    self = (struct xup_synth *)g_malloc(sizeof(struct xup_synth), 1);
+    if (self == NULL)
+    {
+        g_sck_close(sck);
+        return NULL;
+    }
+    self->sck = sck;
+    self->fd = -1;
+    self->pattern = pattern;
+    self->frame_interval = frame_interval;
+    self->seed = 0x9e3779b9u ^ (unsigned int)sck;
+    /* the client info is the largest message xup sends */
+    self->in_size = (int)sizeof(struct xrdp_client_info) + 8192;
+    self->in_data = (char *)g_malloc(self->in_size, 0);
+    if (self->in_data == NULL)
+    {
+        xup_synth_delete(self);
+        return NULL;
+    }
+    if (g_sck_get_peer_cred(sck, &self->xrdp_pid, &uid, &gid) != 0)
+    {
+        self->xrdp_pid = 0;
+    }
+    if (send_all(sck, caps, sizeof(caps)) != 0)
+    {
+        xup_synth_delete(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xup_synth_delete(struct xup_synth *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    if (self->sck >= 0)
+    {
+        g_sck_close(self->sck);
+    }
+    screen_free(self);
+    g_free(self->in_data);
+    latency_list_free(&self->latencies);
+    g_free(self);
+}
+
+/*****************************************************************************/
+static void
+fill_rect(struct xup_synth *self, int x, int y, int cx, int cy,
+          unsigned int pixel)
+{
+    unsigned int *row;
+    int i;
+    int j;
+
+    for (j = y; j < y + cy; j++)
+    {
+        row = self->fb + j * self->width + x;
+        for (i = 0; i < cx; i++)
+        {
+            row[i] = pixel;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* paints the desktop, a check of two blues */
+static void
+draw_background(struct xup_synth *self, int x, int y, int cx, int cy)
+{
+    unsigned int *row;
+    int i;
+    int j;
+
+    for (j = y; j < y + cy; j++)
+    {
+        row = self->fb + j * self->width;
+        for (i = x; i < x + cx; i++)
+        {
+            row[i] = ((i ^ j) & 32) ? 0x3a6ea5 : 0x30609a;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* a terminal, which scrolls up a line and prints a new one each frame.
+   Returns the number of damage rects */
+static int
+draw_text(struct xup_synth *self, short *rects)
+{
+    unsigned int *row;
+    int x = self->width / 8;
+    int y = self->height / 8;
+    int cx = self->width - 2 * x;
+    int cy = (self->height - 2 * y) / TEXT_LINE_HEIGHT * TEXT_LINE_HEIGHT;
+    int line_y = y + cy - TEXT_LINE_HEIGHT;
+    int cols = cx / TEXT_CELL_WIDTH;
+    int len;
+    int col;
+    unsigned int bits;
+    int gx;
+    int gy;
+    int j;
+
+    if (self->step == 0)
+    {
+        fill_rect(self, x, y, cx, cy, TEXT_BACKGROUND);
+    }
+    else
+    {
+        for (j = y; j < line_y; j++)
+        {
+            g_memmove(self->fb + j * self->width + x,
+                      self->fb + (j + TEXT_LINE_HEIGHT) * self->width + x,
+                      cx * 4);
+        }
+        fill_rect(self, x, line_y, cx, TEXT_LINE_HEIGHT, TEXT_BACKGROUND);
+    }
+    /* a line of made up glyphs, with some spaces */
+    len = cols > 0 ? (int)(next_random(self) % cols) : 0;
+    for (col = 0; col < len; col++)
+    {
+        if (next_random(self) % 6 == 0)
+        {
+            continue;
+        }
+        for (gy = 3; gy < 13; gy++)
+        {
+            bits = next_random(self);
+            row = self->fb + (line_y + gy) * self->width +
+                  x + col * TEXT_CELL_WIDTH;
+            for (gx = 1; gx < 7; gx++)
+            {
+                if (bits & (1 << gx))
+                {
+                    row[gx] = TEXT_FOREGROUND;
+                }
+            }
+        }
+    }
+    rects[0] = x;
+    rects[1] = y;
+    rects[2] = cx;
+    rects[3] = cy;
+    return 1;
+}
+
+/*****************************************************************************/
+/* video, as noise which changes every pixel each frame */
+static int
+draw_video(struct xup_synth *self, short *rects)
+{
+    unsigned int *row;
+    int cx = MIN(VIDEO_WIDTH, self->width);
+    int cy = MIN(VIDEO_HEIGHT, self->height);
+    int x = (self->width - cx) / 2;
+    int y = (self->height - cy) / 2;
+    int i;
+    int j;
+
+    for (j = y; j < y + cy; j++)
+    {
+        row = self->fb + j * self->width + x;
+        for (i = 0; i < cx; i++)
+        {
+            row[i] = next_random(self) & 0xffffff;
+        }
+    }
+    rects[0] = x;
+    rects[1] = y;
+    rects[2] = cx;
+    rects[3] = cy;
+    return 1;
+}
+
+/*****************************************************************************/
+static void
+draw_window(struct xup_synth *self, int x, int y, int cx, int cy)
+{
+    int title = MIN(DRAG_TITLE_HEIGHT, cy);
+    int j;
+
+    fill_rect(self, x, y, cx, title, 0x2050a0);
+    fill_rect(self, x, y + title, cx, cy - title, 0xf0f0f0);
+    for (j = y + title + 16; j < y + cy - 8; j += 16)
+    {
+        fill_rect(self, x + 8, j, cx - 16, 1, 0xc8c8c8);
+    }
+}
+
+/*****************************************************************************/
+/* a window being dragged, which damages where it was and where it is */
+static int
+draw_drag(struct xup_synth *self, short *rects)
+{
+    int cx = MIN(DRAG_WIDTH, self->width / 2);
+    int cy = MIN(DRAG_HEIGHT, self->height / 2);
+
+    if (self->step == 0)
+    {
+        self->drag_x = 0;
+        self->drag_y = 0;
+        self->drag_dx = DRAG_STEP_X;
+        self->drag_dy = DRAG_STEP_Y;
+        draw_window(self, self->drag_x, self->drag_y, cx, cy);
+        rects[0] = self->drag_x;
+        rects[1] = self->drag_y;
+        rects[2] = cx;
+        rects[3] = cy;
+        return 1;
+    }
+    draw_background(self, self->drag_x, self->drag_y, cx, cy);
+    rects[0] = self->drag_x;
+    rects[1] = self->drag_y;
+    rects[2] = cx;
+    rects[3] = cy;
+    if (self->drag_x + self->drag_dx < 0 ||
+            self->drag_x + self->drag_dx + cx > self->width)
+    {
+        self->drag_dx = -self->drag_dx;
+    }
+    if (self->drag_y + self->drag_dy < 0 ||
+            self->drag_y + self->drag_dy + cy > self->height)
+    {
+        self->drag_dy = -self->drag_dy;
+    }
+    self->drag_x += self->drag_dx;
+    self->drag_y += self->drag_dy;
+    draw_window(self, self->drag_x, self->drag_y, cx, cy);
+    rects[4] = self->drag_x;
+    rects[5] = self->drag_y;
+    rects[6] = cx;
+    rects[7] = cy;
+    return 2;
+}
+
+/*****************************************************************************/
+/* draws the next frame. Returns the number of damage rects */
+static int
+draw_frame(struct xup_synth *self, short *rects)
+{
+    int num_rects;
+
+    if (self->step == 0)
+    {
+        draw_background(self, 0, 0, self->width, self->height);
+    }
+    switch (self->pattern)
+    {
+        case XUP_SYNTH_VIDEO:
+            num_rects = draw_video(self, rects);
+            break;
+        case XUP_SYNTH_DRAG:
+            num_rects = draw_drag(self, rects);
+            break;
+        default:
+            num_rects = draw_text(self, rects);
+            break;
+    }
+    if (self->step == 0)
+    {
+        num_rects = 1;
+        rects[0] = 0;
+        rects[1] = 0;
+        rects[2] = self->width;
+        rects[3] = self->height;
+    }
+    self->step++;
+    return num_rects;
+}
+
+/*****************************************************************************/
+int
+xup_synth_can_send(struct xup_synth *self, int *wait)
+{
+    int now;
+    int left;
+
+    if (self->fb == NULL)
+    {
+        return 0;
+    }
+    now = g_time3();
+    if (self->in_flight)
+    {
+        if (now - self->frame_time <= XUP_SYNTH_ACK_TIMEOUT)
+        {
+            return 0;
+        }
+        self->frames_lost++;
+        self->in_flight = 0;
+    }
+    if (self->frame_interval > 0)
+    {
+        left = self->next_frame_time - now;
+        if (left > 0)
+        {
+            *wait = MIN(*wait, left);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+int
+xup_synth_send(struct xup_synth *self)
+{
+    short rects[MAX_DAMAGE * 4];
+    char msg[4] = { 0 };
+    struct stream *s;
+    char *orders;
+    char *order;
+    int num_rects;
+    int index;
+    int rv;
+
+    num_rects = draw_frame(self, rects);
+    self->frame_id++;
+
+    make_stream(s);
+    init_stream(s, 256);
+    out_uint16_le(s, 3); /* type, orders */
+    out_uint16_le(s, 3); /* num_orders */
+    s_push_layer(s, iso_hdr, 4);
+    orders = s->p;
+    out_uint16_le(s, 1); /* begin update */
+    out_uint16_le(s, 4);
+    order = s->p;
+    out_uint16_le(s, 64); /* paint rect shmfd */
+    out_uint8s(s, 2);
+    out_uint16_le(s, num_rects); /* dirty rects */
+    for (index = 0; index < num_rects * 4; index++)
+    {
+        out_uint16_le(s, rects[index]);
+    }
+    out_uint16_le(s, num_rects); /* copied rects */
+    for (index = 0; index < num_rects * 4; index++)
+    {
+        out_uint16_le(s, rects[index]);
+    }
+    out_uint32_le(s, 0); /* flags */
+    out_uint32_le(s, self->frame_id);
+    out_uint32_le(s, self->fb_bytes); /* shmem_bytes */
+    out_uint32_le(s, 0); /* shmem_offset */
+    out_uint16_le(s, 0); /* left */
+    out_uint16_le(s, 0); /* top */
+    out_uint16_le(s, self->width);
+    out_uint16_le(s, self->height);
+    index = (int)(s->p - order);
+    out_uint16_le(s, 2); /* end update */
+    out_uint16_le(s, 4);
+    s_mark_end(s);
+    order[2] = (char)index;
+    order[3] = (char)(index >> 8);
+    s_pop_layer(s, iso_hdr);
+    out_uint32_le(s, s->end - orders);
+
+    rv = send_all(self->sck, s->data, s->end - s->data);
+    if (rv == 0 &&
+            g_sck_send_fd_set(self->sck, msg, sizeof(msg),
+                              &self->fd, 1) != sizeof(msg))
+    {
+        rv = 1;
+    }
+    free_stream(s);
+    if (rv != 0)
+    {
+        return 1;
+    }
+
+    self->frames++;
+    for (index = 0; index < num_rects; index++)
+    {
+        self->pixels += rects[index * 4 + 2] * rects[index * 4 + 3];
+    }
+    self->in_flight = 1;
+    self->frame_time = g_time3();
+    self->next_frame_time = self->frame_time + self->frame_interval;
+    return 0;
+}
+
+/*****************************************************************************/
+/* takes the screen size from the client info xup sends. xup sends the
+   struct as it is, so this only works with xup from the same build */
+static int
+process_client_info(struct xup_synth *self, const char *data, int bytes)
+{
+    int size;
+    unsigned int width;
+    unsigned int height;
+
+    if (bytes < 4)
+    {
+        return 1;
+    }
+    g_memcpy(&size, data, sizeof(size));
+    if (size != (int)sizeof(struct xrdp_client_info) || bytes < size)
+    {
+        fprintf(stderr, "The client info from xup is %d bytes, not %d. "
+                "Is xup from this build?\n", size,
+                (int)sizeof(struct xrdp_client_info));
+        return 1;
+    }
+    g_memcpy(&width, data + offsetof(struct xrdp_client_info,
+                                     display_sizes.session_width),
+             sizeof(width));
+    g_memcpy(&height, data + offsetof(struct xrdp_client_info,
+                                      display_sizes.session_height),
+             sizeof(height));
+    if (width < 1 || height < 1 || width > 0x7fff || height > 0x7fff)
+    {
+        return 1;
+    }
+    if ((int)width == self->width && (int)height == self->height)
+    {
+        return 0;
+    }
+    return screen_create(self, width, height);
+}
+
+/*****************************************************************************/
+int
+xup_synth_check(struct xup_synth *self)
+{
+    const char *p;
+    int rv;
+    int len;
+    int type;
+
+    rv = g_sck_recv(self->sck, self->in_data + self->in_bytes,
+                    self->in_size - self->in_bytes, 0);
+    if (rv < 1)
+    {
+        return 1;
+    }
+    self->in_bytes += rv;
+    /* len including itself, type, then the body */
+    p = self->in_data;
+    while (self->in_bytes - (p - self->in_data) >= 6)
+    {
+        len = (int)get_uint32(p);
+        if (len < 6 || len > self->in_size)
+        {
+            return 1;
+        }
+        if (len > self->in_bytes - (p - self->in_data))
+        {
+            break;
+        }
+        type = get_uint16(p + 4);
+        if (type == 104)
+        {
+            if (process_client_info(self, p + 6, len - 6) != 0)
+            {
+                return 1;
+            }
+        }
+        else if ((type == 105 || type == 106) && len >= 14)
+        {
+            /* paint rect ack: flags, frame_id, ... */
+            if (self->in_flight &&
+                    (int)(get_uint32(p + 10) - self->frame_id) >= 0)
+            {
+                latency_list_add(&self->latencies,
+                                 g_time3() - self->frame_time);
+                self->in_flight = 0;
+            }
+        }
+        p += len;
+    }
+    len = self->in_bytes - (int)(p - self->in_data);
+    if (len > 0 && p != self->in_data)
+    {
+        g_memmove(self->in_data, p, len);
+    }
+    self->in_bytes = len;
+    return 0;
+}
+
+/*****************************************************************************/
+void
+xup_synth_clear_results(struct xup_synth *self)
+{
+    self->frames = 0;
+    self->frames_lost = 0;
+    self->pixels = 0;
+    latency_list_clear(&self->latencies);
+}
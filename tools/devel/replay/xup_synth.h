@@ -0,0 +1,140 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    tools/devel/replay/xup_synth.h
+ * @brief   Stands in for the X server, painting made up damage for xup
+ *
+ * The synth sends xup an empty capabilities message, and xup replies
+ * with the client info. The synth then draws a pattern into a memfd the
+ * size of the screen, and sends each frame as a paint rect message with
+ * the memfd passed, as xorgxrdp does. Like xorgxrdp, it doesn't paint a
+ * frame until xrdp has acked the last one.
+ */
+
+#ifndef _XUP_SYNTH_H
+#define _XUP_SYNTH_H
+
+#include "stats.h"
+
+/* A frame not acked in this time is given up on */
+#define XUP_SYNTH_ACK_TIMEOUT 5000
+
+enum xup_synth_pattern
+{
+    XUP_SYNTH_TEXT = 0, /* a terminal scrolling text */
+    XUP_SYNTH_VIDEO, /* noise, changing every pixel of a video sized area */
+    XUP_SYNTH_DRAG, /* a window being dragged across the desktop */
+    XUP_SYNTH_PATTERNS
+};
+
+struct xup_synth
+{
+    int sck; /* connection from xup */
+    int xrdp_pid; /* pid of the xrdp process, from the socket */
+    enum xup_synth_pattern pattern;
+    int frame_interval; /* ms between frames, 0 to send each when acked */
+
+    /* the screen, once the client info has arrived */
+    int width;
+    int height;
+    int fd; /* memfd holding the screen */
+    unsigned int *fb;
+    int fb_bytes;
+
+    /* drawing state */
+    int step; /* frames drawn since the screen was made */
+    unsigned int seed;
+    int drag_x;
+    int drag_y;
+    int drag_dx;
+    int drag_dy;
+
+    /* the frame sent, and not yet acked */
+    int in_flight;
+    unsigned int frame_id;
+    int frame_time;
+    int next_frame_time;
+
+    /* data from xup */
+    char *in_data;
+    int in_bytes;
+    int in_size;
+
+    /* results */
+    int frames; /* frames sent */
+    int frames_lost; /* frames not acked in XUP_SYNTH_ACK_TIMEOUT */
+    long long pixels; /* damaged pixels sent */
+    struct latency_list latencies; /* from each frame to its ack */
+};
+
+/**
+ * Creates a synth for a connection from xup
+ *
+ * @param sck Accepted socket. The synth closes it
+ * @param pattern What to draw
+ * @param frame_interval Milliseconds between frames, or 0 to send each
+ *                       frame as soon as the last is acked
+ * @return the synth, or NULL for error
+ */
+struct xup_synth *
+xup_synth_create(int sck, enum xup_synth_pattern pattern, int frame_interval);
+
+/**
+ * Closes the socket, and frees the synth
+ */
+void
+xup_synth_delete(struct xup_synth *self);
+
+/**
+ * Returns non-zero if the next frame can be sent now
+ *
+ * A frame can't be sent until the screen size is known, and the last
+ * frame has been acked.
+ *
+ * @param[in,out] wait If the frame is only waiting for its time, this is
+ *                     lowered to the milliseconds left
+ */
+int
+xup_synth_can_send(struct xup_synth *self, int *wait);
+
+/**
+ * Draws the next frame, and sends it to xup
+ *
+ * @return 0 for success
+ */
+int
+xup_synth_send(struct xup_synth *self);
+
+/**
+ * Reads and processes what xup has sent
+ *
+ * Call this when the socket is readable.
+ *
+ * @return 0 for success, non-zero if the connection has closed
+ */
+int
+xup_synth_check(struct xup_synth *self);
+
+/**
+ * Empties the results, keeping the drawing state
+ */
+void
+xup_synth_clear_results(struct xup_synth *self);
+
+#endif
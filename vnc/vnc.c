@@ -34,6 +34,8 @@
 
 #include "vnc.h"
 #include "vnc_clip.h"
+#include "vnc_decode.h"
+#include "vnc_shadow.h"
 #include "rfb.h"
 #include "log.h"
 #include "trans.h"
@@ -48,9 +50,38 @@
 /* Used by enabled_encodings_mask */
 enum
 {
-    MSK_EXTENDED_DESKTOP_SIZE = (1 << 0)
+    MSK_EXTENDED_DESKTOP_SIZE = (1 << 0),
+    MSK_ZRLE = (1 << 1),
+    MSK_TIGHT = (1 << 2),
+    MSK_TIGHT_JPEG = (1 << 3),
+    MSK_CONTINUOUS_UPDATES = (1 << 4)
 };
 
+/* Encodings requested unless disabled. Others must be enabled explicitly */
+#define MSK_DEFAULT_ENCODINGS \
+    (MSK_EXTENDED_DESKTOP_SIZE | MSK_CONTINUOUS_UPDATES)
+
+/* JPEG quality level requested when Tight JPEG is enabled (0..9) */
+#define TIGHT_JPEG_QUALITY_LEVEL 8
+
+/* Framebuffer updates we accept from the server before xrdp
+ * has acknowledged them */
+#define VNC_MAX_FRAMES_IN_FLIGHT 2
+
+/* Incremental update requests kept outstanding if the server doesn't
+ * support ContinuousUpdates */
+#define VNC_PIPELINED_UPDATE_REQUESTS 2
+
+/* Size of the transport input buffer */
+#define VNC_IN_STREAM_SIZE (8 * 8192)
+
+/* Raw pixel data and skipped data are read in chunks of about this
+ * size, so a large update doesn't hold up the rest of xrdp */
+#define VNC_READ_CHUNK_SIZE (32 * 1024)
+
+/* Size of a FramebufferUpdate rectangle header */
+#define RECT_HEADER_SIZE 12
+
 /******************************************************************************/
 int
 lib_send_copy(struct vnc *v, struct stream *s)
@@ -58,6 +89,38 @@ lib_send_copy(struct vnc *v, struct stream *s)
     return trans_write_copy_s(v->trans, s);
 }
 
+/******************************************************************************/
+int
+vnc_have_bytes(struct vnc *v, const struct stream *s, int bytes)
+{
+    if (bytes >= 0 && s_check_rem(s, bytes))
+    {
+        return 1;
+    }
+
+    if (bytes < 0 || bytes > VNC_MAX_MESSAGE_SIZE)
+    {
+        /* Rejected when the next read is set up */
+        v->parse_need = VNC_MAX_MESSAGE_SIZE + 1;
+    }
+    else
+    {
+        v->parse_need = (unsigned int)(s->p - s->data) + bytes;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+void
+vnc_skip_server_data(struct vnc *v, unsigned int bytes)
+{
+    if (bytes > 0)
+    {
+        v->skip_bytes = bytes;
+        v->parse_state = VPS_SKIP;
+    }
+}
+
 /******************************************************************************/
 /* taken from vncauth.c */
 /* performing the des3 crypt on the password so it can not be seen
@@ -205,69 +268,64 @@ static int vnc_screen_layouts_equal(const struct vnc_screen_layout *a,
  * Reads an extended desktop size rectangle from the VNC server
  *
  * @param v VNC object
+ * @param s Stream containing the rectangle
  * @param [out] layout Desired layout for server
  * @return != 0 for error
  *
- * @pre The next octet read from v->trans is the number of screens
+ * @pre s->p points to the number of screens
  *
  * @post Returned structure is in increasing ID order
  * @post layout->total_width is untouched
  * @post layout->total_height is untouched
+ * @post If the rectangle isn't complete, v->parse_need is set
  */
 static int
-read_extended_desktop_size_rect(struct vnc *v,
+read_extended_desktop_size_rect(struct vnc *v, struct stream *s,
                                 struct vnc_screen_layout *layout)
 {
-    struct stream *s;
-    int error;
+    int error = 0;
     unsigned int count;
+    unsigned int i;
 
     layout->count = 0;
 
-    make_stream(s);
-    init_stream(s, 8192);
+    if (!vnc_have_bytes(v, s, 4))
+    {
+        return 0;
+    }
 
-    /* Read in the current screen config */
-    error = trans_force_read_s(v->trans, s, 4);
-    if (error == 0)
+    /* Get the number of screens */
+    in_uint8(s, count);
+    if (count <= 0 || count > CLIENT_MONITOR_DATA_MAXIMUM_MONITORS)
     {
-        /* Get the number of screens */
-        in_uint8(s, count);
-        if (count <= 0 || count > CLIENT_MONITOR_DATA_MAXIMUM_MONITORS)
-        {
-            LOG(LOG_LEVEL_ERROR,
-                "Bad monitor count %d in ExtendedDesktopSize rectangle",
-                count);
-            error = 1;
-        }
-        else
-        {
-            in_uint8s(s, 3);
+        LOG(LOG_LEVEL_ERROR,
+            "Bad monitor count %d in ExtendedDesktopSize rectangle",
+            count);
+        error = 1;
+    }
+    else
+    {
+        in_uint8s(s, 3);
 
-            error = trans_force_read_s(v->trans, s, 16 * count);
-            if (error == 0)
+        if (vnc_have_bytes(v, s, 16 * count))
+        {
+            for (i = 0 ; i < count ; ++i)
             {
-                unsigned int i;
-                for (i = 0 ; i < count ; ++i)
-                {
-                    in_uint32_be(s, layout->s[i].id);
-                    in_uint16_be(s, layout->s[i].x);
-                    in_uint16_be(s, layout->s[i].y);
-                    in_uint16_be(s, layout->s[i].width);
-                    in_uint16_be(s, layout->s[i].height);
-                    in_uint32_be(s, layout->s[i].flags);
-                }
-
-                /* sort monitors in increasing (x,y) order */
-                qsort(layout->s, count, sizeof(layout->s[0]),
-                      (int (*)(const void *, const void *))cmp_vnc_screen);
-                layout->count = count;
+                in_uint32_be(s, layout->s[i].id);
+                in_uint16_be(s, layout->s[i].x);
+                in_uint16_be(s, layout->s[i].y);
+                in_uint16_be(s, layout->s[i].width);
+                in_uint16_be(s, layout->s[i].height);
+                in_uint32_be(s, layout->s[i].flags);
             }
+
+            /* sort monitors in increasing (x,y) order */
+            qsort(layout->s, count, sizeof(layout->s[0]),
+                  (int (*)(const void *, const void *))cmp_vnc_screen);
+            layout->count = count;
         }
     }
 
-    free_stream(s);
-
     return error;
 }
 
@@ -445,6 +503,51 @@ resize_server_to_client_layout(struct vnc *v)
     return error;
 }
 
+/*****************************************************************************/
+/**
+ * Sends the input messages held back since WM_INPUT_BATCH_BEGIN
+ */
+static int
+send_input_batch(struct vnc *v)
+{
+    int error = 0;
+
+    if (v->input_batch != NULL && v->input_batch->p > v->input_batch->data)
+    {
+        s_mark_end(v->input_batch);
+        error = lib_send_copy(v, v->input_batch);
+        init_stream(v->input_batch, 0);
+    }
+    return error;
+}
+
+/*****************************************************************************/
+/**
+ * Sends a client input message, or adds it to the current batch
+ */
+static int
+send_input(struct vnc *v, struct stream *s)
+{
+    int len;
+
+    if (!v->input_batching)
+    {
+        return lib_send_copy(v, s);
+    }
+    len = (int)(s->end - s->data);
+    if (v->input_batch == NULL)
+    {
+        make_stream(v->input_batch);
+        init_stream(v->input_batch, 8192);
+    }
+    if (!s_check_rem_out(v->input_batch, len) && send_input_batch(v) != 0)
+    {
+        return 1;
+    }
+    out_uint8a(v->input_batch, s->data, len);
+    return 0;
+}
+
 /*****************************************************************************/
 /**
  * Process keysym messages
@@ -484,7 +587,7 @@ process_keysym_msg(struct vnc *v, int keysym, int keydown)
                 out_uint8s(s, 2);
                 out_uint32_be(s, XK_Control_L); /* left control */
                 s_mark_end(s);
-                error = lib_send_copy(v, s);
+                error = send_input(v, s);
                 if (error != 0)
                 {
                     goto end_keysym_msg;
@@ -498,7 +601,7 @@ process_keysym_msg(struct vnc *v, int keysym, int keydown)
         out_uint8s(s, 2);
         out_uint32_be(s, keysym);
         s_mark_end(s);
-        error = lib_send_copy(v, s);
+        error = send_input(v, s);
 
         switch (keysym)
         {
@@ -640,7 +743,16 @@ lib_mod_event(struct vnc *v, int msg, long param1, long param2,
         out_uint16_be(s, param1);
         out_uint16_be(s, param2);
         s_mark_end(s);
-        error = lib_send_copy(v, s);
+        error = send_input(v, s);
+    }
+    else if (msg == WM_INPUT_BATCH_BEGIN)
+    {
+        v->input_batching = 1;
+    }
+    else if (msg == WM_INPUT_BATCH_END)
+    {
+        v->input_batching = 0;
+        error = send_input_batch(v);
     }
     else if (msg == 200) /* invalidate */
     {
@@ -865,197 +977,6 @@ get_bytes_per_pixel(int bpp)
 }
 
 
-/**************************************************************************//**
- * Skips the specified number of bytes from the transport
- *
- * @param transport Transport to read
- * @param bytes Bytes to skip
- * @return != 0 for error
- */
-int
-skip_trans_bytes(struct trans *trans, unsigned int bytes)
-{
-    struct stream *s;
-    int error = 0;
-
-    make_stream(s);
-
-    while (error == 0 && bytes > 0)
-    {
-        int chunk_size = MIN(32768, bytes);
-        init_stream(s, chunk_size);
-        error = trans_force_read_s(trans, s, chunk_size);
-        bytes -= chunk_size;
-    }
-
-    free_stream(s);
-
-    return error;
-}
-
-/**************************************************************************//**
- * Reads an encoding from the input stream and discards it
- *
- * @param v VNC object
- * @param x Encoding X value
- * @param y Encoding Y value
- * @param cx Encoding CX value
- * @param cy Encoding CY value
- * @param encoding Code for encoding
- * @return != 0 for error
- *
- * @pre On entry the input stream is positioned after the encoding header
- */
-static int
-skip_encoding(struct vnc *v, int x, int y, int cx, int cy,
-              encoding_type encoding)
-{
-    char text[256];
-    int error = 0;
-
-    switch (encoding)
-    {
-        case RFB_ENC_RAW:
-        {
-            int need_size = cx * cy * get_bytes_per_pixel(v->server_bpp);
-            LOG(LOG_LEVEL_DEBUG, "Skipping RFB_ENC_RAW encoding");
-            error = skip_trans_bytes(v->trans, need_size);
-        }
-        break;
-
-        case RFB_ENC_COPY_RECT:
-        {
-            LOG(LOG_LEVEL_DEBUG, "Skipping RFB_ENC_COPY_RECT encoding");
-            error = skip_trans_bytes(v->trans, 4);
-        }
-        break;
-
-        case RFB_ENC_CURSOR:
-        {
-            int j = cx * cy * get_bytes_per_pixel(v->server_bpp);
-            int k = ((cx + 7) / 8) * cy;
-
-            LOG(LOG_LEVEL_DEBUG, "Skipping RFB_ENC_CURSOR encoding");
-            error = skip_trans_bytes(v->trans, j + k);
-        }
-        break;
-
-        case RFB_ENC_DESKTOP_SIZE:
-            LOG(LOG_LEVEL_DEBUG, "Skipping RFB_ENC_DESKTOP_SIZE encoding");
-            break;
-
-        case RFB_ENC_EXTENDED_DESKTOP_SIZE:
-        {
-            struct vnc_screen_layout layout = {0};
-            LOG(LOG_LEVEL_DEBUG,
-                "Skipping RFB_ENC_EXTENDED_DESKTOP_SIZE encoding "
-                "x=%d, y=%d geom=%dx%d",
-                x, y, cx, cy);
-            error = read_extended_desktop_size_rect(v, &layout);
-        }
-        break;
-
-        default:
-            g_sprintf(text, "VNC error in skip_encoding "
-                      "encoding = %8.8x", encoding);
-            v->server_msg(v, text, 1);
-    }
-
-    return error;
-}
-
-/**************************************************************************//**
- * Parses an entire framebuffer update message from the wire, and returns the
- * first matching ExtendedDesktopSize encoding if found.
- *
- * Caller can check for a match by examining match_layout.count after the call
- *
- * @param v VNC object
- * @param match Function to call to check for a match
- * @param [out] match_x Matching x parameter for an encoding (if needed)
- * @param [out] match_y Matching y parameter for an encoding (if needed)
- * @param [out] match_layout Returned layout for the encoding
- * @return != 0 for error
- */
-static int
-find_matching_extended_rect(struct vnc *v,
-                            int (*match)(int x, int y, int cx, int cy),
-                            int *match_x,
-                            int *match_y,
-                            struct vnc_screen_layout *match_layout)
-{
-    int error;
-    struct stream *s;
-    unsigned int num_rects;
-    unsigned int i;
-    int x;
-    int y;
-    int cx;
-    int cy;
-    encoding_type encoding;
-    int found = 0;
-
-    make_stream(s);
-    init_stream(s, 8192);
-    error = trans_force_read_s(v->trans, s, 3);
-
-    if (error == 0)
-    {
-        in_uint8s(s, 1);
-        in_uint16_be(s, num_rects);
-
-        for (i = 0; i < num_rects; ++i)
-        {
-            if (error != 0)
-            {
-                break;
-            }
-
-            init_stream(s, 8192);
-            error = trans_force_read_s(v->trans, s, 12);
-
-            if (error == 0)
-            {
-                in_uint16_be(s, x);
-                in_uint16_be(s, y);
-                in_uint16_be(s, cx);
-                in_uint16_be(s, cy);
-                in_uint32_be(s, encoding);
-
-                if (encoding == RFB_ENC_EXTENDED_DESKTOP_SIZE &&
-                        !found &&
-                        match(x, y, cx, cy))
-                {
-                    LOG(LOG_LEVEL_DEBUG,
-                        "VNC matched ExtendedDesktopSize rectangle "
-                        "x=%d, y=%d geom=%dx%d",
-                        x, y, cx, cy);
-                    found = 1;
-                    error = read_extended_desktop_size_rect(v, match_layout);
-                    if (match_x)
-                    {
-                        *match_x = x;
-                    }
-                    if (match_y)
-                    {
-                        *match_y = y;
-                    }
-                    match_layout->total_width = cx;
-                    match_layout->total_height = cy;
-                }
-                else
-                {
-                    error = skip_encoding(v, x, y, cx, cy, encoding);
-                }
-            }
-        }
-    }
-
-    free_stream(s);
-
-    return error;
-}
-
 /**************************************************************************//**
  * Sends a FramebufferUpdateRequest for the resize status state machine
  *
@@ -1124,90 +1045,229 @@ send_update_request_for_resize_status(struct vnc *v)
 }
 
 /**************************************************************************//**
- * Tests if extended desktop size rect is an initial geometry specification
+ * Sends an incremental FramebufferUpdateRequest for the whole screen
  *
- * This should be x == 0, but the specification says to treat undefined
- * values as 0 also */
+ * @param v VNC object
+ * @return != 0 for error
+ */
 static int
-rect_is_initial_geometry(int x, int y, int cx, int cy)
+send_incremental_update_request(struct vnc *v)
 {
-    return (x != 1 && x != 2);
+    int error;
+    struct stream *s;
+    make_stream(s);
+    init_stream(s, 8192);
+
+    out_uint8(s, RFB_C2S_FRAMEBUFFER_UPDATE_REQUEST);
+    out_uint8(s, 1); /* incremental == 1 : Changes only */
+    out_uint16_be(s, 0);
+    out_uint16_be(s, 0);
+    out_uint16_be(s, v->server_layout.total_width);
+    out_uint16_be(s, v->server_layout.total_height);
+    s_mark_end(s);
+    error = lib_send_copy(v, s);
+
+    free_stream(s);
+
+    return error;
 }
 
 /**************************************************************************//**
- * Tests if extended desktop size rect is a reply to a request from us
+ * Sends an EnableContinuousUpdates message
+ *
+ * @param v VNC object
+ * @param enable != 0 to enable updates for the whole screen
+ * @return != 0 for error
+ *
+ * The EnableContinuousUpdates message is documented in the RFB community
+ * wiki "EnableContinuousUpdates" section.
  */
 static int
-rect_is_reply_to_us(int x, int y, int cx, int cy)
+send_enable_continuous_updates(struct vnc *v, int enable)
 {
-    return (x == 1);
+    int error;
+    struct stream *s;
+    make_stream(s);
+    init_stream(s, 8192);
+
+    out_uint8(s, RFB_C2S_ENABLE_CONTINUOUS_UPDATES);
+    out_uint8(s, enable ? 1 : 0);
+    out_uint16_be(s, 0);
+    out_uint16_be(s, 0);
+    out_uint16_be(s, v->server_layout.total_width);
+    out_uint16_be(s, v->server_layout.total_height);
+    s_mark_end(s);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "VNC %s continuous updates",
+              enable ? "enabling" : "disabling");
+    error = lib_send_copy(v, s);
+
+    v->cu_enabled = enable;
+    v->cu_width = v->server_layout.total_width;
+    v->cu_height = v->server_layout.total_height;
+
+    free_stream(s);
+
+    return error;
 }
 
 /**************************************************************************//**
- * Handles the first framebuffer update from the server
+ * Lets the server send us updates if we're ready for them
  *
- * This is used to determine if the server supports resizes from
- * us. See The RFB community wiki for details.
+ * If the server supports ContinuousUpdates, these are turned on and off
+ * as needed. Otherwise, a few incremental update requests are kept
+ * outstanding, so the server isn't waiting for a round trip between
+ * updates.
  *
- * If the server does support resizing, we send our client geometry over.
+ * Updates are paused while output is suppressed, or while xrdp has not
+ * acknowledged recent updates.
  *
  * @param v VNC object
  * @return != 0 for error
  */
 static int
-lib_framebuffer_first_update(struct vnc *v)
+update_flow_control(struct vnc *v)
 {
-    int error;
-    struct vnc_screen_layout layout = {0};
+    int error = 0;
+    int ready;
 
-    error = find_matching_extended_rect(v,
-                                        rect_is_initial_geometry,
-                                        NULL,
-                                        NULL,
-                                        &layout);
-    if (error == 0)
+    if (v->resize_status != VRS_DONE)
     {
-        if (layout.count > 0)
-        {
-            LOG(LOG_LEVEL_DEBUG, "VNC server supports resizing");
-            v->resize_supported = VRSS_SUPPORTED;
-            v->server_layout = layout;
+        /* The resize state machine makes its own requests */
+        return 0;
+    }
 
-            /* Force the client geometry over to the server */
-            log_screen_layout(LOG_LEVEL_INFO, "ClientLayout", &v->client_layout);
-            log_screen_layout(LOG_LEVEL_INFO, "OldServerLayout", &layout);
+    ready = (v->suppress_output == 0 &&
+             v->frame_id - v->frame_id_acked < VNC_MAX_FRAMES_IN_FLIGHT);
 
-            /*
-             * If we've only got one screen, and the other side has
-             * only got one screen, we will preserve their screen ID
-             * and any flags.  This may prevent us sending an unwanted
-             * SetDesktopSize message if the screen dimensions are
-             * a match. We can't do this with more than one screen,
-             * as we have no way to map different IDs
-             */
-            if (layout.count == 1 && v->client_layout.count == 1)
+    if (v->cu_supported)
+    {
+        if (ready)
+        {
+            if (!v->cu_enabled ||
+                    v->cu_width != v->server_layout.total_width ||
+                    v->cu_height != v->server_layout.total_height)
             {
-                LOG(LOG_LEVEL_DEBUG, "VNC "
-                    "setting screen id to %d from server",
-                    layout.s[0].id);
-
-                v->client_layout.s[0].id = layout.s[0].id;
-                v->client_layout.s[0].flags = layout.s[0].flags;
+                error = send_enable_continuous_updates(v, 1);
             }
-
-            resize_server_to_client_layout(v);
         }
-        else
+        else if (v->cu_enabled)
         {
-            LOG(LOG_LEVEL_DEBUG, "VNC server does not support resizing");
-            v->resize_supported = VRSS_NOT_SUPPORTED;
-
-            /* Force client to same size as server */
-            LOG(LOG_LEVEL_DEBUG, "Resizing client to server %dx%d",
-                v->server_layout.total_width, v->server_layout.total_height);
-            error = resize_client_to_server(v, 0);
-            v->resize_status = VRS_DONE;
+            error = send_enable_continuous_updates(v, 0);
+        }
+    }
+    else if (ready)
+    {
+        while (error == 0 &&
+                v->pending_update_requests < VNC_PIPELINED_UPDATE_REQUESTS)
+        {
+            error = send_incremental_update_request(v);
+            ++v->pending_update_requests;
+        }
+    }
+
+    return error;
+}
+
+/**************************************************************************//**
+ * Records that xrdp has finished with a framebuffer update
+ *
+ * @param v VNC object
+ * @param frame_id ID of the frame. Frames up to this one are acknowledged
+ * @return != 0 for error
+ */
+static int
+frame_acked(struct vnc *v, int frame_id)
+{
+    /* INT_MAX is used to acknowledge all frames during a resize */
+    frame_id = MIN(frame_id, v->frame_id);
+    if (frame_id > v->frame_id_acked)
+    {
+        v->frame_id_acked = frame_id;
+    }
+
+    return update_flow_control(v);
+}
+
+/**************************************************************************//**
+ * Tests if extended desktop size rect is an initial geometry specification
+ *
+ * This should be x == 0, but the specification says to treat undefined
+ * values as 0 also */
+static int
+rect_is_initial_geometry(int x, int y, int cx, int cy)
+{
+    return (x != 1 && x != 2);
+}
+
+/**************************************************************************//**
+ * Tests if extended desktop size rect is a reply to a request from us
+ */
+static int
+rect_is_reply_to_us(int x, int y, int cx, int cy)
+{
+    return (x == 1);
+}
+
+/**************************************************************************//**
+ * Handles the end of the first framebuffer update from the server
+ *
+ * This is used to determine if the server supports resizes from
+ * us. See The RFB community wiki for details.
+ *
+ * If the server does support resizing, we send our client geometry over.
+ *
+ * @param v VNC object
+ * @return != 0 for error
+ *
+ * @pre v->update_layout contains any initial geometry rectangle from
+ *      the update
+ */
+static int
+lib_framebuffer_first_update(struct vnc *v)
+{
+    int error = 0;
+    struct vnc_screen_layout layout = v->update_layout;
+
+    if (layout.count > 0)
+    {
+        LOG(LOG_LEVEL_DEBUG, "VNC server supports resizing");
+        v->resize_supported = VRSS_SUPPORTED;
+        v->server_layout = layout;
+
+        /* Force the client geometry over to the server */
+        log_screen_layout(LOG_LEVEL_INFO, "ClientLayout", &v->client_layout);
+        log_screen_layout(LOG_LEVEL_INFO, "OldServerLayout", &layout);
+
+        /*
+         * If we've only got one screen, and the other side has
+         * only got one screen, we will preserve their screen ID
+         * and any flags.  This may prevent us sending an unwanted
+         * SetDesktopSize message if the screen dimensions are
+         * a match. We can't do this with more than one screen,
+         * as we have no way to map different IDs
+         */
+        if (layout.count == 1 && v->client_layout.count == 1)
+        {
+            LOG(LOG_LEVEL_DEBUG, "VNC "
+                "setting screen id to %d from server",
+                layout.s[0].id);
+
+            v->client_layout.s[0].id = layout.s[0].id;
+            v->client_layout.s[0].flags = layout.s[0].flags;
         }
+
+        resize_server_to_client_layout(v);
+    }
+    else
+    {
+        LOG(LOG_LEVEL_DEBUG, "VNC server does not support resizing");
+        v->resize_supported = VRSS_NOT_SUPPORTED;
+
+        /* Force client to same size as server */
+        LOG(LOG_LEVEL_DEBUG, "Resizing client to server %dx%d",
+            v->server_layout.total_width, v->server_layout.total_height);
+        error = resize_client_to_server(v, 0);
+        v->resize_status = VRS_DONE;
     }
 
     if (error == 0)
@@ -1219,265 +1279,489 @@ lib_framebuffer_first_update(struct vnc *v)
 }
 
 /**************************************************************************//**
- * Looks for a resize confirm in a framebuffer update request
+ * Looks for a resize confirm at the end of a framebuffer update
  *
  * If the server supports resizes from us, this is used to find the
  * reply to our resize request. See The RFB community wiki for details.
  *
  * @param v VNC object
  * @return != 0 for error
+ *
+ * @pre v->update_layout contains any reply to us from the update
  */
 static int
 lib_framebuffer_waiting_for_resize_confirm(struct vnc *v)
 {
-    int error;
-    struct vnc_screen_layout layout = {0};
-    int response_code = 0;
-
-    error = find_matching_extended_rect(v,
-                                        rect_is_reply_to_us,
-                                        NULL,
-                                        &response_code,
-                                        &layout);
-    if (error == 0)
+    int error = 0;
+    struct vnc_screen_layout layout = v->update_layout;
+    int response_code = v->update_match_y;
+
+    if (layout.count > 0)
     {
-        if (layout.count > 0)
+        if (response_code == 0)
         {
-            if (response_code == 0)
-            {
-                LOG(LOG_LEVEL_DEBUG, "VNC server successfully resized");
-                log_screen_layout(LOG_LEVEL_INFO, "NewLayout", &layout);
-                v->server_layout = layout;
-            }
-            else
-            {
-                LOG(LOG_LEVEL_WARNING,
-                    "VNC server resize failed - error code %d [%s]",
-                    response_code,
-                    rfb_get_eds_status_msg(response_code));
-                // This is awkward. The client has asked for a specific size
-                // which we can't support.
-                //
-                // Currently we handle this by queueing a resize to our
-                // supported size, and continuing with the resize state
-                // machine in xrdp_mm.c
-                LOG(LOG_LEVEL_WARNING, "Resizing client to server");
-                error = resize_client_to_server(v, 0);
-            }
+            LOG(LOG_LEVEL_DEBUG, "VNC server successfully resized");
+            log_screen_layout(LOG_LEVEL_INFO, "NewLayout", &layout);
+            v->server_layout = layout;
+        }
+        else
+        {
+            LOG(LOG_LEVEL_WARNING,
+                "VNC server resize failed - error code %d [%s]",
+                response_code,
+                rfb_get_eds_status_msg(response_code));
+            // This is awkward. The client has asked for a specific size
+            // which we can't support.
+            //
+            // Currently we handle this by queueing a resize to our
+            // supported size, and continuing with the resize state
+            // machine in xrdp_mm.c
+            LOG(LOG_LEVEL_WARNING, "Resizing client to server");
+            error = resize_client_to_server(v, 0);
+        }
+
+        if (error == 0)
+        {
+            // If this resize was requested by the client mid-session
+            // (dynamic resize), we need to tell xrdp_mm that
+            // it's OK to continue with the resize state machine.
+            error = v->server_monitor_resize_done(v);
+        }
+        v->resize_status = VRS_DONE;
+    }
+
+    if (error == 0)
+    {
+        error = send_update_request_for_resize_status(v);
+    }
+
+    return error;
+}
+
+/**************************************************************************//**
+ * Finishes a FramebufferUpdate message from the server
+ *
+ * @param v VNC object
+ * @return != 0 for error
+ */
+static int
+lib_framebuffer_update_end(struct vnc *v)
+{
+    int error;
 
+    switch (v->update_status)
+    {
+        case VRS_WAITING_FOR_FIRST_UPDATE:
+            error = lib_framebuffer_first_update(v);
+            break;
+
+        case VRS_WAITING_FOR_RESIZE_CONFIRM:
+            error = lib_framebuffer_waiting_for_resize_confirm(v);
+            break;
+
+        default:
+            error = v->server_end_update(v);
             if (error == 0)
             {
-                // If this resize was requested by the client mid-session
-                // (dynamic resize), we need to tell xrdp_mm that
-                // it's OK to continue with the resize state machine.
-                error = v->server_monitor_resize_done(v);
+                ++v->frame_id;
+                if (vnc_shadow_has_damage(v))
+                {
+                    /* xrdp will ack the frame when the encoder is done
+                     * with it */
+                    error = vnc_shadow_submit(v, v->frame_id);
+                }
+                else
+                {
+                    /* Painting with server_paint_rect() is synchronous,
+                     * so xrdp has finished with this frame already */
+                    error = frame_acked(v, v->frame_id);
+                }
             }
-            v->resize_status = VRS_DONE;
+    }
+
+    return error;
+}
+
+/**************************************************************************//**
+ * Moves on from a completed FramebufferUpdate rectangle
+ *
+ * @param v VNC object
+ * @return != 0 for error
+ */
+static int
+lib_framebuffer_update_rect_done(struct vnc *v)
+{
+    if (v->update_rects > 0)
+    {
+        --v->update_rects;
+    }
+
+    if (v->update_rects > 0)
+    {
+        v->parse_state = VPS_UPDATE_RECT;
+        return 0;
+    }
+
+    v->parse_state = VPS_MESSAGE;
+    return lib_framebuffer_update_end(v);
+}
+
+/**************************************************************************//**
+ * Starts a FramebufferUpdate message from the server
+ *
+ * Rectangles are only painted if the resize state machine isn't
+ * running when the update starts. Otherwise we're just looking for the
+ * ExtendedDesktopSize rectangle the state machine is waiting for.
+ *
+ * @param v VNC object
+ * @param s Stream containing the message
+ * @return != 0 for error
+ */
+static int
+lib_framebuffer_update_start(struct vnc *v, struct stream *s)
+{
+    int error = 0;
+
+    if (!vnc_have_bytes(v, s, 3))
+    {
+        return 0;
+    }
+
+    in_uint8s(s, 1);
+    in_uint16_be(s, v->update_rects);
+    v->update_status = v->resize_status;
+    v->update_match = 0;
+    v->update_match_y = 0;
+    g_memset(&v->update_layout, 0, sizeof(v->update_layout));
+
+    if (v->update_status == VRS_DONE)
+    {
+        error = v->server_begin_update(v);
+
+        /* This update answers a request, if we made one */
+        if (v->pending_update_requests > 0)
+        {
+            --v->pending_update_requests;
         }
     }
 
     if (error == 0)
     {
-        error = send_update_request_for_resize_status(v);
+        if (v->update_rects > 0)
+        {
+            v->parse_state = VPS_UPDATE_RECT;
+        }
+        else
+        {
+            error = lib_framebuffer_update_end(v);
+        }
     }
 
     return error;
 }
 
-/******************************************************************************/
+/**************************************************************************//**
+ * Processes a RichCursor rectangle
+ *
+ * @param v VNC object
+ * @param s Stream positioned after the rectangle header
+ * @param x Cursor hotspot X
+ * @param y Cursor hotspot Y
+ * @param cx Cursor width
+ * @param cy Cursor height
+ * @param paint Zero if the cursor is to be read but not set
+ * @return != 0 for error
+ */
 static int
-lib_framebuffer_update(struct vnc *v)
+lib_cursor_rect(struct vnc *v, struct stream *s,
+                int x, int y, int cx, int cy, int paint)
 {
     char *d1;
     char *d2;
     char cursor_data[32 * (32 * 3)];
     char cursor_mask[32 * (32 / 8)];
-    char text[256];
-    int num_recs;
+    int data_bytes;
+    int mask_bytes;
     int i;
     int j;
-    int k;
-    int x;
-    int y;
-    int cx;
-    int cy;
-    int srcx;
-    int srcy;
-    unsigned int encoding;
     int pixel;
     int r = 0;
     int g = 0;
     int b = 0;
-    int error;
-    int need_size;
-    struct stream *s;
-    struct stream *pixel_s;
-    struct vnc_screen_layout layout = { 0 };
-
-    num_recs = 0;
 
-    make_stream(pixel_s);
-
-    make_stream(s);
-    init_stream(s, 8192);
-    error = trans_force_read_s(v->trans, s, 3);
+    /* cx and cy are 16-bit, so this can't overflow */
+    if ((unsigned int)cx * (unsigned int)cy > VNC_MAX_MESSAGE_SIZE / 4)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC cursor is too large (%dx%d)", cx, cy);
+        return 1;
+    }
 
-    if (error == 0)
+    data_bytes = cx * cy * get_bytes_per_pixel(v->server_bpp);
+    mask_bytes = ((cx + 7) / 8) * cy;
+    if (!vnc_have_bytes(v, s, data_bytes + mask_bytes) || !paint)
     {
-        in_uint8s(s, 1);
-        in_uint16_be(s, num_recs);
-        error = v->server_begin_update(v);
+        return 0;
     }
 
-    for (i = 0; i < num_recs; i++)
+    in_uint8p(s, d1, data_bytes);
+    in_uint8p(s, d2, mask_bytes);
+
+    g_memset(cursor_data, 0, 32 * (32 * 3));
+    g_memset(cursor_mask, 0, 32 * (32 / 8));
+
+    for (j = 0; j < 32; j++)
     {
-        if (error != 0)
+        for (i = 0; i < 32; i++)
         {
-            break;
+            pixel = get_pixel_safe(d2, i, 31 - j, cx, cy, 1);
+            set_pixel_safe(cursor_mask, i, j, 32, 32, 1, !pixel);
+
+            if (pixel)
+            {
+                pixel = get_pixel_safe(d1, i, 31 - j, cx, cy, v->server_bpp);
+                split_color(pixel, &r, &g, &b, v->server_bpp, v->palette);
+                pixel = make_color(r, g, b, 24);
+                set_pixel_safe(cursor_data, i, j, 32, 32, 24, pixel);
+            }
         }
+    }
 
-        init_stream(s, 8192);
-        error = trans_force_read_s(v->trans, s, 12);
+    /* keep these in 32x32, vnc cursor can be a lot bigger */
+    if (x > 31)
+    {
+        x = 31;
+    }
 
-        if (error == 0)
-        {
-            in_uint16_be(s, x);
-            in_uint16_be(s, y);
-            in_uint16_be(s, cx);
-            in_uint16_be(s, cy);
-            in_uint32_be(s, encoding);
+    if (y > 31)
+    {
+        y = 31;
+    }
 
-            if (encoding == RFB_ENC_RAW)
-            {
-                need_size = cx * cy * get_bytes_per_pixel(v->server_bpp);
-                init_stream(pixel_s, need_size);
-                error = trans_force_read_s(v->trans, pixel_s, need_size);
+    return v->server_set_cursor(v, x, y, cursor_data, cursor_mask);
+}
 
-                if (error == 0)
-                {
-                    error = v->server_paint_rect(v, x, y, cx, cy, pixel_s->data, cx, cy, 0, 0);
-                }
-            }
-            else if (encoding == RFB_ENC_COPY_RECT)
-            {
-                init_stream(s, 8192);
-                error = trans_force_read_s(v->trans, s, 4);
+/**************************************************************************//**
+ * Processes an ExtendedDesktopSize rectangle
+ *
+ * @param v VNC object
+ * @param s Stream positioned after the rectangle header
+ * @param x Rectangle X value (the reason for the change)
+ * @param y Rectangle Y value (the status code for the change)
+ * @param cx New framebuffer width
+ * @param cy New framebuffer height
+ * @return != 0 for error
+ */
+static int
+lib_extended_desktop_size_rect(struct vnc *v, struct stream *s,
+                               int x, int y, int cx, int cy)
+{
+    struct vnc_screen_layout layout = { 0 };
+    int error;
+    int match;
 
-                if (error == 0)
-                {
-                    in_uint16_be(s, srcx);
-                    in_uint16_be(s, srcy);
-                    error = v->server_screen_blt(v, x, y, cx, cy, srcx, srcy);
-                }
-            }
-            else if (encoding == RFB_ENC_CURSOR)
+    layout.total_width = cx;
+    layout.total_height = cy;
+    error = read_extended_desktop_size_rect(v, s, &layout);
+    if (error != 0 || v->parse_need != 0)
+    {
+        return error;
+    }
+
+    switch (v->update_status)
+    {
+        case VRS_WAITING_FOR_FIRST_UPDATE:
+            match = rect_is_initial_geometry(x, y, cx, cy);
+            break;
+
+        case VRS_WAITING_FOR_RESIZE_CONFIRM:
+            match = rect_is_reply_to_us(x, y, cx, cy);
+            break;
+
+        default:
+            /* If this is a reply to a request from us, x == 1 */
+            if (x != 1 &&
+                    !vnc_screen_layouts_equal(&v->server_layout, &layout))
             {
-                g_memset(cursor_data, 0, 32 * (32 * 3));
-                g_memset(cursor_mask, 0, 32 * (32 / 8));
-                j = cx * cy * get_bytes_per_pixel(v->server_bpp);
-                k = ((cx + 7) / 8) * cy;
-                init_stream(s, j + k);
-                error = trans_force_read_s(v->trans, s, j + k);
+                v->server_layout = layout;
+                log_screen_layout(LOG_LEVEL_INFO, "NewServerLayout",
+                                  &v->server_layout);
+                error = resize_client_to_server(v, 1);
+            }
+            return error;
+    }
 
-                if (error == 0)
-                {
-                    in_uint8p(s, d1, j);
-                    in_uint8p(s, d2, k);
+    /* The resize state machine uses the first match in the update */
+    if (match && !v->update_match)
+    {
+        LOG(LOG_LEVEL_DEBUG, "VNC matched ExtendedDesktopSize rectangle "
+            "x=%d, y=%d geo=%dx%d", x, y, cx, cy);
+        v->update_match = 1;
+        v->update_match_y = y;
+        v->update_layout = layout;
+    }
 
-                    for (j = 0; j < 32; j++)
-                    {
-                        for (k = 0; k < 32; k++)
-                        {
-                            pixel = get_pixel_safe(d2, k, 31 - j, cx, cy, 1);
-                            set_pixel_safe(cursor_mask, k, j, 32, 32, 1, !pixel);
-
-                            if (pixel)
-                            {
-                                pixel = get_pixel_safe(d1, k, 31 - j, cx, cy, v->server_bpp);
-                                split_color(pixel, &r, &g, &b, v->server_bpp, v->palette);
-                                pixel = make_color(r, g, b, 24);
-                                set_pixel_safe(cursor_data, k, j, 32, 32, 24, pixel);
-                            }
-                        }
-                    }
+    return 0;
+}
 
-                    /* keep these in 32x32, vnc cursor can be a lot bigger */
-                    if (x > 31)
-                    {
-                        x = 31;
-                    }
+/**************************************************************************//**
+ * Processes a rectangle header from a FramebufferUpdate message
+ *
+ * Apart from Raw rectangles, which are read a few rows at a time, the
+ * whole rectangle is buffered before it is processed.
+ *
+ * @param v VNC object
+ * @param s Stream containing the rectangle
+ * @return != 0 for error
+ */
+static int
+lib_framebuffer_update_rect(struct vnc *v, struct stream *s)
+{
+    char text[256];
+    int x;
+    int y;
+    int cx;
+    int cy;
+    int srcx;
+    int srcy;
+    unsigned int encoding;
+    int paint = (v->update_status == VRS_DONE);
+    int error = 0;
 
-                    if (y > 31)
-                    {
-                        y = 31;
-                    }
+    if (!vnc_have_bytes(v, s, RECT_HEADER_SIZE))
+    {
+        return 0;
+    }
 
-                    error = v->server_set_cursor(v, x, y, cursor_data, cursor_mask);
-                }
+    in_uint16_be(s, x);
+    in_uint16_be(s, y);
+    in_uint16_be(s, cx);
+    in_uint16_be(s, cy);
+    in_uint32_be(s, encoding);
+
+    switch (encoding)
+    {
+        case RFB_ENC_RAW:
+            if (cx > 0 && cy > 0)
+            {
+                /* Rows are processed by lib_framebuffer_raw_rows() */
+                v->raw_x = x;
+                v->raw_y = y;
+                v->raw_cx = cx;
+                v->raw_rows = cy;
+                v->parse_state = VPS_RAW_ROWS;
+                return 0;
             }
-            else if (encoding == RFB_ENC_DESKTOP_SIZE)
+            break;
+
+        case RFB_ENC_COPY_RECT:
+            if (!vnc_have_bytes(v, s, 4))
             {
-                /* Server end has resized */
-                init_single_screen_layout(cx, cy, &v->server_layout);
-                error = resize_client_to_server(v, 1);
+                return 0;
             }
-            else if (encoding == RFB_ENC_EXTENDED_DESKTOP_SIZE)
+            in_uint16_be(s, srcx);
+            in_uint16_be(s, srcy);
+            if (paint)
             {
-                layout.total_width = cx;
-                layout.total_height = cy;
-                error = read_extended_desktop_size_rect(v, &layout);
-                /* If this is a reply to a request from us, x == 1 */
-                if (error == 0 && x != 1)
-                {
-                    if (!vnc_screen_layouts_equal(&v->server_layout, &layout))
-                    {
-                        v->server_layout = layout;
-                        log_screen_layout(LOG_LEVEL_INFO, "NewServerLayout",
-                                          &v->server_layout);
-                        error = resize_client_to_server(v, 1);
-                    }
-                }
+                error = vnc_shadow_screen_blt(v, x, y, cx, cy, srcx, srcy);
             }
-            else
+            break;
+
+#if defined(XRDP_ZLIB)
+        case RFB_ENC_ZRLE:
+            error = vnc_decode_zrle(v, s, x, y, cx, cy, paint);
+            break;
+
+        case RFB_ENC_TIGHT:
+            error = vnc_decode_tight(v, s, x, y, cx, cy, paint);
+            break;
+#endif
+
+        case RFB_ENC_CURSOR:
+            error = lib_cursor_rect(v, s, x, y, cx, cy, paint);
+            break;
+
+        case RFB_ENC_DESKTOP_SIZE:
+            if (paint)
             {
-                g_sprintf(text, "VNC error in lib_framebuffer_update encoding = %8.8x",
-                          encoding);
-                v->server_msg(v, text, 1);
+                /* Server end has resized */
+                init_single_screen_layout(cx, cy, &v->server_layout);
+                error = resize_client_to_server(v, 1);
             }
-        }
+            break;
+
+        case RFB_ENC_EXTENDED_DESKTOP_SIZE:
+            error = lib_extended_desktop_size_rect(v, s, x, y, cx, cy);
+            break;
+
+        default:
+            /* We've no way of knowing how long the rectangle is */
+            g_snprintf(text, sizeof(text),
+                       "VNC error in lib_framebuffer_update encoding = %8.8x",
+                       encoding);
+            v->server_msg(v, text, 1);
+            error = 1;
     }
 
-    if (error == 0)
+    if (error == 0 && v->parse_need == 0)
     {
-        error = v->server_end_update(v);
+        error = lib_framebuffer_update_rect_done(v);
     }
 
-    if (error == 0)
+    return error;
+}
+
+/**************************************************************************//**
+ * Returns the number of bytes to read for the next Raw rectangle chunk
+ *
+ * Raw rectangles can be very large, so they are read a band of whole
+ * rows at a time, rather than buffered in full.
+ *
+ * @param v VNC object
+ * @return Bytes to read
+ */
+static unsigned int
+raw_rows_read_size(const struct vnc *v)
+{
+    unsigned int row_bytes = v->raw_cx * get_bytes_per_pixel(v->server_bpp);
+    unsigned int rows = MAX(1, VNC_READ_CHUNK_SIZE / row_bytes);
+
+    return MIN(rows, (unsigned int)v->raw_rows) * row_bytes;
+}
+
+/**************************************************************************//**
+ * Processes a band of rows from a Raw rectangle
+ *
+ * @param v VNC object
+ * @param s Stream containing the rows
+ * @return != 0 for error
+ */
+static int
+lib_framebuffer_raw_rows(struct vnc *v, struct stream *s)
+{
+    int row_bytes = v->raw_cx * get_bytes_per_pixel(v->server_bpp);
+    int rows = (int)(s->end - s->data) / row_bytes;
+    int error = 0;
+
+    if (v->update_status == VRS_DONE)
     {
-        if (v->suppress_output == 0)
-        {
-            init_stream(s, 8192);
-            out_uint8(s, RFB_C2S_FRAMEBUFFER_UPDATE_REQUEST);
-            out_uint8(s, 1); /* incremental == 1 : Changes only */
-            out_uint16_be(s, 0);
-            out_uint16_be(s, 0);
-            out_uint16_be(s, v->server_layout.total_width);
-            out_uint16_be(s, v->server_layout.total_height);
-            s_mark_end(s);
-            error = lib_send_copy(v, s);
-        }
+        error = vnc_shadow_paint_rect(v, v->raw_x, v->raw_y,
+                                      v->raw_cx, rows, s->data);
+    }
+
+    v->raw_y += rows;
+    v->raw_rows -= rows;
+    if (error == 0 && v->raw_rows <= 0)
+    {
+        error = lib_framebuffer_update_rect_done(v);
     }
 
-    free_stream(s);
-    free_stream(pixel_s);
     return error;
 }
 
 /******************************************************************************/
 static int
-lib_palette_update(struct vnc *v)
+lib_palette_update(struct vnc *v, struct stream *s)
 {
-    struct stream *s;
     int first_color;
     int num_colors;
     int i;
@@ -1486,35 +1770,39 @@ lib_palette_update(struct vnc *v)
     int b;
     int error;
 
-    make_stream(s);
-    init_stream(s, 8192);
-    error = trans_force_read_s(v->trans, s, 5);
+    if (!vnc_have_bytes(v, s, 5))
+    {
+        return 0;
+    }
 
-    if (error == 0)
+    in_uint8s(s, 1);
+    in_uint16_be(s, first_color);
+    in_uint16_be(s, num_colors);
+    if (!vnc_have_bytes(v, s, num_colors * 6))
     {
-        in_uint8s(s, 1);
-        in_uint16_be(s, first_color);
-        in_uint16_be(s, num_colors);
-        init_stream(s, 8192);
-        error = trans_force_read_s(v->trans, s, num_colors * 6);
+        return 0;
     }
 
-    if (error == 0)
+    if (first_color + num_colors > 256)
     {
-        for (i = 0; i < num_colors; i++)
-        {
-            in_uint16_be(s, r);
-            in_uint16_be(s, g);
-            in_uint16_be(s, b);
-            r = r >> 8;
-            g = g >> 8;
-            b = b >> 8;
-            v->palette[first_color + i] = (r << 16) | (g << 8) | b;
-        }
+        LOG(LOG_LEVEL_ERROR, "VNC bad colour map entries %d + %d",
+            first_color, num_colors);
+        return 1;
+    }
 
-        error = v->server_begin_update(v);
+    for (i = 0; i < num_colors; i++)
+    {
+        in_uint16_be(s, r);
+        in_uint16_be(s, g);
+        in_uint16_be(s, b);
+        r = r >> 8;
+        g = g >> 8;
+        b = b >> 8;
+        v->palette[first_color + i] = (r << 16) | (g << 8) | b;
     }
 
+    error = v->server_begin_update(v);
+
     if (error == 0)
     {
         error = v->server_palette(v, v->palette);
@@ -1525,7 +1813,6 @@ lib_palette_update(struct vnc *v)
         error = v->server_end_update(v);
     }
 
-    free_stream(s);
     return error;
 }
 
@@ -1539,6 +1826,96 @@ lib_bell_trigger(struct vnc *v)
     return error;
 }
 
+/**************************************************************************//**
+ * Handles an EndOfContinuousUpdates message from the server
+ *
+ * The server sends this when it first sees the ContinuousUpdates
+ * pseudo-encoding from us, and whenever it stops sending continuous
+ * updates.
+ *
+ * @param v VNC object
+ * @return != 0 for error
+ */
+static int
+lib_end_of_continuous_updates(struct vnc *v)
+{
+    if (!v->cu_supported)
+    {
+        LOG(LOG_LEVEL_INFO, "VNC server supports ContinuousUpdates");
+        v->cu_supported = 1;
+    }
+    v->cu_enabled = 0;
+
+    return update_flow_control(v);
+}
+
+/**************************************************************************//**
+ * Handles a Fence message from the server
+ *
+ * We process messages in order, and send our replies as we go, so the
+ * fence flags are honoured just by replying straight away.
+ *
+ * @param v VNC object
+ * @param s Stream containing the message
+ * @return != 0 for error
+ */
+static int
+lib_fence(struct vnc *v, struct stream *s)
+{
+    struct stream *out_s;
+    unsigned int flags;
+    int len;
+    int error;
+    char *payload;
+
+    if (!vnc_have_bytes(v, s, 8))
+    {
+        return 0;
+    }
+
+    in_uint8s(s, 3);
+    in_uint32_be(s, flags);
+    in_uint8(s, len);
+    if (len > RFB_FENCE_MAX_PAYLOAD)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC Fence payload too long (%d)", len);
+        return 1;
+    }
+
+    if (!vnc_have_bytes(v, s, len))
+    {
+        return 0;
+    }
+
+    if ((flags & RFB_FENCE_REQUEST) == 0)
+    {
+        return 0;
+    }
+
+    if (!v->fence_supported)
+    {
+        LOG(LOG_LEVEL_INFO, "VNC server supports Fence");
+        v->fence_supported = 1;
+    }
+
+    in_uint8p(s, payload, len);
+    flags &= (RFB_FENCE_BLOCK_BEFORE | RFB_FENCE_BLOCK_AFTER |
+              RFB_FENCE_SYNC_NEXT);
+
+    make_stream(out_s);
+    init_stream(out_s, 8192);
+    out_uint8(out_s, RFB_C2S_FENCE);
+    out_uint8s(out_s, 3);
+    out_uint32_be(out_s, flags);
+    out_uint8(out_s, len);
+    out_uint8a(out_s, payload, len);
+    s_mark_end(out_s);
+    error = lib_send_copy(v, out_s);
+    free_stream(out_s);
+
+    return error;
+}
+
 /******************************************************************************/
 static int
 lib_mod_signal(struct vnc *v)
@@ -1550,49 +1927,41 @@ lib_mod_signal(struct vnc *v)
 static int
 lib_mod_process_message(struct vnc *v, struct stream *s)
 {
-    char type;
+    int type;
     int error;
     char text[256];
 
     in_uint8(s, type);
 
     error = 0;
-    if (error == 0)
+    if (type == RFB_S2C_FRAMEBUFFER_UPDATE)
     {
-        if (type == RFB_S2C_FRAMEBUFFER_UPDATE)
-        {
-            switch (v->resize_status)
-            {
-                case VRS_WAITING_FOR_FIRST_UPDATE:
-                    error = lib_framebuffer_first_update(v);
-                    break;
-
-                case VRS_WAITING_FOR_RESIZE_CONFIRM:
-                    error = lib_framebuffer_waiting_for_resize_confirm(v);
-                    break;
-
-                default:
-                    error = lib_framebuffer_update(v);
-            }
-        }
-        else if (type == RFB_S2C_SET_COLOUR_MAP_ENTRIES)
-        {
-            error = lib_palette_update(v);
-        }
-        else if (type == RFB_S2C_BELL)
-        {
-            error = lib_bell_trigger(v);
-        }
-        else if (type == RFB_S2C_SERVER_CUT_TEXT) /* clipboard */
-        {
-            LOG(LOG_LEVEL_DEBUG, "VNC got clip data");
-            error = vnc_clip_process_rfb_data(v);
-        }
-        else
-        {
-            g_sprintf(text, "VNC unknown in lib_mod_process_message %d", type);
-            v->server_msg(v, text, 1);
-        }
+        error = lib_framebuffer_update_start(v, s);
+    }
+    else if (type == RFB_S2C_SET_COLOUR_MAP_ENTRIES)
+    {
+        error = lib_palette_update(v, s);
+    }
+    else if (type == RFB_S2C_BELL)
+    {
+        error = lib_bell_trigger(v);
+    }
+    else if (type == RFB_S2C_SERVER_CUT_TEXT) /* clipboard */
+    {
+        error = vnc_clip_process_rfb_data(v, s);
+    }
+    else if (type == RFB_S2C_END_OF_CONTINUOUS_UPDATES)
+    {
+        error = lib_end_of_continuous_updates(v);
+    }
+    else if (type == RFB_S2C_FENCE)
+    {
+        error = lib_fence(v, s);
+    }
+    else
+    {
+        g_sprintf(text, "VNC unknown in lib_mod_process_message %d", type);
+        v->server_msg(v, text, 1);
     }
 
     return error;
@@ -1610,12 +1979,125 @@ lib_mod_start(struct vnc *v, int w, int h, int bpp)
     return 0;
 }
 
-/******************************************************************************/
+/**************************************************************************//**
+ * Resizes the transport input stream, keeping any buffered data
+ *
+ * @param s Transport input stream
+ * @param size New size for the stream
+ * @return != 0 for error
+ */
+static int
+resize_in_stream(struct stream *s, int size)
+{
+    int used = (int)(s->end - s->data);
+    char *data;
+
+    if (used > size)
+    {
+        return 1;
+    }
+
+    data = (char *)realloc(s->data, size);
+    if (data == NULL)
+    {
+        return 1;
+    }
+
+    s->data = data;
+    s->p = data;
+    s->end = data + used;
+    s->size = size;
+
+    return 0;
+}
+
+/**************************************************************************//**
+ * Sets up the transport to read the next piece of server data
+ *
+ * If the parser is waiting on more data for the current message, the
+ * buffered data is kept, and the transport is asked to top it up.
+ * Otherwise the buffer is emptied, and the read is sized for whatever
+ * the parser is expecting next.
+ *
+ * @param v VNC object
+ * @return != 0 for error
+ */
+static int
+set_next_read(struct vnc *v)
+{
+    struct stream *s = v->trans->in_s;
+    unsigned int need = v->parse_need;
+
+    if (need > 0)
+    {
+        if (need > VNC_MAX_MESSAGE_SIZE)
+        {
+            LOG(LOG_LEVEL_ERROR, "VNC server message is too large");
+            return 1;
+        }
+    }
+    else
+    {
+        /* Drop anything the last message needed us to allocate */
+        if (s->size > VNC_IN_STREAM_SIZE)
+        {
+            init_stream(s, 0);
+            if (resize_in_stream(s, VNC_IN_STREAM_SIZE) != 0)
+            {
+                return 1;
+            }
+        }
+        init_stream(s, 0);
+
+        switch (v->parse_state)
+        {
+            case VPS_UPDATE_RECT:
+                need = RECT_HEADER_SIZE;
+                break;
+
+            case VPS_RAW_ROWS:
+                need = raw_rows_read_size(v);
+                break;
+
+            case VPS_SKIP:
+                need = MIN(v->skip_bytes, VNC_READ_CHUNK_SIZE);
+                break;
+
+            default:
+                need = 1;
+        }
+    }
+
+    if (need > (unsigned int)s->size &&
+            resize_in_stream(s, (int)need) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC can't buffer %u bytes of server data",
+            need);
+        return 1;
+    }
+
+    v->trans->header_size = (int)need;
+    return 0;
+}
+
+/**************************************************************************//**
+ * Processes data from the VNC server
+ *
+ * This is called by the transport whenever header_size bytes have been
+ * buffered in the input stream. We never block waiting for the rest of
+ * a message - if a parser needs more data than is buffered, it sets
+ * v->parse_need and returns. We then ask the transport for the extra
+ * data, and parse the message again from the start when it has arrived.
+ *
+ * @param trans Transport
+ * @return != 0 for error
+ */
 static int
 lib_data_in(struct trans *trans)
 {
     struct vnc *self;
     struct stream *s;
+    int error;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "lib_data_in:");
 
@@ -1632,15 +2114,40 @@ lib_data_in(struct trans *trans)
         return 1;
     }
 
-    if (lib_mod_process_message(self, s) != 0)
+    s->p = s->data;
+    self->parse_need = 0;
+
+    switch (self->parse_state)
+    {
+        case VPS_UPDATE_RECT:
+            error = lib_framebuffer_update_rect(self, s);
+            break;
+
+        case VPS_RAW_ROWS:
+            error = lib_framebuffer_raw_rows(self, s);
+            break;
+
+        case VPS_SKIP:
+            self->skip_bytes -= MIN(self->skip_bytes,
+                                    (unsigned int)(s->end - s->data));
+            if (self->skip_bytes == 0)
+            {
+                self->parse_state = VPS_MESSAGE;
+            }
+            error = 0;
+            break;
+
+        default:
+            error = lib_mod_process_message(self, s);
+    }
+
+    if (error != 0)
     {
         LOG(LOG_LEVEL_ERROR, "lib_data_in: lib_mod_process_message failed");
         return 1;
     }
 
-    init_stream(s, 0);
-
-    return 0;
+    return set_next_read(self);
 }
 
 /******************************************************************************/
@@ -1688,7 +2195,7 @@ lib_mod_connect(struct vnc *v)
     g_sprintf(con_port, "%s", v->port);
     make_stream(pixel_format);
 
-    v->trans = trans_create(TRANS_MODE_TCP, 8 * 8192, 8192);
+    v->trans = trans_create(TRANS_MODE_TCP, VNC_IN_STREAM_SIZE, 8192);
     if (v->trans == 0)
     {
         v->server_msg(v, "VNC error: trans_create() failed", 0);
@@ -1975,10 +2482,42 @@ lib_mod_connect(struct vnc *v)
 
     if (error == 0)
     {
-        encoding_type e[10];
+        encoding_type e[16];
         unsigned int n = 0;
         unsigned int i;
 
+        v->enabled_encodings_mask &= ~v->disabled_encodings_mask;
+#if defined(XRDP_ZLIB)
+        if (!vnc_decode_jpeg_supported() &&
+                (v->enabled_encodings_mask & MSK_TIGHT_JPEG) != 0)
+        {
+            LOG(LOG_LEVEL_WARNING,
+                "VNC Tight JPEG requested, but not supported by this build");
+            v->enabled_encodings_mask &= ~MSK_TIGHT_JPEG;
+        }
+
+        /* Preferred encodings are listed first */
+        if (v->enabled_encodings_mask & MSK_TIGHT)
+        {
+            e[n++] = RFB_ENC_TIGHT;
+            if (v->enabled_encodings_mask & MSK_TIGHT_JPEG)
+            {
+                /* The server only sends JPEG if we ask for a quality level */
+                e[n++] = RFB_ENC_QUALITY_LEVEL_0 + TIGHT_JPEG_QUALITY_LEVEL;
+            }
+        }
+        if (v->enabled_encodings_mask & MSK_ZRLE)
+        {
+            e[n++] = RFB_ENC_ZRLE;
+        }
+#else
+        if (v->enabled_encodings_mask & (MSK_ZRLE | MSK_TIGHT))
+        {
+            LOG(LOG_LEVEL_WARNING,
+                "VNC ZRLE/Tight requested, but not supported by this build");
+        }
+#endif
+
         /* These encodings are always supported */
         e[n++] = RFB_ENC_RAW;
         e[n++] = RFB_ENC_COPY_RECT;
@@ -1993,6 +2532,17 @@ lib_mod_connect(struct vnc *v)
             LOG(LOG_LEVEL_INFO,
                 "VNC User disabled EXTENDED_DESKTOP_SIZE");
         }
+        if (v->enabled_encodings_mask & MSK_CONTINUOUS_UPDATES)
+        {
+            /* ContinuousUpdates needs Fence support from us */
+            e[n++] = RFB_ENC_FENCE;
+            e[n++] = RFB_ENC_CONTINUOUS_UPDATES;
+        }
+        else
+        {
+            LOG(LOG_LEVEL_INFO,
+                "VNC User disabled CONTINUOUS_UPDATES");
+        }
 
         init_stream(s, 8192);
         out_uint8(s, RFB_C2S_SET_ENCODINGS);
@@ -2050,7 +2600,9 @@ lib_mod_connect(struct vnc *v)
         v->server_msg(v, "connected ok", 0);
         v->trans->trans_data_in = lib_data_in;
         v->trans->header_size = 1;
+        v->trans->no_stream_init_on_data_in = 1;
         v->trans->callback_data = v;
+        v->parse_state = VPS_MESSAGE;
     }
 
     return error;
@@ -2141,13 +2693,19 @@ lib_mod_set_param(struct vnc *v, const char *name, const char *value)
     }
     else if (g_strcasecmp(name, "disabled_encodings_mask") == 0)
     {
-        v->enabled_encodings_mask = ~g_atoi(value);
+        v->disabled_encodings_mask = g_atoi(value);
+    }
+    else if (g_strcasecmp(name, "enabled_encodings_mask") == 0)
+    {
+        v->enabled_encodings_mask |= g_atoi(value);
     }
     else if (g_strcasecmp(name, "client_info") == 0)
     {
         const struct xrdp_client_info *client_info =
             (const struct xrdp_client_info *) value;
 
+        /* Kept to see which encoder xrdp is using */
+        v->client_info = client_info;
         v->multimon_configured = client_info->multimon;
 
         /* Save monitor information from the client
@@ -2212,7 +2770,7 @@ lib_mod_check_wait_objs(struct vnc *v)
 static int
 lib_mod_frame_ack(struct vnc *v, int flags, int frame_id)
 {
-    return 0;
+    return frame_acked(v, frame_id);
 }
 
 /******************************************************************************/
@@ -2240,6 +2798,11 @@ lib_mod_suppress_output(struct vnc *v, int suppress,
         error = lib_send_copy(v, s);
         free_stream(s);
     }
+
+    if (error == 0)
+    {
+        error = update_flow_control(v);
+    }
     return error;
 }
 
@@ -2314,8 +2877,12 @@ mod_init(void)
     v->mod_server_version_message = lib_mod_server_version_message;
 
     /* Member variables */
-    v->enabled_encodings_mask = -1;
+    v->enabled_encodings_mask = MSK_DEFAULT_ENCODINGS;
     vnc_clip_init(v);
+#if defined(XRDP_ZLIB)
+    vnc_decode_init(v);
+#endif
+    vnc_shadow_init(v);
 
     return (tintptr) v;
 }
@@ -2333,6 +2900,11 @@ mod_exit(tintptr handle)
     }
     trans_delete(v->trans);
     vnc_clip_exit(v);
+#if defined(XRDP_ZLIB)
+    vnc_decode_exit(v);
+#endif
+    vnc_shadow_exit(v);
+    free_stream(v->input_batch);
     g_free(v);
     return 0;
 }
@@ -68,12 +68,32 @@ enum vnc_resize_support_status
     VRSS_UNKNOWN
 };
 
+/**
+ * What the parser for server messages is expecting next
+ */
+enum vnc_parse_state
+{
+    VPS_MESSAGE, /* A server message */
+    VPS_UPDATE_RECT, /* A rectangle in a FramebufferUpdate */
+    VPS_RAW_ROWS, /* Pixel rows for a Raw rectangle */
+    VPS_SKIP /* Data to be discarded */
+};
+
+/* Largest server message (or update rectangle) we will buffer */
+#define VNC_MAX_MESSAGE_SIZE (80 * 1024 * 1024)
+
 struct source_info;
 struct xrdp_client_info;
 
 /* Defined in vnc_clip.c */
 struct vnc_clipboard_data;
 
+/* Defined in vnc_decode.c */
+struct vnc_decoder_data;
+
+/* Defined in vnc_shadow.c */
+struct vnc_shadow;
+
 /* Defined in xrdp_client_info.h */
 struct monitor_info;
 
@@ -154,7 +174,12 @@ struct vnc
     int (*server_chansrv_in_use)(struct vnc *v);
     void (*server_init_xkb_layout)(struct vnc *v,
                                    struct xrdp_client_info *client_info);
-    tintptr server_dumby[100 - 29]; /* align, 100 minus the number of server
+    tintptr server_unused[50 - 29]; /* server functions not used by this
+                                     module, up to server_egfx_cmd */
+    int (*server_egfx_cmd)(struct vnc *v,
+                           char *cmd, int cmd_bytes,
+                           char *data, int data_bytes);
+    tintptr server_dumby[100 - 51]; /* align, 100 minus the number of server
                                      functions above */
     /* common */
     tintptr handle; /* pointer to self as long */
@@ -182,12 +207,41 @@ struct vnc
     struct guid guid;
     int suppress_output;
     unsigned int enabled_encodings_mask;
+    unsigned int disabled_encodings_mask;
+    struct vnc_decoder_data *vd;
+    struct vnc_shadow *shadow;
+    const struct xrdp_client_info *client_info;
     /* Resizeable support */
     int multimon_configured;
     struct vnc_screen_layout client_layout;
     struct vnc_screen_layout server_layout;
     enum vnc_resize_status resize_status;
     enum vnc_resize_support_status resize_supported;
+    /* Update flow control */
+    int frame_id; /* Last framebuffer update received from the server */
+    int frame_id_acked; /* Last framebuffer update acknowledged by xrdp */
+    int pending_update_requests; /* Incremental requests not answered */
+    int fence_supported;
+    int cu_supported; /* Server supports ContinuousUpdates */
+    int cu_enabled;
+    int cu_width; /* Area requested for continuous updates */
+    int cu_height;
+    /* Server message parser. See lib_data_in() */
+    enum vnc_parse_state parse_state;
+    unsigned int parse_need; /* Bytes needed to continue, or 0 */
+    unsigned int skip_bytes; /* Bytes left to discard for VPS_SKIP */
+    unsigned int update_rects; /* Rectangles left in this update */
+    enum vnc_resize_status update_status; /* Status when update started */
+    int update_match; /* Resize state machine rect found in update */
+    int update_match_y;
+    struct vnc_screen_layout update_layout;
+    int raw_x; /* Position of next Raw rectangle row */
+    int raw_y;
+    int raw_cx;
+    int raw_rows; /* Raw rectangle rows still to be read */
+    /* Input events waiting for WM_INPUT_BATCH_END */
+    int input_batching;
+    struct stream *input_batch;
 };
 
 /*
@@ -195,7 +249,31 @@ struct vnc
  */
 int
 lib_send_copy(struct vnc *v, struct stream *s);
+
+/**
+ * Checks the buffered server message has enough data to continue
+ *
+ * Server messages are buffered in the transport input stream, and
+ * parsed from the start each time more data arrives. Parsing functions
+ * use this call before reading from the stream. If the data isn't
+ * there yet, the function should return 0 without side effects. It
+ * will be called again when the data has arrived.
+ *
+ * @param v VNC object
+ * @param s Stream containing the message so far
+ * @param bytes Bytes needed after s->p
+ * @return non-zero if the bytes are available
+ */
 int
-skip_trans_bytes(struct trans *trans, unsigned int bytes);
+vnc_have_bytes(struct vnc *v, const struct stream *s, int bytes);
+
+/**
+ * Discards data from the server following the current message
+ *
+ * @param v VNC object
+ * @param bytes Bytes to discard
+ */
+void
+vnc_skip_server_data(struct vnc *v, unsigned int bytes);
 
 #endif /* VNC_H */
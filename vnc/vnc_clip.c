@@ -36,7 +36,6 @@
 #include "ssl_calls.h"
 #include "rfb.h"
 #include "log.h"
-#include "trans.h"
 #include "ms-rdpbcgr.h"
 #include "ms-rdpeclip.h"
 #include "xrdp_constants.h"
@@ -968,91 +967,93 @@ vnc_clip_process_channel_data(struct vnc *v, char *data, int size,
 /******************************************************************************/
 /* clip data from the vnc server */
 int
-vnc_clip_process_rfb_data(struct vnc *v)
+vnc_clip_process_rfb_data(struct vnc *v, struct stream *s)
 {
     struct vnc_clipboard_data *vc = v->vc;
-    struct stream *s;
     int size;
-    int rv;
+    int rv = 0;
 
-    make_stream(s);
-    init_stream(s, 8192);
-    rv = trans_force_read_s(v->trans, s, 7);
+    if (!vnc_have_bytes(v, s, 7))
+    {
+        return 0;
+    }
 
-    if (rv == 0)
+    in_uint8s(s, 3);
+    in_uint32_be(s, size);
+
+    if (v->clip_chanid < 0 || v->server_chansrv_in_use(v))
+    {
+        /* Skip this message */
+        LOG(LOG_LEVEL_DEBUG, "Skipping %d clip bytes from RFB", size);
+        vnc_skip_server_data(v, (unsigned int)size);
+    }
+    else if (size > 0 && !vnc_have_bytes(v, s, size))
+    {
+        /* Wait until we've got all the data */
+    }
+    else
     {
-        in_uint8s(s, 3);
-        in_uint32_be(s, size);
+        struct stream_characteristics old_chars;
+        struct stream_characteristics new_chars;
 
-        if (v->clip_chanid < 0 || v->server_chansrv_in_use(v))
+        /* Compute the characteristics of the existing data */
+        compute_stream_characteristics(vc->rfb_clip_s, &old_chars);
+
+        /* Lose any existing RFB clip data */
+        free_stream(vc->rfb_clip_s);
+        vc->rfb_clip_s = 0;
+
+        make_stream(vc->rfb_clip_s);
+        if (size < 0)
+        {
+            /* This shouldn't happen - see Extended Clipboard
+             * Pseudo-Encoding */
+            LOG(LOG_LEVEL_ERROR, "Unexpected size %d for RFB data", size);
+            rv = 1;
+        }
+        else if (size == 0)
         {
-            /* Skip this message */
-            LOG(LOG_LEVEL_DEBUG, "Skipping %d clip bytes from RFB", size);
-            rv = skip_trans_bytes(v->trans, size);
+            LOG(LOG_LEVEL_DEBUG, "RFB clip data cleared by VNC server");
         }
         else
         {
-            struct stream_characteristics old_chars;
-            struct stream_characteristics new_chars;
-
-            /* Compute the characteristics of the existing data */
-            compute_stream_characteristics(vc->rfb_clip_s, &old_chars);
-
-            /* Lose any existing RFB clip data */
-            free_stream(vc->rfb_clip_s);
-            vc->rfb_clip_s = 0;
-
-            make_stream(vc->rfb_clip_s);
-            if (size < 0)
+            init_stream(vc->rfb_clip_s, size);
+            if (vc->rfb_clip_s->data == NULL)
             {
-                /* This shouldn't happen - see Extended Clipboard
-                 * Pseudo-Encoding */
-                LOG(LOG_LEVEL_ERROR, "Unexpected size %d for RFB data", size);
+                LOG(LOG_LEVEL_ERROR,
+                    "Memory exhausted allocating %d bytes"
+                    " for RFB clip data",
+                    size);
                 rv = 1;
             }
-            else if (size == 0)
-            {
-                LOG(LOG_LEVEL_DEBUG, "RFB clip data cleared by VNC server");
-            }
             else
             {
-                init_stream(vc->rfb_clip_s, size);
-                if (vc->rfb_clip_s->data == NULL)
-                {
-                    LOG(LOG_LEVEL_ERROR,
-                        "Memory exhausted allocating %d bytes"
-                        " for RFB clip data",
-                        size);
-                    rv = 1;
-                }
-                else
-                {
-                    LOG(LOG_LEVEL_DEBUG, "Reading %d clip bytes from RFB",
-                        size);
-                    rv = trans_force_read_s(v->trans, vc->rfb_clip_s, size);
-                }
+                LOG(LOG_LEVEL_DEBUG, "Reading %d clip bytes from RFB",
+                    size);
+                out_uint8a(vc->rfb_clip_s, s->p, size);
+                s_mark_end(vc->rfb_clip_s);
+                vc->rfb_clip_s->p = vc->rfb_clip_s->data;
             }
+        }
 
-            /* Consider telling the RDP client about the update only if we've
-             * completed the startup handshake */
-            if (rv == 0 && vc->startup_complete)
+        /* Consider telling the RDP client about the update only if we've
+         * completed the startup handshake */
+        if (rv == 0 && vc->startup_complete)
+        {
+            /* Has the data actually changed ? */
+            compute_stream_characteristics(vc->rfb_clip_s, &new_chars);
+            if (stream_characteristics_equal(&old_chars, &new_chars))
             {
-                /* Has the data actually changed ? */
-                compute_stream_characteristics(vc->rfb_clip_s, &new_chars);
-                if (stream_characteristics_equal(&old_chars, &new_chars))
-                {
-                    LOG_DEVEL(LOG_LEVEL_INFO, "RFB Clip data is unchanged");
-                }
-                else
-                {
-                    LOG_DEVEL(LOG_LEVEL_INFO, "RFB Clip data is updated");
-                    send_format_list(v);
-                }
+                LOG_DEVEL(LOG_LEVEL_INFO, "RFB Clip data is unchanged");
+            }
+            else
+            {
+                LOG_DEVEL(LOG_LEVEL_INFO, "RFB Clip data is updated");
+                send_format_list(v);
             }
         }
     }
 
-    free_stream(s);
     return rv;
 }
 
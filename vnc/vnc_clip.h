@@ -50,11 +50,16 @@ vnc_clip_process_channel_data(struct vnc *v, char *data, int size,
 /**
  * Process incoming RFB protocol clipboard data
  * @param v VNC Object
+ * @param s Buffered ServerCutText message, positioned after the type
  *
  * @return Non-zero if error occurs
+ *
+ * If the message has not all been buffered yet, zero is returned and
+ * v->parse_need is set. The call should be repeated when the data has
+ * arrived.
  */
 int
-vnc_clip_process_rfb_data(struct vnc *v);
+vnc_clip_process_rfb_data(struct vnc *v, struct stream *s);
 
 /**
  * Open the RDP clipboard channel
@@ -0,0 +1,1125 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libvnc
+ *
+ * Decoders for the ZRLE and Tight encodings.
+ *
+ * ZRLE is documented in RFC6143. The Tight encoding is reserved in
+ * RFC6143, but documented in the RFB community wiki at
+ * https://github.com/rfbproto/rfbroto.
+ *
+ * Both decoders produce a rectangle in the pixel format we sent to
+ * the server in lib_mod_connect(), so the result can be painted in the
+ * same way as a Raw rectangle.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <zlib.h>
+
+#if defined(XRDP_TJPEG)
+#include <turbojpeg.h>
+#endif
+
+#include "arch.h"
+#include "vnc.h"
+#include "vnc_decode.h"
+#include "vnc_shadow.h"
+#include "log.h"
+
+/* Number of zlib streams used by the Tight encoding */
+#define TIGHT_ZLIB_STREAMS 4
+
+/* Tight data smaller than this is always sent uncompressed */
+#define TIGHT_MIN_TO_COMPRESS 12
+
+/* Tight compression types (top 4 bits of the compression control byte) */
+#define TIGHT_FILL 0x08
+#define TIGHT_JPEG 0x09
+#define TIGHT_EXPLICIT_FILTER 0x04
+
+/* Tight filter IDs */
+#define TIGHT_FILTER_COPY 0
+#define TIGHT_FILTER_PALETTE 1
+#define TIGHT_FILTER_GRADIENT 2
+
+#define ZRLE_TILE_SIZE 64
+
+/* Sanity limits for data from the server */
+#define MAX_RECT_PIXELS (8192 * 8192)
+#define MAX_COMPRESSED_LENGTH (64 * 1024 * 1024)
+
+/**
+ * Describes the pixel format we asked the server for
+ */
+struct pixel_format
+{
+    int bytes; /* Bytes per pixel in our decoded output */
+    int cbytes; /* Bytes per ZRLE CPIXEL or Tight TPIXEL */
+    int true_colour;
+    int shift[3]; /* Red, green, blue */
+    int max[3];
+};
+
+/**
+ * Data private to the decoders
+ */
+struct vnc_decoder_data
+{
+    z_stream zrle_zs;
+    int zrle_zs_active;
+    z_stream tight_zs[TIGHT_ZLIB_STREAMS];
+    int tight_zs_active[TIGHT_ZLIB_STREAMS];
+    struct stream *src; /* Buffered server data for the current rect */
+    struct stream *in_s; /* Data read from the server */
+    struct stream *zout_s; /* Inflated data */
+    struct stream *pixel_s; /* Decoded rectangle */
+#if defined(XRDP_TJPEG)
+    tjhandle tj_han;
+    struct stream *jpeg_s; /* RGB output of the JPEG decoder */
+#endif
+};
+
+/*****************************************************************************/
+static void
+get_pixel_format(int bpp, struct pixel_format *pf)
+{
+    g_memset(pf, 0, sizeof(*pf));
+
+    switch (bpp)
+    {
+        case 8:
+            pf->bytes = 1;
+            pf->cbytes = 1;
+            break;
+
+        case 15:
+            pf->bytes = 2;
+            pf->cbytes = 2;
+            pf->true_colour = 1;
+            pf->shift[0] = 10;
+            pf->shift[1] = 5;
+            pf->max[0] = 31;
+            pf->max[1] = 31;
+            pf->max[2] = 31;
+            break;
+
+        case 16:
+            pf->bytes = 2;
+            pf->cbytes = 2;
+            pf->true_colour = 1;
+            pf->shift[0] = 11;
+            pf->shift[1] = 5;
+            pf->max[0] = 31;
+            pf->max[1] = 63;
+            pf->max[2] = 31;
+            break;
+
+        default:
+            /* 24 and 32 bpp are both 32 bits per pixel, depth 24 */
+            pf->bytes = 4;
+            pf->cbytes = 3;
+            pf->true_colour = 1;
+            pf->shift[0] = 16;
+            pf->shift[1] = 8;
+            pf->max[0] = 255;
+            pf->max[1] = 255;
+            pf->max[2] = 255;
+            break;
+    }
+}
+
+/*****************************************************************************/
+/* Writes a pixel in host byte order, as requested from the server */
+static void
+put_pixel(char *dst, int bytes, unsigned int pixel)
+{
+    if (bytes == 1)
+    {
+        dst[0] = (char)pixel;
+    }
+    else if (bytes == 2)
+    {
+#if defined(B_ENDIAN)
+        dst[0] = (char)(pixel >> 8);
+        dst[1] = (char)pixel;
+#else
+        dst[0] = (char)pixel;
+        dst[1] = (char)(pixel >> 8);
+#endif
+    }
+    else
+    {
+#if defined(B_ENDIAN)
+        dst[0] = (char)(pixel >> 24);
+        dst[1] = (char)(pixel >> 16);
+        dst[2] = (char)(pixel >> 8);
+        dst[3] = (char)pixel;
+#else
+        dst[0] = (char)pixel;
+        dst[1] = (char)(pixel >> 8);
+        dst[2] = (char)(pixel >> 16);
+        dst[3] = (char)(pixel >> 24);
+#endif
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Reads a compact pixel (ZRLE CPIXEL or Tight TPIXEL) from the wire
+ *
+ * For 24-bit colour, a CPIXEL contains the three least significant
+ * bytes of the pixel value in the byte order we asked for, whereas a
+ * TPIXEL is always sent in R, G, B order.
+ */
+static unsigned int
+get_wire_pixel(const struct pixel_format *pf, const char *src, int is_tight)
+{
+    const unsigned char *p = (const unsigned char *)src;
+    unsigned int pixel;
+
+    if (pf->cbytes == 1)
+    {
+        pixel = p[0];
+    }
+    else if (pf->cbytes == 2)
+    {
+#if defined(B_ENDIAN)
+        pixel = (p[0] << 8) | p[1];
+#else
+        pixel = p[0] | (p[1] << 8);
+#endif
+    }
+    else if (is_tight)
+    {
+        pixel = (p[0] << pf->shift[0]) | (p[1] << pf->shift[1]) |
+                (p[2] << pf->shift[2]);
+    }
+    else
+    {
+#if defined(B_ENDIAN)
+        pixel = (p[0] << 16) | (p[1] << 8) | p[2];
+#else
+        pixel = p[0] | (p[1] << 8) | (p[2] << 16);
+#endif
+    }
+
+    return pixel;
+}
+
+/*****************************************************************************/
+/**
+ * Copies the next part of the rectangle from the buffered server data
+ *
+ * If the server data hasn't all arrived yet, an error is returned, and
+ * v->parse_need is set. Decoding is restarted from the beginning of
+ * the rectangle when more data is available, so nothing which can't be
+ * repeated must be done before the last call to this function.
+ *
+ * @param v VNC object
+ * @param s Stream to copy the data to
+ * @param len Length of data to copy
+ * @return != 0 for error
+ */
+static int
+read_server_data(struct vnc *v, struct stream *s, int len)
+{
+    struct stream *src = v->vd->src;
+
+    if (!vnc_have_bytes(v, src, len))
+    {
+        return 1;
+    }
+
+    init_stream(s, len);
+    out_uint8a(s, src->p, len);
+    s_mark_end(s);
+    s->p = s->data;
+    in_uint8s(src, len);
+
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Reads a Tight 'compact length' from the server (1 to 3 bytes)
+ */
+static int
+read_compact_length(struct vnc *v, int *len)
+{
+    struct stream *s = v->vd->in_s;
+    int error = 0;
+    int i;
+    int b;
+
+    *len = 0;
+    for (i = 0 ; error == 0 && i < 3 ; ++i)
+    {
+        error = read_server_data(v, s, 1);
+        if (error == 0)
+        {
+            in_uint8(s, b);
+            if (i == 2)
+            {
+                *len |= b << 14;
+            }
+            else
+            {
+                *len |= (b & 0x7f) << (7 * i);
+                if ((b & 0x80) == 0)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    return error;
+}
+
+/*****************************************************************************/
+/**
+ * Reads a length-prefixed block of compressed data into vd->in_s
+ *
+ * @param v VNC object
+ * @param len Length of data to read
+ */
+static int
+read_compressed_data(struct vnc *v, int len)
+{
+    if (len < 0 || len > MAX_COMPRESSED_LENGTH)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC bad compressed data length %d", len);
+        return 1;
+    }
+
+    return read_server_data(v, v->vd->in_s, len);
+}
+
+/*****************************************************************************/
+/**
+ * Inflates all the data in an input stream
+ *
+ * @param zs zlib stream to use, already initialised
+ * @param in Input data
+ * @param out Output stream
+ * @param max_len Maximum length of inflated data
+ * @return != 0 for error
+ *
+ * The server flushes the zlib stream at the end of each rectangle, so
+ * consuming all the input gives us all the output for the rectangle.
+ */
+static int
+inflate_data(z_stream *zs, struct stream *in, struct stream *out, int max_len)
+{
+    int rv;
+
+    init_stream(out, max_len);
+    zs->next_in = (Bytef *)in->data;
+    zs->avail_in = (uInt)(in->end - in->data);
+    zs->next_out = (Bytef *)out->data;
+    zs->avail_out = (uInt)max_len;
+
+    while (zs->avail_in > 0)
+    {
+        rv = inflate(zs, Z_SYNC_FLUSH);
+        if (rv != Z_OK)
+        {
+            if (rv == Z_BUF_ERROR && zs->avail_out == 0)
+            {
+                LOG(LOG_LEVEL_ERROR, "VNC inflated data exceeds %d bytes",
+                    max_len);
+            }
+            else
+            {
+                LOG(LOG_LEVEL_ERROR, "VNC inflate error %d [%s]", rv,
+                    (zs->msg == NULL) ? "" : zs->msg);
+            }
+            return 1;
+        }
+    }
+
+    out->end = out->data + (max_len - zs->avail_out);
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+check_rect_size(int cx, int cy)
+{
+    if (cx < 0 || cy < 0 ||
+            (unsigned int)cx * (unsigned int)cy > MAX_RECT_PIXELS)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC rectangle %dx%d is too large to decode",
+            cx, cy);
+        return 1;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static int
+paint_decoded_rect(struct vnc *v, int x, int y, int cx, int cy)
+{
+    if (cx == 0 || cy == 0)
+    {
+        return 0;
+    }
+    return vnc_shadow_paint_rect(v, x, y, cx, cy, v->vd->pixel_s->data);
+}
+
+/*****************************************************************************/
+/**
+ * Reads a palette of compact pixels from a stream
+ */
+static int
+read_palette(struct stream *s, const struct pixel_format *pf, int is_tight,
+             unsigned int *palette, int count)
+{
+    int i;
+    char *p;
+
+    if (!s_check_rem_and_log(s, count * pf->cbytes, "VNC palette"))
+    {
+        return 1;
+    }
+
+    for (i = 0 ; i < count ; ++i)
+    {
+        in_uint8p(s, p, pf->cbytes);
+        palette[i] = get_wire_pixel(pf, p, is_tight);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Decodes a single ZRLE tile
+ *
+ * @param s Inflated ZRLE data
+ * @param pf Pixel format
+ * @param dst Top-left of tile in output buffer
+ * @param stride Bytes per line of output buffer
+ * @param tw Tile width
+ * @param th Tile height
+ */
+static int
+zrle_decode_tile(struct stream *s, const struct pixel_format *pf,
+                 char *dst, int stride, int tw, int th)
+{
+    unsigned int palette[128];
+    unsigned int pixel;
+    int subencoding;
+    int palette_size;
+    int count = tw * th;
+    int i;
+    int j;
+    int run;
+    int b;
+    char *p;
+
+    if (!s_check_rem_and_log(s, 1, "ZRLE subencoding"))
+    {
+        return 1;
+    }
+    in_uint8(s, subencoding);
+
+    if (subencoding == 0)
+    {
+        /* Raw pixels */
+        if (!s_check_rem_and_log(s, count * pf->cbytes, "ZRLE raw"))
+        {
+            return 1;
+        }
+        for (j = 0 ; j < th ; ++j)
+        {
+            for (i = 0 ; i < tw ; ++i)
+            {
+                in_uint8p(s, p, pf->cbytes);
+                put_pixel(dst + j * stride + i * pf->bytes, pf->bytes,
+                          get_wire_pixel(pf, p, 0));
+            }
+        }
+    }
+    else if (subencoding == 1)
+    {
+        /* Solid tile */
+        if (read_palette(s, pf, 0, palette, 1) != 0)
+        {
+            return 1;
+        }
+        for (j = 0 ; j < th ; ++j)
+        {
+            for (i = 0 ; i < tw ; ++i)
+            {
+                put_pixel(dst + j * stride + i * pf->bytes, pf->bytes,
+                          palette[0]);
+            }
+        }
+    }
+    else if (subencoding <= 16)
+    {
+        /* Packed palette */
+        int bits = (subencoding == 2) ? 1 : (subencoding <= 4) ? 2 : 4;
+        int mask = (1 << bits) - 1;
+        int row_bytes = (tw * bits + 7) / 8;
+
+        palette_size = subencoding;
+        if (read_palette(s, pf, 0, palette, palette_size) != 0 ||
+                !s_check_rem_and_log(s, row_bytes * th, "ZRLE packed"))
+        {
+            return 1;
+        }
+        for (j = 0 ; j < th ; ++j)
+        {
+            const unsigned char *row = (const unsigned char *)s->p;
+            for (i = 0 ; i < tw ; ++i)
+            {
+                int bitpos = i * bits;
+                int index = (row[bitpos / 8] >> (8 - bits - bitpos % 8)) & mask;
+                if (index >= palette_size)
+                {
+                    LOG(LOG_LEVEL_ERROR, "ZRLE bad palette index %d", index);
+                    return 1;
+                }
+                put_pixel(dst + j * stride + i * pf->bytes, pf->bytes,
+                          palette[index]);
+            }
+            in_uint8s(s, row_bytes);
+        }
+    }
+    else if (subencoding == 128 || subencoding >= 130)
+    {
+        /* Plain RLE or palette RLE */
+        palette_size = (subencoding == 128) ? 0 : subencoding - 128;
+        if (read_palette(s, pf, 0, palette, palette_size) != 0)
+        {
+            return 1;
+        }
+
+        i = 0;
+        while (i < count)
+        {
+            run = 1;
+            if (palette_size == 0)
+            {
+                if (!s_check_rem_and_log(s, pf->cbytes + 1, "ZRLE RLE"))
+                {
+                    return 1;
+                }
+                in_uint8p(s, p, pf->cbytes);
+                pixel = get_wire_pixel(pf, p, 0);
+                b = 255;
+            }
+            else
+            {
+                if (!s_check_rem_and_log(s, 1, "ZRLE palette RLE"))
+                {
+                    return 1;
+                }
+                in_uint8(s, b);
+                if ((b & 0x7f) >= palette_size)
+                {
+                    LOG(LOG_LEVEL_ERROR, "ZRLE bad palette index %d", b & 0x7f);
+                    return 1;
+                }
+                pixel = palette[b & 0x7f];
+                /* Top bit set means a run length follows */
+                b = (b & 0x80) ? 255 : 0;
+            }
+
+            while (b == 255)
+            {
+                if (!s_check_rem_and_log(s, 1, "ZRLE run length"))
+                {
+                    return 1;
+                }
+                in_uint8(s, b);
+                run += b;
+            }
+
+            if (run > count - i)
+            {
+                LOG(LOG_LEVEL_ERROR, "ZRLE run length overflows tile");
+                return 1;
+            }
+
+            while (run-- > 0)
+            {
+                put_pixel(dst + (i / tw) * stride + (i % tw) * pf->bytes,
+                          pf->bytes, pixel);
+                ++i;
+            }
+        }
+    }
+    else
+    {
+        LOG(LOG_LEVEL_ERROR, "ZRLE unsupported subencoding %d", subencoding);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+int
+vnc_decode_zrle(struct vnc *v, struct stream *s,
+                int x, int y, int cx, int cy, int paint)
+{
+    struct vnc_decoder_data *vd = v->vd;
+    struct pixel_format pf;
+    int error;
+    int len = 0;
+    int max_len;
+    int stride;
+    int tx;
+    int ty;
+
+    get_pixel_format(v->server_bpp, &pf);
+    vd->src = s;
+    error = check_rect_size(cx, cy);
+
+    if (error == 0)
+    {
+        error = read_server_data(v, vd->in_s, 4);
+    }
+
+    if (error == 0)
+    {
+        in_uint32_be(vd->in_s, len);
+        error = read_compressed_data(v, len);
+    }
+
+    if (error == 0 && !vd->zrle_zs_active)
+    {
+        if (inflateInit(&vd->zrle_zs) != Z_OK)
+        {
+            LOG(LOG_LEVEL_ERROR, "VNC can't initialise ZRLE zlib stream");
+            error = 1;
+        }
+        else
+        {
+            vd->zrle_zs_active = 1;
+        }
+    }
+
+    if (error == 0)
+    {
+        /* Worst case is a palette RLE tile with a run of 1 per pixel */
+        int tiles = ((cx + ZRLE_TILE_SIZE - 1) / ZRLE_TILE_SIZE) *
+                    ((cy + ZRLE_TILE_SIZE - 1) / ZRLE_TILE_SIZE);
+        max_len = tiles * (1 + 127 * pf.cbytes) + cx * cy * (pf.cbytes + 1);
+        error = inflate_data(&vd->zrle_zs, vd->in_s, vd->zout_s, max_len);
+    }
+
+    if (error == 0)
+    {
+        stride = cx * pf.bytes;
+        init_stream(vd->pixel_s, stride * cy);
+        for (ty = 0 ; error == 0 && ty < cy ; ty += ZRLE_TILE_SIZE)
+        {
+            int th = MIN(ZRLE_TILE_SIZE, cy - ty);
+            for (tx = 0 ; error == 0 && tx < cx ; tx += ZRLE_TILE_SIZE)
+            {
+                int tw = MIN(ZRLE_TILE_SIZE, cx - tx);
+                error = zrle_decode_tile(vd->zout_s, &pf,
+                                         vd->pixel_s->data +
+                                         ty * stride + tx * pf.bytes,
+                                         stride, tw, th);
+            }
+        }
+    }
+
+    if (error == 0 && paint)
+    {
+        error = paint_decoded_rect(v, x, y, cx, cy);
+    }
+
+    vd->src = NULL;
+    /* If we're waiting for more data, we'll be called again */
+    return (v->parse_need != 0) ? 0 : error;
+}
+
+/*****************************************************************************/
+static int
+tight_fill(struct vnc *v, const struct pixel_format *pf, int cx, int cy)
+{
+    struct vnc_decoder_data *vd = v->vd;
+    unsigned int pixel;
+    char *dst;
+    int count;
+    int error;
+
+    error = read_server_data(v, vd->in_s, pf->cbytes);
+    if (error == 0)
+    {
+        pixel = get_wire_pixel(pf, vd->in_s->data, 1);
+        dst = vd->pixel_s->data;
+        for (count = cx * cy ; count > 0 ; --count)
+        {
+            put_pixel(dst, pf->bytes, pixel);
+            dst += pf->bytes;
+        }
+    }
+
+    return error;
+}
+
+/*****************************************************************************/
+static int
+tight_jpeg(struct vnc *v, const struct pixel_format *pf, int cx, int cy)
+{
+#if defined(XRDP_TJPEG)
+    struct vnc_decoder_data *vd = v->vd;
+    unsigned char *src;
+    char *dst;
+    int len;
+    int width;
+    int height;
+    int subsamp;
+    int count;
+    int error;
+
+    if (!pf->true_colour)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC Tight JPEG needs a true colour format");
+        return 1;
+    }
+
+    error = read_compact_length(v, &len);
+    if (error == 0)
+    {
+        error = read_compressed_data(v, len);
+    }
+
+    if (error == 0)
+    {
+        if (tjDecompressHeader2(vd->tj_han, (unsigned char *)vd->in_s->data,
+                                len, &width, &height, &subsamp) != 0 ||
+                width != cx || height != cy)
+        {
+            LOG(LOG_LEVEL_ERROR, "VNC bad Tight JPEG header for %dx%d rect",
+                cx, cy);
+            error = 1;
+        }
+    }
+
+    if (error == 0)
+    {
+        init_stream(vd->jpeg_s, cx * cy * 3);
+        if (tjDecompress2(vd->tj_han, (unsigned char *)vd->in_s->data, len,
+                          (unsigned char *)vd->jpeg_s->data,
+                          cx, cx * 3, cy, TJPF_RGB, 0) != 0)
+        {
+            LOG(LOG_LEVEL_ERROR, "VNC Tight JPEG decode failed [%s]",
+                tjGetErrorStr());
+            error = 1;
+        }
+    }
+
+    if (error == 0)
+    {
+        src = (unsigned char *)vd->jpeg_s->data;
+        dst = vd->pixel_s->data;
+        for (count = cx * cy ; count > 0 ; --count)
+        {
+            put_pixel(dst, pf->bytes,
+                      ((src[0] * pf->max[0] / 255) << pf->shift[0]) |
+                      ((src[1] * pf->max[1] / 255) << pf->shift[1]) |
+                      ((src[2] * pf->max[2] / 255) << pf->shift[2]));
+            src += 3;
+            dst += pf->bytes;
+        }
+    }
+
+    return error;
+#else
+    LOG(LOG_LEVEL_ERROR, "VNC Tight JPEG rectangle received, but JPEG "
+        "support is not compiled in");
+    return 1;
+#endif
+}
+
+/*****************************************************************************/
+/**
+ * Applies the Tight gradient filter to a block of true colour data
+ */
+static int
+tight_gradient(struct stream *s, const struct pixel_format *pf,
+               char *dst, int cx, int cy)
+{
+    int *prev_row;
+    int *this_row;
+    int *tmp;
+    unsigned int pixel;
+    int i;
+    int j;
+    int c;
+    int est;
+    char *p;
+
+    prev_row = (int *)g_malloc(cx * 3 * sizeof(int), 1);
+    this_row = (int *)g_malloc(cx * 3 * sizeof(int), 1);
+    if (prev_row == NULL || this_row == NULL)
+    {
+        g_free(prev_row);
+        g_free(this_row);
+        return 1;
+    }
+
+    for (j = 0 ; j < cy ; ++j)
+    {
+        for (i = 0 ; i < cx ; ++i)
+        {
+            in_uint8p(s, p, pf->cbytes);
+            pixel = get_wire_pixel(pf, p, 1);
+            for (c = 0 ; c < 3 ; ++c)
+            {
+                /* Predict from left + above - above-left */
+                est = prev_row[i * 3 + c];
+                if (i > 0)
+                {
+                    est += this_row[(i - 1) * 3 + c] -
+                           prev_row[(i - 1) * 3 + c];
+                }
+                est = MAX(0, MIN(est, pf->max[c]));
+                this_row[i * 3 + c] =
+                    (est + (int)(pixel >> pf->shift[c])) & pf->max[c];
+            }
+            put_pixel(dst, pf->bytes,
+                      (this_row[i * 3] << pf->shift[0]) |
+                      (this_row[i * 3 + 1] << pf->shift[1]) |
+                      (this_row[i * 3 + 2] << pf->shift[2]));
+            dst += pf->bytes;
+        }
+        tmp = prev_row;
+        prev_row = this_row;
+        this_row = tmp;
+    }
+
+    g_free(prev_row);
+    g_free(this_row);
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Decodes a Tight rectangle using 'basic' compression
+ *
+ * @param v VNC object
+ * @param pf Pixel format
+ * @param comp Compression type from the compression control byte
+ * @param cx Rectangle width
+ * @param cy Rectangle height
+ */
+static int
+tight_basic(struct vnc *v, const struct pixel_format *pf, int comp,
+            int cx, int cy)
+{
+    struct vnc_decoder_data *vd = v->vd;
+    unsigned int palette[256];
+    int stream_id = comp & 0x03;
+    int filter = TIGHT_FILTER_COPY;
+    int num_colours = 0;
+    int row_size;
+    int data_size;
+    int len;
+    int error;
+    struct stream *s;
+    char *dst;
+    int i;
+    int j;
+
+    error = 0;
+    if (comp & TIGHT_EXPLICIT_FILTER)
+    {
+        error = read_server_data(v, vd->in_s, 1);
+        if (error == 0)
+        {
+            in_uint8(vd->in_s, filter);
+        }
+    }
+
+    if (error != 0)
+    {
+        return error;
+    }
+
+    switch (filter)
+    {
+        case TIGHT_FILTER_COPY:
+            row_size = cx * pf->cbytes;
+            break;
+
+        case TIGHT_FILTER_PALETTE:
+            error = read_server_data(v, vd->in_s, 1);
+            if (error == 0)
+            {
+                in_uint8(vd->in_s, num_colours);
+                ++num_colours;
+                error = read_server_data(v, vd->in_s,
+                                         num_colours * pf->cbytes);
+            }
+            if (error == 0)
+            {
+                error = read_palette(vd->in_s, pf, 1, palette, num_colours);
+            }
+            row_size = (num_colours == 2) ? (cx + 7) / 8 : cx;
+            break;
+
+        case TIGHT_FILTER_GRADIENT:
+            if (!pf->true_colour)
+            {
+                LOG(LOG_LEVEL_ERROR,
+                    "VNC Tight gradient filter needs a true colour format");
+                error = 1;
+            }
+            row_size = cx * pf->cbytes;
+            break;
+
+        default:
+            LOG(LOG_LEVEL_ERROR, "VNC unsupported Tight filter %d", filter);
+            return 1;
+    }
+
+    if (error != 0)
+    {
+        return error;
+    }
+
+    /* Get the filtered data, which may or may not be compressed */
+    data_size = row_size * cy;
+    if (data_size < TIGHT_MIN_TO_COMPRESS)
+    {
+        error = read_server_data(v, vd->in_s, data_size);
+        s = vd->in_s;
+    }
+    else
+    {
+        error = read_compact_length(v, &len);
+        if (error == 0)
+        {
+            error = read_compressed_data(v, len);
+        }
+
+        if (error == 0 && !vd->tight_zs_active[stream_id])
+        {
+            if (inflateInit(&vd->tight_zs[stream_id]) != Z_OK)
+            {
+                LOG(LOG_LEVEL_ERROR, "VNC can't initialise Tight zlib stream");
+                error = 1;
+            }
+            else
+            {
+                vd->tight_zs_active[stream_id] = 1;
+            }
+        }
+
+        if (error == 0)
+        {
+            error = inflate_data(&vd->tight_zs[stream_id], vd->in_s,
+                                 vd->zout_s, data_size);
+        }
+        s = vd->zout_s;
+    }
+
+    if (error == 0 && !s_check_rem_and_log(s, data_size, "VNC Tight data"))
+    {
+        error = 1;
+    }
+
+    if (error != 0)
+    {
+        return error;
+    }
+
+    /* Now apply the filter */
+    dst = vd->pixel_s->data;
+    if (filter == TIGHT_FILTER_GRADIENT)
+    {
+        error = tight_gradient(s, pf, dst, cx, cy);
+    }
+    else if (filter == TIGHT_FILTER_PALETTE)
+    {
+        for (j = 0 ; j < cy ; ++j)
+        {
+            const unsigned char *row = (const unsigned char *)s->p;
+            for (i = 0 ; i < cx ; ++i)
+            {
+                int index;
+                if (num_colours == 2)
+                {
+                    index = (row[i / 8] >> (7 - i % 8)) & 1;
+                }
+                else
+                {
+                    index = row[i];
+                }
+                if (index >= num_colours)
+                {
+                    LOG(LOG_LEVEL_ERROR, "VNC bad Tight palette index %d",
+                        index);
+                    return 1;
+                }
+                put_pixel(dst, pf->bytes, palette[index]);
+                dst += pf->bytes;
+            }
+            in_uint8s(s, row_size);
+        }
+    }
+    else
+    {
+        char *p;
+        for (i = cx * cy ; i > 0 ; --i)
+        {
+            in_uint8p(s, p, pf->cbytes);
+            put_pixel(dst, pf->bytes, get_wire_pixel(pf, p, 1));
+            dst += pf->bytes;
+        }
+    }
+
+    return error;
+}
+
+/*****************************************************************************/
+int
+vnc_decode_tight(struct vnc *v, struct stream *s,
+                 int x, int y, int cx, int cy, int paint)
+{
+    struct vnc_decoder_data *vd = v->vd;
+    struct pixel_format pf;
+    int error;
+    int ctl = 0;
+    int comp;
+    int i;
+
+    get_pixel_format(v->server_bpp, &pf);
+    vd->src = s;
+    error = check_rect_size(cx, cy);
+
+    if (error == 0)
+    {
+        error = read_server_data(v, vd->in_s, 1);
+    }
+
+    if (error == 0)
+    {
+        in_uint8(vd->in_s, ctl);
+
+        /* Bottom four bits tell us which zlib streams to reset */
+        for (i = 0 ; i < TIGHT_ZLIB_STREAMS ; ++i)
+        {
+            if ((ctl & (1 << i)) != 0 && vd->tight_zs_active[i])
+            {
+                inflateEnd(&vd->tight_zs[i]);
+                vd->tight_zs_active[i] = 0;
+            }
+        }
+
+        init_stream(vd->pixel_s, cx * cy * pf.bytes);
+        comp = ctl >> 4;
+        if (comp == TIGHT_FILL)
+        {
+            error = tight_fill(v, &pf, cx, cy);
+        }
+        else if (comp == TIGHT_JPEG)
+        {
+            error = tight_jpeg(v, &pf, cx, cy);
+        }
+        else if (comp > TIGHT_JPEG)
+        {
+            LOG(LOG_LEVEL_ERROR, "VNC unsupported Tight compression %d", comp);
+            error = 1;
+        }
+        else
+        {
+            error = tight_basic(v, &pf, comp, cx, cy);
+        }
+    }
+
+    if (error == 0 && paint)
+    {
+        error = paint_decoded_rect(v, x, y, cx, cy);
+    }
+
+    vd->src = NULL;
+    /* If we're waiting for more data, we'll be called again */
+    return (v->parse_need != 0) ? 0 : error;
+}
+
+/*****************************************************************************/
+int
+vnc_decode_jpeg_supported(void)
+{
+#if defined(XRDP_TJPEG)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*****************************************************************************/
+void
+vnc_decode_init(struct vnc *v)
+{
+    v->vd = (struct vnc_decoder_data *)g_malloc(sizeof(*v->vd), 1);
+    make_stream(v->vd->in_s);
+    make_stream(v->vd->zout_s);
+    make_stream(v->vd->pixel_s);
+#if defined(XRDP_TJPEG)
+    v->vd->tj_han = tjInitDecompress();
+    make_stream(v->vd->jpeg_s);
+#endif
+}
+
+/*****************************************************************************/
+void
+vnc_decode_exit(struct vnc *v)
+{
+    int i;
+
+    if (v != NULL && v->vd != NULL)
+    {
+        if (v->vd->zrle_zs_active)
+        {
+            inflateEnd(&v->vd->zrle_zs);
+        }
+        for (i = 0 ; i < TIGHT_ZLIB_STREAMS ; ++i)
+        {
+            if (v->vd->tight_zs_active[i])
+            {
+                inflateEnd(&v->vd->tight_zs[i]);
+            }
+        }
+        free_stream(v->vd->in_s);
+        free_stream(v->vd->zout_s);
+        free_stream(v->vd->pixel_s);
+#if defined(XRDP_TJPEG)
+        if (v->vd->tj_han != NULL)
+        {
+            tjDestroy(v->vd->tj_han);
+        }
+        free_stream(v->vd->jpeg_s);
+#endif
+        g_free(v->vd);
+        v->vd = NULL;
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libvnc - decoders for the zlib-based RFB encodings (ZRLE and Tight)
+ */
+
+#ifndef VNC_DECODE_H
+#define VNC_DECODE_H
+
+struct stream;
+struct vnc;
+
+/**
+ * Init the decoder private data structures
+ */
+void
+vnc_decode_init(struct vnc *v);
+
+/**
+ * Deallocate the decoder private data structures
+ */
+void
+vnc_decode_exit(struct vnc *v);
+
+/**
+ * Returns non-zero if Tight JPEG rectangles can be decoded
+ */
+int
+vnc_decode_jpeg_supported(void);
+
+/**
+ * Reads and decodes a ZRLE rectangle from the VNC server
+ *
+ * @param v VNC Object
+ * @param s Buffered server data
+ * @param x Rectangle X value
+ * @param y Rectangle Y value
+ * @param cx Rectangle CX value
+ * @param cy Rectangle CY value
+ * @param paint If zero, the rectangle is decoded to keep the zlib
+ *              stream in step with the server, but not painted
+ * @return Non-zero if error occurs
+ *
+ * @pre On entry s is positioned after the rectangle header
+ *
+ * If the whole rectangle has not been buffered yet, zero is returned
+ * and v->parse_need is set. The call should be repeated when the data
+ * has arrived.
+ */
+int
+vnc_decode_zrle(struct vnc *v, struct stream *s,
+                int x, int y, int cx, int cy, int paint);
+
+/**
+ * Reads and decodes a Tight rectangle from the VNC server
+ *
+ * @param v VNC Object
+ * @param s Buffered server data
+ * @param x Rectangle X value
+ * @param y Rectangle Y value
+ * @param cx Rectangle CX value
+ * @param cy Rectangle CY value
+ * @param paint If zero, the rectangle is decoded to keep the zlib
+ *              streams in step with the server, but not painted
+ * @return Non-zero if error occurs
+ *
+ * @pre On entry s is positioned after the rectangle header
+ *
+ * If the whole rectangle has not been buffered yet, zero is returned
+ * and v->parse_need is set. The call should be repeated when the data
+ * has arrived.
+ */
+int
+vnc_decode_tight(struct vnc *v, struct stream *s,
+                 int x, int y, int cx, int cy, int paint);
+
+#endif /* VNC_DECODE_H */
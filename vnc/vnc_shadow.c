@@ -0,0 +1,584 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libvnc
+ *
+ * Shadow framebuffer for the xrdp encoder.
+ *
+ * Normally, rectangles from the VNC server are painted one at a time with
+ * server_paint_rect(). For a GFX client this means the xrdp painter
+ * sends planar-compressed updates from the main thread.
+ *
+ * When the client has negotiated H.264 over GFX, rectangles are instead
+ * drawn into a shadow copy of the server framebuffer, and the damage is
+ * accumulated. At the end of each framebuffer update, the damaged areas
+ * are converted to NV12 and handed to the xrdp encoder thread with
+ * server_egfx_cmd(), in the same way as xorgxrdp output arrives via xup.
+ * The frame is acknowledged by xrdp with mod_frame_ack(), which paces
+ * our update requests.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include "arch.h"
+#include "vnc.h"
+#include "vnc_shadow.h"
+#include "log.h"
+#include "parse.h"
+#include "xrdp_client_info.h"
+
+/* Values from [MS-RDPEGFX]. These must agree with xrdp/xrdp_egfx.h */
+#define RDPGFX_CMDID_WIRETOSURFACE_1 0x0001
+#define RDPGFX_CMDID_STARTFRAME 0x000B
+#define RDPGFX_CMDID_ENDFRAME 0x000C
+#define RDPGFX_CODECID_AVC420 0x000B
+#define GFX_PIXEL_FORMAT_XRGB_8888 0x20
+
+/* Size of the header at the start of a command passed to
+ * server_egfx_cmd() */
+#define EGFX_CMD_HEADER_SIZE 8
+
+/* Damage is tracked as a short list of rectangles. If the list fills,
+ * it is collapsed into its bounding box */
+#define MAX_DAMAGE_RECTS 64
+
+/**
+ * Rectangle with exclusive right and bottom edges
+ */
+struct shadow_rect
+{
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+};
+
+struct vnc_shadow
+{
+    unsigned int *data; /* XRGB pixels */
+    int width;
+    int height;
+    unsigned int num_damage;
+    struct shadow_rect damage[MAX_DAMAGE_RECTS];
+};
+
+/*****************************************************************************/
+void
+vnc_shadow_init(struct vnc *v)
+{
+    v->shadow = g_new0(struct vnc_shadow, 1);
+}
+
+/*****************************************************************************/
+void
+vnc_shadow_exit(struct vnc *v)
+{
+    if (v != NULL && v->shadow != NULL)
+    {
+        g_free(v->shadow->data);
+        g_free(v->shadow);
+        v->shadow = NULL;
+    }
+}
+
+/*****************************************************************************/
+int
+vnc_shadow_in_use(const struct vnc *v)
+{
+    const struct xrdp_client_info *ci = v->client_info;
+
+    return v->shadow != NULL &&
+           ci != NULL &&
+           ci->gfx &&
+           ci->capture_code == CC_GFX_A2 &&
+           (v->server_bpp == 24 || v->server_bpp == 32);
+}
+
+/*****************************************************************************/
+/**
+ * Makes sure the shadow framebuffer matches the server framebuffer size
+ *
+ * @return != 0 for error
+ */
+static int
+check_shadow_size(struct vnc *v)
+{
+    struct vnc_shadow *sh = v->shadow;
+    int width = v->server_layout.total_width;
+    int height = v->server_layout.total_height;
+
+    if (sh->data != NULL && sh->width == width && sh->height == height)
+    {
+        return 0;
+    }
+
+    g_free(sh->data);
+    sh->data = NULL;
+    sh->width = 0;
+    sh->height = 0;
+    sh->num_damage = 0;
+
+    if (width <= 0 || height <= 0)
+    {
+        return 0;
+    }
+
+    sh->data = g_new0(unsigned int, (size_t)width * height);
+    if (sh->data == NULL)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC: Can't allocate %dx%d shadow framebuffer",
+            width, height);
+        return 1;
+    }
+    sh->width = width;
+    sh->height = height;
+    LOG(LOG_LEVEL_INFO, "VNC: using %dx%d shadow framebuffer for the "
+        "H.264 encoder", width, height);
+    return 0;
+}
+
+/*****************************************************************************/
+/**
+ * Clips a rectangle to a width and height
+ *
+ * @return != 0 if anything is left of the rectangle
+ */
+static int
+clip_rect(struct shadow_rect *r, int width, int height)
+{
+    r->x1 = MAX(r->x1, 0);
+    r->y1 = MAX(r->y1, 0);
+    r->x2 = MIN(r->x2, width);
+    r->y2 = MIN(r->y2, height);
+    return r->x1 < r->x2 && r->y1 < r->y2;
+}
+
+/*****************************************************************************/
+static void
+add_damage(struct vnc_shadow *sh, const struct shadow_rect *r)
+{
+    unsigned int i;
+    struct shadow_rect *d;
+
+    for (i = 0; i < sh->num_damage; ++i)
+    {
+        d = &sh->damage[i];
+        if (r->x1 >= d->x1 && r->y1 >= d->y1 &&
+                r->x2 <= d->x2 && r->y2 <= d->y2)
+        {
+            /* Already covered */
+            return;
+        }
+    }
+
+    if (sh->num_damage == MAX_DAMAGE_RECTS)
+    {
+        d = &sh->damage[0];
+        for (i = 1; i < sh->num_damage; ++i)
+        {
+            d->x1 = MIN(d->x1, sh->damage[i].x1);
+            d->y1 = MIN(d->y1, sh->damage[i].y1);
+            d->x2 = MAX(d->x2, sh->damage[i].x2);
+            d->y2 = MAX(d->y2, sh->damage[i].y2);
+        }
+        sh->num_damage = 1;
+    }
+
+    sh->damage[sh->num_damage++] = *r;
+}
+
+/*****************************************************************************/
+int
+vnc_shadow_paint_rect(struct vnc *v, int x, int y, int cx, int cy,
+                      char *data)
+{
+    struct vnc_shadow *sh = v->shadow;
+    struct shadow_rect r;
+    const char *src;
+    unsigned int *dst;
+    int src_stride;
+    int row;
+
+    if (!vnc_shadow_in_use(v))
+    {
+        return v->server_paint_rect(v, x, y, cx, cy, data, cx, cy, 0, 0);
+    }
+
+    if (check_shadow_size(v) != 0)
+    {
+        return 1;
+    }
+
+    r.x1 = x;
+    r.y1 = y;
+    r.x2 = x + cx;
+    r.y2 = y + cy;
+    if (!clip_rect(&r, sh->width, sh->height))
+    {
+        return 0;
+    }
+
+    /* Pixels are 32-bit host order, as negotiated in lib_mod_connect() */
+    src_stride = cx * 4;
+    src = data + (r.y1 - y) * src_stride + (r.x1 - x) * 4;
+    dst = sh->data + r.y1 * sh->width + r.x1;
+    for (row = r.y1; row < r.y2; ++row)
+    {
+        g_memcpy(dst, src, (r.x2 - r.x1) * 4);
+        src += src_stride;
+        dst += sh->width;
+    }
+
+    add_damage(sh, &r);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+vnc_shadow_screen_blt(struct vnc *v, int x, int y, int cx, int cy,
+                      int srcx, int srcy)
+{
+    struct vnc_shadow *sh = v->shadow;
+    struct shadow_rect r;
+    const unsigned int *src;
+    unsigned int *dst;
+    int dx;
+    int dy;
+    int row;
+    int bytes;
+
+    if (!vnc_shadow_in_use(v))
+    {
+        return v->server_screen_blt(v, x, y, cx, cy, srcx, srcy);
+    }
+
+    if (check_shadow_size(v) != 0)
+    {
+        return 1;
+    }
+
+    /* Clip the destination against both the destination and the source
+     * areas of the framebuffer */
+    dx = x - srcx;
+    dy = y - srcy;
+    r.x1 = x;
+    r.y1 = y;
+    r.x2 = x + cx;
+    r.y2 = y + cy;
+    if (!clip_rect(&r, sh->width, sh->height))
+    {
+        return 0;
+    }
+    r.x1 = MAX(r.x1, dx);
+    r.y1 = MAX(r.y1, dy);
+    r.x2 = MIN(r.x2, sh->width + dx);
+    r.y2 = MIN(r.y2, sh->height + dy);
+    if (r.x1 >= r.x2 || r.y1 >= r.y2)
+    {
+        return 0;
+    }
+
+    bytes = (r.x2 - r.x1) * 4;
+    if (dy > 0)
+    {
+        /* Moving down - copy from the bottom up */
+        for (row = r.y2 - 1; row >= r.y1; --row)
+        {
+            dst = sh->data + row * sh->width + r.x1;
+            src = sh->data + (row - dy) * sh->width + (r.x1 - dx);
+            g_memmove(dst, src, bytes);
+        }
+    }
+    else
+    {
+        for (row = r.y1; row < r.y2; ++row)
+        {
+            dst = sh->data + row * sh->width + r.x1;
+            src = sh->data + (row - dy) * sh->width + (r.x1 - dx);
+            g_memmove(dst, src, bytes);
+        }
+    }
+
+    add_damage(sh, &r);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+vnc_shadow_has_damage(const struct vnc *v)
+{
+    return vnc_shadow_in_use(v) && v->shadow->num_damage > 0;
+}
+
+/*****************************************************************************/
+/**
+ * Converts an area of the shadow framebuffer to NV12, BT.709 full range
+ *
+ * This is the format the encoder expects for CC_GFX_A2 captures.
+ *
+ * @param sh Shadow framebuffer
+ * @param left Left of the surface in the shadow framebuffer
+ * @param top Top of the surface in the shadow framebuffer
+ * @param width Width of the surface (this is also the NV12 stride)
+ * @param height Height of the surface
+ * @param r Area to convert, relative to the surface. Must start on an
+ *          even pixel.
+ * @param nv12 NV12 image for the whole surface
+ */
+static void
+shadow_to_nv12(const struct vnc_shadow *sh, int left, int top,
+               int width, int height, const struct shadow_rect *r,
+               unsigned char *nv12)
+{
+    unsigned char *uv_plane = nv12 + width * height;
+    unsigned int pixel;
+    int x;
+    int y;
+    int i;
+    int sx;
+    int sy;
+    int red;
+    int green;
+    int blue;
+    int sum_r;
+    int sum_g;
+    int sum_b;
+    int u;
+    int v;
+    unsigned char *uv;
+
+    for (y = r->y1; y < r->y2; y += 2)
+    {
+        for (x = r->x1; x < r->x2; x += 2)
+        {
+            sum_r = 0;
+            sum_g = 0;
+            sum_b = 0;
+            /* Visit the 2x2 block. Pixels outside the shadow framebuffer
+             * are replaced by the nearest edge pixel */
+            for (i = 0; i < 4; ++i)
+            {
+                sx = MIN(left + x + (i & 1), sh->width - 1);
+                sy = MIN(top + y + (i >> 1), sh->height - 1);
+                pixel = sh->data[sy * sh->width + sx];
+                red = (pixel >> 16) & 0xff;
+                green = (pixel >> 8) & 0xff;
+                blue = pixel & 0xff;
+                sum_r += red;
+                sum_g += green;
+                sum_b += blue;
+                if (x + (i & 1) < r->x2 && y + (i >> 1) < r->y2)
+                {
+                    nv12[(y + (i >> 1)) * width + x + (i & 1)] =
+                        (54 * red + 183 * green + 19 * blue + 128) >> 8;
+                }
+            }
+            u = ((-29 * sum_r - 99 * sum_g + 128 * sum_b + 512) >> 10) + 128;
+            v = ((128 * sum_r - 116 * sum_g - 12 * sum_b + 512) >> 10) + 128;
+            uv = uv_plane + (y / 2) * width + x;
+            uv[0] = MAX(0, MIN(255, u));
+            if (x + 1 < width)
+            {
+                uv[1] = MAX(0, MIN(255, v));
+            }
+        }
+    }
+}
+
+/*****************************************************************************/
+/**
+ * Starts an EGFX command in a stream
+ */
+static void
+start_egfx_cmd(struct stream *s, int cmd_id)
+{
+    init_stream(s, 0);
+    out_uint16_le(s, cmd_id);
+    out_uint16_le(s, 0); /* flags */
+    s_push_layer(s, iso_hdr, 4); /* cmd_bytes, set later */
+}
+
+/*****************************************************************************/
+/**
+ * Finishes an EGFX command in a stream and passes it to xrdp
+ *
+ * Ownership of any data passes to xrdp, even if an error is returned.
+ */
+static int
+send_egfx_cmd(struct vnc *v, struct stream *s, char *data, int data_bytes)
+{
+    int cmd_bytes;
+
+    s_mark_end(s);
+    cmd_bytes = (int)(s->end - s->data);
+    s_pop_layer(s, iso_hdr);
+    out_uint32_le(s, cmd_bytes);
+    return v->server_egfx_cmd(v, s->data, cmd_bytes, data, data_bytes);
+}
+
+/*****************************************************************************/
+/**
+ * Sends the damaged parts of one monitor surface to the encoder
+ *
+ * @param v VNC object
+ * @param s Stream for the command
+ * @param surface_id Surface (and monitor index)
+ * @param mon Surface position in the framebuffer
+ * @return != 0 for error
+ */
+static int
+send_surface(struct vnc *v, struct stream *s, int surface_id,
+             const struct monitor_info *mon)
+{
+    struct vnc_shadow *sh = v->shadow;
+    struct shadow_rect rects[MAX_DAMAGE_RECTS];
+    struct shadow_rect *r;
+    unsigned int num_rects = 0;
+    unsigned int i;
+    int width = mon->right - mon->left + 1;
+    int height = mon->bottom - mon->top + 1;
+    size_t data_bytes;
+    void *data;
+
+    if (width <= 0 || height <= 0)
+    {
+        return 0;
+    }
+
+    /* Make the damage relative to the surface, and align it to the NV12
+     * chroma blocks */
+    for (i = 0; i < sh->num_damage; ++i)
+    {
+        r = &rects[num_rects];
+        r->x1 = (sh->damage[i].x1 - mon->left) & ~1;
+        r->y1 = (sh->damage[i].y1 - mon->top) & ~1;
+        r->x2 = (sh->damage[i].x2 - mon->left + 1) & ~1;
+        r->y2 = (sh->damage[i].y2 - mon->top + 1) & ~1;
+        if (clip_rect(r, width, height))
+        {
+            ++num_rects;
+        }
+    }
+
+    if (num_rects == 0)
+    {
+        return 0;
+    }
+
+    /* Y plane, then interleaved UV plane. The extra row is slack for
+     * odd surface heights */
+    data_bytes = (size_t)width * (height + height / 2 + 2);
+    if (g_anon_map(data_bytes, &data) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "VNC: Can't map %u bytes for a frame",
+            (unsigned int)data_bytes);
+        return 1;
+    }
+
+    for (i = 0; i < num_rects; ++i)
+    {
+        shadow_to_nv12(sh, mon->left, mon->top, width, height,
+                       &rects[i], (unsigned char *)data);
+    }
+
+    start_egfx_cmd(s, RDPGFX_CMDID_WIRETOSURFACE_1);
+    out_uint16_le(s, surface_id);
+    out_uint16_le(s, RDPGFX_CODECID_AVC420);
+    out_uint8(s, GFX_PIXEL_FORMAT_XRGB_8888);
+    out_uint32_le(s, (unsigned int)surface_id << 28); /* monitor index */
+    /* Damage rects, then rects to copy from the data. These are the
+     * same for us */
+    out_uint16_le(s, num_rects);
+    for (i = 0; i < num_rects; ++i)
+    {
+        out_uint16_le(s, rects[i].x1);
+        out_uint16_le(s, rects[i].y1);
+        out_uint16_le(s, rects[i].x2 - rects[i].x1);
+        out_uint16_le(s, rects[i].y2 - rects[i].y1);
+    }
+    out_uint16_le(s, num_rects);
+    for (i = 0; i < num_rects; ++i)
+    {
+        out_uint16_le(s, rects[i].x1);
+        out_uint16_le(s, rects[i].y1);
+        out_uint16_le(s, rects[i].x2 - rects[i].x1);
+        out_uint16_le(s, rects[i].y2 - rects[i].y1);
+    }
+    out_uint16_le(s, 0);
+    out_uint16_le(s, 0);
+    out_uint16_le(s, width);
+    out_uint16_le(s, height);
+
+    return send_egfx_cmd(v, s, (char *)data, (int)data_bytes);
+}
+
+/*****************************************************************************/
+int
+vnc_shadow_submit(struct vnc *v, int frame_id)
+{
+    struct vnc_shadow *sh = v->shadow;
+    const struct display_size_description *ds;
+    const struct monitor_info *mons;
+    struct monitor_info single = {0};
+    unsigned int count;
+    unsigned int i;
+    struct stream *s;
+    int error;
+
+    ds = &v->client_info->display_sizes;
+    if (ds->monitorCount < 1)
+    {
+        /* xrdp creates a single surface for the whole session */
+        single.right = ds->session_width - 1;
+        single.bottom = ds->session_height - 1;
+        mons = &single;
+        count = 1;
+    }
+    else
+    {
+        mons = ds->minfo_wm;
+        count = MIN(ds->monitorCount, CLIENT_MONITOR_DATA_MAXIMUM_MONITORS);
+    }
+
+    /* Commands are small - the pixel data goes separately */
+    make_stream(s);
+    init_stream(s, 2048);
+
+    start_egfx_cmd(s, RDPGFX_CMDID_STARTFRAME);
+    out_uint32_le(s, frame_id);
+    out_uint32_le(s, g_time3()); /* timestamp */
+    error = send_egfx_cmd(v, s, NULL, 0);
+
+    for (i = 0; error == 0 && i < count; ++i)
+    {
+        error = send_surface(v, s, i, &mons[i]);
+    }
+
+    /* Always end the frame so xrdp acknowledges it */
+    if (error == 0)
+    {
+        start_egfx_cmd(s, RDPGFX_CMDID_ENDFRAME);
+        out_uint32_le(s, frame_id);
+        error = send_egfx_cmd(v, s, NULL, 0);
+    }
+
+    free_stream(s);
+    sh->num_damage = 0;
+    return error;
+}
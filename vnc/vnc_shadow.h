@@ -0,0 +1,103 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2015
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * libvnc - shadow framebuffer used to feed the xrdp encoder
+ */
+
+#ifndef VNC_SHADOW_H
+#define VNC_SHADOW_H
+
+struct vnc;
+
+/**
+ * Init the shadow framebuffer private data structures
+ */
+void
+vnc_shadow_init(struct vnc *v);
+
+/**
+ * Deallocate the shadow framebuffer private data structures
+ */
+void
+vnc_shadow_exit(struct vnc *v);
+
+/**
+ * Returns non-zero if screen output is going via the shadow framebuffer
+ *
+ * This is the case when the client is using the GFX pipeline with
+ * H.264, and the server pixel format is 24 or 32 bpp.
+ */
+int
+vnc_shadow_in_use(const struct vnc *v);
+
+/**
+ * Paints a rectangle received from the VNC server
+ *
+ * If the shadow framebuffer is not in use, this is passed straight on
+ * to server_paint_rect()
+ *
+ * @param v VNC Object
+ * @param x Rectangle X value
+ * @param y Rectangle Y value
+ * @param cx Rectangle CX value
+ * @param cy Rectangle CY value
+ * @param data Pixels in the format negotiated with the server
+ * @return Non-zero if error occurs
+ */
+int
+vnc_shadow_paint_rect(struct vnc *v, int x, int y, int cx, int cy,
+                      char *data);
+
+/**
+ * Performs a CopyRect operation received from the VNC server
+ *
+ * If the shadow framebuffer is not in use, this is passed straight on
+ * to server_screen_blt()
+ *
+ * @param v VNC Object
+ * @param x Destination X value
+ * @param y Destination Y value
+ * @param cx Rectangle CX value
+ * @param cy Rectangle CY value
+ * @param srcx Source X value
+ * @param srcy Source Y value
+ * @return Non-zero if error occurs
+ */
+int
+vnc_shadow_screen_blt(struct vnc *v, int x, int y, int cx, int cy,
+                      int srcx, int srcy);
+
+/**
+ * Returns non-zero if the shadow framebuffer has damage to submit
+ */
+int
+vnc_shadow_has_damage(const struct vnc *v);
+
+/**
+ * Submits the damaged areas of the shadow framebuffer to the encoder
+ *
+ * xrdp acknowledges the frame with mod_frame_ack() once the encoder
+ * (and the client, if it acknowledges frames) has finished with it.
+ *
+ * @param v VNC Object
+ * @param frame_id ID of the frame to submit
+ * @return Non-zero if error occurs
+ */
+int
+vnc_shadow_submit(struct vnc *v, int frame_id);
+
+#endif /* VNC_SHADOW_H */
@@ -21,11 +21,38 @@ alarm_handler(int signal_num)
      *
      * Prefix the message with a newline in case another message
      * has been partly output */
-    const char msg[] = "\n<E>Timed out waiting for RandR outputs\n";
+    const char msg[] = "\n<E>Timed out waiting for the X server\n";
     g_file_write(1, msg, g_strlen(msg));
     exit(XW_STATUS_TIMED_OUT);
 }
 
+/*****************************************************************************/
+/**
+ * Wait for the X server to say it's ready on its -displayfd pipe
+ *
+ * The X server writes the display number and a newline when it's
+ * accepting connections.
+ *
+ * @param fd Read end of the pipe
+ * @return 0 if the server is ready, 1 if it exited first
+ */
+static int
+wait_for_ready_fd(int fd)
+{
+    char c;
+
+    printf("<D>Waiting for the X server to become ready\n");
+    while (g_file_read(fd, &c, 1) == 1)
+    {
+        if (c == '\n')
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
 /*****************************************************************************/
 static Display *
 open_display(const char *display)
@@ -64,6 +91,7 @@ wait_for_r_and_r(Display *dpy)
     unsigned int outputs = 0;
     unsigned int wait = ATTEMPTS;
     unsigned int n;
+    XEvent ev;
 
     XRRScreenResources *res = NULL;
 
@@ -74,9 +102,13 @@ wait_for_r_and_r(Display *dpy)
         return 0;
     }
 
+    /* Ask for output changes before the first check, so none are missed */
+    XRRSelectInput(dpy, DefaultRootWindow(dpy),
+                   RRScreenChangeNotifyMask | RROutputChangeNotifyMask);
+
     for (n = 1; n <= wait; ++n)
     {
-        printf("<D>Waiting for outputs. Attempt %u of %u\n", n, wait);
+        printf("<D>Waiting for outputs. Check %u of %u\n", n, wait);
         res = XRRGetScreenResources(dpy, DefaultRootWindow(dpy));
         if (res != NULL)
         {
@@ -93,7 +125,18 @@ wait_for_r_and_r(Display *dpy)
                    DisplayString(dpy), outputs);
             return 0;
         }
-        g_sleep(1000);
+
+        /* Check again when the server tells us something has changed,
+         * or after a second if it doesn't */
+        if (XPending(dpy) == 0)
+        {
+            g_sck_can_recv(ConnectionNumber(dpy), 1000);
+        }
+        while (XPending(dpy) > 0)
+        {
+            XNextEvent(dpy, &ev);
+            XRRUpdateConfiguration(&ev);
+        }
     }
 
     printf("<E>Unable to find any RandR outputs\n");
@@ -104,7 +147,7 @@ wait_for_r_and_r(Display *dpy)
 static void
 usage(const char *argv0, int status)
 {
-    printf("Usage: %s -d display\n", argv0);
+    printf("Usage: %s -d display [-f ready_fd]\n", argv0);
     exit(status);
 }
 
@@ -113,6 +156,7 @@ int
 main(int argc, char **argv)
 {
     const char *display_name = NULL;
+    int ready_fd = -1;
     int opt;
     int status = XW_STATUS_MISC_ERROR;
     Display *dpy = NULL;
@@ -121,13 +165,16 @@ main(int argc, char **argv)
      * to sesman */
     setvbuf(stdout, NULL, _IONBF, 0);
 
-    while ((opt = getopt(argc, argv, "d:")) != -1)
+    while ((opt = getopt(argc, argv, "d:f:")) != -1)
     {
         switch (opt)
         {
             case 'd':
                 display_name = optarg;
                 break;
+            case 'f':
+                ready_fd = g_atoi(optarg);
+                break;
             default: /* '?' */
                 usage(argv[0], status);
         }
@@ -140,6 +187,12 @@ main(int argc, char **argv)
 
     g_set_alarm(alarm_handler, ALARM_WAIT);
 
+    if (ready_fd >= 0 && wait_for_ready_fd(ready_fd) != 0)
+    {
+        printf("<E>X server exited before it was ready\n");
+        return XW_STATUS_FAILED_TO_START;
+    }
+
     dpy = open_display(display_name);
     if (!dpy)
     {
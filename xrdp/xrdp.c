@@ -335,6 +335,11 @@ read_xrdp_ini_startup_params(struct xrdp_startup_params *startup_params)
                 startup_params->use_vsock = g_text2bool(val);
             }
 
+            else if (g_strcasecmp(name, "prefork") == 0)
+            {
+                startup_params->prefork = g_atoi(val);
+            }
+
             else if (g_strcasecmp(name, "runtime_user") == 0)
             {
                 g_snprintf(startup_params->runtime_user,
@@ -772,10 +777,15 @@ main(int argc, char **argv)
             LOG(LOG_LEVEL_WARNING, "error creating g_sync_event");
         }
 
+        /* Connections forked from here share the decoded login
+         * screen images and fonts */
+        xrdp_asset_cache_preload(startup_params.xrdp_ini);
+
         exit_status = xrdp_listen_main_loop(g_listen);
     }
 
     xrdp_listen_delete(g_listen);
+    xrdp_asset_cache_delete();
 
     tc_mutex_delete(g_get_sync_mutex());
     g_set_sync_mutex(0);
@@ -225,16 +225,41 @@ xrdp_region_delete(struct xrdp_region *self);
 int
 xrdp_region_add_rect(struct xrdp_region *self, struct xrdp_rect *rect);
 int
+xrdp_region_add_rects(struct xrdp_region *self, struct xrdp_rect *rects,
+                      int count);
+int
+xrdp_region_add_region(struct xrdp_region *self, struct xrdp_region *region);
+int
 xrdp_region_subtract_rect(struct xrdp_region *self, struct xrdp_rect *rect);
 int
 xrdp_region_intersect_rect(struct xrdp_region *self, struct xrdp_rect *rect);
+void
+xrdp_region_clear(struct xrdp_region *self);
 int
 xrdp_region_get_rect(struct xrdp_region *self, int index,
                      struct xrdp_rect *rect);
 int
 xrdp_region_get_bounds(struct xrdp_region *self, struct xrdp_rect *rect);
 int
+xrdp_region_get_clipped_bounds(struct xrdp_region *self,
+                               struct xrdp_rect *clip,
+                               struct xrdp_rect *rect);
+int
 xrdp_region_not_empty(struct xrdp_region *self);
+struct xrdp_tile_map *
+xrdp_tile_map_create(int width, int height);
+void
+xrdp_tile_map_delete(struct xrdp_tile_map *self);
+void
+xrdp_tile_map_clear(struct xrdp_tile_map *self);
+void
+xrdp_tile_map_add_rect(struct xrdp_tile_map *self, struct xrdp_rect *rect);
+int
+xrdp_tile_map_add_region(struct xrdp_tile_map *self,
+                         struct xrdp_region *region);
+int
+xrdp_tile_map_get_run(struct xrdp_tile_map *self, int *index,
+                      struct xrdp_rect *rect);
 
 /* xrdp_bitmap_common.c */
 struct xrdp_bitmap *
@@ -319,6 +344,19 @@ xrdp_bitmap_load(struct xrdp_bitmap *self, const char *filename,
                  enum xrdp_bitmap_load_transform transform,
                  int twidth,
                  int theight);
+
+/**
+ * Decodes an image file and adds it to the asset cache
+ *
+ * @param filename Filename to load
+ * @return 0 for success
+ *
+ * Later calls to xrdp_bitmap_load() for the same file use the cached
+ * image instead of decoding the file again. Nothing is cached if the
+ * image library isn't built in.
+ */
+int
+xrdp_bitmap_preload(const char *filename);
 /* xrdp_painter.c */
 struct xrdp_painter *
 xrdp_painter_create(struct xrdp_wm *wm, struct xrdp_session *session);
@@ -404,9 +442,74 @@ xrdp_painter_line(struct xrdp_painter *self,
                   struct xrdp_bitmap *bitmap,
                   int x1, int y1, int x2, int y2);
 
+/* xrdp_asset_cache.c */
+/**
+ * Loads the login screen assets named in xrdp.ini into the cache
+ *
+ * Call this in the listener before any connections are accepted.
+ *
+ * @param xrdp_ini Path to xrdp.ini
+ */
+void
+xrdp_asset_cache_preload(const char *xrdp_ini);
+/**
+ * Frees the asset cache
+ */
+void
+xrdp_asset_cache_delete(void);
+/**
+ * Adds the contents of a file to the asset cache
+ *
+ * @param filename File to add
+ * @return 0 for success
+ */
+int
+xrdp_asset_cache_add_file(const char *filename);
+/**
+ * Adds a decoded image to the asset cache
+ *
+ * @param filename File the image was decoded from
+ * @param width Image width
+ * @param height Image height
+ * @param has_alpha Non-zero if the image has an alpha channel
+ * @param pixels width * height 32-bit ARGB pixels
+ * @return 0 for success
+ */
+int
+xrdp_asset_cache_add_image(const char *filename, int width, int height,
+                           int has_alpha, const void *pixels);
+/**
+ * Gets the contents of a cached file
+ *
+ * @param filename File to look for
+ * @param[out] size Size of the file
+ * @return File contents, or NULL if the file isn't cached. The contents
+ *         are shared, and must not be changed or freed.
+ */
+const char *
+xrdp_asset_cache_get_file(const char *filename, int *size);
+/**
+ * Gets a cached decoded image
+ *
+ * @param filename File the image was decoded from
+ * @param[out] width Image width
+ * @param[out] height Image height
+ * @param[out] has_alpha Non-zero if the image has an alpha channel
+ * @return ARGB pixels, or NULL if the image isn't cached. The pixels are
+ *         shared, and must not be changed or freed.
+ */
+const void *
+xrdp_asset_cache_get_image(const char *filename, int *width, int *height,
+                           int *has_alpha);
+
 /* xrdp_font.c */
 struct xrdp_font *
 xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi);
+/**
+ * Adds all the fonts selected by fv1_select to the asset cache
+ */
+void
+xrdp_font_preload(const struct xrdp_cfg_globals *globals);
 void
 xrdp_font_delete(struct xrdp_font *self);
 int
@@ -510,6 +613,8 @@ int
 xrdp_mm_suppress_output(struct xrdp_mm *self, int suppress,
                         int left, int top, int right, int bottom);
 int
+xrdp_mm_input_batch(struct xrdp_mm *self, int begin);
+int
 xrdp_mm_up_and_running(struct xrdp_mm *self);
 int xrdp_mm_send_unicode_to_chansrv(struct xrdp_mm *self,
                                     int key_down,
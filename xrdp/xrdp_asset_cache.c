@@ -0,0 +1,321 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Copyright (C) Jay Sorg 2004-2024
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file    xrdp/xrdp_asset_cache.c
+ * @brief   Login screen assets loaded once by the listener
+ *
+ * The listener decodes the login screen background and logo, and reads
+ * the fonts, before it accepts any connections. Connection processes
+ * forked from the listener inherit the cache. They never write to it,
+ * so the pages stay shared between all of them.
+ *
+ * Each entry records the size and modification time of its file. If
+ * the file has changed since it was cached, the entry is ignored and
+ * the caller loads the file itself.
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <sys/stat.h>
+
+#include "xrdp.h"
+#include "list.h"
+#include "log.h"
+#include "os_calls.h"
+#include "string_calls.h"
+
+struct asset
+{
+    char *filename;
+    time_t mtime;
+    off_t file_size;
+    char *data;
+    int data_size;
+    /* images only */
+    int width;
+    int height;
+    int has_alpha;
+};
+
+static struct list *g_assets = NULL;
+
+/*****************************************************************************/
+static void
+asset_delete(struct asset *asset)
+{
+    if (asset != NULL)
+    {
+        g_free(asset->filename);
+        g_free(asset->data);
+        g_free(asset);
+    }
+}
+
+/*****************************************************************************/
+/* returns the entry for a file, or NULL if it's not cached or if the file
+   has changed */
+static const struct asset *
+asset_find(const char *filename)
+{
+    struct asset *asset;
+    struct stat st;
+    int index;
+
+    if (g_assets == NULL)
+    {
+        return NULL;
+    }
+    for (index = 0; index < g_assets->count; index++)
+    {
+        asset = (struct asset *)list_get_item(g_assets, index);
+        if (g_strcmp(asset->filename, filename) == 0)
+        {
+            if (stat(filename, &st) != 0 ||
+                    st.st_mtime != asset->mtime ||
+                    st.st_size != asset->file_size)
+            {
+                LOG(LOG_LEVEL_DEBUG, "%s has changed since it was cached",
+                    filename);
+                return NULL;
+            }
+            return asset;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/* adds a copy of data to the cache
+   returns the new entry, or NULL for error */
+static struct asset *
+asset_add(const char *filename, const void *data, int data_size)
+{
+    struct asset *asset;
+    struct stat st;
+
+    if (stat(filename, &st) != 0)
+    {
+        LOG(LOG_LEVEL_WARNING, "Can't cache %s [%s]", filename,
+            g_get_strerror());
+        return NULL;
+    }
+    if (g_assets == NULL)
+    {
+        g_assets = list_create();
+        if (g_assets == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    asset = g_new0(struct asset, 1);
+    if (asset != NULL)
+    {
+        asset->filename = g_strdup(filename);
+        asset->data = (char *)g_malloc(data_size, 0);
+        if (asset->filename == NULL || asset->data == NULL)
+        {
+            asset_delete(asset);
+            asset = NULL;
+        }
+    }
+    if (asset == NULL)
+    {
+        LOG(LOG_LEVEL_WARNING, "Out of memory caching %s", filename);
+        return NULL;
+    }
+    g_memcpy(asset->data, data, data_size);
+    asset->data_size = data_size;
+    asset->mtime = st.st_mtime;
+    asset->file_size = st.st_size;
+    list_add_item(g_assets, (tintptr)asset);
+    return asset;
+}
+
+/*****************************************************************************/
+int
+xrdp_asset_cache_add_file(const char *filename)
+{
+    char *data;
+    int size;
+    int fd;
+    int rv;
+
+    if (asset_find(filename) != NULL)
+    {
+        return 0;
+    }
+    size = g_file_get_size(filename);
+    if (size < 1)
+    {
+        return 1;
+    }
+    fd = g_file_open_ro(filename);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    data = (char *)g_malloc(size, 0);
+    rv = (data == NULL || g_file_read(fd, data, size) != size);
+    g_file_close(fd);
+    if (rv == 0)
+    {
+        rv = asset_add(filename, data, size) == NULL;
+    }
+    g_free(data);
+    return rv;
+}
+
+/*****************************************************************************/
+int
+xrdp_asset_cache_add_image(const char *filename, int width, int height,
+                           int has_alpha, const void *pixels)
+{
+    struct asset *asset;
+
+    if (width < 1 || height < 1 || width > 0x4000 || height > 0x4000)
+    {
+        return 1;
+    }
+    asset = asset_add(filename, pixels, width * height * 4);
+    if (asset == NULL)
+    {
+        return 1;
+    }
+    asset->width = width;
+    asset->height = height;
+    asset->has_alpha = has_alpha;
+    return 0;
+}
+
+/*****************************************************************************/
+const char *
+xrdp_asset_cache_get_file(const char *filename, int *size)
+{
+    const struct asset *asset = asset_find(filename);
+
+    if (asset == NULL || asset->width != 0)
+    {
+        return NULL;
+    }
+    *size = asset->data_size;
+    return asset->data;
+}
+
+/*****************************************************************************/
+const void *
+xrdp_asset_cache_get_image(const char *filename, int *width, int *height,
+                           int *has_alpha)
+{
+    const struct asset *asset = asset_find(filename);
+
+    if (asset == NULL || asset->width == 0)
+    {
+        return NULL;
+    }
+    *width = asset->width;
+    *height = asset->height;
+    *has_alpha = asset->has_alpha;
+    return asset->data;
+}
+
+/*****************************************************************************/
+void
+xrdp_asset_cache_preload(const char *xrdp_ini)
+{
+    struct xrdp_config *config;
+    struct xrdp_cfg_globals *globals;
+    char filename[256];
+    struct asset *asset;
+    int bytes;
+    int index;
+
+    config = g_new0(struct xrdp_config, 1);
+    if (config == NULL)
+    {
+        return;
+    }
+    /* The bpp only affects the colours, which aren't needed here */
+    if (load_xrdp_config(config, xrdp_ini, 24) != 0)
+    {
+        g_free(config);
+        return;
+    }
+    globals = &config->cfg_globals;
+
+    /* Paths are worked out as xrdp_login_wnd_create() does */
+    if (globals->ls_background_image[0] != '\0')
+    {
+        if (globals->ls_background_image[0] == '/')
+        {
+            g_snprintf(filename, sizeof(filename), "%s",
+                       globals->ls_background_image);
+        }
+        else
+        {
+            g_snprintf(filename, sizeof(filename), "%s/%s",
+                       XRDP_SHARE_PATH, globals->ls_background_image);
+        }
+        xrdp_bitmap_preload(filename);
+    }
+
+    if (globals->ls_logo_filename[0] != '\0')
+    {
+        xrdp_bitmap_preload(globals->ls_logo_filename);
+    }
+    else
+    {
+#ifdef USE_IMLIB2
+        xrdp_bitmap_preload(XRDP_SHARE_PATH "/xrdp_logo.png");
+#else
+        xrdp_bitmap_preload(XRDP_SHARE_PATH "/xrdp_logo.bmp");
+#endif
+    }
+
+    xrdp_font_preload(globals);
+    g_free(config);
+
+    bytes = 0;
+    for (index = 0; g_assets != NULL && index < g_assets->count; index++)
+    {
+        asset = (struct asset *)list_get_item(g_assets, index);
+        bytes += asset->data_size;
+    }
+    LOG(LOG_LEVEL_INFO, "Cached %d login screen assets (%d KiB)",
+        g_assets == NULL ? 0 : g_assets->count, bytes / 1024);
+}
+
+/*****************************************************************************/
+void
+xrdp_asset_cache_delete(void)
+{
+    int index;
+
+    if (g_assets != NULL)
+    {
+        for (index = 0; index < g_assets->count; index++)
+        {
+            asset_delete((struct asset *)list_get_item(g_assets, index));
+        }
+        list_delete(g_assets);
+        g_assets = NULL;
+    }
+}
@@ -1038,18 +1038,42 @@ xrdp_bitmap_load(struct xrdp_bitmap *self, const char *filename,
     int result = 0;
     Imlib_Load_Error lerr;
     int free_context_image = 0; /* Set if we've got an image loaded */
-    Imlib_Image img = imlib_load_image_with_error_return(filename, &lerr);
+    Imlib_Image img = NULL;
+    const void *cached;
+    int width;
+    int height;
+    int has_alpha;
 
-    /* Load the image */
-    if (img == NULL)
+    /* Use the listener's decoded copy if there is one. A copy is made,
+     * as the transforms below work on the context image */
+    cached = xrdp_asset_cache_get_image(filename, &width, &height,
+                                        &has_alpha);
+    if (cached != NULL)
     {
-        log_imlib2_error(LOG_LEVEL_ERROR, filename, lerr);
-        result = 1;
+        img = imlib_create_image_using_copied_data(width, height,
+                                                   (DATA32 *)cached);
+        if (img != NULL)
+        {
+            imlib_context_set_image(img);
+            imlib_image_set_has_alpha(has_alpha ? 1 : 0);
+            free_context_image = 1;
+        }
     }
-    else
+
+    /* Load the image */
+    if (img == NULL)
     {
-        imlib_context_set_image(img);
-        free_context_image = 1;
+        img = imlib_load_image_with_error_return(filename, &lerr);
+        if (img == NULL)
+        {
+            log_imlib2_error(LOG_LEVEL_ERROR, filename, lerr);
+            result = 1;
+        }
+        else
+        {
+            imlib_context_set_image(img);
+            free_context_image = 1;
+        }
     }
 
     /* Sort out the background */
@@ -1097,3 +1121,33 @@ xrdp_bitmap_load(struct xrdp_bitmap *self, const char *filename,
     return result;
 }
 #endif /* USE_IMLIB2 */
+
+/*****************************************************************************/
+int
+xrdp_bitmap_preload(const char *filename)
+{
+#ifdef USE_IMLIB2
+    int result;
+    Imlib_Load_Error lerr;
+    Imlib_Image img = imlib_load_image_with_error_return(filename, &lerr);
+
+    if (img == NULL)
+    {
+        log_imlib2_error(LOG_LEVEL_WARNING, filename, lerr);
+        return 1;
+    }
+    imlib_context_set_image(img);
+    result = xrdp_asset_cache_add_image(filename,
+                                        imlib_image_get_width(),
+                                        imlib_image_get_height(),
+                                        imlib_image_has_alpha(),
+                                        imlib_image_get_data_for_reading_only());
+    /* Don't keep a second copy in imlib2's own cache */
+    imlib_free_image_and_decache();
+    return result;
+#else
+    /* The builtin loader converts to the bpp of the connection as it
+     * reads the file, so there's no decoded form to share */
+    return 0;
+#endif
+}
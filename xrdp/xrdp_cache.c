@@ -24,6 +24,7 @@
 
 #include "xrdp.h"
 #include "log.h"
+#include "mem_account.h"
 
 
 
@@ -81,32 +82,51 @@ xrdp_cache_reset_crc(struct xrdp_cache *self)
 }
 
 /*****************************************************************************/
-struct xrdp_cache *
-xrdp_cache_create(struct xrdp_wm *owner,
-                  struct xrdp_session *session,
-                  struct xrdp_client_info *client_info)
+/* Sets the bitmap cache sizes from the client capabilities. The
+ * low memory profile limits the number of bitmaps we keep */
+static void
+xrdp_cache_set_sizes(struct xrdp_cache *self,
+                     const struct xrdp_client_info *client_info)
 {
-    struct xrdp_cache *self;
+    int max_entries;
 
-    self = (struct xrdp_cache *)g_malloc(sizeof(struct xrdp_cache), 1);
-    self->wm = owner;
-    self->session = session;
-    self->use_bitmap_comp = client_info->use_bitmap_comp;
+    max_entries = XRDP_MAX_BITMAP_CACHE_IDX;
+    if (client_info->low_memory)
+    {
+        max_entries = XRDP_LOW_MEMORY_BITMAP_CACHE_IDX;
+    }
 
-    self->cache1_entries = MIN(XRDP_MAX_BITMAP_CACHE_IDX,
-                               client_info->cache1_entries);
+    self->cache1_entries = MIN(max_entries, client_info->cache1_entries);
     self->cache1_entries = MAX(self->cache1_entries, 0);
     self->cache1_size = client_info->cache1_size;
 
-    self->cache2_entries = MIN(XRDP_MAX_BITMAP_CACHE_IDX,
-                               client_info->cache2_entries);
+    self->cache2_entries = MIN(max_entries, client_info->cache2_entries);
     self->cache2_entries = MAX(self->cache2_entries, 0);
     self->cache2_size = client_info->cache2_size;
 
-    self->cache3_entries = MIN(XRDP_MAX_BITMAP_CACHE_IDX,
-                               client_info->cache3_entries);
+    self->cache3_entries = MIN(max_entries, client_info->cache3_entries);
     self->cache3_entries = MAX(self->cache3_entries, 0);
     self->cache3_size = client_info->cache3_size;
+}
+
+/*****************************************************************************/
+struct xrdp_cache *
+xrdp_cache_create(struct xrdp_wm *owner,
+                  struct xrdp_session *session,
+                  struct xrdp_client_info *client_info)
+{
+    struct xrdp_cache *self;
+
+    self = (struct xrdp_cache *)mem_account_malloc(MEM_TAG_CACHE,
+            sizeof(struct xrdp_cache), 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->wm = owner;
+    self->session = session;
+    self->use_bitmap_comp = client_info->use_bitmap_comp;
+    xrdp_cache_set_sizes(self, client_info);
 
     self->bitmap_cache_persist_enable = client_info->bitmap_cache_persist_enable;
     self->bitmap_cache_version = client_info->bitmap_cache_version;
@@ -172,7 +192,7 @@ void
 xrdp_cache_delete(struct xrdp_cache *self)
 {
     clear_all_cached_items(self);
-    g_free(self);
+    mem_account_free(self);
 }
 
 /*****************************************************************************/
@@ -194,12 +214,7 @@ xrdp_cache_reset(struct xrdp_cache *self,
     self->wm = wm;
     self->session = session;
     self->use_bitmap_comp = client_info->use_bitmap_comp;
-    self->cache1_entries = client_info->cache1_entries;
-    self->cache1_size = client_info->cache1_size;
-    self->cache2_entries = client_info->cache2_entries;
-    self->cache2_size = client_info->cache2_size;
-    self->cache3_entries = client_info->cache3_entries;
-    self->cache3_size = client_info->cache3_size;
+    xrdp_cache_set_sizes(self, client_info);
     self->bitmap_cache_persist_enable = client_info->bitmap_cache_persist_enable;
     self->bitmap_cache_version = client_info->bitmap_cache_version;
     self->pointer_cache_entries = client_info->pointer_cache_entries;
@@ -208,8 +223,8 @@ xrdp_cache_reset(struct xrdp_cache *self,
     return 0;
 }
 
-#define COMPARE_WITH_CRC32(_b1, _b2) \
-    ((_b1->crc32 == _b2->crc32) && \
+#define COMPARE_WITH_HASH(_b1, _b2) \
+    ((_b1->hash == _b2->hash) && \
      (_b1->bpp == _b2->bpp) && \
      (_b1->width == _b2->width) && (_b1->height == _b2->height))
 
@@ -347,7 +362,7 @@ xrdp_cache_add_bitmap(struct xrdp_cache *self, struct xrdp_bitmap *bitmap,
     {
         cache_idx = list16_get_item(ll, jndex);
         lbm = self->bitmap_items[cache_id][cache_idx].bitmap;
-        if ((lbm != NULL) && COMPARE_WITH_CRC32(lbm, bitmap))
+        if ((lbm != NULL) && COMPARE_WITH_HASH(lbm, bitmap))
         {
             LOG_DEVEL(LOG_LEVEL_DEBUG, "found bitmap at %d %d", cache_idx, jndex);
             found = 1;
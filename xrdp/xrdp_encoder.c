@@ -29,6 +29,7 @@
 #include "fifo.h"
 #include "xrdp_egfx.h"
 #include "string_calls.h"
+#include "mem_account.h"
 
 #ifdef XRDP_RFXCODEC
 #include "rfxcodec_encode.h"
@@ -44,6 +45,8 @@
 #define MAX_XRDP_GFX_FRAMES_IN_FLIGHT 16
 
 #define DEFAULT_XRDP_GFX_MAX_COMPRESSED_BYTES (3 * 1024 * 1024)
+/* Used instead of the default for the low memory profile */
+#define LOW_MEMORY_XRDP_GFX_MAX_COMPRESSED_BYTES (1024 * 1024)
 /* limits used for validate env var XRDP_GFX_MAX_COMPRESSED_BYTES */
 #define MIN_XRDP_GFX_MAX_COMPRESSED_BYTES (64 * 1024)
 #define MAX_XRDP_GFX_MAX_COMPRESSED_BYTES (256 * 1024 * 1024)
@@ -262,6 +265,10 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     {
         const char *env_var = g_getenv("XRDP_GFX_FRAMES_IN_FLIGHT");
         self->frames_in_flight = DEFAULT_XRDP_GFX_FRAMES_IN_FLIGHT;
+        if (client_info->low_memory)
+        {
+            self->frames_in_flight = MIN_XRDP_GFX_FRAMES_IN_FLIGHT;
+        }
         if (env_var != NULL)
         {
             int fif = g_atoix(env_var);
@@ -281,6 +288,11 @@ xrdp_encoder_create(struct xrdp_mm *mm)
         }
         env_var = g_getenv("XRDP_GFX_MAX_COMPRESSED_BYTES");
         self->max_compressed_bytes = DEFAULT_XRDP_GFX_MAX_COMPRESSED_BYTES;
+        if (client_info->low_memory)
+        {
+            self->max_compressed_bytes =
+                LOW_MEMORY_XRDP_GFX_MAX_COMPRESSED_BYTES;
+        }
         if (env_var != NULL)
         {
             int mcb = g_atoix(env_var);
@@ -305,6 +317,11 @@ xrdp_encoder_create(struct xrdp_mm *mm)
     {
         self->frames_in_flight = client_info->max_unacknowledged_frame_count;
         self->max_compressed_bytes = client_info->max_fastpath_frag_bytes & ~15;
+        if (client_info->low_memory)
+        {
+            /* Each frame in flight holds an output buffer */
+            self->frames_in_flight = 1;
+        }
     }
     /* make sure frames_in_flight is at least 1 */
     self->frames_in_flight = MAX(self->frames_in_flight, 1);
@@ -766,7 +783,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     s = &ls;
     g_memset(s, 0, sizeof(struct stream));
     s->size = self->max_compressed_bytes;
-    s->data = g_new(char, s->size);
+    s->data = (char *)mem_account_malloc(MEM_TAG_ENCODER, s->size, 0);
     if (s->data == NULL)
     {
         return NULL;
@@ -774,7 +791,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     s->p = s->data;
     if (!s_check_rem(in_s, 11))
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         return NULL;
     }
     in_uint16_le(in_s, surface_id);
@@ -786,13 +803,13 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     if ((num_rects_d < 1) || (num_rects_d > 16 * 1024) ||
             (!s_check_rem(in_s, num_rects_d * 8)))
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         return NULL;
     }
     d_rects = g_new0(struct xrdp_egfx_rect, num_rects_d);
     if (d_rects == NULL)
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         return NULL;
     }
     for (index = 0; index < num_rects_d; index++)
@@ -809,7 +826,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     }
     if (!s_check_rem(in_s, 2))
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         g_free(d_rects);
         return NULL;
     }
@@ -817,21 +834,21 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     if ((num_rects_c < 1) || (num_rects_c > 16 * 1024) ||
             (!s_check_rem(in_s, num_rects_c * 8)))
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         g_free(d_rects);
         return NULL;
     }
     c_rects = g_new0(struct xrdp_egfx_rect, num_rects_c);
     if (c_rects == NULL)
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         g_free(d_rects);
         return NULL;
     }
     crects = g_new(short, num_rects_c * 4);
     if (crects == NULL)
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         g_free(c_rects);
         g_free(d_rects);
         return NULL;
@@ -850,7 +867,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     }
     if (!s_check_rem(in_s, 8))
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         g_free(c_rects);
         g_free(d_rects);
         g_free(crects);
@@ -872,7 +889,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
     /* RFX_AVC420_METABLOCK */
     if (out_RFX_AVC420_METABLOCK(&dst_rect, s, d_rects, num_rects_d) != 0)
     {
-        g_free(s->data);
+        mem_account_free(s->data);
         g_free(c_rects);
         g_free(d_rects);
         g_free(crects);
@@ -893,7 +910,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
         /* assume NV12 format */
         if (twidth * theight * 3 / 2 > enc_gfx_cmd->data_bytes)
         {
-            g_free(s->data);
+            mem_account_free(s->data);
             g_free(crects);
             return NULL;
         }
@@ -904,7 +921,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
                 xrdp_encoder_x264_create();
             if (self->codec_handle_h264_gfx[mon_index] == NULL)
             {
-                g_free(s->data);
+                mem_account_free(s->data);
                 g_free(crects);
                 return NULL;
             }
@@ -923,7 +940,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
         }
         else
         {
-            g_free(s->data);
+            mem_account_free(s->data);
             g_free(crects);
             return NULL;
         }
@@ -934,7 +951,7 @@ gfx_wiretosurface1(struct xrdp_encoder *self,
                                     codec_id,
                                     pixel_format, &dst_rect,
                                     s->data, bitmap_data_length);
-    g_free(s->data);
+    mem_account_free(s->data);
     g_free(crects);
     return rv;
 #else
@@ -1067,7 +1084,8 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
         }
     }
     bitmap_data_length = self->max_compressed_bytes;
-    bitmap_data = g_new(char, bitmap_data_length);
+    bitmap_data = (char *)mem_account_malloc(MEM_TAG_ENCODER,
+                                             bitmap_data_length, 0);
     if (bitmap_data == NULL)
     {
         g_free(tiles);
@@ -1125,7 +1143,7 @@ gfx_wiretosurface2(struct xrdp_encoder *self,
     }
     g_free(tiles);
     g_free(rfxrects);
-    g_free(bitmap_data);
+    mem_account_free(bitmap_data);
     return rv;
 #else
     (void)self;
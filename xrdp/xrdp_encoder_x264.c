@@ -31,6 +31,7 @@
 #include "xrdp.h"
 #include "arch.h"
 #include "os_calls.h"
+#include "mem_account.h"
 #include "xrdp_encoder_x264.h"
 #include "xrdp_tconfig.h"
 
@@ -89,7 +90,7 @@ xrdp_encoder_x264_delete(void *handle)
         {
             x264_encoder_close(xe->x264_enc_han);
         }
-        g_free(xe->yuvdata);
+        mem_account_free(xe->yuvdata);
     }
     g_free(xg);
     return 0;
@@ -144,7 +145,7 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
                 "x264_encoder_close %p", xe->x264_enc_han);
             x264_encoder_close(xe->x264_enc_han);
             xe->x264_enc_han = NULL;
-            g_free(xe->yuvdata);
+            mem_account_free(xe->yuvdata);
             xe->yuvdata = NULL;
             flags |= 2;
         }
@@ -171,7 +172,8 @@ xrdp_encoder_x264_encode(void *handle, int session, int left, int top,
             {
                 return 1;
             }
-            xe->yuvdata = g_new(char, width * height * 2);
+            xe->yuvdata = (char *)mem_account_malloc(MEM_TAG_ENCODER,
+                          width * height * 2, 0);
             if (xe->yuvdata == NULL)
             {
                 x264_encoder_close(xe->x264_enc_han);
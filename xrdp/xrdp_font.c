@@ -55,6 +55,9 @@ static char w_char[] =
 // First character allocated in the 'struct xrdp_font.chars' array
 #define FIRST_CHAR ' '
 
+/* Data for empty glyphs in fonts which share the asset cache's glyph data */
+static char g_blank_glyph[FONT_DATASIZE_FROM_GEOMETRY(1, 1)];
+
 /*****************************************************************************/
 /**
  * Parses the fv1_select configuration value to get the font to use,
@@ -139,12 +142,70 @@ get_font_name_from_dpi(const struct xrdp_cfg_globals *globals,
     }
 }
 
+/*****************************************************************************/
+/* returns the path to a font file, which is font_name if it's absolute */
+static const char *
+get_font_path(const char *font_name, char *buff, int buff_len)
+{
+    if (font_name[0] == '/')
+    {
+        /* User specified absolute path */
+        return font_name;
+    }
+    g_snprintf(buff, buff_len, XRDP_SHARE_PATH "/%s", font_name);
+    return buff;
+}
+
+/*****************************************************************************/
+void
+xrdp_font_preload(const struct xrdp_cfg_globals *globals)
+{
+    char font_name[256];
+    char file_path_buff[256];
+    const char *file_path;
+    const char *p;
+    const char *q;
+    int len;
+
+    p = globals->fv1_select;
+    if (p == NULL || p[0] == '\0')
+    {
+        p = DEFAULT_FV1_SELECT;
+    }
+
+    /* Each entry is "dpi:font_name" */
+    while (p != NULL)
+    {
+        p = g_strchr(p, ':');
+        if (p == NULL)
+        {
+            break;
+        }
+        ++p;
+        q = g_strchr(p, ',');
+        len = (q == NULL) ? g_strlen(p) : (int)(q - p);
+        if (len > 0 && len < (int)sizeof(font_name))
+        {
+            g_memcpy(font_name, p, len);
+            font_name[len] = '\0';
+            file_path = get_font_path(font_name, file_path_buff,
+                                      sizeof(file_path_buff));
+            xrdp_asset_cache_add_file(file_path);
+        }
+        p = q;
+    }
+
+    xrdp_asset_cache_add_file(XRDP_SHARE_PATH "/" DEFAULT_FONT_NAME);
+}
+
 /*****************************************************************************/
 struct xrdp_font *
 xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
 {
     struct xrdp_font *self;
     struct stream *s;
+    struct stream cached_s;
+    const char *cached;
     int fd;
     int b;
     int i;
@@ -166,19 +227,8 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
         LOG(LOG_LEVEL_WARNING, "Using the default_dpi of %u", dpi);
     }
     get_font_name_from_dpi(globals, dpi, font_name, sizeof(font_name));
-
-    if (font_name[0] == '/')
-    {
-        /* User specified absolute path */
-        file_path = font_name;
-    }
-    else
-    {
-        g_snprintf(file_path_buff, sizeof(file_path_buff),
-                   XRDP_SHARE_PATH "/%s",
-                   font_name);
-        file_path = file_path_buff;
-    }
+    file_path = get_font_path(font_name, file_path_buff,
+                              sizeof(file_path_buff));
 
     if (!g_file_exist(file_path))
     {
@@ -200,7 +250,11 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
         }
     }
 
-    file_size = g_file_get_size(file_path);
+    cached = xrdp_asset_cache_get_file(file_path, &file_size);
+    if (cached == NULL)
+    {
+        file_size = g_file_get_size(file_path);
+    }
 
     if (file_size < 1)
     {
@@ -217,23 +271,44 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
         return self;
     }
     self->wm = wm;
-    make_stream(s);
-    init_stream(s, file_size + 1024);
-    fd = g_file_open_ro(file_path);
+    if (cached != NULL)
+    {
+        /* Parse the listener's copy of the file, and point the glyphs
+         * at the data in it rather than copying it */
+        g_memset(&cached_s, 0, sizeof(cached_s));
+        cached_s.data = (char *)cached;
+        cached_s.p = cached_s.data;
+        cached_s.size = file_size;
+        s = &cached_s;
+        b = file_size;
+        self->glyphs_shared = 1;
+    }
+    else
+    {
+        make_stream(s);
+        init_stream(s, file_size + 1024);
+        fd = g_file_open_ro(file_path);
+        if (fd < 0)
+        {
+            LOG(LOG_LEVEL_ERROR,
+                "xrdp_font_create: Can't open %s - %s", file_path,
+                g_get_strerror());
+            b = -1;
+        }
+        else
+        {
+            b = g_file_read(fd, s->data, file_size + 1024);
+            g_file_close(fd);
+        }
+    }
 
-    if (fd < 0)
+    if (b < 0)
     {
-        LOG(LOG_LEVEL_ERROR,
-            "xrdp_font_create: Can't open %s - %s", file_path,
-            g_get_strerror());
         g_free(self);
         self = NULL;
     }
     else
     {
-        b = g_file_read(fd, s->data, file_size + 1024);
-        g_file_close(fd);
-
         // Got at least a header?
         if (b < (4 + 32 + 2 + 2 + 2 + 2 + 4))
         {
@@ -315,7 +390,18 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
 
                     /* GOTCHA - we need to allocate more than one byte in
                      * memory for this glyph */
-                    f->data = (char *)g_malloc(FONT_DATASIZE(f), 1);
+                    if (self->glyphs_shared)
+                    {
+                        f->data = g_blank_glyph;
+                    }
+                    else
+                    {
+                        f->data = (char *)g_malloc(FONT_DATASIZE(f), 1);
+                    }
+                }
+                else if (self->glyphs_shared)
+                {
+                    f->data = s->p;
                 }
                 else
                 {
@@ -329,7 +415,14 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
                         "Allocation error for character U+%X", char_count);
                     break;
                 }
-                in_uint8a(s, f->data, datasize);
+                if (self->glyphs_shared)
+                {
+                    in_uint8s(s, datasize);
+                }
+                else
+                {
+                    in_uint8a(s, f->data, datasize);
+                }
 
                 ++char_count;
             }
@@ -367,7 +460,10 @@ xrdp_font_create(struct xrdp_wm *wm, unsigned int dpi)
         }
     }
 
-    free_stream(s);
+    if (s != &cached_s)
+    {
+        free_stream(s);
+    }
     /*
       self->font_items[0].offset = -4;
       self->font_items[0].baseline = -16;
@@ -392,9 +488,12 @@ xrdp_font_delete(struct xrdp_font *self)
         return;
     }
 
-    for (i = FIRST_CHAR; i < self->char_count; i++)
+    if (!self->glyphs_shared)
     {
-        g_free(self->chars[i].data);
+        for (i = FIRST_CHAR; i < self->char_count; i++)
+        {
+            g_free(self->chars[i].data);
+        }
     }
 
     g_free(self);
@@ -26,6 +26,9 @@
 #include "log.h"
 #include "string_calls.h"
 
+/* Most idle children kept by the prefork setting */
+#define MAX_PREFORK 64
+
 /* 'g_process' is protected by the semaphore 'g_process_sem'.  One thread sets
    g_process and waits for the other to process it */
 static tbus g_process_sem = 0;
@@ -65,6 +68,9 @@ xrdp_listen_create(struct xrdp_startup_params *startup_params)
     self->process_list = list_create();
     self->fork_list = list_create();
     self->startup_params = startup_params;
+    self->prefork_list = list_create();
+    self->prefork_pipe[0] = -1;
+    self->prefork_pipe[1] = -1;
 
     if (g_process_sem == 0)
     {
@@ -103,6 +109,15 @@ xrdp_listen_delete(struct xrdp_listen *self)
     g_delete_wait_obj(self->pro_done_event);
     list_delete(self->process_list);
     list_delete(self->fork_list);
+    list_delete(self->prefork_list);
+    if (self->prefork_pipe[0] >= 0)
+    {
+        g_file_close(self->prefork_pipe[0]);
+    }
+    if (self->prefork_pipe[1] >= 0)
+    {
+        g_file_close(self->prefork_pipe[1]);
+    }
     g_free(self);
 }
 
@@ -674,39 +689,59 @@ xrdp_listen_init(struct xrdp_listen *self)
         }
         ltrans->trans_conn_in = xrdp_listen_conn_in;
         ltrans->callback_data = self;
+        ltrans->accept_limit = TRANS_BURST_ACCEPT_LIMIT;
         list_add_item(self->trans_list, (intptr_t) ltrans);
     }
     return 0;
 }
 
 /*****************************************************************************/
-static int
-xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
+/* called in a new child, to replace the state it shares with the parent */
+static void
+xrdp_listen_child_init(struct xrdp_listen *self)
+{
+    /* recreate some main globals */
+    xrdp_child_fork();
+    /* recreate the process done wait object, not used in fork mode */
+    /* close, don't delete this */
+    g_close_wait_obj(self->pro_done_event);
+    xrdp_listen_create_pro_done(self);
+    /* idle children are the parent's business */
+    list_clear(self->prefork_list);
+    if (self->prefork_pipe[0] >= 0)
+    {
+        g_file_close(self->prefork_pipe[0]);
+        self->prefork_pipe[0] = -1;
+    }
+}
+
+/*****************************************************************************/
+/* runs a connection in a child, and marks the child to exit */
+static void
+xrdp_listen_child_run(struct xrdp_listen *self, struct trans *server_trans)
 {
-    int pid;
     int index;
     struct xrdp_process *process;
     struct trans *ltrans;
 
-    pid = g_fork();
-
-    if (pid == 0)
+    /* delete listener, child need not listen */
+    for (index = 0; index < self->trans_list->count; index++)
+    {
+        ltrans = (struct trans *) list_get_item(self->trans_list, index);
+        trans_delete_from_child(ltrans);
+    }
+    list_delete(self->trans_list);
+    self->trans_list = NULL;
+    /* other connections accepted at the same time belong to other
+       children, don't hold them open */
+    for (index = 0; index < self->fork_list->count; index++)
+    {
+        ltrans = (struct trans *) list_get_item(self->fork_list, index);
+        trans_delete(ltrans);
+    }
+    list_clear(self->fork_list);
+    if (server_trans != NULL)
     {
-        /* child */
-        /* recreate some main globals */
-        xrdp_child_fork();
-        /* recreate the process done wait object, not used in fork mode */
-        /* close, don't delete this */
-        g_close_wait_obj(self->pro_done_event);
-        xrdp_listen_create_pro_done(self);
-        /* delete listener, child need not listen */
-        for (index = 0; index < self->trans_list->count; index++)
-        {
-            ltrans = (struct trans *) list_get_item(self->trans_list, index);
-            trans_delete_from_child(ltrans);
-        }
-        list_delete(self->trans_list);
-        self->trans_list = NULL;
         /* new connect instance */
         process = xrdp_process_create(self, 0);
         process->server_trans = server_trans;
@@ -714,8 +749,24 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
         xrdp_process_run(0);
         tc_sem_dec(g_process_sem);
         xrdp_process_delete(process);
-        /* mark this process to exit */
-        g_set_term(1);
+    }
+    /* mark this process to exit */
+    g_set_term(1);
+}
+
+/*****************************************************************************/
+static int
+xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
+{
+    int pid;
+
+    pid = g_fork();
+
+    if (pid == 0)
+    {
+        /* child */
+        xrdp_listen_child_init(self);
+        xrdp_listen_child_run(self, server_trans);
         return 1;
     }
 
@@ -724,6 +775,181 @@ xrdp_listen_fork(struct xrdp_listen *self, struct trans *server_trans)
     return 0;
 }
 
+/*****************************************************************************/
+/* in a preforked child, waits for a connection on the listeners shared
+   with the parent and the other idle children
+   returns the connection, or NULL if the child should exit */
+static struct trans *
+xrdp_listen_prefork_accept(struct xrdp_listen *self)
+{
+    int robjs_count;
+    int index;
+    intptr_t robjs[32];
+    intptr_t term_obj;
+    struct trans *ltrans;
+    struct trans *server_trans = NULL;
+
+    /* Leave the rest of the backlog to the other idle children */
+    for (index = 0; index < self->trans_list->count; index++)
+    {
+        ltrans = (struct trans *) list_get_item(self->trans_list, index);
+        ltrans->accept_limit = 1;
+    }
+
+    term_obj = g_get_term();
+    while (server_trans == NULL)
+    {
+        robjs_count = 0;
+        robjs[robjs_count++] = term_obj;
+        for (index = 0; index < self->trans_list->count; index++)
+        {
+            ltrans = (struct trans *) list_get_item(self->trans_list, index);
+            if (trans_get_wait_objs(ltrans, robjs, &robjs_count) != 0)
+            {
+                return NULL;
+            }
+        }
+
+        if (g_obj_wait(robjs, robjs_count, 0, 0, -1) != 0)
+        {
+            /* error, should not get here */
+            g_sleep(100);
+        }
+
+        if (g_is_wait_obj_set(term_obj))
+        {
+            return NULL;
+        }
+
+        /* Stop at the first connection, so there's only one */
+        for (index = 0; index < self->trans_list->count &&
+                self->fork_list->count == 0; index++)
+        {
+            ltrans = (struct trans *) list_get_item(self->trans_list, index);
+            if (trans_check_wait_objs(ltrans) != 0)
+            {
+                LOG(LOG_LEVEL_ERROR, "Preforked child can't accept "
+                    "connections");
+                return NULL;
+            }
+        }
+        if (self->fork_list->count > 0)
+        {
+            server_trans = (struct trans *) list_get_item(self->fork_list, 0);
+            list_remove_item(self->fork_list, 0);
+        }
+    }
+
+    return server_trans;
+}
+
+/*****************************************************************************/
+/* forks children until there are enough idle ones waiting for a
+   connection. If fork() fails, *timeout is set so the parent tries
+   again later
+   returns 1 in a child once it has finished, 0 in the parent */
+static int
+xrdp_listen_prefork(struct xrdp_listen *self, int *timeout)
+{
+    int pid;
+    struct trans *server_trans;
+
+    while (self->prefork_list->count < self->startup_params->prefork)
+    {
+        pid = g_fork();
+        if (pid == -1)
+        {
+            LOG(LOG_LEVEL_ERROR, "Can't fork an idle child [%s]",
+                g_get_strerror());
+            *timeout = 1000;
+            break;
+        }
+        if (pid == 0)
+        {
+            /* child */
+            xrdp_listen_child_init(self);
+            server_trans = xrdp_listen_prefork_accept(self);
+            if (server_trans != NULL)
+            {
+                /* Ask the parent for a replacement */
+                pid = g_getpid();
+                if (g_file_write(self->prefork_pipe[1], (const char *)&pid,
+                                 sizeof(pid)) != sizeof(pid))
+                {
+                    LOG(LOG_LEVEL_WARNING, "Can't notify the listener of a "
+                        "new connection [%s]", g_get_strerror());
+                }
+            }
+            g_file_close(self->prefork_pipe[1]);
+            self->prefork_pipe[1] = -1;
+            xrdp_listen_child_run(self, server_trans);
+            return 1;
+        }
+        list_add_item(self->prefork_list, pid);
+    }
+
+    return 0;
+}
+
+/*****************************************************************************/
+/* reads the pids of idle children which have taken a connection */
+static void
+xrdp_listen_prefork_read_taken(struct xrdp_listen *self)
+{
+    int pid;
+    int index;
+
+    while (g_is_wait_obj_set(self->prefork_pipe[0]))
+    {
+        if (g_file_read(self->prefork_pipe[0], (char *)&pid,
+                        sizeof(pid)) != sizeof(pid))
+        {
+            break;
+        }
+        index = list_index_of(self->prefork_list, pid);
+        if (index >= 0)
+        {
+            list_remove_item(self->prefork_list, index);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* sets up prefork mode
+   returns 0 if prefork mode is in use */
+static int
+xrdp_listen_prefork_init(struct xrdp_listen *self)
+{
+    struct xrdp_startup_params *startup_params = self->startup_params;
+
+    if (startup_params->prefork <= 0)
+    {
+        return 1;
+    }
+    if (!startup_params->fork)
+    {
+        LOG(LOG_LEVEL_WARNING, "prefork is ignored without fork=true");
+        return 1;
+    }
+    if (startup_params->prefork > MAX_PREFORK)
+    {
+        LOG(LOG_LEVEL_WARNING, "prefork=%d is too large, using %d",
+            startup_params->prefork, MAX_PREFORK);
+        startup_params->prefork = MAX_PREFORK;
+    }
+    if (g_pipe(self->prefork_pipe) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "Can't create prefork pipe [%s], "
+            "forking for each connection", g_get_strerror());
+        self->prefork_pipe[0] = -1;
+        self->prefork_pipe[1] = -1;
+        return 1;
+    }
+    LOG(LOG_LEVEL_INFO, "Keeping %d idle children for new connections",
+        startup_params->prefork);
+    return 0;
+}
+
 /*****************************************************************************/
 /* a new connection is coming in */
 int
@@ -763,16 +989,25 @@ xrdp_listen_conn_in(struct trans *self, struct trans *new_self)
  * Process pending SIGCHLD events in the listen process
  *
  * The main reason for this is to log children which fail
- * on a signal. This should be investigated.
+ * on a signal. This should be investigated. Idle preforked children
+ * which have exited are also forgotten here, so they are replaced.
  */
 static void
-process_pending_sigchld_events(void)
+process_pending_sigchld_events(struct xrdp_listen *self)
 {
     struct proc_exit_status e;
     int pid;
+    int index;
 
     while ((pid = g_waitchild(&e)) > 0)
     {
+        index = list_index_of(self->prefork_list, pid);
+        if (index >= 0)
+        {
+            list_remove_item(self->prefork_list, index);
+            LOG(LOG_LEVEL_WARNING,
+                "Idle child %d exited before taking a connection", pid);
+        }
         if (e.reason == E_PXR_SIGNAL)
         {
             char sigstr[MAXSTRSIGLEN];
@@ -798,8 +1033,10 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
     intptr_t sync_obj;
     intptr_t done_obj;
     struct trans *ltrans;
+    int prefork;
 
     self->status = 1;
+    prefork = (xrdp_listen_prefork_init(self) == 0);
 
     term_obj = g_get_term(); /*Global termination event */
     sigchld_obj = g_get_sigchld();
@@ -816,19 +1053,31 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         robjs[robjs_count++] = done_obj;
         timeout = -1;
 
-        for (index = 0; index < self->trans_list->count; index++)
+        if (prefork)
         {
-            ltrans = (struct trans *)
-                     list_get_item(self->trans_list, index);
-            if (trans_get_wait_objs(ltrans, robjs, &robjs_count) != 0)
+            /* The idle children accept the connections */
+            if (xrdp_listen_prefork(self, &timeout) != 0)
             {
-                cont = 0;
                 break;
             }
+            robjs[robjs_count++] = self->prefork_pipe[0];
         }
-        if (cont == 0)
+        else
         {
-            break;
+            for (index = 0; index < self->trans_list->count; index++)
+            {
+                ltrans = (struct trans *)
+                         list_get_item(self->trans_list, index);
+                if (trans_get_wait_objs(ltrans, robjs, &robjs_count) != 0)
+                {
+                    cont = 0;
+                    break;
+                }
+            }
+            if (cont == 0)
+            {
+                break;
+            }
         }
 
         /* wait - timeout -1 means wait indefinitely*/
@@ -846,10 +1095,17 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
             break;
         }
 
+        /* Read these before SIGCHLD, or a child which took a connection
+         * and exited quickly would look like one which failed */
+        if (prefork)
+        {
+            xrdp_listen_prefork_read_taken(self);
+        }
+
         if (g_is_wait_obj_set(sigchld_obj)) /* SIGCHLD caught */
         {
             g_set_sigchld(0);
-            process_pending_sigchld_events();
+            process_pending_sigchld_events(self);
         }
 
         /* some function must be processed by this thread */
@@ -867,7 +1123,7 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         }
 
         /* Run the callback when accept() returns a new socket*/
-        for (index = 0; index < self->trans_list->count; index++)
+        for (index = 0; !prefork && index < self->trans_list->count; index++)
         {
             ltrans = (struct trans *)
                      list_get_item(self->trans_list, index);
@@ -897,6 +1153,13 @@ xrdp_listen_main_loop(struct xrdp_listen *self)
         }
     }
 
+    /* idle children have nothing to finish */
+    for (index = 0; index < self->prefork_list->count; index++)
+    {
+        g_sigterm((int)list_get_item(self->prefork_list, index));
+    }
+    list_clear(self->prefork_list);
+
     /* stop listening */
     xrdp_listen_stop_all_listen(self);
 
@@ -2196,6 +2196,21 @@ xrdp_mm_suppress_output(struct xrdp_mm *self, int suppress,
     return 0;
 }
 
+/******************************************************************************/
+/* brackets the input events from one client PDU, so the module can
+   pass them on together */
+int
+xrdp_mm_input_batch(struct xrdp_mm *self, int begin)
+{
+    if (self->mod != NULL && self->mod->mod_event != NULL)
+    {
+        self->mod->mod_event(self->mod,
+                             begin ? WM_INPUT_BATCH_BEGIN : WM_INPUT_BATCH_END,
+                             0, 0, 0, 0);
+    }
+    return 0;
+}
+
 /******************************************************************************/
 int
 xrdp_mm_up_and_running(struct xrdp_mm *self)
@@ -2552,23 +2567,34 @@ xrdp_mm_chan_process_msg(struct xrdp_mm *self, struct trans *trans,
     int rv;
     int id;
     int size;
+    int in_rail_orders;
     char *next_msg;
     char *s_end;
 
     rv = 0;
+    in_rail_orders = 0;
 
     while (s_check_rem(s, 8))
     {
         next_msg = s->p;
         in_uint32_le(s, id);
         in_uint32_le(s, size);
-        if (size < 8)
+        if (size < 8 || !s_check_rem(s, size - 8))
         {
-            return 1;
+            rv = 1;
+            break;
         }
-        if (!s_check_rem(s, size - 8))
+        /* chansrv batches rail orders, so send a run of them in one
+           orders PDU. The nested init/send in each order handler is
+           then a no-op */
+        if (id == 10 && !in_rail_orders)
         {
-            return 1;
+            in_rail_orders = libxrdp_orders_init(self->wm->session) == 0;
+        }
+        else if (id != 10 && in_rail_orders)
+        {
+            libxrdp_orders_send(self->wm->session);
+            in_rail_orders = 0;
         }
         next_msg += size;
         s_end = s->end;
@@ -2611,6 +2637,11 @@ xrdp_mm_chan_process_msg(struct xrdp_mm *self, struct trans *trans,
         s->p = next_msg;
     }
 
+    if (in_rail_orders)
+    {
+        libxrdp_orders_send(self->wm->session);
+    }
+
     return rv;
 }
 
@@ -3742,24 +3773,14 @@ void
 xrdp_mm_efgx_add_dirty_region_to_planar_list(struct xrdp_mm *self,
         struct xrdp_region *dirty_region)
 {
-    int jndex = 0;
-    struct xrdp_rect rect;
-
-    int error = xrdp_region_get_rect(dirty_region, jndex, &rect);
-    if (error == 0)
+    if (xrdp_region_not_empty(dirty_region))
     {
         if (self->wm->screen_dirty_region == NULL)
         {
             self->wm->screen_dirty_region = xrdp_region_create(self->wm);
         }
 
-        do
-        {
-            xrdp_region_add_rect(self->wm->screen_dirty_region, &rect);
-            jndex++;
-            error = xrdp_region_get_rect(dirty_region, jndex, &rect);
-        }
-        while (error == 0);
+        xrdp_region_add_region(self->wm->screen_dirty_region, dirty_region);
 
         if (self->mod_handle != 0)
         {
@@ -3776,10 +3797,8 @@ xrdp_mm_draw_dirty(struct xrdp_mm *self)
 {
     struct xrdp_rect rect;
     struct xrdp_rect mon_rect;
-    struct xrdp_region *mon_reg;
     int error;
     int index;
-    int jndex;
     int count;
     int surface_id;
     struct monitor_info *mi;
@@ -3801,44 +3820,23 @@ xrdp_mm_draw_dirty(struct xrdp_mm *self)
     {
         for (index = 0; index < count; index++)
         {
-            /* make a copy of screen_dirty_region */
-            mon_reg = xrdp_region_create(self->wm);
-            if (mon_reg == NULL)
-            {
-                return 1;
-            }
-            jndex = 0;
-            while (xrdp_region_get_rect(self->wm->screen_dirty_region,
-                                        jndex, &mon_rect) == 0)
-            {
-                LOG_DEVEL(LOG_LEVEL_INFO, "xrdp_mm_draw_dirty: jndex %d "
-                          "mon_rect %d %d %d %d",
-                          jndex, mon_rect.left, mon_rect.top,
-                          mon_rect.right, mon_rect.bottom);
-                xrdp_region_add_rect(mon_reg, &mon_rect);
-                jndex++;
-            }
-            /* intercect monitor */
+            /* clip to the monitor */
             mi = self->wm->client_info->display_sizes.minfo_wm + index;
             mon_rect.left = mi->left;
             mon_rect.top = mi->top;
             mon_rect.right = mi->right + 1;
             mon_rect.bottom = mi->bottom + 1;
-            xrdp_region_intersect_rect(mon_reg, &mon_rect);
-            if (xrdp_region_not_empty(mon_reg))
+            error = xrdp_region_get_clipped_bounds(
+                        self->wm->screen_dirty_region, &mon_rect, &rect);
+            if (error == 0)
             {
-                error = xrdp_region_get_bounds(mon_reg, &rect);
-                if (error == 0)
-                {
-                    surface_id = index;
-                    rv = xrdp_mm_egfx_send_planar_bitmap(self,
-                                                         self->wm->screen,
-                                                         &rect,
-                                                         surface_id,
-                                                         mi->left, mi->top);
-                }
+                surface_id = index;
+                rv = xrdp_mm_egfx_send_planar_bitmap(self,
+                                                     self->wm->screen,
+                                                     &rect,
+                                                     surface_id,
+                                                     mi->left, mi->top);
             }
-            xrdp_region_delete(mon_reg);
         }
     }
     return rv;
@@ -3932,8 +3930,7 @@ xrdp_mm_check_wait_objs(struct xrdp_mm *self)
                 if (self->egfx_up)
                 {
                     rv = xrdp_mm_draw_dirty(self);
-                    xrdp_region_delete(self->wm->screen_dirty_region);
-                    self->wm->screen_dirty_region = NULL;
+                    xrdp_region_clear(self->wm->screen_dirty_region);
                     self->wm->last_screen_draw_time = now;
                 }
                 else
@@ -133,8 +133,7 @@ xrdp_painter_send_dirty(struct xrdp_painter *self)
         }
     }
 
-    xrdp_region_delete(self->dirty_region);
-    self->dirty_region = xrdp_region_create(self->wm);
+    xrdp_region_clear(self->dirty_region);
 
     return 0;
 }
@@ -23,6 +23,7 @@
 #endif
 
 #include "xrdp.h"
+#include "mem_account.h"
 
 static int g_session_id = 0;
 
@@ -304,6 +305,8 @@ xrdp_process_main_loop(struct xrdp_process *self)
            maybe should check that connection got far enough */
         libxrdp_disconnect(self->session);
     }
+    /* Does nothing unless memory_accounting is set in xrdp.ini */
+    mem_account_log_usage(LOG_LEVEL_INFO, "Session memory");
     /* Run end in module */
     xrdp_process_mod_end(self);
     xrdp_wm_delete(self->wm);
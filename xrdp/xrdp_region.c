@@ -16,6 +16,15 @@
  * limitations under the License.
  *
  * region
+ *
+ * Rects added to a region are queued, and merged into it in a tree of
+ * unions when it is next read. Merging each rect as it was added cost a
+ * pass over the whole region per rect, which adds up for the hundreds of
+ * small rects a busy screen is damaged by between updates.
+ *
+ * Each region has two pixman box stores. An operation writes into the
+ * spare one and the two are swapped, so once the stores have grown to
+ * fit the damage, updating the region doesn't allocate.
  */
 
 #if defined(HAVE_CONFIG_H)
@@ -30,6 +39,12 @@
 #include "pixman-region.h"
 #endif
 
+/* rects queued before they are merged in */
+#define XRDP_REGION_MAX_PENDING 128
+
+/* screen tiles, as encoders work on */
+#define XRDP_TILE_SIZE 64
+
 /*****************************************************************************/
 struct xrdp_region *
 xrdp_region_create(struct xrdp_wm *wm)
@@ -41,6 +56,9 @@ xrdp_region_create(struct xrdp_wm *wm)
     self->reg = (struct pixman_region16 *)
                 g_malloc(sizeof(struct pixman_region16), 1);
     pixman_region_init(self->reg);
+    self->scratch = (struct pixman_region16 *)
+                    g_malloc(sizeof(struct pixman_region16), 1);
+    pixman_region_init(self->scratch);
     return self;
 }
 
@@ -48,31 +66,183 @@ xrdp_region_create(struct xrdp_wm *wm)
 void
 xrdp_region_delete(struct xrdp_region *self)
 {
+    int index;
+
     if (self == 0)
     {
         return;
     }
+    for (index = 0; index < self->num_pending; index++)
+    {
+        pixman_region_fini(self->pending + index);
+    }
+    g_free(self->pending);
+    pixman_region_fini(self->scratch);
+    g_free(self->scratch);
     pixman_region_fini(self->reg);
     g_free(self->reg);
     g_free(self);
 }
 
+/*****************************************************************************/
+/* makes the result of the last operation, in scratch, the region */
+static void
+xrdp_region_swap(struct xrdp_region *self)
+{
+    struct pixman_region16 *reg;
+
+    reg = self->reg;
+    self->reg = self->scratch;
+    self->scratch = reg;
+}
+
+/*****************************************************************************/
+/* empties a pixman region, keeping its box store if it has one */
+static void
+xrdp_region_empty(struct pixman_region16 *reg)
+{
+    if (reg->data != NULL && reg->data->size > 0)
+    {
+        /* no boxes with data present is how pixman marks an empty
+           region, the same as an operation with an empty result leaves */
+        reg->data->numRects = 0;
+        reg->extents.x1 = 0;
+        reg->extents.y1 = 0;
+        reg->extents.x2 = 0;
+        reg->extents.y2 = 0;
+    }
+    else
+    {
+        pixman_region_fini(reg);
+        pixman_region_init(reg);
+    }
+}
+
+/*****************************************************************************/
+/* merges the queued rects into the region
+   returns error */
+static int
+xrdp_region_merge_pending(struct xrdp_region *self)
+{
+    struct pixman_region16 *pending;
+    int count;
+    int step;
+    int index;
+    int rv;
+
+    count = self->num_pending;
+    if (count < 1)
+    {
+        return 0;
+    }
+    pending = self->pending;
+    rv = 0;
+    /* union the rects in pairs, then pairs of pairs, and so on, so
+       each box is copied log2(count) times, not once per rect after it */
+    for (step = 1; step < count; step *= 2)
+    {
+        for (index = 0; index + step < count; index += step * 2)
+        {
+            if (!pixman_region_union(pending + index, pending + index,
+                                     pending + index + step))
+            {
+                rv = 1;
+            }
+            pixman_region_fini(pending + index + step);
+        }
+    }
+    if (rv == 0)
+    {
+        if (pixman_region_union(self->scratch, self->reg, pending))
+        {
+            xrdp_region_swap(self);
+        }
+        else
+        {
+            rv = 1;
+        }
+    }
+    pixman_region_fini(pending);
+    self->num_pending = 0;
+    return rv;
+}
+
 /*****************************************************************************/
 /* returns error */
 int
 xrdp_region_add_rect(struct xrdp_region *self, struct xrdp_rect *rect)
 {
-    struct pixman_region16 lreg;
-
-    pixman_region_init_rect(&lreg, rect->left, rect->top,
+    if (rect->right <= rect->left || rect->bottom <= rect->top)
+    {
+        return 0;
+    }
+    if (self->num_pending == 0 && self->reg->data == NULL &&
+            rect->left >= self->reg->extents.x1 &&
+            rect->top >= self->reg->extents.y1 &&
+            rect->right <= self->reg->extents.x2 &&
+            rect->bottom <= self->reg->extents.y2)
+    {
+        /* already covered by a region of one rect, such as the
+           whole screen */
+        return 0;
+    }
+    if (self->pending == NULL)
+    {
+        self->pending = g_new(struct pixman_region16,
+                              XRDP_REGION_MAX_PENDING);
+        if (self->pending == NULL)
+        {
+            return 1;
+        }
+    }
+    else if (self->num_pending >= XRDP_REGION_MAX_PENDING)
+    {
+        if (xrdp_region_merge_pending(self) != 0)
+        {
+            return 1;
+        }
+    }
+    pixman_region_init_rect(self->pending + self->num_pending,
+                            rect->left, rect->top,
                             rect->right - rect->left,
                             rect->bottom - rect->top);
-    if (!pixman_region_union(self->reg, self->reg, &lreg))
+    self->num_pending++;
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_region_add_rects(struct xrdp_region *self, struct xrdp_rect *rects,
+                      int count)
+{
+    int index;
+
+    for (index = 0; index < count; index++)
+    {
+        if (xrdp_region_add_rect(self, rects + index) != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* returns error */
+int
+xrdp_region_add_region(struct xrdp_region *self, struct xrdp_region *region)
+{
+    if (xrdp_region_merge_pending(self) != 0 ||
+            xrdp_region_merge_pending(region) != 0)
     {
-        pixman_region_fini(&lreg);
         return 1;
     }
-    pixman_region_fini(&lreg);
+    if (!pixman_region_union(self->scratch, self->reg, region->reg))
+    {
+        return 1;
+    }
+    xrdp_region_swap(self);
     return 0;
 }
 
@@ -83,15 +253,20 @@ xrdp_region_subtract_rect(struct xrdp_region *self, struct xrdp_rect *rect)
 {
     struct pixman_region16 lreg;
 
+    if (xrdp_region_merge_pending(self) != 0)
+    {
+        return 1;
+    }
     pixman_region_init_rect(&lreg, rect->left, rect->top,
                             rect->right - rect->left,
                             rect->bottom - rect->top);
-    if (!pixman_region_subtract(self->reg, self->reg, &lreg))
+    if (!pixman_region_subtract(self->scratch, self->reg, &lreg))
     {
         pixman_region_fini(&lreg);
         return 1;
     }
     pixman_region_fini(&lreg);
+    xrdp_region_swap(self);
     return 0;
 }
 
@@ -102,18 +277,37 @@ xrdp_region_intersect_rect(struct xrdp_region *self, struct xrdp_rect *rect)
 {
     struct pixman_region16 lreg;
 
+    if (xrdp_region_merge_pending(self) != 0)
+    {
+        return 1;
+    }
     pixman_region_init_rect(&lreg, rect->left, rect->top,
                             rect->right - rect->left,
                             rect->bottom - rect->top);
-    if (!pixman_region_intersect(self->reg, self->reg, &lreg))
+    if (!pixman_region_intersect(self->scratch, self->reg, &lreg))
     {
         pixman_region_fini(&lreg);
         return 1;
     }
     pixman_region_fini(&lreg);
+    xrdp_region_swap(self);
     return 0;
 }
 
+/*****************************************************************************/
+/* empties the region, keeping its memory for reuse */
+void
+xrdp_region_clear(struct xrdp_region *self)
+{
+    int index;
+
+    for (index = 0; index < self->num_pending; index++)
+    {
+        pixman_region_fini(self->pending + index);
+    }
+    self->num_pending = 0;
+    xrdp_region_empty(self->reg);
+}
 
 /*****************************************************************************/
 /* returns error */
@@ -124,6 +318,10 @@ xrdp_region_get_rect(struct xrdp_region *self, int index,
     struct pixman_box16 *box;
     int count;
 
+    if (xrdp_region_merge_pending(self) != 0)
+    {
+        return 1;
+    }
     box = pixman_region_rectangles(self->reg, &count);
     if ((box != 0) && (index >= 0) && (index < count))
     {
@@ -143,6 +341,10 @@ xrdp_region_get_bounds(struct xrdp_region *self, struct xrdp_rect *rect)
 {
     struct pixman_box16 *box;
 
+    if (xrdp_region_merge_pending(self) != 0)
+    {
+        return 1;
+    }
     box = pixman_region_extents(self->reg);
     if (box != 0)
     {
@@ -155,6 +357,58 @@ xrdp_region_get_bounds(struct xrdp_region *self, struct xrdp_rect *rect)
     return 1;
 }
 
+/*****************************************************************************/
+/* gets the bounds of the part of the region inside clip, such as a
+   monitor, without making a clipped copy of the region
+   returns error, or 1 if none of the region is inside clip */
+int
+xrdp_region_get_clipped_bounds(struct xrdp_region *self,
+                               struct xrdp_rect *clip,
+                               struct xrdp_rect *rect)
+{
+    struct pixman_box16 *box;
+    int count;
+    int index;
+    int left;
+    int top;
+    int right;
+    int bottom;
+
+    if (xrdp_region_merge_pending(self) != 0)
+    {
+        return 1;
+    }
+    box = pixman_region_rectangles(self->reg, &count);
+    if (box == 0)
+    {
+        return 1;
+    }
+    rect->left = clip->right;
+    rect->top = clip->bottom;
+    rect->right = clip->left;
+    rect->bottom = clip->top;
+    for (index = 0; index < count; index++)
+    {
+        if (box[index].y1 >= clip->bottom)
+        {
+            /* boxes are sorted by band, top to bottom */
+            break;
+        }
+        left = MAX(box[index].x1, clip->left);
+        top = MAX(box[index].y1, clip->top);
+        right = MIN(box[index].x2, clip->right);
+        bottom = MIN(box[index].y2, clip->bottom);
+        if (left < right && top < bottom)
+        {
+            rect->left = MIN(rect->left, left);
+            rect->top = MIN(rect->top, top);
+            rect->right = MAX(rect->right, right);
+            rect->bottom = MAX(rect->bottom, bottom);
+        }
+    }
+    return (rect->left < rect->right) ? 0 : 1;
+}
+
 /*****************************************************************************/
 /* returns boolean */
 int
@@ -162,6 +416,194 @@ xrdp_region_not_empty(struct xrdp_region *self)
 {
     pixman_bool_t not_empty;
 
+    if (self->num_pending > 0)
+    {
+        /* only rects with an area are queued */
+        return 1;
+    }
     not_empty = pixman_region_not_empty(self->reg);
     return not_empty;
 }
+
+/*****************************************************************************/
+/* returns the number of set bits */
+static int
+count_bits(unsigned int bits)
+{
+    int count;
+
+    for (count = 0; bits != 0; count++)
+    {
+        bits &= bits - 1;
+    }
+    return count;
+}
+
+/*****************************************************************************/
+struct xrdp_tile_map *
+xrdp_tile_map_create(int width, int height)
+{
+    struct xrdp_tile_map *self;
+
+    if (width < 1 || height < 1)
+    {
+        return NULL;
+    }
+    self = g_new0(struct xrdp_tile_map, 1);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    self->width = width;
+    self->height = height;
+    self->tiles_x = (width + XRDP_TILE_SIZE - 1) / XRDP_TILE_SIZE;
+    self->tiles_y = (height + XRDP_TILE_SIZE - 1) / XRDP_TILE_SIZE;
+    self->words_per_row = (self->tiles_x + 31) / 32;
+    self->bits = g_new0(unsigned int, self->words_per_row * self->tiles_y);
+    if (self->bits == NULL)
+    {
+        g_free(self);
+        return NULL;
+    }
+    return self;
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_map_delete(struct xrdp_tile_map *self)
+{
+    if (self == NULL)
+    {
+        return;
+    }
+    g_free(self->bits);
+    g_free(self);
+}
+
+/*****************************************************************************/
+void
+xrdp_tile_map_clear(struct xrdp_tile_map *self)
+{
+    g_memset(self->bits, 0,
+             self->words_per_row * self->tiles_y * sizeof(unsigned int));
+    self->num_dirty = 0;
+}
+
+/*****************************************************************************/
+/* marks the tiles the rect touches as dirty */
+void
+xrdp_tile_map_add_rect(struct xrdp_tile_map *self, struct xrdp_rect *rect)
+{
+    unsigned int *row;
+    unsigned int mask;
+    int tx1;
+    int tx2;
+    int ty1;
+    int ty2;
+    int ty;
+    int word;
+    int first;
+    int last;
+
+    if (rect->right <= rect->left || rect->bottom <= rect->top ||
+            rect->right <= 0 || rect->bottom <= 0 ||
+            rect->left >= self->width || rect->top >= self->height)
+    {
+        return;
+    }
+    tx1 = MAX(rect->left, 0) / XRDP_TILE_SIZE;
+    ty1 = MAX(rect->top, 0) / XRDP_TILE_SIZE;
+    tx2 = (MIN(rect->right, self->width) - 1) / XRDP_TILE_SIZE;
+    ty2 = (MIN(rect->bottom, self->height) - 1) / XRDP_TILE_SIZE;
+    for (ty = ty1; ty <= ty2; ty++)
+    {
+        row = self->bits + ty * self->words_per_row;
+        for (word = tx1 / 32; word <= tx2 / 32; word++)
+        {
+            first = MAX(tx1 - word * 32, 0);
+            last = MIN(tx2 - word * 32, 31);
+            mask = (0xffffffffU >> (31 - last)) & (0xffffffffU << first);
+            self->num_dirty += count_bits(mask & ~row[word]);
+            row[word] |= mask;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* marks the tiles the region touches as dirty
+   returns error */
+int
+xrdp_tile_map_add_region(struct xrdp_tile_map *self,
+                         struct xrdp_region *region)
+{
+    struct pixman_box16 *box;
+    struct xrdp_rect rect;
+    int count;
+    int index;
+
+    if (xrdp_region_merge_pending(region) != 0)
+    {
+        return 1;
+    }
+    box = pixman_region_rectangles(region->reg, &count);
+    for (index = 0; index < count; index++)
+    {
+        rect.left = box[index].x1;
+        rect.top = box[index].y1;
+        rect.right = box[index].x2;
+        rect.bottom = box[index].y2;
+        xrdp_tile_map_add_rect(self, &rect);
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/* gets the next run of dirty tiles along a row, from tile *index on, as
+   a rect clipped to the screen, and moves *index past it
+   returns 1 if there are no more */
+int
+xrdp_tile_map_get_run(struct xrdp_tile_map *self, int *index,
+                      struct xrdp_rect *rect)
+{
+    unsigned int *row;
+    unsigned int bits;
+    int tx;
+    int ty;
+    int end;
+
+    tx = *index % self->tiles_x;
+    ty = *index / self->tiles_x;
+    for (; ty < self->tiles_y; ty++, tx = 0)
+    {
+        row = self->bits + ty * self->words_per_row;
+        while (tx < self->tiles_x)
+        {
+            bits = row[tx / 32] >> (tx % 32);
+            if (bits == 0)
+            {
+                /* nothing more in this word */
+                tx = (tx / 32 + 1) * 32;
+                continue;
+            }
+            while ((bits & 1) == 0)
+            {
+                bits >>= 1;
+                tx++;
+            }
+            end = tx + 1;
+            while (end < self->tiles_x &&
+                    (row[end / 32] & (1U << (end % 32))) != 0)
+            {
+                end++;
+            }
+            rect->left = tx * XRDP_TILE_SIZE;
+            rect->top = ty * XRDP_TILE_SIZE;
+            rect->right = MIN(end * XRDP_TILE_SIZE, self->width);
+            rect->bottom = MIN((ty + 1) * XRDP_TILE_SIZE, self->height);
+            *index = ty * self->tiles_x + end;
+            return 0;
+        }
+    }
+    *index = self->tiles_x * self->tiles_y;
+    return 1;
+}
@@ -613,6 +613,8 @@ struct xrdp_listen
     struct list *fork_list;
     tbus pro_done_event;
     struct xrdp_startup_params *startup_params;
+    struct list *prefork_list; /* pids of idle preforked children */
+    int prefork_pipe[2]; /* children write their pid here on a connection */
 };
 
 /* region */
@@ -620,6 +622,21 @@ struct xrdp_region
 {
     struct xrdp_wm *wm; /* owner */
     struct pixman_region16 *reg;
+    struct pixman_region16 *scratch; /* spare box store, swapped with reg */
+    struct pixman_region16 *pending; /* rects added, not yet in reg */
+    int num_pending;
+};
+
+/* dirty 64x64 screen tiles, one bit each */
+struct xrdp_tile_map
+{
+    int width;
+    int height;
+    int tiles_x;
+    int tiles_y;
+    int words_per_row;
+    int num_dirty; /* tiles marked */
+    unsigned int *bits;
 };
 
 /* painter */
@@ -691,9 +708,10 @@ struct xrdp_bitmap
     /* for popup */
     struct xrdp_bitmap *popped_from;
     int item_height;
-    /* crc */
-    int crc32;
-    int crc16;
+    /* bitmap cache key, see xrdp_bitmap_hash_crc() */
+    tui64 hash;
+    int crc32; /* low 32 bits of hash */
+    int crc16; /* top 16 bits of hash, used to pick a cache list */
 };
 
 #define MAX_FONT_CHARS 0x4e00
@@ -727,6 +745,8 @@ struct xrdp_font
     /** Body height in pixels */
     int body_height;
     int style;
+    /** Glyph data points into the asset cache, and is not freed */
+    int glyphs_shared;
 };
 
 /* module */
@@ -753,6 +773,7 @@ struct xrdp_startup_params
     int tcp_nodelay;
     int tcp_keepalive;
     int use_vsock;
+    int prefork; /* idle children to keep ready in fork mode */
     // These should be local users/groups, and so we shouldn't need
     // a lot of storage for them.
     char runtime_user[64];
@@ -2168,6 +2168,9 @@ callback(intptr_t id, int msg, intptr_t param1, intptr_t param2,
             // "yeah, up_and_running"
             xrdp_mm_up_and_running(wm->mm);
             break;
+        case 0x555b: /* start (param1 != 0) or end of a fastpath input PDU */
+            xrdp_mm_input_batch(wm->mm, param1);
+            break;
     }
     return rv;
 }
@@ -0,0 +1,351 @@
+/**
+ * xrdp: A Remote Desktop Protocol server.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Throughput benchmark for dynamic virtual channels opened with xrdpapi
+ *
+ * This program stands in for xrdp and the RDP client. It connects to
+ * chansrv as xrdp would, then starts a child process which opens a DVC
+ * with WTSVirtualChannelOpenEx() and writes to it as fast as it can.
+ * The parent accepts the channel open, counts the data_first and data
+ * messages chansrv sends, and reports the throughput.
+ *
+ * Run chansrv for a display without an xrdp connected, e.g.:-
+ *
+ *     DISPLAY=:99 xrdp-chansrv &
+ *     DISPLAY=:99 ./xrdp-xrdpapi-dvcbench [megabytes] [write size]
+ */
+
+#if defined(HAVE_CONFIG_H)
+#include <config_ac.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "xrdpapi.h"
+#include "xrdp_sockets.h"
+#include "log.h"
+#include "os_calls.h"
+#include "string_calls.h"
+
+#define BENCH_CHANNEL_NAME "DVCBENCH"
+
+/*****************************************************************************/
+static int
+connect_to_chansrv(int display)
+{
+    struct sockaddr_un s;
+    int sck;
+
+    sck = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sck < 0)
+    {
+        return -1;
+    }
+    memset(&s, 0, sizeof(s));
+    s.sun_family = AF_UNIX;
+    snprintf(s.sun_path, sizeof(s.sun_path), XRDP_CHANSRV_STR,
+             (int)getuid(), display);
+    if (connect(sck, (struct sockaddr *)&s, sizeof(s)) < 0)
+    {
+        fprintf(stderr, "Can't connect to %s : %s\n", s.sun_path,
+                strerror(errno));
+        close(sck);
+        return -1;
+    }
+    return sck;
+}
+
+/*****************************************************************************/
+static int
+read_all(int sck, char *data, int bytes)
+{
+    int rv;
+
+    while (bytes > 0)
+    {
+        rv = read(sck, data, bytes);
+        if (rv < 1)
+        {
+            return 1;
+        }
+        data += rv;
+        bytes -= rv;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+static unsigned int
+get_uint32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int)u[3] << 24);
+}
+
+/*****************************************************************************/
+static void
+put_uint32(char *p, unsigned int v)
+{
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    p[2] = (char)(v >> 16);
+    p[3] = (char)(v >> 24);
+}
+
+/*****************************************************************************/
+/* the child - opens the channel and writes to it */
+static int
+run_writer(long long total_bytes, int write_size)
+{
+    void *channel;
+    void *buffer;
+    unsigned int bytes_returned;
+    unsigned int written;
+    struct pollfd pollfd;
+    char *data;
+    int fd;
+    int chunk;
+
+    channel = WTSVirtualChannelOpenEx(WTS_CURRENT_SESSION, BENCH_CHANNEL_NAME,
+                                      WTS_CHANNEL_OPTION_DYNAMIC);
+    if (channel == NULL)
+    {
+        fprintf(stderr, "WTSVirtualChannelOpenEx() failed\n");
+        return 1;
+    }
+    /* the handle is non-blocking, so wait for space with poll() */
+    if (!WTSVirtualChannelQuery(channel, WTSVirtualFileHandle, &buffer,
+                                &bytes_returned))
+    {
+        WTSVirtualChannelClose(channel);
+        return 1;
+    }
+    memcpy(&fd, buffer, sizeof(fd));
+    WTSFreeMemory(buffer);
+
+    data = (char *)malloc(write_size);
+    if (data == NULL)
+    {
+        WTSVirtualChannelClose(channel);
+        return 1;
+    }
+    memset(data, 0x5a, write_size);
+
+    while (total_bytes > 0)
+    {
+        chunk = (total_bytes < write_size) ? (int)total_bytes : write_size;
+        if (!WTSVirtualChannelWrite(channel, data, chunk, &written))
+        {
+            fprintf(stderr, "WTSVirtualChannelWrite() failed\n");
+            break;
+        }
+        if (written == 0)
+        {
+            pollfd.fd = fd;
+            pollfd.events = POLLOUT;
+            pollfd.revents = 0;
+            poll(&pollfd, 1, -1);
+        }
+        total_bytes -= written;
+    }
+
+    free(data);
+    WTSVirtualChannelClose(channel);
+    return (total_bytes == 0) ? 0 : 1;
+}
+
+/*****************************************************************************/
+/* sends a successful open response for a channel */
+static int
+send_open_response(int sck, int chan_id)
+{
+    char msg[24];
+
+    put_uint32(msg + 0, 0); /* version */
+    put_uint32(msg + 4, 24);
+    put_uint32(msg + 8, 13); /* msg id */
+    put_uint32(msg + 12, 16);
+    put_uint32(msg + 16, chan_id);
+    put_uint32(msg + 20, 0); /* creation status */
+    return write(sck, msg, sizeof(msg)) != sizeof(msg);
+}
+
+/*****************************************************************************/
+/* the parent - plays xrdp's part, and counts what arrives */
+static int
+run_reader(int sck, long long total_bytes)
+{
+    char *block;
+    char *msg;
+    long long received = 0;
+    int block_count = 0;
+    int msg_count = 0;
+    int block_size;
+    int msg_id;
+    int msg_size;
+    int chan_id;
+    int start = 0;
+    int elapsed;
+
+    block = (char *)malloc(8192);
+    if (block == NULL)
+    {
+        return 1;
+    }
+    while (received < total_bytes)
+    {
+        if (read_all(sck, block, 8) != 0)
+        {
+            fprintf(stderr, "chansrv closed the connection\n");
+            free(block);
+            return 1;
+        }
+        block_size = (int)get_uint32(block + 4);
+        if (block_size < 8 || block_size > 8192 ||
+                read_all(sck, block + 8, block_size - 8) != 0)
+        {
+            fprintf(stderr, "Bad block from chansrv\n");
+            free(block);
+            return 1;
+        }
+        ++block_count;
+        for (msg = block + 8; msg + 8 <= block + block_size; msg += msg_size)
+        {
+            msg_id = (int)get_uint32(msg);
+            msg_size = (int)get_uint32(msg + 4);
+            if (msg_size < 8 || msg + msg_size > block + block_size)
+            {
+                fprintf(stderr, "Bad message from chansrv\n");
+                free(block);
+                return 1;
+            }
+            switch (msg_id)
+            {
+                case 12: /* drdynvc open */
+                    /* name_bytes, name, flags, chan_id */
+                    chan_id = (int)get_uint32(msg + msg_size - 4);
+                    if (send_open_response(sck, chan_id) != 0)
+                    {
+                        free(block);
+                        return 1;
+                    }
+                    start = g_time3();
+                    break;
+                case 16: /* drdynvc data first */
+                case 18: /* drdynvc data */
+                    received += get_uint32(msg + 12);
+                    ++msg_count;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    elapsed = g_time3() - start;
+    if (elapsed < 1)
+    {
+        elapsed = 1;
+    }
+
+    printf("bytes:     %lld\n", received);
+    printf("messages:  %d in %d blocks\n", msg_count, block_count);
+    printf("elapsed:   %d ms\n", elapsed);
+    printf("rate:      %.1f MB/s\n",
+           (double)received / (1024.0 * 1024.0) * 1000.0 / elapsed);
+    free(block);
+    return 0;
+}
+
+/*****************************************************************************/
+int
+main(int argc, char **argv)
+{
+    struct log_config *lc;
+    long long total_bytes;
+    int write_size = 32768;
+    int display;
+    int status;
+    int sck;
+    int rv;
+    pid_t pid;
+
+    total_bytes = 256;
+    if (argc > 1)
+    {
+        total_bytes = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        write_size = atoi(argv[2]);
+    }
+    if (total_bytes < 1 || write_size < 1)
+    {
+        fprintf(stderr, "usage: %s [megabytes] [write size]\n", argv[0]);
+        return 1;
+    }
+    total_bytes *= 1024 * 1024;
+
+    display = g_get_display_num_from_display(getenv("DISPLAY"));
+    if (display < 0)
+    {
+        fprintf(stderr, "DISPLAY is not set\n");
+        return 1;
+    }
+
+    if ((lc = log_config_init_for_console(LOG_LEVEL_WARNING, NULL)) != NULL)
+    {
+        log_start_from_param(lc);
+        log_config_free(lc);
+    }
+
+    sck = connect_to_chansrv(display);
+    if (sck < 0)
+    {
+        log_end();
+        return 1;
+    }
+
+    pid = fork();
+    if (pid == 0)
+    {
+        close(sck);
+        _exit(run_writer(total_bytes, write_size));
+    }
+    if (pid < 0)
+    {
+        close(sck);
+        log_end();
+        return 1;
+    }
+
+    rv = run_reader(sck, total_bytes);
+    close(sck);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+    {
+        rv = 1;
+    }
+    log_end();
+    return rv;
+}
@@ -54,6 +54,8 @@ static int
 mysend(int sck, const void *adata, int bytes);
 static int
 myrecv(int sck, void *adata, int bytes);
+static int
+would_block(int lerrno);
 
 /*
  * Opens a handle to the server end of a specified virtual channel - this
@@ -136,6 +138,13 @@ WTSVirtualChannelOpenEx(unsigned int SessionId, const char *pVirtualName,
         LOG(LOG_LEVEL_WARNING, "WTSVirtualChannelOpenEx: set non-block mode failed");
     }
 
+#if defined(SO_NOSIGPIPE)
+    {
+        const int on = 1;
+        setsockopt(wts->fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+
     /* connect to chansrv session */
     memset(&s, 0, sizeof(struct sockaddr_un));
     s.sun_family = AF_UNIX;
@@ -248,6 +257,8 @@ WTSVirtualChannelOpenEx(unsigned int SessionId, const char *pVirtualName,
 #endif
 
 /*****************************************************************************/
+/* The socket is non-blocking, so these only poll when a send or receive
+   can't make progress */
 static int
 mysend(int sck, const void *adata, int bytes)
 {
@@ -255,24 +266,23 @@ mysend(int sck, const void *adata, int bytes)
     int error;
     const char *data;
 
-#if defined(SO_NOSIGPIPE)
-    const int on = 1;
-    setsockopt(sck, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
-#endif
-
     data = (const char *) adata;
     sent = 0;
     while (sent < bytes)
     {
-        if (can_send(sck, 100, 0))
+        error = send(sck, data + sent, bytes - sent, MSG_NOSIGNAL);
+        if (error > 0)
         {
-            error = send(sck, data + sent, bytes - sent, MSG_NOSIGNAL);
-            if (error < 1)
-            {
-                return -1;
-            }
             sent += error;
         }
+        else if (error < 0 && would_block(errno))
+        {
+            can_send(sck, 100, 0);
+        }
+        else
+        {
+            return -1;
+        }
     }
     return sent;
 }
@@ -285,24 +295,23 @@ myrecv(int sck, void *adata, int bytes)
     int error;
     char *data;
 
-#if defined(SO_NOSIGPIPE)
-    const int on = 1;
-    setsockopt(sck, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
-#endif
-
     data = (char *) adata;
     recd = 0;
     while (recd < bytes)
     {
-        if (can_recv(sck, 100, 0))
+        error = recv(sck, data + recd, bytes - recd, MSG_NOSIGNAL);
+        if (error > 0)
         {
-            error = recv(sck, data + recd, bytes - recd, MSG_NOSIGNAL);
-            if (error < 1)
-            {
-                return -1;
-            }
             recd += error;
         }
+        else if (error < 0 && would_block(errno))
+        {
+            can_recv(sck, 100, 0);
+        }
+        else
+        {
+            return -1;
+        }
     }
     return recd;
 }
@@ -329,14 +338,26 @@ WTSVirtualChannelWrite(void *hChannelHandle, const char *Buffer,
         return 0;
     }
 
-    if (!can_send(wts->fd, 0, 0))
+    rv = send(wts->fd, Buffer, Length, MSG_NOSIGNAL);
+    if (rv < 0)
     {
-        return 1;    /* can't write now, ok to try again */
+        if (would_block(errno))
+        {
+            return 1;    /* can't write now, ok to try again */
+        }
+        return 0;
+    }
+    if ((unsigned int)rv < Length)
+    {
+        /* the socket buffer filled up part way through - finish off */
+        if (mysend(wts->fd, Buffer + rv, Length - rv) < 0)
+        {
+            return 0;
+        }
+        rv = Length;
     }
 
-    rv = mysend(wts->fd, Buffer, Length);
-
-    LOG_DEVEL(LOG_LEVEL_DEBUG, "WTSVirtualChannelWrite: mysend() returned %d", rv);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "WTSVirtualChannelWrite: sent %d", rv);
 
     if (rv >= 0)
     {
@@ -361,7 +382,6 @@ WTSVirtualChannelRead(void *hChannelHandle, unsigned int TimeOut,
 {
     struct wts_obj *wts;
     int rv;
-    int lerrno;
 
     wts = (struct wts_obj *)hChannelHandle;
 
@@ -370,36 +390,27 @@ WTSVirtualChannelRead(void *hChannelHandle, unsigned int TimeOut,
         return 0;
     }
 
-    if (can_recv(wts->fd, TimeOut, 0))
+    *pBytesRead = 0;
+
+    /* only wait for the timeout if there's nothing to read already */
+    rv = recv(wts->fd, Buffer, BufferSize, 0);
+    if (rv < 0 && would_block(errno) && TimeOut > 0 &&
+            can_recv(wts->fd, TimeOut, 0))
     {
         rv = recv(wts->fd, Buffer, BufferSize, 0);
+    }
 
-        if (rv == -1)
-        {
-            lerrno = errno;
-
-            if ((lerrno == EWOULDBLOCK) || (lerrno == EAGAIN) ||
-                    (lerrno == EINPROGRESS))
-            {
-                *pBytesRead = 0;
-                return 1;
-            }
-
-            return 0;
-        }
-        else if (rv == 0)
-        {
-            return 0;
-        }
-        else if (rv > 0)
-        {
-            *pBytesRead = rv;
-            return 1;
-        }
+    if (rv > 0)
+    {
+        *pBytesRead = rv;
+        return 1;
+    }
+    if (rv < 0 && would_block(errno))
+    {
+        return 1;
     }
 
-    *pBytesRead = 0;
-    return 1;
+    return 0;
 }
 
 /*****************************************************************************/
@@ -535,3 +546,11 @@ can_recv(int sck, int millis, int restart)
 
     return rv;
 }
+
+/*****************************************************************************/
+static int
+would_block(int lerrno)
+{
+    return (lerrno == EWOULDBLOCK) || (lerrno == EAGAIN) ||
+           (lerrno == EINPROGRESS) || (lerrno == EINTR);
+}
@@ -24,6 +24,9 @@
 
 #include "xup.h"
 #include "log.h"
+#if defined(USE_DEVEL_RECORD)
+#include "proto_record.h"
+#endif
 #include "trans.h"
 #include "string_calls.h"
 #include "scancode.h"
@@ -270,12 +273,66 @@ lib_mod_connect(struct mod *mod)
         mod->trans->callback_data = mod;
         mod->trans->no_stream_init_on_data_in = 1;
         mod->trans->extra_flags = 1;
+#if defined(USE_DEVEL_RECORD)
+        if (proto_record_is_open())
+        {
+            mod->trans->record_type = PROTO_RECORD_MODULE_IN;
+        }
+#endif
     }
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "out lib_mod_connect");
     return 0;
 }
 
+/******************************************************************************/
+/* sends the input events held back since WM_INPUT_BATCH_BEGIN
+   return error */
+static int
+lib_send_input_batch(struct mod *mod)
+{
+    int rv;
+
+    rv = 0;
+    if (mod->input_batch != NULL &&
+            mod->input_batch->p > mod->input_batch->data)
+    {
+        s_mark_end(mod->input_batch);
+        rv = lib_send_copy(mod, mod->input_batch);
+        init_stream(mod->input_batch, 0);
+    }
+    return rv;
+}
+
+/******************************************************************************/
+/* sends an input event message, or adds it to the current batch
+   return error */
+static int
+lib_send_input(struct mod *mod, struct stream *s)
+{
+    int len;
+
+    if (!mod->input_batching)
+    {
+        return lib_send_copy(mod, s);
+    }
+    len = (int)(s->end - s->data);
+    if (mod->input_batch == NULL)
+    {
+        make_stream(mod->input_batch);
+        init_stream(mod->input_batch, 8192);
+    }
+    if (!s_check_rem_out(mod->input_batch, len))
+    {
+        if (lib_send_input_batch(mod) != 0)
+        {
+            return 1;
+        }
+    }
+    out_uint8a(mod->input_batch, s->data, len);
+    return 0;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -289,6 +346,18 @@ lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
     int scancode;
 
     LOG_DEVEL(LOG_LEVEL_TRACE, "in lib_mod_event");
+    if (msg == WM_INPUT_BATCH_BEGIN)
+    {
+        mod->input_batching = 1;
+        return 0;
+    }
+    if (msg == WM_INPUT_BATCH_END)
+    {
+        /* one write for all the events of the client PDU */
+        mod->input_batching = 0;
+        return lib_send_input_batch(mod);
+    }
+
     make_stream(s);
 
     if ((msg >= 15) && (msg <= 16)) /* key events */
@@ -319,7 +388,7 @@ lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
                     len = (int)(s->end - s->data);
                     s_pop_layer(s, iso_hdr);
                     out_uint32_le(s, len);
-                    lib_send_copy(mod, s);
+                    lib_send_input(mod, s);
                 }
             }
 
@@ -348,7 +417,7 @@ lib_mod_event(struct mod *mod, int msg, tbus param1, tbus param2,
     len = (int)(s->end - s->data);
     s_pop_layer(s, iso_hdr);
     out_uint32_le(s, len);
-    rv = lib_send_copy(mod, s);
+    rv = lib_send_input(mod, s);
     free_stream(s);
     LOG_DEVEL(LOG_LEVEL_TRACE, "out lib_mod_event");
     return rv;
@@ -1139,6 +1208,111 @@ send_suppress_output(struct mod *mod, int suppress,
     return 0;
 }
 
+/******************************************************************************/
+/* tell the X server if the frame ring can be used
+   max_buffers of 0 means use server_paint_rect_shmfd
+   return error */
+static int
+send_frame_ring_state(struct mod *mod, int max_buffers)
+{
+    int len;
+    struct stream *s;
+
+    make_stream(s);
+    init_stream(s, 8192);
+    s_push_layer(s, iso_hdr, 4);
+    out_uint16_le(s, 109);
+    out_uint32_le(s, XUP_FRAME_RING_VERSION);
+    out_uint32_le(s, max_buffers);
+    s_mark_end(s);
+    len = (int)(s->end - s->data);
+    s_pop_layer(s, iso_hdr);
+    out_uint32_le(s, len);
+    lib_send_copy(mod, s);
+    free_stream(s);
+    return 0;
+}
+
+/******************************************************************************/
+static void
+frame_buffer_unmap(struct xup_frame_buffer *fb)
+{
+    g_munmap(fb->ptr, fb->bytes);
+    g_memset(fb, 0, sizeof(*fb));
+}
+
+/******************************************************************************/
+/* returns non-zero if frame_id is at or after the last frame painted from
+   fb. Frame ids are allowed to wrap */
+static int
+frame_buffer_acked(const struct xup_frame_buffer *fb, int frame_id)
+{
+    return (int)((unsigned int)frame_id - (unsigned int)fb->frame_id) >= 0;
+}
+
+/******************************************************************************/
+/* called when xrdp has finished with all frames up to frame_id */
+static void
+frame_ring_ack(struct mod *mod, int frame_id)
+{
+    int index;
+    struct xup_frame_buffer *fb;
+
+    for (index = 0; index < mod->frame_ring_count; index++)
+    {
+        fb = mod->frame_ring + index;
+        if (fb->busy && frame_buffer_acked(fb, frame_id))
+        {
+            fb->busy = 0;
+        }
+    }
+    for (index = 0; index < XUP_FRAME_RING_MAX_BUFFERS; index++)
+    {
+        fb = mod->frame_ring_retired + index;
+        if (fb->ptr != NULL && frame_buffer_acked(fb, frame_id))
+        {
+            frame_buffer_unmap(fb);
+        }
+    }
+}
+
+/******************************************************************************/
+/* drop the current ring. Buffers still in use by xrdp are unmapped
+   when their frame is acked */
+static void
+frame_ring_clear(struct mod *mod)
+{
+    int index;
+    int jndex;
+    struct xup_frame_buffer *fb;
+
+    for (index = 0; index < mod->frame_ring_count; index++)
+    {
+        fb = mod->frame_ring + index;
+        if (!fb->busy)
+        {
+            frame_buffer_unmap(fb);
+            continue;
+        }
+        for (jndex = 0; jndex < XUP_FRAME_RING_MAX_BUFFERS; jndex++)
+        {
+            if (mod->frame_ring_retired[jndex].ptr == NULL)
+            {
+                mod->frame_ring_retired[jndex] = *fb;
+                break;
+            }
+        }
+        if (jndex == XUP_FRAME_RING_MAX_BUFFERS)
+        {
+            /* can't unmap it safely, leave it until the process ends */
+            LOG(LOG_LEVEL_WARNING, "frame_ring_clear: too many retired "
+                "buffers, leaving %d bytes mapped", fb->bytes);
+        }
+        g_memset(fb, 0, sizeof(*fb));
+    }
+    mod->frame_ring_count = 0;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1295,6 +1469,9 @@ process_server_egfx_shmfd(struct mod *amod, struct stream *s)
         {
             if (g_file_map(fd, 1, 0, shmem_bytes, &shmem_ptr) == 0)
             {
+#if defined(USE_DEVEL_RECORD)
+                proto_record_buffer_fd(fd, shmem_ptr, shmem_bytes, 1);
+#endif
                 /* we give up ownership of shmem_ptr
                    will get cleaned up in server_egfx_cmd or
                    xrdp_mm_process_enc_done(gfx) */
@@ -1352,6 +1529,9 @@ process_server_set_pointer_shmfd(struct mod *amod, struct stream *s)
             shmembytes = width * height * Bpp + width * height / 8;
             if (g_file_map(fd, 1, 0, shmembytes, &shmemptr) == 0)
             {
+#if defined(USE_DEVEL_RECORD)
+                proto_record_buffer_fd(fd, shmemptr, shmembytes, 0);
+#endif
                 cur_data = (char *)shmemptr;
                 cur_mask = cur_data + width * height * Bpp;
                 rv = amod->server_set_pointer_large(amod, x, y,
@@ -1365,6 +1545,30 @@ process_server_set_pointer_shmfd(struct mod *amod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* reads a counted list of rects for the paint_rect_shmfd messages
+   returns a list to be freed with g_free() */
+static int16_t *
+in_paint_rect_list(struct stream *s, int *num_rects)
+{
+    int index;
+    int16_t *rects;
+    int16_t *rects1;
+
+    in_uint16_le(s, *num_rects);
+    rects = g_new(int16_t, 2 * 4 * *num_rects);
+    rects1 = rects;
+    for (index = 0; index < *num_rects; index++)
+    {
+        in_sint16_le(s, rects1[0]);
+        in_sint16_le(s, rects1[1]);
+        in_sint16_le(s, rects1[2]);
+        in_sint16_le(s, rects1[3]);
+        rects1 += 4;
+    }
+    return rects;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1380,12 +1584,9 @@ process_server_paint_rect_shmfd(struct mod *amod, struct stream *s)
     int top;
     int width;
     int height;
-    int index;
     int rv;
     int16_t *ldrects;
-    int16_t *ldrects1;
     int16_t *lcrects;
-    int16_t *lcrects1;
     char *bmpdata;
     int fd;
     int recv_bytes;
@@ -1394,30 +1595,9 @@ process_server_paint_rect_shmfd(struct mod *amod, struct stream *s)
     char msg[4];
 
     /* dirty pixels */
-    in_uint16_le(s, num_drects);
-    ldrects = g_new(int16_t, 2 * 4 * num_drects);
-    ldrects1 = ldrects;
-    for (index = 0; index < num_drects; index++)
-    {
-        in_sint16_le(s, ldrects1[0]);
-        in_sint16_le(s, ldrects1[1]);
-        in_sint16_le(s, ldrects1[2]);
-        in_sint16_le(s, ldrects1[3]);
-        ldrects1 += 4;
-    }
-
+    ldrects = in_paint_rect_list(s, &num_drects);
     /* copied pixels */
-    in_uint16_le(s, num_crects);
-    lcrects = g_new(int16_t, 2 * 4 * num_crects);
-    lcrects1 = lcrects;
-    for (index = 0; index < num_crects; index++)
-    {
-        in_sint16_le(s, lcrects1[0]);
-        in_sint16_le(s, lcrects1[1]);
-        in_sint16_le(s, lcrects1[2]);
-        in_sint16_le(s, lcrects1[3]);
-        lcrects1 += 4;
-    }
+    lcrects = in_paint_rect_list(s, &num_crects);
 
     in_uint32_le(s, flags);
     in_uint32_le(s, frame_id);
@@ -1445,6 +1625,9 @@ process_server_paint_rect_shmfd(struct mod *amod, struct stream *s)
         {
             if (g_file_map(fd, 1, 0, shmem_bytes, &shmem_ptr) == 0)
             {
+#if defined(USE_DEVEL_RECORD)
+                proto_record_buffer_fd(fd, shmem_ptr, shmem_bytes, 1);
+#endif
                 bmpdata = (char *)shmem_ptr;
                 bmpdata += shmem_offset;
                 /* we give up ownership of shmem_ptr
@@ -1464,6 +1647,186 @@ process_server_paint_rect_shmfd(struct mod *amod, struct stream *s)
     return rv;
 }
 
+/******************************************************************************/
+/* the X server sends the frame ring buffers once, as memfds
+   return error */
+static int
+process_server_frame_ring_register(struct mod *amod, struct stream *s)
+{
+    int num_buffers;
+    int buffer_bytes;
+    int index;
+    int recv_bytes;
+    int rv;
+    int fds[XUP_FRAME_RING_MAX_BUFFERS];
+    unsigned int num_fds;
+    void *ptr;
+    char msg[4];
+
+    in_uint32_le(s, num_buffers);
+    in_uint32_le(s, buffer_bytes);
+
+    frame_ring_clear(amod);
+
+    if (g_tcp_can_recv(amod->trans->sck, 5000) == 0)
+    {
+        return 1;
+    }
+    num_fds = 0;
+    recv_bytes = g_sck_recv_fd_set(amod->trans->sck, msg, 4,
+                                   fds, XUP_FRAME_RING_MAX_BUFFERS, &num_fds);
+    LOG_DEVEL(LOG_LEVEL_DEBUG, "process_server_frame_ring_register: "
+              "g_sck_recv_fd_set rv %d num_fds %u", recv_bytes, num_fds);
+    if (num_fds > XUP_FRAME_RING_MAX_BUFFERS)
+    {
+        /* the excess have been closed */
+        num_fds = XUP_FRAME_RING_MAX_BUFFERS;
+    }
+
+    rv = (recv_bytes == 4) ? 0 : 1;
+    if (rv == 0 && (num_buffers < 1 || num_buffers != (int)num_fds ||
+                    buffer_bytes < 1))
+    {
+        LOG(LOG_LEVEL_ERROR, "process_server_frame_ring_register: bad "
+            "ring, %d buffers of %d bytes with %u fds",
+            num_buffers, buffer_bytes, num_fds);
+        rv = 1;
+    }
+    for (index = 0; index < (int)num_fds; index++)
+    {
+        if (rv == 0)
+        {
+            if (g_file_map(fds[index], 1, 0, buffer_bytes, &ptr) == 0)
+            {
+                amod->frame_ring[index].ptr = (char *)ptr;
+                amod->frame_ring[index].bytes = buffer_bytes;
+#if defined(USE_DEVEL_RECORD)
+                amod->frame_ring[index].record_id =
+                    proto_record_buffer_fd(fds[index], ptr, buffer_bytes, 1);
+#endif
+                amod->frame_ring_count = index + 1;
+            }
+            else
+            {
+                LOG(LOG_LEVEL_ERROR, "process_server_frame_ring_register: "
+                    "can't map buffer %d", index);
+                rv = 1;
+            }
+        }
+        g_file_close(fds[index]);
+    }
+
+    if (recv_bytes != 4)
+    {
+        frame_ring_clear(amod);
+        return 1;
+    }
+    if (rv != 0)
+    {
+        /* fall back to an fd for each frame */
+        frame_ring_clear(amod);
+        return send_frame_ring_state(amod, 0);
+    }
+    LOG(LOG_LEVEL_INFO, "Using a frame ring of %d buffers of %d bytes",
+        num_buffers, buffer_bytes);
+    return 0;
+}
+
+/******************************************************************************/
+/* checks a frame of width x height 32 bpp pixels at shmem_offset is
+   inside a mapped buffer of the frame ring
+   return error */
+static int
+check_frame_ring_bounds(struct mod *amod, int buffer_index, int shmem_offset,
+                        int width, int height)
+{
+    struct xup_frame_buffer *fb;
+
+    if (buffer_index < 0 || buffer_index >= amod->frame_ring_count)
+    {
+        return 1;
+    }
+    fb = amod->frame_ring + buffer_index;
+    if (fb->ptr == NULL || shmem_offset < 0 || width < 1 || height < 1)
+    {
+        return 1;
+    }
+    if ((tui64)shmem_offset + (tui64)width * height * 4 > (tui64)fb->bytes)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************/
+/* as process_server_paint_rect_shmfd, but the pixels are in a buffer
+   of the frame ring
+   return error */
+static int
+process_server_paint_rect_ring(struct mod *amod, struct stream *s)
+{
+    int num_drects;
+    int num_crects;
+    int flags;
+    int frame_id;
+    int buffer_index;
+    int shmem_offset;
+    int left;
+    int top;
+    int width;
+    int height;
+    int rv;
+    int16_t *ldrects;
+    int16_t *lcrects;
+    struct xup_frame_buffer *fb;
+
+    /* dirty pixels */
+    ldrects = in_paint_rect_list(s, &num_drects);
+    /* copied pixels */
+    lcrects = in_paint_rect_list(s, &num_crects);
+
+    in_uint32_le(s, flags);
+    in_uint32_le(s, frame_id);
+    in_uint32_le(s, buffer_index);
+    in_uint32_le(s, shmem_offset);
+
+    in_uint16_le(s, left);
+    in_uint16_le(s, top);
+    in_uint16_le(s, width);
+    in_uint16_le(s, height);
+
+    if (check_frame_ring_bounds(amod, buffer_index, shmem_offset,
+                                width, height) != 0)
+    {
+        LOG(LOG_LEVEL_ERROR, "process_server_paint_rect_ring: bad buffer "
+            "index %d offset %d size %dx%d", buffer_index, shmem_offset,
+            width, height);
+        g_free(ldrects);
+        g_free(lcrects);
+        /* ack the frame so the X server doesn't wait for it */
+        return send_paint_rect_ex_ack(amod, flags, frame_id);
+    }
+
+    /* mark the buffer busy first, as the ack can come back before
+       server_paint_rects_ex returns */
+    fb = amod->frame_ring + buffer_index;
+    fb->busy = 1;
+    fb->frame_id = frame_id;
+#if defined(USE_DEVEL_RECORD)
+    proto_record_buffer(fb->record_id, fb->ptr, fb->bytes);
+#endif
+    /* the mapping stays with us, so no shmem_ptr is passed for
+       xrdp to unmap */
+    rv = amod->server_paint_rects_ex(amod, num_drects, ldrects,
+                                     num_crects, lcrects,
+                                     fb->ptr + shmem_offset,
+                                     left, top, width, height,
+                                     flags, frame_id, NULL, 0);
+    g_free(ldrects);
+    g_free(lcrects);
+    return rv;
+}
+
 /******************************************************************************/
 /* return error */
 static int
@@ -1699,6 +2062,12 @@ lib_mod_process_orders(struct mod *mod, int type, struct stream *s)
         case 64: /* server_paint_rect_shmfd */
             rv = process_server_paint_rect_shmfd(mod, s);
             break;
+        case 65: /* server_frame_ring_register */
+            rv = process_server_frame_ring_register(mod, s);
+            break;
+        case 66: /* server_paint_rect_ring */
+            rv = process_server_paint_rect_ring(mod, s);
+            break;
         default:
             LOG_DEVEL(LOG_LEVEL_WARNING,
                       "lib_mod_process_orders: unknown order type %d", type);
@@ -1779,6 +2148,9 @@ lib_mod_process_message(struct mod *mod, struct stream *s)
 
             switch (type)
             {
+                case XUP_CAP_FRAME_RING:
+                    mod->frame_ring_offered = 1;
+                    break;
                 default:
                     LOG_DEVEL(LOG_LEVEL_TRACE,
                               "lib_mod_process_message: unknown"
@@ -1789,6 +2161,10 @@ lib_mod_process_message(struct mod *mod, struct stream *s)
             s->p = phold + len;
         }
         lib_send_client_info(mod);
+        if (mod->frame_ring_offered)
+        {
+            send_frame_ring_state(mod, XUP_FRAME_RING_MAX_BUFFERS);
+        }
     }
     else if (type == 3) /* order list with len after type */
     {
@@ -1942,6 +2318,8 @@ lib_mod_frame_ack(struct mod *amod, int flags, int frame_id)
 {
     LOG_DEVEL(LOG_LEVEL_TRACE,
               "lib_mod_frame_ack: flags 0x%8.8x frame_id %d", flags, frame_id);
+    /* the ack also hands frame ring buffers back to the X server */
+    frame_ring_ack(amod, frame_id);
     send_paint_rect_ex_ack(amod, flags, frame_id);
     return 0;
 }
@@ -1996,6 +2374,9 @@ mod_exit(tintptr handle)
     {
         return 0;
     }
+    /* any ring buffers xrdp is still encoding from are left mapped */
+    frame_ring_clear(mod);
+    free_stream(mod->input_batch);
     trans_delete(mod->trans);
     g_free(mod);
     return 0;
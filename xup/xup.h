@@ -33,9 +33,26 @@
 
 #define CURRENT_MOD_VER 4
 
+/* Persistent frame buffer ring shared with the X server. The X server
+   offers the ring in its caps, and then registers a set of memfd buffers
+   once. Each paint then carries a buffer index instead of an fd */
+#define XUP_CAP_FRAME_RING 1
+#define XUP_FRAME_RING_VERSION 1
+#define XUP_FRAME_RING_MAX_BUFFERS 8
+
 struct source_info;
 struct xrdp_client_info;
 
+/* One buffer of the frame ring */
+struct xup_frame_buffer
+{
+    char *ptr; /* mapping, or NULL if the slot is unused */
+    int bytes;
+    int busy; /* set until xrdp acks frame_id */
+    int frame_id; /* last frame painted from this buffer */
+    int record_id; /* see proto_record_buffer_fd(), --enable-devel-record */
+};
+
 struct mod
 {
     int size; /* size of this struct */
@@ -202,6 +219,14 @@ struct mod
     char *screen_shmem_pixels;
     struct trans *trans;
     char keycode_set[32];
+    /* input events waiting for WM_INPUT_BATCH_END */
+    int input_batching; /* boolean */
+    struct stream *input_batch;
+    int frame_ring_offered; /* boolean */
+    int frame_ring_count;
+    struct xup_frame_buffer frame_ring[XUP_FRAME_RING_MAX_BUFFERS];
+    /* buffers from an earlier ring still in use by xrdp */
+    struct xup_frame_buffer frame_ring_retired[XUP_FRAME_RING_MAX_BUFFERS];
 };
 
 #endif // XUP_H